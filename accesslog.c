@@ -0,0 +1,314 @@
+/*
+ * accesslog.c - 고정 크기 레코드의 binary access log
+ *
+ * 요청마다 텍스트 한 줄을 printf 하는 대신 AccessRecord 하나(72 bytes)를 남긴다.
+ * - thread 마다 레코드를 모아두는 버퍼(LogBuffer)를 가지고, 쓸 때는 lock 없이 자기 버퍼에만 추가한다.
+ *   stats.c 의 묶음과 같이 thread 가 끝나면 버퍼는 내용을 가진 채 free list 로 돌아가고 다음 thread 가 이어서 쓴다.
+ * - 버퍼가 가득 차면 주인 thread 가 직접, 쉬고 있는(free list 의) 버퍼는 flush thread 가 ACCESSLOG_FLUSH_MS 마다
+ *   현재 segment 에 write 한다. 따라서 파일 안의 레코드는 대략적인 시간 순서일 뿐이다.
+ * - segment 는 <dir>/access-<번호>.bin 이고, segment_size 를 넘으면 다음 번호로 넘어가며 최근 segments 개만 남긴다.
+ * - 레코드에는 URL 대신 캐시 key 의 hash 만 넣는다. 처음 보는 hash 라면 urls.bin 에 (hash, URL) 을 한 번 추가한다.
+ *   기억하는 hash 가 가득 차면 비우고 다시 시작하므로 같은 URL 이 여러 번 기록될 수 있다 (읽는 쪽에서 무시).
+ * 분석은 proxylog 로 한다.
+ */
+#include <time.h>
+#include "accesslog.h"
+#include "util.h"
+
+// thread 하나가 쓰는 레코드 버퍼
+typedef struct LogBuffer {
+    AccessRecord records[ACCESSLOG_BUFFER_RECORDS];
+    int count;
+    int in_use;
+    struct LogBuffer *next_all;     // flush thread 가 순회하는 전체 목록
+    struct LogBuffer *next_free;
+} LogBuffer;
+
+static int log_enabled;
+static char log_dir[MAXLINE / 2];     // segment 경로를 만들 여유를 남겨둔다
+static long long max_segment_size;
+static int max_segments;
+
+static LogBuffer *all_buffers, *free_buffers;
+static sem_t buffer_mutex;          // 버퍼 목록과 in_use 를 보호
+static pthread_key_t buffer_key;
+static __thread LogBuffer *my_buffer;
+
+static sem_t segment_mutex;         // 현재 segment 의 fd, 번호, 크기를 보호
+static int segment_fd = -1;
+static int segment_id;
+static long long segment_bytes;
+
+static sem_t url_mutex;
+static int url_fd = -1;
+static uint64_t url_seen[ACCESSLOG_URL_SLOTS];  // 0 은 빈 칸
+static int url_count;
+
+int accesslog_enabled(void) {
+    return log_enabled;
+}
+
+// 캐시 key 의 64bit FNV-1a hash, 0 은 빈 칸 표시로 쓰므로 피한다
+uint64_t accesslog_hash(char *key) {
+    uint64_t h = fnv1a64_str(key);
+
+    return h == 0 ? 1 : h;
+}
+
+static void segment_path(char *path, int id) {
+    char name[64];
+
+    snprintf(name, sizeof(name), ACCESSLOG_SEGMENT_FORMAT, id);
+    snprintf(path, MAXLINE, "%s/%s", log_dir, name);
+}
+
+// id 번 segment 를 새로 만들어 현재 segment 로 바꾸고, 남길 개수를 넘는 오래된 segment 를 지우는 함수
+// segment_mutex 를 잡은 상태에서 호출
+static int segment_open(int id) {
+    AccessLogHeader header;
+    char path[MAXLINE];
+    struct timespec ts;
+    int fd;
+
+    segment_path(path, id);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        fprintf(stderr, "access log: cannot create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&header, 0, sizeof(header));
+    header.magic = ACCESSLOG_MAGIC;
+    header.version = ACCESSLOG_VERSION;
+    header.record_size = sizeof(AccessRecord);
+    header.created_us = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    rio_writen(fd, &header, sizeof(header));
+
+    if (segment_fd >= 0) {
+        close(segment_fd);
+    }
+    segment_fd = fd;
+    segment_id = id;
+    segment_bytes = sizeof(header);
+
+    if (max_segments > 0 && id - max_segments > 0) {
+        segment_path(path, id - max_segments);
+        unlink(path);
+    }
+    return 0;
+}
+
+// 레코드들을 현재 segment 에 쓰는 함수, 크기를 넘으면 다음 segment 로 넘어간다
+static void segment_write(AccessRecord *records, int count) {
+    size_t n = count * sizeof(AccessRecord);
+
+    P(&segment_mutex);
+    if (segment_bytes > (long long) sizeof(AccessLogHeader) && segment_bytes + (long long) n > max_segment_size) {
+        segment_open(segment_id + 1);
+    }
+    if (rio_writen(segment_fd, records, n) == (ssize_t) n) {
+        segment_bytes += n;
+    }
+    V(&segment_mutex);
+}
+
+static void buffer_flush(LogBuffer *buffer) {
+    if (buffer->count > 0) {
+        segment_write(buffer->records, buffer->count);
+        buffer->count = 0;
+    }
+}
+
+// thread 가 끝날 때 버퍼를 free list 로 돌려주는 함수, 남은 레코드는 flush thread 가 내보낸다
+static void buffer_release(void *vargp) {
+    LogBuffer *buffer = (LogBuffer *) vargp;
+
+    P(&buffer_mutex);
+    buffer->in_use = 0;
+    buffer->next_free = free_buffers;
+    free_buffers = buffer;
+    V(&buffer_mutex);
+}
+
+// 현재 thread 의 버퍼를 가져오는 함수, 처음 부르는 thread 라면 free list 에서 하나 받아온다
+static LogBuffer *local_buffer(void) {
+    LogBuffer *buffer;
+
+    if (my_buffer != NULL) {
+        return my_buffer;
+    }
+
+    P(&buffer_mutex);
+    if ((buffer = free_buffers) != NULL) {
+        free_buffers = buffer->next_free;
+    } else {
+        buffer = (LogBuffer *) calloc(1, sizeof(LogBuffer));
+        buffer->next_all = all_buffers;
+        all_buffers = buffer;
+    }
+    buffer->in_use = 1;
+    V(&buffer_mutex);
+
+    pthread_setspecific(buffer_key, buffer);
+    return my_buffer = buffer;
+}
+
+// 쉬고 있는 버퍼에 남은 레코드를 주기적으로 파일로 내보내는 thread
+// 사용 중인 버퍼는 주인 thread 가 끝나고 free list 로 돌아온 뒤에 내보낸다
+static void *accesslog_flusher(void *vargp) {
+    LogBuffer *buffer;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        usleep(ACCESSLOG_FLUSH_MS * 1000);
+
+        P(&buffer_mutex);
+        for (buffer = all_buffers; buffer != NULL; buffer = buffer->next_all) {
+            if (!buffer->in_use) {
+                buffer_flush(buffer);
+            }
+        }
+        V(&buffer_mutex);
+    }
+    return NULL;
+}
+
+// access log 초기화 함수, dir 에 남아있는 segment 다음 번호부터 새 segment 를 만든다 (시작 시에만 호출)
+int accesslog_init(char *dir, long long segment_size, int segments) {
+    DIR *dp;
+    struct dirent *ent;
+    char path[MAXLINE];
+    int id, first = 0, last = 0;
+    pthread_t tid;
+
+    snprintf(log_dir, sizeof(log_dir), "%s", dir);
+    max_segment_size = segment_size;
+    max_segments = segments;
+    if (mkdir(log_dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "access log disabled: cannot create %s: %s\n", log_dir, strerror(errno));
+        return -1;
+    }
+
+    if ((dp = opendir(log_dir)) == NULL) {
+        return -1;
+    }
+    while ((ent = readdir(dp)) != NULL) {
+        if (sscanf(ent->d_name, "access-%d.bin", &id) == 1 && id > 0) {
+            if (first == 0 || id < first) first = id;
+            if (id > last) last = id;
+        }
+    }
+    closedir(dp);
+
+    // 이번에 만들 segment 까지 포함해서 segments 개만 남김
+    for (id = first; first > 0 && max_segments > 0 && id <= last + 1 - max_segments; id++) {
+        segment_path(path, id);
+        unlink(path);
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", log_dir, ACCESSLOG_URL_FILE);
+    if ((url_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+        fprintf(stderr, "access log disabled: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    Sem_init(&buffer_mutex, 0, 1);
+    Sem_init(&segment_mutex, 0, 1);
+    Sem_init(&url_mutex, 0, 1);
+    pthread_key_create(&buffer_key, buffer_release);
+    if (segment_open(last + 1) < 0) {
+        return -1;
+    }
+
+    log_enabled = 1;
+    Pthread_create(&tid, NULL, accesslog_flusher, NULL);
+    return 0;
+}
+
+// accept 직후 시각과 client 주소를 채워주는 함수
+void accesslog_begin(AccessRecord *rec, struct sockaddr *addr) {
+    struct timespec ts;
+
+    memset(rec, 0, sizeof(AccessRecord));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->time_us = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    if (addr->sa_family == AF_INET) {
+        rec->client[10] = rec->client[11] = 0xff;
+        memcpy(rec->client + 12, &((struct sockaddr_in *) addr)->sin_addr, 4);
+    } else if (addr->sa_family == AF_INET6) {
+        memcpy(rec->client, &((struct sockaddr_in6 *) addr)->sin6_addr, 16);
+    }
+}
+
+int accesslog_method(char *method) {
+    if (!strcmp(method, "GET")) {
+        return ACCESS_METHOD_GET;
+    }
+    if (!strcmp(method, "HEAD")) {
+        return ACCESS_METHOD_HEAD;
+    }
+    if (!strcmp(method, "POST")) {
+        return ACCESS_METHOD_POST;
+    }
+    return ACCESS_METHOD_OTHER;
+}
+
+// 이번 실행에서 처음 보는 hash 라면 urls.bin 에 URL 을 추가하는 함수
+// 칸을 차지하는 것은 compare-and-swap 으로 하므로, 같은 URL 을 동시에 처음 본 thread 중 하나만 기록한다
+static void url_intern(uint64_t hash, char *key) {
+    char entry[sizeof(AccessUrlEntry) + MAXLINE];
+    AccessUrlEntry *header = (AccessUrlEntry *) entry;
+    uint64_t seen, empty;
+    int i, slot = (int) (hash & (ACCESSLOG_URL_SLOTS - 1));
+
+    for (i = 0; i < 16; i++, slot = (slot + 1) & (ACCESSLOG_URL_SLOTS - 1)) {
+        if ((seen = __atomic_load_n(&url_seen[slot], __ATOMIC_RELAXED)) == hash) {
+            return;
+        }
+        empty = 0;
+        if (seen == 0 && __atomic_compare_exchange_n(&url_seen[slot], &empty, hash, 0,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (empty == hash) {
+            return;
+        }
+    }
+
+    memset(header, 0, sizeof(AccessUrlEntry));
+    header->key_hash = hash;
+    header->len = strnlen(key, MAXLINE);
+    memcpy(entry + sizeof(AccessUrlEntry), key, header->len);
+
+    P(&url_mutex);
+    // 칸을 못 찾았거나 3/4 이상 찼으면 비우고 다시 시작
+    if (i == 16 || ++url_count > ACCESSLOG_URL_SLOTS / 4 * 3) {
+        memset(url_seen, 0, sizeof(url_seen));
+        url_count = 0;
+    }
+    rio_writen(url_fd, entry, sizeof(AccessUrlEntry) + header->len);
+    V(&url_mutex);
+}
+
+// 레코드에 캐시 key 의 hash 를 넣는 함수
+void accesslog_key(AccessRecord *rec, char *key) {
+    if (!log_enabled) {
+        return;
+    }
+    rec->key_hash = accesslog_hash(key);
+    url_intern(rec->key_hash, key);
+}
+
+// 완성된 레코드를 현재 thread 의 버퍼에 추가하는 함수, 가득 차면 바로 파일로 내보낸다
+void accesslog_write(AccessRecord *rec) {
+    LogBuffer *buffer;
+
+    if (!log_enabled) {
+        return;
+    }
+    buffer = local_buffer();
+    buffer->records[buffer->count++] = *rec;
+    if (buffer->count == ACCESSLOG_BUFFER_RECORDS) {
+        buffer_flush(buffer);
+    }
+}
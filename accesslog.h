@@ -0,0 +1,90 @@
+/*
+ * accesslog.h - 고정 크기 레코드의 binary access log
+ *
+ * proxylog.c (분석 도구) 도 이 header 의 형식 정의를 그대로 사용하므로, 형식을 바꿀 때는
+ * ACCESSLOG_VERSION 을 올려야 한다. 모든 값은 little endian 으로 기록된다.
+ */
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include <stdint.h>
+
+#define ACCESSLOG_MAGIC 0x4c415850u        /* "PXAL" */
+#define ACCESSLOG_VERSION 1
+#define ACCESSLOG_PHASES 6                  /* stats.h 의 PHASE_COUNT 와 같은 순서 (total, parse, cache, connect, origin, send) */
+#define ACCESSLOG_URL_FILE "urls.bin"       /* key hash 와 URL 을 짝지어 둔 table */
+#define ACCESSLOG_SEGMENT_FORMAT "access-%08d.bin"
+#define ACCESSLOG_BUFFER_RECORDS 256        /* thread 별 버퍼 하나에 모아두는 레코드 수 */
+#define ACCESSLOG_FLUSH_MS 1000             /* 쉬고 있는 버퍼를 파일로 내보내는 주기 */
+#define ACCESSLOG_URL_SLOTS 65536           /* 이미 기록한 URL 의 hash 를 기억하는 칸 수 */
+#define DEFAULT_ACCESSLOG_SEGMENT_SIZE (64 * 1024 * 1024)
+#define DEFAULT_ACCESSLOG_SEGMENTS 16
+
+// 요청 하나가 어떻게 처리됐는지
+enum {
+    ACCESS_LOCAL,           // proxy 자신이 답한 요청 (통계, 캐시 관리 API)
+    ACCESS_HIT_RAM,
+    ACCESS_HIT_DISK,
+    ACCESS_HIT_NEGATIVE,
+    ACCESS_MISS,            // origin 에서 받아 캐시에 넣은 요청
+    ACCESS_UNCACHEABLE,     // 크기 때문에 캐시하지 않고 중계만 한 요청
+    ACCESS_ERROR,           // origin 에 연결하지 못하는 등 proxy 가 에러로 답한 요청
+    ACCESS_RESULTS
+};
+
+enum {
+    ACCESS_METHOD_OTHER,
+    ACCESS_METHOD_GET,
+    ACCESS_METHOD_HEAD,
+    ACCESS_METHOD_POST
+};
+
+// segment 파일 맨 앞에 한 번 기록되는 header
+typedef struct AccessLogHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;   // sizeof(AccessRecord), 읽는 쪽에서 형식이 맞는지 확인용
+    int64_t created_us;     // segment 를 만든 시각 (epoch us)
+} AccessLogHeader;
+
+// 요청 하나의 레코드 (72 bytes)
+typedef struct AccessRecord {
+    int64_t time_us;                    // accept 한 시각 (epoch us)
+    uint64_t key_hash;                  // 캐시 key 의 FNV-1a hash, URL 은 urls.bin 에서 찾는다
+    uint64_t bytes;                     // client 로 보낸 바이트
+    uint8_t client[16];                 // client 주소 (IPv4 는 ::ffff:a.b.c.d 형태)
+    uint32_t phase_us[ACCESSLOG_PHASES]; // 단계별 시간 (us), 거치지 않은 단계는 0
+    uint16_t status;                    // client 로 보낸 status, 알 수 없으면 0
+    uint8_t result;                     // ACCESS_*
+    uint8_t method;                     // ACCESS_METHOD_*
+    uint32_t reserved;
+} AccessRecord;
+
+// urls.bin 의 항목 하나, 뒤에 len 바이트의 URL 이 이어진다
+typedef struct AccessUrlEntry {
+    uint64_t key_hash;
+    uint32_t len;
+    uint32_t reserved;
+} AccessUrlEntry;
+
+#ifndef ACCESSLOG_FORMAT_ONLY
+
+#include "csapp.h"
+
+uint64_t accesslog_hash(char *key);
+
+int accesslog_init(char *dir, long long segment_size, int segments);
+
+int accesslog_enabled(void);
+
+void accesslog_begin(AccessRecord *rec, struct sockaddr *addr);
+
+int accesslog_method(char *method);
+
+void accesslog_key(AccessRecord *rec, char *key);
+
+void accesslog_write(AccessRecord *rec);
+
+#endif
+
+#endif /* __ACCESSLOG_H__ */
@@ -0,0 +1,369 @@
+/*
+ * admin.c - 캐시 관리 API (목록, purge, preload)
+ *
+ * proxy 의 listen port 로 들어온 요청 중 path 가 ADMIN_PATH 로 시작하는 요청을 처리한다.
+ * loopback 에서 온 연결만 받고, 나머지는 403 으로 거절한다. 응답은 모두 JSON 이다.
+ *   GET  /__proxy/cache[?prefix=<key>&limit=<n>]   RAM/disk 캐시 항목 목록 (key, 크기, age, hit 수)
+ *   POST /__proxy/cache/purge?url=<url>            URL 하나(와 Vary variant 들)를 모든 tier 에서 삭제
+ *   POST /__proxy/cache/purge?prefix=<key>         key 가 prefix 로 시작하는 항목 삭제 (예: http://host:80/img/)
+ *   POST /__proxy/cache/purge?all                  전부 삭제
+ *   POST /__proxy/cache/preload?url=<url>[&refresh] proxy 자신에게 GET 을 보내 캐시를 채움 (refresh 면 먼저 purge)
+ * query 의 값은 percent-decoding 하므로, url 은 curl -G --data-urlencode url=... 처럼 인코딩해서 보낸다.
+ *
+ * 목록과 purge 는 각 캐시의 lock 을 잡고 한 번씩 훑기만 하므로 부하 중에도 실행할 수 있다.
+ * purge 와 동시에 origin 에서 받아오던 요청은 purge 뒤에 새 응답을 캐시에 넣을 수 있다 (새로 받은 것이므로 괜찮다).
+ */
+#include <stdarg.h>
+#include <time.h>
+#include "admin.h"
+#include "cache_key.h"
+#include "disk_cache.h"
+#include "negative_cache.h"
+#include "request.h"
+
+// 크기가 정해지지 않은 JSON 응답을 만드는 버퍼
+typedef struct AdminOutput {
+    char *buf;
+    size_t len;
+    size_t size;
+} AdminOutput;
+
+// 목록을 만들 때 cache_foreach, disk_cache_foreach 에 넘기는 상태
+typedef struct AdminList {
+    AdminOutput *out;
+    char *prefix;
+    time_t now;
+    int limit;
+    int items;          // prefix 에 맞는 전체 항목 수 (limit 을 넘어도 셈)
+    ssize_t bytes;      // prefix 에 맞는 항목들의 저장 크기 합
+} AdminList;
+
+static char proxy_port[MAXLINE];
+
+// preload 에서 자기 자신에게 연결하기 위해 listen port 를 기억
+void admin_init(char *port) {
+    snprintf(proxy_port, sizeof(proxy_port), "%s", port);
+}
+
+// loopback 에서 온 연결인지 알려주는 함수
+int admin_is_local(struct sockaddr *addr) {
+    struct in6_addr *a6;
+
+    if (addr->sa_family == AF_INET) {
+        return (ntohl(((struct sockaddr_in *) addr)->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (addr->sa_family == AF_INET6) {
+        a6 = &((struct sockaddr_in6 *) addr)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(a6) || (IN6_IS_ADDR_V4MAPPED(a6) && a6->s6_addr[12] == 127);
+    }
+    return 0;
+}
+
+static void out_reserve(AdminOutput *out, size_t n) {
+    if (out->len + n >= out->size) {
+        out->size = (out->len + n) * 2;
+        out->buf = (char *) realloc(out->buf, out->size);
+    }
+}
+
+static void out_printf(AdminOutput *out, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+    va_end(ap);
+    if ((size_t) n >= out->size - out->len) {
+        out_reserve(out, n + 1);
+        va_start(ap, fmt);
+        vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+        va_end(ap);
+    }
+    out->len += n;
+}
+
+// JSON 문자열로 이스케이프해서 붙여주는 함수 (Vary variant key 에는 '\n' 이 들어있다)
+static void out_json_string(AdminOutput *out, char *s) {
+    out_reserve(out, strlen(s) * 6 + 3);
+    out->buf[out->len++] = '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            out->buf[out->len++] = '\\';
+            out->buf[out->len++] = *s;
+        } else if ((unsigned char) *s < 0x20) {
+            out->len += sprintf(out->buf + out->len, "\\u%04x", (unsigned char) *s);
+        } else {
+            out->buf[out->len++] = *s;
+        }
+    }
+    out->buf[out->len++] = '"';
+    out->buf[out->len] = '\0';
+}
+
+static int hex_digit(int c) {
+    if (isdigit(c)) return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// query string 에서 name 의 값을 percent-decoding 해서 value 에 넣어주는 함수
+// 값 없이 name 만 있어도 찾은 것으로 보고 빈 문자열을 넣는다, 없으면 0 을 반환
+static int query_param(char *query, char *name, char *value, size_t size) {
+    size_t len = strlen(name), n = 0;
+    char *p = query;
+
+    while (p != NULL && *p != '\0') {
+        if (strncmp(p, name, len) == 0 && (p[len] == '=' || p[len] == '&' || p[len] == '\0')) {
+            for (p += len + (p[len] == '='); *p != '\0' && *p != '&' && n + 1 < size; p++) {
+                if (*p == '%' && hex_digit(p[1]) >= 0 && hex_digit(p[2]) >= 0) {
+                    value[n++] = hex_digit(p[1]) * 16 + hex_digit(p[2]);
+                    p += 2;
+                } else {
+                    value[n++] = *p;
+                }
+            }
+            value[n] = '\0';
+            return 1;
+        }
+        if ((p = strchr(p, '&')) != NULL) {
+            p++;
+        }
+    }
+    return 0;
+}
+
+// URL 을 캐시 key 로 바꿔주는 함수, deliver 와 같은 방식으로 정규화한다
+static void url_to_key(char *key, char *url, ProxyConfig *config) {
+    char uri[MAXLINE], hostname[MAXLINE], port[MAXLINE], filename[MAXLINE];
+
+    snprintf(uri, MAXLINE, "%s", url);
+    parse_uri(uri, hostname, port, filename);
+    build_cache_key(key, hostname, port, filename, config->sort_query);
+}
+
+static void admin_reply(int connfd, char *status, AdminOutput *out) {
+    char header[MAXLINE];
+
+    snprintf(header, MAXLINE, "HTTP/1.0 %s\r\nContent-type: application/json\r\nContent-length: %zu\r\n"
+                              "Cache-Control: no-store\r\nConnection: close\r\n\r\n", status, out->len);
+    Rio_writen(connfd, header, strlen(header));
+    Rio_writen(connfd, out->buf, out->len);
+}
+
+static void admin_error(int connfd, char *status, char *message) {
+    AdminOutput out = {malloc(MAXLINE), 0, MAXLINE};
+
+    out_printf(&out, "{\"error\": ");
+    out_json_string(&out, message);
+    out_printf(&out, "}\n");
+    admin_reply(connfd, status, &out);
+    free(out.buf);
+}
+
+static void list_ram_item(CacheItem *item, void *arg) {
+    AdminList *list = (AdminList *) arg;
+
+    if (!cache_key_matches(item->key, list->prefix, 1)) {
+        return;
+    }
+    if (list->items++ < list->limit) {
+        out_printf(list->out, "%s\n      {\"key\": ", list->items > 1 ? "," : "");
+        out_json_string(list->out, item->key);
+        out_printf(list->out, ", \"size\": %zd, \"raw_size\": %zd, \"encoding\": \"%s\", \"age\": %ld, \"hits\": %lu}",
+                   item->size, item->raw_size, item->encoding == ENCODING_GZIP ? "gzip" : "identity",
+                   (long) (list->now - item->created), item->hits);
+    }
+    list->bytes += item->size;
+}
+
+static void list_disk_item(char *key, ssize_t size, ssize_t raw_size, int hits, void *arg) {
+    AdminList *list = (AdminList *) arg;
+
+    if (!cache_key_matches(key, list->prefix, 1)) {
+        return;
+    }
+    if (list->items++ < list->limit) {
+        out_printf(list->out, "%s\n      {\"key\": ", list->items > 1 ? "," : "");
+        out_json_string(list->out, key);
+        out_printf(list->out, ", \"size\": %zd, \"raw_size\": %zd, \"hits\": %d}", size, raw_size, hits);
+    }
+    list->bytes += size;
+}
+
+// RAM 과 disk 캐시의 항목 목록, RAM 은 최근에 쓰인 순서
+static void admin_list(int connfd, char *query, Cache *cache) {
+    AdminOutput out = {malloc(MAXBUF), 0, MAXBUF};
+    AdminList list;
+    char prefix[MAXLINE], value[MAXLINE];
+
+    if (!query_param(query, "prefix", prefix, sizeof(prefix))) {
+        prefix[0] = '\0';
+    }
+    memset(&list, 0, sizeof(list));
+    list.out = &out;
+    list.prefix = prefix;
+    list.now = time(NULL);
+    list.limit = query_param(query, "limit", value, sizeof(value)) ? atoi(value) : ADMIN_LIST_LIMIT;
+
+    out_printf(&out, "{\n  \"ram\": {\n    \"entries\": [");
+    cache_foreach(cache, list_ram_item, &list);
+    out_printf(&out, "\n    ],\n    \"items\": %d,\n    \"bytes\": %zd\n  },\n", list.items, list.bytes);
+
+    list.items = 0;
+    list.bytes = 0;
+    out_printf(&out, "  \"disk\": {\n    \"entries\": [");
+    disk_cache_foreach(list_disk_item, &list);
+    out_printf(&out, "\n    ],\n    \"items\": %d,\n    \"bytes\": %zd\n  }\n}\n", list.items, list.bytes);
+
+    admin_reply(connfd, "200 OK", &out);
+    free(out.buf);
+}
+
+// pattern 에 맞는 항목을 RAM, disk, negative cache 에서 모두 지우고 결과를 out 에 붙여주는 함수
+static void admin_purge_pattern(AdminOutput *out, Cache *cache, char *pattern, int prefix) {
+    int ram, disk, negative;
+
+    ram = cache_purge(cache, pattern, prefix);
+    disk = disk_cache_purge(pattern, prefix);
+    negative = negative_cache_purge(pattern, prefix);
+    printf("cache purge %s%s: ram %d, disk %d, negative %d\n", pattern, prefix ? "*" : "", ram, disk, negative);
+
+    out_printf(out, "\"pattern\": ");
+    out_json_string(out, pattern);
+    out_printf(out, ", \"prefix\": %s, \"purged\": {\"ram\": %d, \"disk\": %d, \"negative\": %d}",
+               prefix ? "true" : "false", ram, disk, negative);
+}
+
+static void admin_purge(int connfd, char *query, Cache *cache, ProxyConfig *config) {
+    AdminOutput out = {malloc(MAXLINE), 0, MAXLINE};
+    char value[MAXLINE], key[MAXLINE];
+
+    if (query_param(query, "url", value, sizeof(value))) {
+        url_to_key(key, value, config);
+        out_printf(&out, "{");
+        admin_purge_pattern(&out, cache, key, 0);
+    } else if (query_param(query, "prefix", value, sizeof(value))) {
+        out_printf(&out, "{");
+        admin_purge_pattern(&out, cache, value, 1);
+    } else if (query_param(query, "all", value, sizeof(value))) {
+        out_printf(&out, "{");
+        admin_purge_pattern(&out, cache, "", 1);
+    } else {
+        free(out.buf);
+        admin_error(connfd, "400 Bad Request", "purge needs url=, prefix= or all");
+        return;
+    }
+    out_printf(&out, "}\n");
+    admin_reply(connfd, "200 OK", &out);
+    free(out.buf);
+}
+
+// proxy 자신에게 url 을 GET 해서 캐시를 채우는 함수, 받은 status 를 반환 (연결 실패 시 -1)
+// 일반 요청과 같은 경로를 지나므로 Vary, negative cache, 크기 제한도 똑같이 적용된다
+static int preload_url(char *url, ssize_t *bytes) {
+    char buf[MAXLINE], request[4 * MAXLINE], uri[MAXLINE], hostname[MAXLINE], port[MAXLINE], filename[MAXLINE];
+    rio_t rio;
+    ssize_t n;
+    int fd, status = -1;
+
+    *bytes = 0;
+    if ((fd = open_clientfd("127.0.0.1", proxy_port)) < 0) {
+        return -1;
+    }
+    snprintf(uri, MAXLINE, "%s", url);
+    parse_uri(uri, hostname, port, filename);
+    snprintf(request, sizeof(request), "GET %s %s\r\nHost: %s:%s\r\n\r\n", url, STATIC_HTTP_VER, hostname, port);
+    Rio_writen(fd, request, strlen(request));
+
+    Rio_readinitb(&rio, fd);
+    if ((n = Rio_readlineb(&rio, buf, MAXLINE)) > 0) {
+        *bytes = n;
+        sscanf(buf, "HTTP/1.%*d %d", &status);
+    }
+    while ((n = Rio_readnb(&rio, buf, MAXLINE)) > 0) {
+        *bytes += n;
+    }
+    Close(fd);
+    return status;
+}
+
+// percent-decode 된 url 에 요청줄에 넣을 수 없는 공백이나 제어 문자가 있는지 확인하는 함수
+static int url_has_ctl(char *url) {
+    for (; *url != '\0'; url++) {
+        if ((unsigned char) *url <= ' ' || *url == 0x7f) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void admin_preload(int connfd, char *query, Cache *cache, ProxyConfig *config) {
+    AdminOutput out = {malloc(MAXLINE), 0, MAXLINE};
+    char url[MAXLINE], value[MAXLINE], key[MAXLINE];
+    ssize_t bytes;
+    int status;
+
+    // %0d%0a 같은 값이 preload 요청에 header 를 끼워 넣지 못하도록 막는다
+    if (!query_param(query, "url", url, sizeof(url)) || strncasecmp(url, "http://", 7) != 0 || url_has_ctl(url)) {
+        free(out.buf);
+        admin_error(connfd, "400 Bad Request", "preload needs url=http://... without spaces or control characters");
+        return;
+    }
+
+    out_printf(&out, "{\"url\": ");
+    out_json_string(&out, url);
+    if (query_param(query, "refresh", value, sizeof(value))) {
+        url_to_key(key, url, config);
+        out_printf(&out, ", ");
+        admin_purge_pattern(&out, cache, key, 0);
+    }
+
+    status = preload_url(url, &bytes);
+    out_printf(&out, ", \"status\": %d, \"bytes\": %zd}\n", status, bytes);
+    admin_reply(connfd, status > 0 ? "200 OK" : "502 Bad Gateway", &out);
+    free(out.buf);
+}
+
+// ADMIN_PATH 요청을 처리하는 함수, 요청 header 는 읽어서 버린다
+void admin_serve(int connfd, rio_t *rp, char *method, char *uri, int local, Cache *cache, ProxyConfig *config) {
+    char header[MAXLINE], path[MAXLINE], *query;
+
+    do {
+        if (Rio_readlineb(rp, header, MAXLINE) <= 0) {
+            break;
+        }
+    } while (strcmp(header, "\r\n"));
+
+    if (!local) {
+        admin_error(connfd, "403 Forbidden", "cache admin is only available from loopback");
+        return;
+    }
+
+    snprintf(path, MAXLINE, "%s", uri);
+    if ((query = strchr(path, '?')) != NULL) {
+        *query++ = '\0';
+    } else {
+        query = "";
+    }
+
+    if (strcmp(path, ADMIN_PATH) == 0) {
+        if (strcasecmp(method, "GET") != 0) {
+            admin_error(connfd, "405 Method Not Allowed", "use GET to list the cache");
+            return;
+        }
+        admin_list(connfd, query, cache);
+    } else if (strcmp(path, ADMIN_PATH "/purge") == 0 || strcmp(path, ADMIN_PATH "/preload") == 0) {
+        if (strcasecmp(method, "POST") != 0) {
+            admin_error(connfd, "405 Method Not Allowed", "use POST to change the cache");
+            return;
+        }
+        if (strcmp(path, ADMIN_PATH "/purge") == 0) {
+            admin_purge(connfd, query, cache, config);
+        } else {
+            admin_preload(connfd, query, cache, config);
+        }
+    } else {
+        admin_error(connfd, "404 Not Found", "unknown cache admin path");
+    }
+}
@@ -0,0 +1,20 @@
+/*
+ * admin.h - 캐시 관리 API (목록, purge, preload)
+ */
+#ifndef __ADMIN_H__
+#define __ADMIN_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "config.h"
+
+#define ADMIN_PATH "/__proxy/cache"     /* 이 경로로 시작하는 요청은 origin 으로 보내지 않고 admin_serve 가 처리 */
+#define ADMIN_LIST_LIMIT 1000           /* 목록에서 tier 별로 보여주는 기본 최대 항목 수 */
+
+void admin_init(char *port);
+
+int admin_is_local(struct sockaddr *addr);
+
+void admin_serve(int connfd, rio_t *rp, char *method, char *uri, int local, Cache *cache, ProxyConfig *config);
+
+#endif /* __ADMIN_H__ */
@@ -0,0 +1,121 @@
+/*
+ * admission.c - 과부하일 때 새 연결과 origin 으로 가는 요청을 바로 503 으로 돌려보내는 admission control
+ *
+ * 예전에는 얼마나 밀려 있든 accept 한 연결마다 thread 를 만들고 origin 으로 보냈기 때문에,
+ * 감당할 수 있는 양을 넘으면 모든 요청이 함께 느려졌다. 이제는 세 군데에서 거른다.
+ * 1. accept: 열려 있는 연결이 max_connections 이상이면 thread 를 만들지 않고 503
+ *    (메모리 예산은 원래대로 memory_admit 이 확인한다).
+ * 2. origin 으로 가기 전: accept 부터 deliver thread 가 시작될 때까지 기다린 시간이 shed_queue_ms 를 넘었으면 503.
+ *    thread 가 제때 돌지 못한다는 것은 CPU 가 이미 모자라다는 뜻이다.
+ * 3. origin 으로 가기 전: origin 으로 가는 요청 수가 동시 실행 limit 이상이면 503.
+ *    limit 은 AIMD 로 조절한다. 요청이 끝날 때마다 origin 의 첫 바이트까지 걸린 시간을 concurrency_target_ms 와 비교해서
+ *    - 넘었거나 deadline 이 지났으면 limit 을 ADMISSION_BACKOFF_PCT 로 줄이고 (한 번 줄인 뒤 target 만큼은 더 줄이지 않음),
+ *    - 목표 안이고 limit 의 절반 이상을 쓰고 있었으면 limit 을 1/limit 씩 늘린다 (limit 개가 끝날 때마다 1 씩).
+ * 캐시 hit 은 거의 비용이 들지 않으므로 2, 3 을 거치지 않는다. 과부하에서도 hit 은 계속 나가고 miss 만 걸러진다.
+ * 거절은 요청을 더 읽거나 origin 에 연결하지 않는 짧은 503 (Retry-After: 1) 이다.
+ */
+#include "admission.h"
+#include "stats.h"
+
+static sem_t admission_mutex;
+static int admission_initialized = 0;
+static double limit;                // origin 으로 가는 요청의 동시 실행 limit (concurrency_target_ms 가 0 이면 쓰지 않음)
+static int inflight;                // origin 으로 가는 중인 요청 수
+static int connections;             // 열려 있는 연결 수 (main thread 와 h2 session 이 늘리고 deliver thread 가 줄인다)
+static long long last_decrease_us;  // 마지막으로 limit 을 줄인 시각
+
+// 시작할 때와 reload 할 때 limit 을 설정 범위 안으로 맞추는 함수, 처음에는 최대치에서 시작해 지연을 보며 줄인다
+void admission_configure(ProxyConfig *config) {
+    if (!admission_initialized) {
+        Sem_init(&admission_mutex, 0, 1);
+        admission_initialized = 1;
+        limit = config->concurrency_limit_max;
+    }
+    P(&admission_mutex);
+    if (limit > config->concurrency_limit_max) {
+        limit = config->concurrency_limit_max;
+    }
+    if (limit < config->concurrency_limit_min) {
+        limit = config->concurrency_limit_min;
+    }
+    V(&admission_mutex);
+}
+
+// 새 연결을 받을 수 있는지 확인하는 함수, 받으면 1 (연결을 닫을 때 admission_close), 아니면 0
+// main thread 와 h2 session thread 들이 함께 부르므로 먼저 늘려보고 넘으면 되돌린다
+int admission_accept(ProxyConfig *config) {
+    if (__sync_fetch_and_add(&connections, 1) >= config->max_connections && config->max_connections > 0) {
+        __sync_fetch_and_sub(&connections, 1);
+        return 0;
+    }
+    return 1;
+}
+
+void admission_close(void) {
+    __sync_fetch_and_sub(&connections, 1);
+}
+
+// cache miss 가 origin 으로 가도 되는지 확인하는 함수, 되면 1 (끝나면 admission_leave), 아니면 0
+// queued_us 는 accept 부터 deliver thread 가 시작될 때까지 기다린 시간
+int admission_enter(ProxyConfig *config, long long queued_us) {
+    if (config->shed_queue_ms > 0 && queued_us > config->shed_queue_ms * 1000LL) {
+        return 0;
+    }
+    P(&admission_mutex);
+    if (config->concurrency_target_ms > 0 && inflight >= (int) limit) {
+        V(&admission_mutex);
+        return 0;
+    }
+    inflight++;
+    V(&admission_mutex);
+    return 1;
+}
+
+// origin 으로 간 요청이 끝났을 때 limit 을 조절하는 함수
+// latency_us 는 origin 으로 출발해서 첫 바이트를 받을 때까지, ok 는 deadline 없이 끝났는지
+void admission_leave(ProxyConfig *config, long long latency_us, int ok) {
+    long long now = stats_now_us(), target_us = config->concurrency_target_ms * 1000LL;
+
+    P(&admission_mutex);
+    inflight--;
+    if (target_us > 0) {
+        if (!ok || latency_us > target_us) {
+            // 같은 과부하 때문에 늦어진 응답들이 한꺼번에 와도 limit 이 바닥까지 떨어지지 않도록 target 에 한 번만 줄인다
+            if (now - last_decrease_us >= target_us) {
+                limit = limit * ADMISSION_BACKOFF_PCT / 100;
+                if (limit < config->concurrency_limit_min) {
+                    limit = config->concurrency_limit_min;
+                }
+                last_decrease_us = now;
+            }
+        } else if (inflight + 1 >= limit / 2) {
+            // 한가해서 limit 까지 쓰지도 않는 동안에는 늘리지 않는다
+            limit += 1 / limit;
+            if (limit > config->concurrency_limit_max) {
+                limit = config->concurrency_limit_max;
+            }
+        }
+    }
+    V(&admission_mutex);
+}
+
+// origin 으로 가는 요청이 limit 의 절반도 안 되는지 확인하는 함수 (prefetch 처럼 미뤄도 되는 일을 할 여유)
+int admission_idle(ProxyConfig *config) {
+    int idle;
+
+    P(&admission_mutex);
+    idle = inflight < (config->concurrency_target_ms > 0 ? limit : config->concurrency_limit_max) / 2;
+    V(&admission_mutex);
+    return idle;
+}
+
+// 현재 limit 과 요청 수를 JSON 객체로 쓰는 함수
+ssize_t admission_render(char *buf, ssize_t size) {
+    int n;
+
+    P(&admission_mutex);
+    n = snprintf(buf, size, "{\"limit\": %d, \"inflight\": %d, \"connections\": %d}",
+                 (int) limit, inflight, __atomic_load_n(&connections, __ATOMIC_RELAXED));
+    V(&admission_mutex);
+    return n < size ? n : size - 1;
+}
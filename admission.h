@@ -0,0 +1,26 @@
+/*
+ * admission.h - 과부하일 때 새 연결과 origin 으로 가는 요청을 바로 503 으로 돌려보내는 admission control
+ */
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+#include "csapp.h"
+#include "config.h"
+
+#define ADMISSION_BACKOFF_PCT 90    /* 목표 지연을 넘은 응답이 오면 limit 을 이만큼으로 줄인다 (multiplicative decrease) */
+
+void admission_configure(ProxyConfig *config);
+
+int admission_accept(ProxyConfig *config);
+
+void admission_close(void);
+
+int admission_enter(ProxyConfig *config, long long queued_us);
+
+void admission_leave(ProxyConfig *config, long long latency_us, int ok);
+
+int admission_idle(ProxyConfig *config);
+
+ssize_t admission_render(char *buf, ssize_t size);
+
+#endif /* __ADMISSION_H__ */
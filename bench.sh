@@ -0,0 +1,127 @@
+#!/bin/bash
+#
+# bench.sh - tiny 를 origin 으로 두고 proxy 에 loadgen 으로 부하를 걸어 성능을 측정한다.
+#
+#     tiny, proxy 를 비어있는 port 에 띄우고, tiny 디렉터리의 파일들을 Zipf 분포로 요청한다.
+#     먼저 BENCH_WARMUP 초 동안 캐시를 채운 뒤 BENCH_DURATION 초 동안 측정하고,
+#     loadgen 의 결과와 proxy 의 /__proxy/stats 를 출력한다.
+#
+#     usage: ./bench.sh            (보통은 make bench 로 실행)
+#
+#     환경 변수로 조절할 수 있는 값:
+#       BENCH_CONNS (32) BENCH_THREADS (4) BENCH_DURATION (10) BENCH_WARMUP (2)
+#       BENCH_RATE (0 = closed-loop) BENCH_ZIPF (1.0) BENCH_KEEPALIVE (0)
+#       BENCH_JSON (결과 JSON 을 저장할 파일, 기본값 ./.bench/result.json)
+#       BENCH_PROXY_OPTS (proxy 에 더 넘길 -o 옵션들, 예: "-o tcp_quickack=1 -o client_sndbuf=256K")
+#
+
+HOME_DIR=`pwd`
+BENCH_DIR="${HOME_DIR}/.bench"
+BENCH_CONNS=${BENCH_CONNS:-32}
+BENCH_THREADS=${BENCH_THREADS:-4}
+BENCH_DURATION=${BENCH_DURATION:-10}
+BENCH_WARMUP=${BENCH_WARMUP:-2}
+BENCH_RATE=${BENCH_RATE:-0}
+BENCH_ZIPF=${BENCH_ZIPF:-1.0}
+BENCH_KEEPALIVE=${BENCH_KEEPALIVE:-0}
+BENCH_JSON=${BENCH_JSON:-${BENCH_DIR}/result.json}
+BENCH_PROXY_OPTS=${BENCH_PROXY_OPTS:-}
+
+# 요청할 tiny 의 파일들, 앞에 있을수록 자주 요청된다 (tiny 는 object_size 보다 커서 중계만 됨)
+BENCH_LIST="home.html
+            csapp.c
+            tiny.c
+            godzilla.gif
+            godzilla.jpg
+            adder.html
+            csapp.h
+            tiny"
+
+#
+# wait_for_http - 해당 URL 이 응답할 때까지 기다린다, 5 초가 지나면 실패
+#     (tiny 는 아무것도 보내지 않고 끊는 연결을 받으면 멈추므로 port 만 열어보지 않고 실제로 요청한다)
+#
+function wait_for_http() {
+    for i in `seq 50`
+    do
+        curl --max-time 1 --silent --output /dev/null $1 && return 0
+        sleep 0.1
+    done
+    echo "Error: timed out waiting for $1"
+    cleanup
+    exit 1
+}
+
+#
+# free_port - 아무도 listen 하고 있지 않은 port 를 하나 골라준다
+#
+function free_port {
+    port=$((( RANDOM % 30000) + 20000))
+    while netstat --numeric-ports --numeric-hosts -ltn | grep -q ":${port} "
+    do
+        port=`expr ${port} + 1`
+    done
+    echo ${port}
+}
+
+function cleanup {
+    kill $tiny_pid $proxy_pid 2> /dev/null
+    wait $tiny_pid $proxy_pid 2> /dev/null
+}
+
+for prog in ./tiny/tiny ./proxy ./loadgen
+do
+    if [ ! -x ${prog} ]
+    then
+        echo "Error: ${prog} not found. Run make first."
+        exit 1
+    fi
+done
+
+mkdir -p ${BENCH_DIR}
+trap 'cleanup; exit 1' INT TERM
+
+tiny_port=$(free_port)
+echo "Starting tiny on port ${tiny_port}"
+cd ./tiny
+./tiny ${tiny_port} &> /dev/null &
+tiny_pid=$!
+cd ${HOME_DIR}
+wait_for_http http://localhost:${tiny_port}/home.html
+
+# 측정이 disk 나 trace log 에 영향을 받지 않도록 disk cache 와 trace 는 끄고 실행
+proxy_port=$(free_port)
+echo "Starting proxy on port ${proxy_port}"
+./proxy -o disk_cache_dir= -o trace_sample=0 ${BENCH_PROXY_OPTS} ${proxy_port} &> ${BENCH_DIR}/proxy.log &
+proxy_pid=$!
+wait_for_http http://localhost:${proxy_port}/__proxy/stats
+
+rm -f ${BENCH_DIR}/urls.txt
+for file in ${BENCH_LIST}
+do
+    echo "http://localhost:${tiny_port}/${file}" >> ${BENCH_DIR}/urls.txt
+done
+
+LOADGEN_ARGS="-c ${BENCH_CONNS} -t ${BENCH_THREADS} -z ${BENCH_ZIPF} -x localhost:${proxy_port} -f ${BENCH_DIR}/urls.txt"
+if [ "${BENCH_RATE}" != "0" ]; then
+    LOADGEN_ARGS="${LOADGEN_ARGS} -r ${BENCH_RATE}"
+fi
+if [ "${BENCH_KEEPALIVE}" != "0" ]; then
+    LOADGEN_ARGS="${LOADGEN_ARGS} -k"
+fi
+
+echo "Warming up for ${BENCH_WARMUP}s"
+./loadgen ${LOADGEN_ARGS} -d ${BENCH_WARMUP} > /dev/null
+
+echo "Measuring for ${BENCH_DURATION}s: ${BENCH_CONNS} connections, ${BENCH_THREADS} threads, zipf ${BENCH_ZIPF}, rate ${BENCH_RATE}"
+./loadgen ${LOADGEN_ARGS} -d ${BENCH_DURATION} -j ${BENCH_JSON}
+status=$?
+
+echo ""
+echo "Proxy stats:"
+curl --max-time 5 --silent http://localhost:${proxy_port}/__proxy/stats
+
+cleanup
+echo ""
+echo "Result written to ${BENCH_JSON}"
+exit ${status}
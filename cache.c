@@ -0,0 +1,331 @@
+/*
+ * cache.c - proxy 의 메모리(RAM) 캐시
+ *
+ * 가장 최근에 사용한 아이템이 head, 가장 오래된 아이템이 tail 에 위치하는 LRU 리스트이다.
+ * 용량이 부족해서 tail 에서 밀려난 아이템은 버리지 않고 disk_cache 로 강등(demote) 한다.
+ * 텍스트 객체는 body 를 gzip 으로 압축해서 저장하므로, capacity 는 압축 후 크기 기준으로 줄어든다.
+ */
+#include "cache.h"
+#include "disk_cache.h"
+#include "stats.h"
+#include "cache_key.h"
+#include "memory.h"
+#include "probes.h"
+
+// 리스트에서 아이템을 떼어내기만 하고 free 는 하지 않는 함수
+static void detachCacheItem(Cache *cache, CacheItem *item) {
+    if (item->prev != NULL) {
+        item->prev->next = item->next;
+    } else {
+        cache->head = item->next;
+    }
+    if (item->next != NULL) {
+        item->next->prev = item->prev;
+    } else {
+        cache->tail = item->prev;
+    }
+
+    item->prev = NULL;
+    item->next = NULL;
+    cache->capacity += item->size;
+    cache->raw_bytes -= item->raw_size;
+}
+
+// 새로운 cache 를 생성하는 함수
+CacheItem *createCacheItem(char *key, char *value, ssize_t size) {
+    CacheItem *newItem = (CacheItem *) malloc(sizeof(CacheItem));
+    newItem->value = (char *) malloc(size);
+    newItem->key = strdup(key);
+
+    memcpy(newItem->value, value, size);
+    newItem->size = size;
+    newItem->raw_size = size;
+    newItem->header_size = 0;
+    newItem->encoding = ENCODING_IDENTITY;
+    newItem->created = time(NULL);
+    newItem->hits = 0;
+    newItem->prev = NULL;
+    newItem->next = NULL;
+    memory_add(MEM_CACHE, memory_block(newItem) + memory_block(newItem->key) + memory_block(newItem->value));
+    return newItem;
+}
+
+// createCacheItem 으로 만든 아이템을 free 하는 함수, 캐시 메모리 사용량에서도 빼준다
+void freeCacheItem(CacheItem *item) {
+    memory_add(MEM_CACHE, -(memory_block(item) + memory_block(item->key) + memory_block(item->value)));
+    free(item->key);
+    free(item->value);
+    free(item);
+}
+
+// cache pool init 함수
+Cache *initCache(ssize_t limit) {
+    Cache *cache = (Cache *) malloc(sizeof(Cache));
+    cache->limit = limit;
+    cache->capacity = limit;
+    cache->raw_bytes = 0;
+    cache->head = NULL;
+    cache->tail = NULL;
+    Sem_init(&cache->mutex, 0, 1);
+    return cache;
+}
+
+// cache_pool 에서 특정 cache 를 삭제하는 함수
+void removeCacheItem(Cache *cache, CacheItem *item) {
+    detachCacheItem(cache, item);
+    freeCacheItem(item);
+}
+
+
+// 이미 만들어진 아이템을 cache_pool 의 head 에 넣어주는 함수 (disk 에서 승격된 아이템도 여기로 들어온다)
+// memory_budget 이 있으면 먼저 자리를 확인하고 (아이템은 만들 때 이미 사용량에 더해졌으므로 cost 0),
+// 캐시를 줄여도 자리가 없으면 RAM 에 넣지 않고 disk 로 보낸다
+void insert_cache_item(Cache *cache, CacheItem *newItem) {
+    CacheItem *curr, *victim;
+
+    if (!memory_admit(cache, memory_current_budget(), 0)) {
+        disk_cache_demote(newItem);
+        return;
+    }
+
+    P(&cache->mutex);
+
+    // 동시에 miss 난 thread 가 먼저 넣어둔 같은 key 가 있다면 새 값으로 교체
+    for (curr = cache->head; curr != NULL; curr = curr->next) {
+        if (strcmp(curr->key, newItem->key) == 0) {
+            removeCacheItem(cache, curr);
+            break;
+        }
+    }
+
+    // 공간이 부족하면 tail 부터 떼어내서 disk 로 강등, 소유권은 disk_cache 로 넘어간다
+    while (cache->capacity < newItem->size && cache->tail != NULL) {
+        victim = cache->tail;
+        detachCacheItem(cache, victim);
+        PROXY_PROBE2(cache_evict, victim->key, victim->size);
+        disk_cache_demote(victim);
+        stats_count(STAT_EVICTIONS, 1);
+    }
+
+    newItem->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = newItem;
+    }
+    cache->head = newItem;
+    if (cache->tail == NULL) {
+        cache->tail = newItem;
+    }
+
+    cache->capacity -= newItem->size;
+    cache->raw_bytes += newItem->raw_size;
+    PROXY_PROBE3(cache_insert, newItem->key, newItem->size, newItem->raw_size);
+
+    V(&cache->mutex);
+}
+
+// cache_pool 에 cache 를 넣어주는 함수
+// 압축 가능한 텍스트 객체라면 lock 을 잡기 전에 body 를 gzip 으로 압축해서 넣는다
+void put_cache(Cache *cache, char *key, char *value, ssize_t size) {
+    CacheItem *newItem;
+    ssize_t header_size = response_header_length(value, size), body_size;
+    char *packed;
+
+    if (header_size > 0 && should_compress(value, header_size, size - header_size)) {
+        packed = (char *) malloc(size);
+        memcpy(packed, value, header_size);
+        body_size = gzip_body(value + header_size, size - header_size, packed + header_size, size - header_size);
+        if (body_size > 0) {
+            newItem = createCacheItem(key, packed, header_size + body_size);
+            newItem->raw_size = size;
+            newItem->header_size = header_size;
+            newItem->encoding = ENCODING_GZIP;
+            free(packed);
+            insert_cache_item(cache, newItem);
+            return;
+        }
+        free(packed);
+    }
+
+    insert_cache_item(cache, createCacheItem(key, value, size));
+}
+
+// client 로 보내면서 이미 gzip 으로 압축한 응답을 다시 압축하지 않고 넣는 함수
+// value 는 [원본 header][압축된 body], raw_body 는 압축 전 body 크기
+void put_cache_gzip(Cache *cache, char *key, char *value, ssize_t size, ssize_t raw_body) {
+    CacheItem *newItem;
+    ssize_t header_size = response_header_length(value, size);
+
+    if (header_size <= 0) {
+        return;
+    }
+    newItem = createCacheItem(key, value, size);
+    newItem->raw_size = header_size + raw_body;
+    newItem->header_size = header_size;
+    newItem->encoding = ENCODING_GZIP;
+    insert_cache_item(cache, newItem);
+}
+
+
+// cache_pool 에서 특정 cache 를 찾아서 client 에게 보낼 형태로 buf 에 만들어주는 함수
+// lock 을 놓은 뒤에는 다른 thread 가 아이템을 지울 수 있으므로, 포인터가 아닌 복사본을 돌려준다.
+// 압축을 풀어야 하는 경우에는 저장된 값만 복사해두고 lock 밖에서 푼다.
+// 찾지 못하면 -1 을 반환
+ssize_t get_cache(Cache *cache, char *key, char *buf, ssize_t buf_size, int accept_gzip) {
+    CacheItem *curr;
+    ssize_t size = -1, stored_size = 0, header_size = 0;
+    char *stored = NULL;
+
+    P(&cache->mutex);
+
+    for (curr = cache->head; curr != NULL; curr = curr->next) {
+        if (strcmp(curr->key, key) == 0) {
+            // 해당 항목을 가장 최근에 사용했으므로, head 로 옮겨줌
+            if (curr != cache->head) {
+                curr->prev->next = curr->next;
+                if (curr->next != NULL) {
+                    curr->next->prev = curr->prev;
+                } else {
+                    cache->tail = curr->prev;
+                }
+                curr->next = cache->head;
+                curr->prev = NULL;
+                cache->head->prev = curr;
+                cache->head = curr;
+            }
+            curr->hits++;
+            if (curr->encoding == ENCODING_GZIP && !accept_gzip) {
+                stored = (char *) malloc(curr->size);
+                memcpy(stored, curr->value, curr->size);
+                stored_size = curr->size;
+                header_size = curr->header_size;
+            } else {
+                size = render_response(curr->value, curr->size, curr->header_size, curr->encoding,
+                                       accept_gzip, buf, buf_size);
+            }
+            break;
+        }
+    }
+
+    V(&cache->mutex);
+
+    if (stored != NULL) {
+        size = render_response(stored, stored_size, header_size, ENCODING_GZIP, 0, buf, buf_size);
+        free(stored);
+    }
+    if (size > 0) {
+        PROXY_PROBE3(cache_hit, key, size, "ram");
+    }
+    return size;
+}
+
+// 캐시 전체 용량을 바꿔주는 함수
+// 줄어든 경우에는 한 번에 다 밀어내지 않고 CACHE_EVICT_BATCH 개씩 lock 을 놓아가며 밀어내서,
+// 그 사이에도 다른 요청들이 캐시를 사용할 수 있게 한다. 밀려난 아이템은 평소처럼 disk 로 간다.
+void cache_resize(Cache *cache, ssize_t limit) {
+    CacheItem *victim;
+    int i;
+
+    P(&cache->mutex);
+    cache->capacity += limit - cache->limit;
+    cache->limit = limit;
+    V(&cache->mutex);
+
+    while (1) {
+        P(&cache->mutex);
+        for (i = 0; i < CACHE_EVICT_BATCH && cache->capacity < 0 && cache->tail != NULL; i++) {
+            victim = cache->tail;
+            detachCacheItem(cache, victim);
+            PROXY_PROBE2(cache_evict, victim->key, victim->size);
+            disk_cache_demote(victim);
+            stats_count(STAT_EVICTIONS, 1);
+        }
+        if (cache->capacity >= 0 || cache->tail == NULL) {
+            V(&cache->mutex);
+            return;
+        }
+        V(&cache->mutex);
+        usleep(1000);
+    }
+}
+
+ssize_t cache_limit(Cache *cache) {
+    ssize_t limit;
+
+    P(&cache->mutex);
+    limit = cache->limit;
+    V(&cache->mutex);
+    return limit;
+}
+
+// 메모리가 모자랄 때 tail 부터 아이템을 지워서 bytes 만큼(아이템이 실제 차지하던 메모리 기준) 비워주는 함수
+// 지운 만큼 용량도 줄여서 바로 다시 차지 않게 하고, 메모리를 바로 돌려받아야 하므로 disk 로 강등하지 않고 버린다.
+// 실제로 비운 메모리 크기를 반환
+long long cache_shrink(Cache *cache, long long bytes) {
+    CacheItem *victim, *freed = NULL;
+    long long n = 0;
+
+    P(&cache->mutex);
+    while (n < bytes && cache->tail != NULL) {
+        victim = cache->tail;
+        detachCacheItem(cache, victim);
+        cache->limit -= victim->size;
+        cache->capacity -= victim->size;
+        n += memory_block(victim) + memory_block(victim->key) + memory_block(victim->value);
+        PROXY_PROBE2(cache_evict, victim->key, victim->size);
+        stats_count(STAT_EVICTIONS, 1);
+        victim->next = freed;
+        freed = victim;
+    }
+    V(&cache->mutex);
+
+    while ((victim = freed) != NULL) {
+        freed = victim->next;
+        freeCacheItem(victim);
+    }
+    return n;
+}
+
+// 모든 아이템에 대해 head(최근) 부터 fn 을 불러주는 함수
+// lock 을 잡은 채로 부르므로 fn 은 아이템을 바꾸거나 오래 걸리는 일을 하면 안 된다 (필요한 값만 복사)
+void cache_foreach(Cache *cache, void (*fn)(CacheItem *item, void *arg), void *arg) {
+    CacheItem *curr;
+
+    P(&cache->mutex);
+    for (curr = cache->head; curr != NULL; curr = curr->next) {
+        fn(curr, arg);
+    }
+    V(&cache->mutex);
+}
+
+// pattern 에 맞는 아이템을 지우고 지운 개수를 반환하는 함수 (cache_key_matches 참고)
+// 지워진 아이템은 disk 로 강등하지 않는다
+int cache_purge(Cache *cache, char *pattern, int prefix) {
+    CacheItem *curr, *next;
+    int n = 0;
+
+    P(&cache->mutex);
+    for (curr = cache->head; curr != NULL; curr = next) {
+        next = curr->next;
+        if (cache_key_matches(curr->key, pattern, prefix)) {
+            removeCacheItem(cache, curr);
+            n++;
+        }
+    }
+    V(&cache->mutex);
+    return n;
+}
+
+// 캐시 사용량과 압축으로 늘어난 실효 용량을 출력해주는 함수
+void cache_report(Cache *cache) {
+    ssize_t used, raw, limit;
+
+    P(&cache->mutex);
+    limit = cache->limit;
+    used = limit - cache->capacity;
+    raw = cache->raw_bytes;
+    V(&cache->mutex);
+
+    printf("cache: %zd bytes stored holding %zd bytes of responses, effective capacity %.0f bytes\n",
+           used, raw, used ? (double) limit * raw / used : (double) limit);
+    compress_report();
+}
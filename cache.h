@@ -0,0 +1,68 @@
+/*
+ * cache.h - proxy 의 메모리(RAM) 캐시 정의
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+#include "compress.h"
+
+#define CACHE_EVICT_BATCH 16    /* 용량을 줄일 때 lock 한 번에 밀어내는 아이템 수 */
+
+/* Recommended max cache and object sizes (config 의 기본값) */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+// 각 캐시 아이템
+typedef struct CacheItem {
+    char *key;
+    char *value;
+    ssize_t size;           // 캐시에 실제로 저장된 크기 (압축된 경우 압축 후 크기)
+    ssize_t raw_size;       // 원본 response 크기
+    ssize_t header_size;    // value 중 response header 부분의 크기
+    int encoding;           // body 의 저장 형식 (ENCODING_IDENTITY / ENCODING_GZIP)
+    time_t created;         // RAM 캐시에 만들어진 시각 (disk 에서 승격된 경우 승격된 시각)
+    unsigned long hits;     // RAM 에서 hit 난 횟수
+    struct CacheItem *prev;
+    struct CacheItem *next;
+} CacheItem;
+
+// 전체 캐시 풀
+typedef struct Cache {
+    ssize_t limit;          // 전체 용량, 설정 reload 로 바뀔 수 있음
+    ssize_t capacity;       // 남은 용량, 용량을 줄인 직후에는 잠시 음수일 수 있다
+    ssize_t raw_bytes;      // 저장된 아이템들의 원본 크기 합, 압축 효과 측정용
+    CacheItem *head;
+    CacheItem *tail;
+    sem_t mutex;    // 여러 deliver thread 가 동시에 접근하므로 리스트 전체를 보호
+} Cache;
+
+CacheItem *createCacheItem(char *key, char *value, ssize_t size);
+
+Cache *initCache(ssize_t limit);
+
+void freeCacheItem(CacheItem *item);
+
+void removeCacheItem(Cache *cache, CacheItem *item);
+
+void insert_cache_item(Cache *cache, CacheItem *item);
+
+void put_cache(Cache *cache, char *key, char *value, ssize_t size);
+
+void put_cache_gzip(Cache *cache, char *key, char *value, ssize_t size, ssize_t raw_body);
+
+ssize_t get_cache(Cache *cache, char *key, char *buf, ssize_t buf_size, int accept_gzip);
+
+void cache_resize(Cache *cache, ssize_t limit);
+
+ssize_t cache_limit(Cache *cache);
+
+long long cache_shrink(Cache *cache, long long bytes);
+
+void cache_foreach(Cache *cache, void (*fn)(CacheItem *item, void *arg), void *arg);
+
+int cache_purge(Cache *cache, char *pattern, int prefix);
+
+void cache_report(Cache *cache);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,357 @@
+/*
+ * cache_key.c - 캐시 key 정규화와 Vary 별 variant key
+ *
+ * 같은 객체를 가리키는 요청들이 같은 key 를 갖도록 "http://<소문자 host>:<port><정규화된 path>" 로 만든다.
+ * - port 가 없으면 80 을 명시
+ * - path 는 RFC 3986 6.2.2 에 따라 unreserved 문자의 %XX 는 풀고, 나머지 %xx 는 대문자로 통일한 뒤
+ *   "." / ".." segment 를 제거
+ * - sort_query 가 켜져 있으면 query parameter 를 정렬 (순서가 의미 있는 origin 도 있으므로 기본은 끔)
+ *
+ * origin 이 Vary 를 보내면 URL 별로 Vary 에 나온 header 이름들을 기억해 두고,
+ * 요청의 해당 header 값들을 key 뒤에 붙여서 variant 별로 따로 캐시한다.
+ */
+#include "cache_key.h"
+#include "compress.h"
+#include "util.h"
+
+#define MAX_QUERY_PARAMS 256
+
+// URL 하나에 대해 기억해 둔 Vary header 목록
+typedef struct VaryEntry {
+    char *base_key;
+    char *headers;      // 소문자, 정렬, ',' 로 구분 (예: "accept-language,user-agent")
+    struct VaryEntry *next;
+} VaryEntry;
+
+static VaryEntry *vary_table[VARY_TABLE_BUCKETS];
+static int vary_count = 0;
+static sem_t vary_mutex;
+static pthread_once_t vary_once = PTHREAD_ONCE_INIT;
+
+static void vary_init(void) {
+    Sem_init(&vary_mutex, 0, 1);
+}
+
+static unsigned int key_hash(char *key) {
+    return fnv1a32_str(key) % VARY_TABLE_BUCKETS;
+}
+
+static int is_unreserved(int c) {
+    return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static int hex_value(int c) {
+    return isdigit(c) ? c - '0' : toupper(c) - 'A' + 10;
+}
+
+// %XX 정규화: unreserved 문자는 풀고, 나머지는 16진수를 대문자로 통일
+static void normalize_percent(char *in, char *out) {
+    int c;
+
+    while (*in) {
+        if (in[0] == '%' && isxdigit((unsigned char) in[1]) && isxdigit((unsigned char) in[2])) {
+            c = hex_value((unsigned char) in[1]) * 16 + hex_value((unsigned char) in[2]);
+            if (is_unreserved(c)) {
+                *out++ = c;
+            } else {
+                *out++ = '%';
+                *out++ = toupper((unsigned char) in[1]);
+                *out++ = toupper((unsigned char) in[2]);
+            }
+            in += 3;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+}
+
+// path 에서 "." 과 ".." segment 를 제거 (RFC 3986 5.2.4)
+static void remove_dot_segments(char *in, char *out) {
+    char buf[MAXLINE], *seg, *next;
+    int len = 0;
+
+    strcpy(buf, in);
+    seg = buf[0] == '/' ? buf + 1 : buf;
+    while (seg != NULL) {
+        if ((next = strchr(seg, '/')) != NULL) {
+            *next++ = '\0';
+        }
+        if (!strcmp(seg, ".")) {
+            if (next == NULL) out[len++] = '/';
+        } else if (!strcmp(seg, "..")) {
+            // 마지막 segment 와 그 앞의 '/' 를 지움
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+            if (next == NULL) out[len++] = '/';
+        } else {
+            out[len++] = '/';
+            strcpy(out + len, seg);
+            len += strlen(seg);
+        }
+        seg = next;
+    }
+    if (len == 0) {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+}
+
+static int compare_params(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+// query 의 parameter 들을 정렬해서 다시 이어 붙임
+static void sort_query_params(char *query) {
+    char buf[MAXLINE], *params[MAX_QUERY_PARAMS], *p, *save;
+    int n = 0, i;
+
+    strcpy(buf, query);
+    for (p = strtok_r(buf, "&", &save); p != NULL && n < MAX_QUERY_PARAMS; p = strtok_r(NULL, "&", &save)) {
+        params[n++] = p;
+    }
+    if (p != NULL) {
+        return;     // parameter 가 너무 많으면 원래 순서 유지
+    }
+    qsort(params, n, sizeof(char *), compare_params);
+
+    query[0] = '\0';
+    for (i = 0; i < n; i++) {
+        if (i > 0) strcat(query, "&");
+        strcat(query, params[i]);
+    }
+}
+
+// hostname, port, path(+query) 로 정규화된 캐시 key 를 만들어주는 함수
+void build_cache_key(char *key, char *hostname, char *port, char *path, int sort_query) {
+    char host[MAXLINE], raw[MAXLINE], decoded[MAXLINE], norm_path[MAXLINE], query[MAXLINE];
+    char *q, *p;
+    int port_num = atoi(port);
+    size_t len;
+
+    // host 는 소문자로, 끝의 '.' 은 제거
+    snprintf(host, sizeof(host), "%s", hostname);
+    for (p = host; *p; p++) {
+        *p = tolower((unsigned char) *p);
+    }
+    len = strlen(host);
+    if (len > 1 && host[len - 1] == '.') {
+        host[len - 1] = '\0';
+    }
+    if (port_num <= 0 || port_num > 65535) {
+        port_num = 80;
+    }
+
+    // fragment 는 server 로 가지 않으므로 key 에서도 제외
+    snprintf(raw, sizeof(raw), "%s", path[0] != '\0' ? path : "/");
+    if ((p = strchr(raw, '#')) != NULL) {
+        *p = '\0';
+    }
+    query[0] = '\0';
+    if ((q = strchr(raw, '?')) != NULL) {
+        *q = '\0';
+        normalize_percent(q + 1, query);
+        if (sort_query) {
+            sort_query_params(query);
+        }
+    }
+    normalize_percent(raw, decoded);
+    remove_dot_segments(decoded, norm_path);
+
+    // 요청 line 자체가 MAXLINE 이내이므로 잘리는 경우는 사실상 없지만, 잘리면 끝을 확실히 막아둠
+    // IPv6 주소는 URL 에서처럼 [] 로 감싼다
+    if (snprintf(key, MAXLINE, strchr(host, ':') ? "http://[%s]:%d%s%s%s" : "http://%s:%d%s%s%s",
+                 host, port_num, norm_path, query[0] ? "?" : "", query) >= MAXLINE) {
+        key[MAXLINE - 1] = '\0';
+    }
+}
+
+// header 블록(첫 줄은 request/status line)에서 name 의 값을 찾아 value 에 넣어주는 함수, 없으면 0
+static int find_header(char *headers, char *name, char *value, int value_size) {
+    char *line = strstr(headers, "\r\n"), *end, *v;
+    size_t name_len = strlen(name);
+    int n;
+
+    while (line != NULL && strncmp(line, "\r\n\r\n", 4) != 0) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            v = line + name_len + 1;
+            end = strstr(v, "\r\n");
+            n = end ? end - v : strlen(v);
+            if (n >= value_size) n = value_size - 1;
+            memcpy(value, v, n);
+            value[n] = '\0';
+            return 1;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
+
+// header 값 정규화: 앞뒤 공백 제거, 연속된 공백은 하나로
+// Accept-Encoding 은 대소문자/순서가 의미 없으므로 소문자로 바꾸고 token 을 정렬한다
+static void normalize_header_value(char *name, char *value) {
+    char buf[MAXLINE], *tokens[MAX_QUERY_PARAMS], *t, *src, *dst, *save;
+    int n = 0, i;
+
+    for (src = dst = value; *src; src++) {
+        if (isspace((unsigned char) *src)) {
+            if (dst != value && dst[-1] != ' ') *dst++ = ' ';
+        } else {
+            *dst++ = *src;
+        }
+    }
+    if (dst != value && dst[-1] == ' ') dst--;
+    *dst = '\0';
+
+    if (strcasecmp(name, "accept-encoding") != 0) {
+        return;
+    }
+    for (src = value; *src; src++) {
+        *src = tolower((unsigned char) *src);
+    }
+    strcpy(buf, value);
+    for (t = strtok_r(buf, ", ", &save); t != NULL && n < MAX_QUERY_PARAMS; t = strtok_r(NULL, ", ", &save)) {
+        tokens[n++] = t;
+    }
+    qsort(tokens, n, sizeof(char *), compare_params);
+    value[0] = '\0';
+    for (i = 0; i < n; i++) {
+        if (i > 0) strcat(value, ",");
+        strcat(value, tokens[i]);
+    }
+}
+
+// base_key 뒤에 Vary 로 지정된 header 들의 요청 값을 붙여서 variant key 를 만들어주는 함수
+static void append_variant(char *key, char *base_key, char *vary_headers, char *request_header) {
+    char names[MAXLINE], value[MAXLINE], *name, *save;
+    size_t len;
+
+    snprintf(key, MAXLINE, "%s", base_key);
+    strcpy(names, vary_headers);
+    for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if (!find_header(request_header, name, value, sizeof(value))) {
+            value[0] = '\0';
+        }
+        normalize_header_value(name, value);
+        len = strlen(key);
+        snprintf(key + len, MAXLINE - len, "\n%s=%s", name, value);
+    }
+}
+
+static VaryEntry **vary_find(char *base_key) {
+    VaryEntry **pp = &vary_table[key_hash(base_key)];
+    while (*pp != NULL && strcmp((*pp)->base_key, base_key) != 0) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+// 요청에 맞는 캐시 key 를 만들어주는 함수
+// 이 URL 에 대해 origin 이 Vary 를 보낸 적이 있다면 해당 header 값이 붙은 variant key 가 된다
+void cache_variant_key(char *key, char *base_key, char *request_header) {
+    char vary_headers[MAXLINE];
+    VaryEntry *e;
+
+    pthread_once(&vary_once, vary_init);
+
+    P(&vary_mutex);
+    e = *vary_find(base_key);
+    if (e != NULL) {
+        strcpy(vary_headers, e->headers);
+    }
+    V(&vary_mutex);
+
+    if (e == NULL) {
+        snprintf(key, MAXLINE, "%s", base_key);
+        return;
+    }
+    append_variant(key, base_key, vary_headers, request_header);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcasecmp(*(char **) a, *(char **) b);
+}
+
+// origin 의 response 를 보고 이 URL 의 Vary 를 기억한 뒤, 이 response 를 저장할 key 를 만들어주는 함수
+// Vary: * 처럼 캐시할 수 없는 경우 -1 을 반환
+int cache_learn_vary(char *key, char *base_key, char *response, ssize_t size, char *request_header) {
+    char header[MAXLINE], value[MAXLINE], spec[MAXLINE], *names[MAX_QUERY_PARAMS], *name, *p, *save;
+    ssize_t header_size = response_header_length(response, size);
+    VaryEntry **pp, *e;
+    int n = 0, i;
+
+    pthread_once(&vary_once, vary_init);
+
+    spec[0] = '\0';
+    if (header_size > 0 && header_size < MAXLINE) {
+        memcpy(header, response, header_size);
+        header[header_size] = '\0';
+        if (find_header(header, "Vary", value, sizeof(value))) {
+            for (name = strtok_r(value, ", \t", &save); name != NULL && n < MAX_QUERY_PARAMS;
+                 name = strtok_r(NULL, ", \t", &save)) {
+                if (!strcmp(name, "*")) {
+                    return -1;
+                }
+                for (p = name; *p; p++) {
+                    *p = tolower((unsigned char) *p);
+                }
+                names[n++] = name;
+            }
+            qsort(names, n, sizeof(char *), compare_names);
+            for (i = 0; i < n; i++) {
+                if (i > 0 && !strcmp(names[i], names[i - 1])) continue;
+                if (spec[0] != '\0') strcat(spec, ",");
+                strcat(spec, names[i]);
+            }
+        }
+    }
+
+    P(&vary_mutex);
+    pp = vary_find(base_key);
+    if (spec[0] == '\0') {
+        // 더 이상 Vary 를 보내지 않는 URL 이면 기억해둔 것도 지움
+        if ((e = *pp) != NULL) {
+            *pp = e->next;
+            free(e->base_key);
+            free(e->headers);
+            free(e);
+            vary_count--;
+        }
+        V(&vary_mutex);
+        snprintf(key, MAXLINE, "%s", base_key);
+        return 0;
+    }
+
+    if ((e = *pp) == NULL) {
+        if (vary_count >= VARY_TABLE_MAX) {
+            V(&vary_mutex);
+            return -1;
+        }
+        e = (VaryEntry *) malloc(sizeof(VaryEntry));
+        e->base_key = strdup(base_key);
+        e->headers = NULL;
+        e->next = NULL;
+        *pp = e;
+        vary_count++;
+    }
+    if (e->headers == NULL || strcmp(e->headers, spec) != 0) {
+        free(e->headers);
+        e->headers = strdup(spec);
+    }
+    V(&vary_mutex);
+
+    append_variant(key, base_key, spec, request_header);
+    return 0;
+}
+
+// 캐시 key 가 purge 대상인지 알려주는 함수
+// prefix 가 0 이면 pattern 과 같은 key 와 그 Vary variant 들, 1 이면 pattern 으로 시작하는 모든 key 가 대상
+int cache_key_matches(char *key, char *pattern, int prefix) {
+    size_t len = strlen(pattern);
+
+    if (strncmp(key, pattern, len) != 0) {
+        return 0;
+    }
+    return prefix || key[len] == '\0' || key[len] == '\n';
+}
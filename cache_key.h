@@ -0,0 +1,20 @@
+/*
+ * cache_key.h - 캐시 key 정규화와 Vary 별 variant key
+ */
+#ifndef __CACHE_KEY_H__
+#define __CACHE_KEY_H__
+
+#include "csapp.h"
+
+#define VARY_TABLE_BUCKETS 4096
+#define VARY_TABLE_MAX 65536    /* Vary 를 기억해둘 최대 URL 수 */
+
+void build_cache_key(char *key, char *hostname, char *port, char *path, int sort_query);
+
+void cache_variant_key(char *key, char *base_key, char *request_header);
+
+int cache_learn_vary(char *key, char *base_key, char *response, ssize_t size, char *request_header);
+
+int cache_key_matches(char *key, char *pattern, int prefix);
+
+#endif /* __CACHE_KEY_H__ */
@@ -0,0 +1,58 @@
+#!/usr/bin/python3
+
+# chunked-server.py - This is a server that we use for the chunked
+#                     transfer coding test. It serves the files in the
+#                     current directory with Transfer-Encoding: chunked
+#                     and no Content-Length. A path starting with
+#                     /trunc/ closes the connection halfway through the
+#                     body, before the last chunk.
+#
+# usage: chunked-server.py <port>
+#
+import socket
+import sys
+import threading
+
+CHUNK_SIZE = 4096
+
+def serve(channel):
+    request = b''
+    while b'\r\n\r\n' not in request:
+        data = channel.recv(4096)
+        if not data:
+            channel.close()
+            return
+        request += data
+
+    path = request.split()[1].decode()
+    truncate = path.startswith('/trunc/')
+    if truncate:
+        path = path[len('/trunc'):]
+    try:
+        with open('.' + path, 'rb') as f:
+            body = f.read()
+    except OSError:
+        channel.sendall(b'HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n')
+        channel.close()
+        return
+
+    channel.sendall(b'HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n'
+                    b'Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n')
+    for i in range(0, len(body), CHUNK_SIZE):
+        if truncate and i >= len(body) // 2:
+            channel.close()
+            return
+        chunk = body[i:i + CHUNK_SIZE]
+        channel.sendall(b'%x\r\n' % len(chunk) + chunk + b'\r\n')
+    channel.sendall(b'0\r\n\r\n')
+    channel.close()
+
+# create an INET, STREAMing socket
+serversocket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+serversocket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+serversocket.bind(('', int(sys.argv[1])))
+serversocket.listen(5)
+
+while 1:
+    channel, details = serversocket.accept()
+    threading.Thread(target=serve, args=(channel,), daemon=True).start()
@@ -0,0 +1,432 @@
+/*
+ * chunked.c - chunked transfer coding 의 decoder 와 응답 framing 변환 (RFC 9112 7.1)
+ *
+ * origin 으로는 HTTP/1.0 으로 요청하지만 chunked 로 답하는 origin 도 있고, client 도 body 를 chunked 로 보낼 수 있다.
+ * - ChunkedDecoder 는 body 가 몇 바이트씩 나뉘어 들어와도 이어서 푸는 state machine 이다.
+ *   chunk extension 과 trailer 는 읽고 버린다. 출력은 입력보다 길지 않으므로 같은 버퍼에 풀어도 된다.
+ * - Framing 은 relay 가 origin 응답을 client 와 캐시로 나눠 보내기 전에 거치는 단계다.
+ *   header 를 다 받으면 Transfer-Encoding 을 보고
+ *   1. chunked 응답이면 body 를 풀어서 캐시에는 그대로, client 에게는 (HTTP/1.1 이면) 다시 chunked 로 감싸서
+ *      (HTTP/1.0 이면) 연결을 닫는 것으로 끝을 알리며 보낸다. 마지막 chunk 가 오면 origin 이 닫지 않아도 끝난다.
+ *   2. Content-Length 도 chunked 도 없는 응답은 HTTP/1.1 client 에게 chunked 로 감싸서 보낸다.
+ *      origin 이 중간에 끊기면 마지막 chunk 를 보내지 않으므로 client 는 잘린 응답을 알아챌 수 있다.
+ *   3. client 가 gzip 을 받고 압축할 만한 텍스트 응답이면 (compress.c) body 를 흘려보내며 gzip 으로 압축한다.
+ *      client 쪽 header 에서는 Content-Length 를 빼고 Content-Encoding 을 붙이고 strong ETag 를 weak 로 바꾸며, 1 처럼 chunked 로 감싸거나 닫아서 끝낸다.
+ *      캐시에는 원본 header 와 압축된 body 가 들어가므로 (cache.c 의 put_cache_gzip) 다시 압축하지 않는다.
+ *   4. 그 외에는 아무것도 바꾸지 않는다 (relay 는 framing 없이 바로 보낸다).
+ *   observer 가 있으면 (prefetch.c) header 와, 원하면 압축 전의 풀어낸 body 도 보여준다.
+ *   캐시에 들어가는 응답은 chunked 가 풀린 body 이고, proxy.c 가 framing_set_length 로 Content-Length 를 붙인다.
+ */
+#include "chunked.h"
+#include "memory.h"
+#include "util.h"
+
+// ChunkedDecoder 의 state
+enum {
+    CHUNK_SIZE,             // chunk 크기 (16진수)
+    CHUNK_EXT,              // 크기 뒤의 chunk extension, 줄 끝까지 버림
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,          // chunk data 뒤의 CRLF
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER,          // trailer 줄의 시작, 빈 줄이면 body 끝
+    CHUNK_TRAILER_LINE,
+    CHUNK_TRAILER_LF,
+    CHUNK_DONE
+};
+
+// Framing 의 state
+enum {
+    FRAMING_HEAD,           // header 를 모으는 중
+    FRAMING_RAW,            // body 를 그대로 (client 가 chunked 를 받으면 감싸서) 보냄
+    FRAMING_CHUNKED,        // chunked body 를 풀어서 보냄
+    FRAMING_DONE            // 마지막 chunk 까지 받음, 뒤에 오는 바이트는 버린다
+};
+
+void chunked_init(ChunkedDecoder *decoder) {
+    memset(decoder, 0, sizeof(ChunkedDecoder));
+    decoder->state = CHUNK_SIZE;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = tolower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// chunk 크기 줄이 끝났을 때 다음 state 를 정하는 함수
+static void size_line_done(ChunkedDecoder *decoder) {
+    if (decoder->digits == 0) {
+        decoder->error = 1;
+    } else {
+        decoder->state = decoder->size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+    }
+}
+
+// in 의 len 바이트를 풀어서 out 에 body 만 담는 함수, 담은 바이트 수 (잘못된 body 면 -1)
+// 마지막 chunk 와 trailer 까지 읽으면 done 이 되고 그 뒤의 바이트는 읽지 않는다. 읽은 바이트는 consumed 에 담는다.
+// out 은 in 과 같아도 된다
+ssize_t chunked_decode(ChunkedDecoder *decoder, char *in, size_t len, char *out, size_t *consumed) {
+    size_t i = 0, n, written = 0;
+    int v;
+
+    while (i < len && !decoder->done && !decoder->error) {
+        if (decoder->state == CHUNK_DATA) {
+            n = len - i < decoder->size ? len - i : decoder->size;
+            memmove(out + written, in + i, n);
+            written += n;
+            i += n;
+            if ((decoder->size -= n) == 0) {
+                decoder->state = CHUNK_DATA_CR;
+            }
+            continue;
+        }
+
+        char c = in[i++];
+        switch (decoder->state) {
+            case CHUNK_SIZE:
+                if ((v = hex_value(c)) >= 0) {
+                    decoder->size = decoder->size * 16 + v;
+                    if (++decoder->digits > 16 || decoder->size > CHUNKED_MAX_SIZE) {
+                        decoder->error = 1;
+                    }
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    decoder->state = CHUNK_EXT;
+                } else if (c == '\r') {
+                    decoder->state = CHUNK_SIZE_LF;
+                } else if (c == '\n') {
+                    size_line_done(decoder);
+                } else {
+                    decoder->error = 1;
+                }
+                break;
+            case CHUNK_EXT:
+                if (c == '\r') {
+                    decoder->state = CHUNK_SIZE_LF;
+                } else if (c == '\n') {
+                    size_line_done(decoder);
+                }
+                break;
+            case CHUNK_SIZE_LF:
+                if (c == '\n') {
+                    size_line_done(decoder);
+                } else {
+                    decoder->error = 1;
+                }
+                break;
+            case CHUNK_DATA_CR:
+                // 줄 끝을 LF 하나로만 보내는 구현도 받아준다
+                if (c == '\r') {
+                    decoder->state = CHUNK_DATA_LF;
+                    break;
+                }
+                /* fall through */
+            case CHUNK_DATA_LF:
+                if (c == '\n') {
+                    decoder->state = CHUNK_SIZE;
+                    decoder->size = 0;
+                    decoder->digits = 0;
+                } else {
+                    decoder->error = 1;
+                }
+                break;
+            case CHUNK_TRAILER:
+                if (c == '\r') {
+                    decoder->state = CHUNK_TRAILER_LF;
+                } else if (c == '\n') {
+                    decoder->done = 1;
+                } else {
+                    decoder->state = CHUNK_TRAILER_LINE;
+                }
+                break;
+            case CHUNK_TRAILER_LINE:
+                if (c == '\n') {
+                    decoder->state = CHUNK_TRAILER;
+                }
+                break;
+            case CHUNK_TRAILER_LF:
+                if (c == '\n') {
+                    decoder->done = 1;
+                } else {
+                    decoder->error = 1;
+                }
+                break;
+        }
+    }
+    if (decoder->done) {
+        decoder->state = CHUNK_DONE;
+    }
+    *consumed = i;
+    return decoder->error ? -1 : (ssize_t) written;
+}
+
+void framing_init(Framing *framing, int client_chunked, int head_only, int gzip_allowed) {
+    memset(framing, 0, sizeof(Framing));
+    framing->state = FRAMING_HEAD;
+    framing->client_chunked = client_chunked;
+    framing->head_only = head_only;
+    framing->gzip_allowed = gzip_allowed;
+    framing->head = (char *) malloc(FRAMING_HEAD_SIZE + 1);
+    chunked_init(&framing->decoder);
+}
+
+// header 와 풀어낸 body 를 볼 observer 를 다는 함수, head 가 1 을 반환하면 body 도 넘겨준다
+void framing_observe(Framing *framing, int (*head)(void *arg, char *head, size_t len),
+                     void (*body)(void *arg, char *data, size_t len), void *arg) {
+    framing->observe_head = head;
+    framing->observe_body = body;
+    framing->observe_arg = arg;
+}
+
+// framing 이 잡은 버퍼를 놓는 함수, compressed 와 body_len 은 남겨둔다 (캐시에 넣을 때 사용)
+void framing_free(Framing *framing) {
+    free(framing->head);
+    framing->head = NULL;
+    if (framing->gzip != NULL) {
+        gzip_stream_free(framing->gzip);
+        free(framing->zbuf);
+        memory_add(MEM_CONNECTIONS, -GZIP_STREAM_MEMORY);
+        framing->gzip = NULL;
+    }
+}
+
+// header 가 name 으로 시작하는 줄인지 확인하는 함수 (대소문자 무시)
+static int header_is(char *line, char *name) {
+    return strncasecmp(line, name, strlen(name)) == 0;
+}
+
+// 풀어낸 body 를 내보내는 함수, client 가 chunked 를 받으면 chunk 하나로 감싼다
+static int body_emit(Framing *framing, char *data, size_t len,
+                     int (*emit)(void *arg, char *data, size_t len, int target), void *arg) {
+    char line[32];
+
+    if (len == 0) {
+        return 0;
+    }
+    if (!framing->encode) {
+        return emit(arg, data, len, FRAMING_BOTH);
+    }
+    if (emit(arg, line, sprintf(line, "%zx\r\n", len), FRAMING_CLIENT) < 0 ||
+        emit(arg, data, len, FRAMING_BOTH) < 0) {
+        return -1;
+    }
+    return emit(arg, "\r\n", 2, FRAMING_CLIENT);
+}
+
+// 풀어낸 body 를 내보내는 함수, 압축하는 응답이면 압축한 바이트를 body_emit 으로 넘긴다
+// finish 면 gzip trailer 까지 내보낸다
+static int body_write(Framing *framing, char *data, size_t len, int finish,
+                      int (*emit)(void *arg, char *data, size_t len, int target), void *arg) {
+    ssize_t n;
+
+    framing->body_len += len;
+    if (framing->observing && len > 0) {
+        framing->observe_body(framing->observe_arg, data, len);
+    }
+    if (framing->gzip == NULL) {
+        return body_emit(framing, data, len, emit, arg);
+    }
+    if (len == 0 && !finish) {
+        return 0;
+    }
+    do {
+        if ((n = gzip_stream(framing->gzip, &data, &len, framing->zbuf, FRAMING_GZIP_SIZE, finish)) < 0 ||
+            body_emit(framing, framing->zbuf, n, emit, arg) < 0) {
+            return -1;
+        }
+    } while (n == FRAMING_GZIP_SIZE);
+    return 0;
+}
+
+// body 의 한 조각을 처리하는 함수, 응답이 끝났으면 1, 계속이면 0, 에러면 -1
+static int body_input(Framing *framing, char *data, size_t len,
+                      int (*emit)(void *arg, char *data, size_t len, int target), void *arg) {
+    size_t consumed;
+    ssize_t n;
+
+    if (framing->state == FRAMING_RAW) {
+        return body_write(framing, data, len, 0, emit, arg);
+    }
+    if (framing->state != FRAMING_CHUNKED) {
+        return framing->state == FRAMING_DONE;
+    }
+    if ((n = chunked_decode(&framing->decoder, data, len, data, &consumed)) < 0 ||
+        body_write(framing, data, n, 0, emit, arg) < 0) {
+        return -1;
+    }
+    if (framing->decoder.done) {
+        framing->state = FRAMING_DONE;
+        framing->complete = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// 다 모인 header 의 framing 을 정하고 client 와 캐시로 내보내는 함수
+// chunked 응답이면 Transfer-Encoding (과 무시해야 하는 Content-Length) 을 빼고,
+// client 에게 chunked 로 감싸서 보낸다면 client 쪽에만 Transfer-Encoding: chunked 를 붙인다.
+// 압축해서 보낸다면 client 쪽에서만 Content-Length 를 빼고 Content-Encoding 과 Vary 를 붙이며, ETag 는 weak 로 바꾼다
+static int head_emit(Framing *framing, size_t head_len,
+                     int (*emit)(void *arg, char *data, size_t len, int target), void *arg) {
+    static char gzip_headers[] = "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+    char *head = framing->head, *line, *next, *end = head + head_len - 2, etag[MAXLINE];
+    char *sp = strchr(head, ' ');
+    int status = sp != NULL ? atoi(sp + 1) : 0, chunked = 0, has_length = 0, no_body, target;
+    long long length = -1;
+
+    for (line = strstr(head, "\r\n") + 2; line < end; line = next) {
+        next = strstr(line, "\r\n") + 2;
+        if (header_is(line, "Transfer-Encoding:")) {
+            *(next - 2) = '\0';
+            chunked |= strcasestr(line, "chunked") != NULL;
+            *(next - 2) = '\r';
+        } else if (header_is(line, "Content-Length:")) {
+            has_length = 1;
+            length = strtoll(line + strlen("Content-Length:"), NULL, 10);
+        }
+    }
+    no_body = framing->head_only || status < 200 || status == 204 || status == 304;
+    framing->observing = framing->observe_head != NULL && !no_body &&
+                         framing->observe_head(framing->observe_arg, head, head_len);
+    // 압축 버퍼나 deflate 상태를 잡지 못하면 압축하지 않고 그대로 보낸다
+    if (framing->gzip_allowed && !no_body && should_compress(head, head_len, chunked ? -1 : length) &&
+        (framing->zbuf = (char *) malloc(FRAMING_GZIP_SIZE)) != NULL) {
+        if ((framing->gzip = gzip_stream_new()) != NULL) {
+            framing->compressed = 1;
+            memory_add(MEM_CONNECTIONS, GZIP_STREAM_MEMORY);
+        } else {
+            free(framing->zbuf);
+            framing->zbuf = NULL;
+        }
+    }
+    framing->encode = framing->client_chunked && !no_body && (chunked || !has_length || framing->compressed);
+    framing->state = chunked && !no_body ? FRAMING_CHUNKED : FRAMING_RAW;
+    // HTTP/1.0 응답에 붙은 Transfer-Encoding 은 잘못된 framing 으로 보므로, 감쌀 때는 proxy 의 version 으로 보낸다
+    if (framing->encode && strncmp(head, "HTTP/1.0 ", 9) == 0) {
+        head[7] = '1';
+    }
+
+    // header 줄마다 보낼 곳을 정해서 내보낸다 (빈 줄은 마지막에 따로 보냄)
+    for (line = head; line < end; line = next) {
+        next = strstr(line, "\r\n") + 2;
+        target = FRAMING_BOTH;
+        if (chunked && line != head && (header_is(line, "Transfer-Encoding:") || header_is(line, "Content-Length:"))) {
+            continue;
+        }
+        if (framing->compressed && header_is(line, "Content-Length:")) {
+            // 캐시에는 압축 전 크기가 남아야 hit 때 gzip 을 받지 않는 client 에게 풀어서 보낼 수 있다
+            target = FRAMING_CACHE;
+        }
+        if (framing->compressed && header_is(line, "ETag:") && next - line + 2 <= sizeof(etag)) {
+            // 캐시에는 origin 의 ETag 를 그대로 두고, hit 때는 render_response 가 같은 방법으로 바꾼다
+            if (emit(arg, line, next - line, FRAMING_CACHE) < 0 ||
+                emit(arg, etag, gzip_etag(line, next - line, etag), FRAMING_CLIENT) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (emit(arg, line, next - line, target) < 0) {
+            return -1;
+        }
+    }
+    if ((framing->encode && emit(arg, "Transfer-Encoding: chunked\r\n", 28, FRAMING_CLIENT) < 0) ||
+        (framing->compressed && emit(arg, gzip_headers, strlen(gzip_headers), FRAMING_CLIENT) < 0)) {
+        return -1;
+    }
+    return emit(arg, "\r\n", 2, FRAMING_BOTH);
+}
+
+// origin 에서 받은 바이트를 framing 에 넣는 함수, 응답이 끝났으면 1 (origin 이 닫지 않아도), 계속이면 0, 에러면 -1
+// 내보내는 바이트는 emit 으로 넘기며, 들어온 바이트보다 최대 FRAMING_SLACK 만큼 많을 수 있다
+int framing_input(Framing *framing, char *data, size_t len,
+                  int (*emit)(void *arg, char *data, size_t len, int target), void *arg) {
+    size_t n, head_len;
+    char *end;
+    int rc;
+
+    if (framing->state != FRAMING_HEAD) {
+        return body_input(framing, data, len, emit, arg);
+    }
+
+    n = FRAMING_HEAD_SIZE - framing->head_len < len ? FRAMING_HEAD_SIZE - framing->head_len : len;
+    memcpy(framing->head + framing->head_len, data, n);
+    framing->head_len += n;
+    framing->head[framing->head_len] = '\0';
+    if ((end = strstr(framing->head, "\r\n\r\n")) == NULL) {
+        if (framing->head_len < FRAMING_HEAD_SIZE) {
+            return 0;
+        }
+        // header 가 너무 길면 framing 을 바꾸지 않고 그대로 보낸다
+        framing->state = FRAMING_RAW;
+        if (emit(arg, framing->head, framing->head_len, FRAMING_BOTH) < 0) {
+            return -1;
+        }
+        return body_input(framing, data + n, len - n, emit, arg);
+    }
+
+    head_len = end - framing->head + 4;
+    if (head_emit(framing, head_len, emit, arg) < 0) {
+        return -1;
+    }
+    // header 와 같이 읽힌 body 부터 처리
+    if ((rc = body_input(framing, framing->head + head_len, framing->head_len - head_len, emit, arg)) != 0) {
+        return rc;
+    }
+    return body_input(framing, data + n, len - n, emit, arg);
+}
+
+// origin 이 연결을 닫았을 때 응답을 마무리하는 함수, 에러면 -1
+// chunked 응답이 마지막 chunk 전에 끊겼다면 client 에게도 마지막 chunk 를 보내지 않는다 (잘린 응답으로 보이도록)
+int framing_finish(Framing *framing, int (*emit)(void *arg, char *data, size_t len, int target), void *arg) {
+    switch (framing->state) {
+        case FRAMING_HEAD:
+            // header 도 다 오지 않은 응답은 받은 만큼 그대로
+            return framing->head_len > 0 ? emit(arg, framing->head, framing->head_len, FRAMING_BOTH) : 0;
+        case FRAMING_RAW:
+            framing->complete = 1;
+            break;
+        case FRAMING_CHUNKED:
+            return 0;
+    }
+    if (framing->gzip != NULL && body_write(framing, NULL, 0, 1, emit, arg) < 0) {
+        return -1;
+    }
+    return framing->encode ? emit(arg, CHUNKED_LAST, strlen(CHUNKED_LAST), FRAMING_CLIENT) : 0;
+}
+
+// header 를 본 뒤 더 바꿀 것이 없는지 (이후 바이트를 그대로 보내도 되는지) 확인하는 함수
+int framing_passthrough(Framing *framing) {
+    return framing->state == FRAMING_RAW && !framing->encode && !framing->compressed && !framing->observing;
+}
+
+// 응답 header 에 Content-Length 가 없으면 body 크기로 붙여주는 함수, 바뀐 응답 크기 (붙일 자리가 없으면 그대로)
+// chunked 를 풀어서 캐시에 넣는 응답이 hit 때 Content-Length 로 나가도록. 압축한 응답은 압축 전 크기를 붙인다
+ssize_t framing_set_length(Framing *framing, char *response, ssize_t len, ssize_t size) {
+    char line[64], *p, *end = NULL;
+    ssize_t head_len, n;
+
+    for (p = response; p + 4 <= response + len; p++) {
+        if (!memcmp(p, "\r\n\r\n", 4)) {
+            end = p + 2;
+            break;
+        }
+    }
+    if (end == NULL) {
+        return len;
+    }
+    head_len = end + 2 - response;
+    for (p = strstr(response, "\r\n"); p != NULL && p + 2 < end; p = strstr(p + 2, "\r\n")) {
+        if (header_is(p + 2, "Content-Length:")) {
+            return len;
+        }
+    }
+    n = sprintf(line, "Content-Length: %lld\r\n", framing->compressed ? framing->body_len : (long long) (len - head_len));
+    if (len + n > size) {
+        return len;
+    }
+    memmove(end + n, end, response + len - end);
+    memcpy(end, line, n);
+    return len + n;
+}
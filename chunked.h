@@ -0,0 +1,71 @@
+/*
+ * chunked.h - chunked transfer coding 의 decoder 와 응답 framing 변환 (gzip 압축 포함)
+ */
+#ifndef __CHUNKED_H__
+#define __CHUNKED_H__
+
+#include "csapp.h"
+#include "compress.h"
+
+#define CHUNKED_LAST "0\r\n\r\n"            /* chunked body 의 마지막 chunk (trailer 없음) */
+#define CHUNKED_MAX_SIZE ((size_t) 1 << 40)  /* 이보다 큰 chunk 크기는 잘못된 body 로 본다 */
+#define FRAMING_HEAD_SIZE MAXLINE           /* 응답 header 를 모으는 버퍼, 넘으면 framing 을 바꾸지 않고 그대로 보낸다 */
+#define FRAMING_SLACK 128                   /* 읽은 것보다 더 내보낼 수 있는 바이트 (chunk 크기 줄, 추가한 header, gzip header 와 flush) */
+#define FRAMING_GZIP_SIZE 16384             /* 압축한 body 를 모았다가 내보내는 버퍼 */
+
+/* framing 이 내보내는 바이트가 가는 곳 */
+#define FRAMING_CLIENT 1
+#define FRAMING_CACHE 2
+#define FRAMING_BOTH (FRAMING_CLIENT | FRAMING_CACHE)
+
+// 조금씩 들어오는 chunked body 를 푸는 decoder 의 상태
+typedef struct ChunkedDecoder {
+    int state;
+    size_t size;            // 읽고 있는 chunk 크기
+    int digits;             // chunk 크기 줄에서 읽은 16진수 자리 수
+    int done;               // 마지막 chunk 와 trailer 까지 다 읽음
+    int error;              // 잘못된 chunked body
+} ChunkedDecoder;
+
+// origin 응답 하나의 framing 을 client 에 맞게 바꾸는 상태 (relay.c 가 사용)
+typedef struct Framing {
+    int state;
+    int client_chunked;     // client 가 HTTP/1.1 이라 길이를 모르는 body 를 chunked 로 보낼 수 있음
+    int head_only;          // HEAD 요청이라 응답에 body 가 없음
+    int gzip_allowed;       // client 가 gzip 을 받고 gzip 설정이 켜져 있음
+    int encode;             // client 로 보내는 body 를 chunked 로 감쌈
+    int compressed;         // body 를 gzip 으로 압축해서 보냄 (캐시에도 압축된 body 가 들어감)
+    int complete;           // 응답이 자기 framing 대로 끝까지 왔음 (chunked 는 마지막 chunk, 아니면 origin 이 닫음)
+    char *head;             // header 를 다 받을 때까지 모으는 버퍼 (FRAMING_HEAD_SIZE)
+    size_t head_len;
+    long long body_len;     // 내보낸 body 의 압축 전 크기
+    GzipStream *gzip;       // compressed 일 때의 deflate 상태
+    char *zbuf;             // compressed 일 때 압축한 바이트를 담는 버퍼 (FRAMING_GZIP_SIZE)
+    int (*observe_head)(void *arg, char *head, size_t len);    // header 를 본 뒤 1 이면 풀어낸 body 도 넘겨줌
+    void (*observe_body)(void *arg, char *data, size_t len);
+    void *observe_arg;
+    int observing;
+    ChunkedDecoder decoder;
+} Framing;
+
+void chunked_init(ChunkedDecoder *decoder);
+
+ssize_t chunked_decode(ChunkedDecoder *decoder, char *in, size_t len, char *out, size_t *consumed);
+
+void framing_init(Framing *framing, int client_chunked, int head_only, int gzip_allowed);
+
+void framing_observe(Framing *framing, int (*head)(void *arg, char *head, size_t len),
+                     void (*body)(void *arg, char *data, size_t len), void *arg);
+
+int framing_input(Framing *framing, char *data, size_t len,
+                  int (*emit)(void *arg, char *data, size_t len, int target), void *arg);
+
+int framing_finish(Framing *framing, int (*emit)(void *arg, char *data, size_t len, int target), void *arg);
+
+int framing_passthrough(Framing *framing);
+
+void framing_free(Framing *framing);
+
+ssize_t framing_set_length(Framing *framing, char *response, ssize_t len, ssize_t size);
+
+#endif /* __CHUNKED_H__ */
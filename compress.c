@@ -0,0 +1,344 @@
+/*
+ * compress.c - 텍스트 응답의 gzip 압축/해제
+ *
+ * 캐시에는 [원본 response header][gzip 으로 압축한 body] 형태로 저장하고,
+ * 꺼낼 때 client 의 Accept-Encoding 에 따라
+ * - gzip 을 받는 client 에게는 Content-Length/Content-Encoding 만 고친 header 와 압축된 body 를 그대로,
+ * - 그렇지 않은 client 에게는 원본 header 와 다시 풀어낸 body 를 보내준다.
+ *
+ * gzip 으로 보내는 쪽은 원본과 바이트가 다른 representation 이므로 strong ETag 는 W/ 를 붙여 weak 로 바꾼다 (gzip_etag).
+ *
+ * 캐시에서 나가지 않는 응답 (miss, 캐시할 수 없는 응답) 은 gzip_stream 으로 origin 에서 받는 대로 압축해서
+ * 보낸다 (chunked.c 의 framing 이 사용). 이렇게 압축한 body 는 그대로 캐시에 들어가므로 객체 하나는 한 번만 압축된다.
+ */
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include "compress.h"
+#include "util.h"
+
+// 흘려보내며 압축하는 응답 하나의 deflate 상태
+struct GzipStream {
+    z_stream zs;
+    long long ns;           // 이 응답을 압축하는 데 쓴 CPU 시간
+};
+
+// 설정 (gzip_level, gzip_min_size), reload 때 바뀌므로 atomic 으로 읽고 쓴다
+static int compress_level = COMPRESS_LEVEL;
+static long long compress_min_size = COMPRESS_MIN_SIZE;
+
+// 압축 통계, 여러 thread 에서 갱신하므로 atomic 연산으로만 더한다
+// compress_* 는 캐시에 넣을 때 압축한 객체, stream_* 는 client 로 보내면서 압축한 응답
+static long long compress_count, compress_in_bytes, compress_out_bytes, compress_ns;
+static long long stream_count, stream_in_bytes, stream_out_bytes, stream_ns;
+static long long decompress_count, decompress_ns;
+
+#define LOAD_STAT(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static long long thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 시작할 때와 reload 할 때 압축 레벨과 최소 크기를 바꾸는 함수
+void compress_configure(ProxyConfig *config) {
+    __atomic_store_n(&compress_level, config->gzip_level, __ATOMIC_RELAXED);
+    __atomic_store_n(&compress_min_size, config->gzip_min_size, __ATOMIC_RELAXED);
+}
+
+// response 에서 header 가 끝나는 위치("\r\n\r\n" 다음)를 찾아주는 함수, 없으면 -1
+ssize_t response_header_length(char *response, ssize_t size) {
+    ssize_t i;
+
+    for (i = 0; i + 3 < size; i++) {
+        if (response[i] == '\r' && response[i + 1] == '\n' && response[i + 2] == '\r' && response[i + 3] == '\n') {
+            return i + 4;
+        }
+    }
+    return -1;
+}
+
+// 압축해서 저장할 만한 response 인지 확인하는 함수 (200 응답, 아직 인코딩되지 않은 텍스트 타입)
+int is_compressible(char *header, ssize_t header_size) {
+    char tmp[MAXLINE], *type;
+
+    if (header_size <= 0 || header_size >= MAXLINE) {
+        return 0;
+    }
+    memcpy(tmp, header, header_size);
+    tmp[header_size] = '\0';
+
+    if (strncmp(tmp, "HTTP/1.", 7) != 0 || strncmp(tmp + 8, " 200", 4) != 0) {
+        return 0;
+    }
+    if (strcasestr(tmp, "\r\nContent-Encoding:") != NULL) {
+        return 0;
+    }
+    if ((type = strcasestr(tmp, "\r\nContent-Type:")) == NULL) {
+        return 0;
+    }
+    type += strlen("\r\nContent-Type:");
+    while (*type == ' ') {
+        type++;
+    }
+
+    return strncasecmp(type, "text/", 5) == 0 ||
+           strncasecmp(type, "application/javascript", 22) == 0 ||
+           strncasecmp(type, "application/json", 16) == 0 ||
+           strncasecmp(type, "application/xml", 15) == 0;
+}
+
+// 압축할 response 인지 확인하는 함수, body 크기를 모르면 (-1) 타입만 본다
+int should_compress(char *header, ssize_t header_size, long long body_size) {
+    return (body_size < 0 || body_size >= __atomic_load_n(&compress_min_size, __ATOMIC_RELAXED)) &&
+           is_compressible(header, header_size);
+}
+
+// client 의 request header 에 gzip 을 받는다는 Accept-Encoding 이 있는지 확인하는 함수
+// 쉼표로 나눈 coding 중 이름이 정확히 gzip 인 것 (없으면 *) 의 q 값이 0 보다 크면 받는다 ("gzip;q=0" 은 명시적인 거부)
+int accepts_gzip(char *request_header) {
+    char line[MAXLINE], *start, *end, *token, *param, *save, *save_param;
+    double q;
+    int gzip = -1, any = -1;    // gzip 과 * 의 q 가 0 보다 큰지, 나오지 않았으면 -1
+
+    if ((start = strcasestr(request_header, "\nAccept-Encoding:")) == NULL) {
+        return 0;
+    }
+    start += strlen("\nAccept-Encoding:");
+    end = strstr(start, "\r\n");
+    if (end == NULL || end - start >= MAXLINE) {
+        return 0;
+    }
+    memcpy(line, start, end - start);
+    line[end - start] = '\0';
+
+    for (token = strtok_r(line, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        q = 1.0;
+        if ((param = strchr(token, ';')) != NULL) {
+            *param++ = '\0';
+            for (param = strtok_r(param, ";", &save_param); param != NULL; param = strtok_r(NULL, ";", &save_param)) {
+                sscanf(param, " %*1[qQ] = %lf", &q);
+            }
+        }
+        while (*token == ' ' || *token == '\t') {
+            token++;
+        }
+        for (end = token + strlen(token); end > token && (end[-1] == ' ' || end[-1] == '\t'); end--);
+        *end = '\0';
+        if (strcasecmp(token, "gzip") == 0) {
+            gzip = q > 0;
+        } else if (strcmp(token, "*") == 0) {
+            any = q > 0;
+        }
+    }
+    return gzip >= 0 ? gzip : any > 0;
+}
+
+// src 를 gzip 형식으로 압축해서 dst 에 넣어주는 함수
+// 압축 결과가 dst_size 보다 크면(압축 이득이 없으면) -1 을 반환
+ssize_t gzip_body(char *src, ssize_t src_size, char *dst, ssize_t dst_size) {
+    z_stream zs;
+    long long start = thread_cpu_ns();
+    ssize_t out;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, __atomic_load_n(&compress_level, __ATOMIC_RELAXED), Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    zs.next_in = (Bytef *) src;
+    zs.avail_in = src_size;
+    zs.next_out = (Bytef *) dst;
+    zs.avail_out = dst_size;
+    rc = deflate(&zs, Z_FINISH);
+    out = dst_size - zs.avail_out;
+    deflateEnd(&zs);
+
+    __sync_fetch_and_add(&compress_ns, thread_cpu_ns() - start);
+    if (rc != Z_STREAM_END) {
+        return -1;
+    }
+
+    __sync_fetch_and_add(&compress_count, 1);
+    __sync_fetch_and_add(&compress_in_bytes, src_size);
+    __sync_fetch_and_add(&compress_out_bytes, out);
+    return out;
+}
+
+// 응답 하나를 흘려보내며 압축할 deflate 상태를 만드는 함수, 실패하면 NULL
+GzipStream *gzip_stream_new(void) {
+    GzipStream *gz = (GzipStream *) calloc(1, sizeof(GzipStream));
+
+    if (gz == NULL) {
+        return NULL;
+    }
+    if (deflateInit2(&gz->zs, __atomic_load_n(&compress_level, __ATOMIC_RELAXED), Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(gz);
+        return NULL;
+    }
+    return gz;
+}
+
+// *in 의 *len 바이트를 압축해서 out 에 담는 함수, 담은 바이트 수 (에러면 -1)
+// 읽은 만큼 *in 과 *len 을 옮기고, 넣은 바이트는 client 가 바로 풀 수 있도록 flush 한다. finish 면 gzip trailer 까지 쓴다.
+// 반환값이 size 면 out 이 모자랐던 것이므로 다시 불러야 한다
+ssize_t gzip_stream(GzipStream *gz, char **in, size_t *len, char *out, size_t size, int finish) {
+    long long start = thread_cpu_ns();
+    int rc;
+
+    gz->zs.next_in = (Bytef *) *in;
+    gz->zs.avail_in = *len;
+    gz->zs.next_out = (Bytef *) out;
+    gz->zs.avail_out = size;
+    rc = deflate(&gz->zs, finish ? Z_FINISH : Z_SYNC_FLUSH);
+    *in += *len - gz->zs.avail_in;
+    *len = gz->zs.avail_in;
+    gz->ns += thread_cpu_ns() - start;
+
+    // Z_BUF_ERROR 는 더 할 일이 없다는 뜻일 뿐이다
+    return rc == Z_STREAM_ERROR ? -1 : (ssize_t) (size - gz->zs.avail_out);
+}
+
+// 응답 하나를 다 압축했을 때 (또는 중간에 끊겼을 때) 통계에 더하고 정리하는 함수
+void gzip_stream_free(GzipStream *gz) {
+    if (gz == NULL) {
+        return;
+    }
+    __sync_fetch_and_add(&stream_count, 1);
+    __sync_fetch_and_add(&stream_in_bytes, (long long) gz->zs.total_in);
+    __sync_fetch_and_add(&stream_out_bytes, (long long) gz->zs.total_out);
+    __sync_fetch_and_add(&stream_ns, gz->ns);
+    deflateEnd(&gz->zs);
+    free(gz);
+}
+
+// gzip 으로 보내는 응답의 ETag 줄 (line, 끝의 "\r\n" 포함 len 바이트) 을 out 에 쓰는 함수, 쓴 바이트 수
+// strong ETag 는 원본 body 의 것이므로 "W/" 를 붙여 weak 로 바꾸고, 이미 weak 면 그대로 둔다 (out 은 len + 2 바이트 필요)
+size_t gzip_etag(char *line, size_t len, char *out) {
+    char *value = line + strlen("ETag:"), *end = line + len;
+
+    while (value < end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    if (end - value >= 2 && strncmp(value, "W/", 2) == 0) {
+        memcpy(out, line, len);
+        return len;
+    }
+    memcpy(out, "ETag: W/", 8);
+    memcpy(out + 8, value, end - value);
+    return 8 + (end - value);
+}
+
+// gzip 으로 압축된 src 를 dst 에 풀어주는 함수, 실패하면 -1
+static ssize_t gunzip_body(char *src, ssize_t src_size, char *dst, ssize_t dst_size) {
+    z_stream zs;
+    long long start = thread_cpu_ns();
+    ssize_t out;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+        return -1;
+    }
+    zs.next_in = (Bytef *) src;
+    zs.avail_in = src_size;
+    zs.next_out = (Bytef *) dst;
+    zs.avail_out = dst_size;
+    rc = inflate(&zs, Z_FINISH);
+    out = dst_size - zs.avail_out;
+    inflateEnd(&zs);
+
+    __sync_fetch_and_add(&decompress_count, 1);
+    __sync_fetch_and_add(&decompress_ns, thread_cpu_ns() - start);
+    return rc == Z_STREAM_END ? out : -1;
+}
+
+// 캐시에 저장된 형태(stored)를 client 에게 보낼 response 로 만들어 out 에 넣어주는 함수
+// 만들어진 response 의 크기를 반환하고, out 에 들어가지 않거나 압축 해제에 실패하면 -1
+ssize_t render_response(char *stored, ssize_t stored_size, ssize_t header_size, int encoding,
+                        int accept_gzip, char *out, ssize_t out_size) {
+    char *line, *next, *header_end;
+    ssize_t len = 0, body_size, n;
+
+    if (encoding == ENCODING_IDENTITY) {
+        if (stored_size > out_size) {
+            return -1;
+        }
+        memcpy(out, stored, stored_size);
+        return stored_size;
+    }
+
+    body_size = stored_size - header_size;
+
+    // gzip 을 받지 않는 client: 원본 header 뒤에 body 를 풀어서 붙여줌
+    if (!accept_gzip) {
+        memcpy(out, stored, header_size);
+        if ((n = gunzip_body(stored + header_size, body_size, out + header_size, out_size - header_size)) < 0) {
+            return -1;
+        }
+        return header_size + n;
+    }
+
+    // gzip 을 받는 client: Content-Length 를 압축된 크기로 바꾸고 Content-Encoding 을 붙여줌, ETag 는 weak 로
+    if (header_size + 128 + body_size > out_size) {
+        return -1;
+    }
+    header_end = stored + header_size - 2;  // 마지막 빈 줄("\r\n") 위치
+    for (line = stored; line < header_end; line = next) {
+        for (next = line; next < header_end && *next != '\n'; next++);
+        next++;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            continue;
+        }
+        if (strncasecmp(line, "ETag:", 5) == 0) {
+            len += gzip_etag(line, next - line, out + len);
+            continue;
+        }
+        memcpy(out + len, line, next - line);
+        len += next - line;
+    }
+    len += sprintf(out + len, "Content-Length: %zd\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding\r\n\r\n",
+                   body_size);
+    memcpy(out + len, stored + header_size, body_size);
+    return len + body_size;
+}
+
+// 압축 비율과 압축/해제에 쓴 CPU 시간을 출력해주는 함수
+void compress_report(void) {
+    long long in = compress_in_bytes, out = compress_out_bytes;
+
+    printf("compression: %lld objects, %lld -> %lld bytes (ratio %.2f), compress %.1f us total (%.2f ns/byte), "
+           "decompress %lld times %.1f us total\n",
+           compress_count, in, out, out ? (double) in / out : 0.0,
+           compress_ns / 1000.0, in ? (double) compress_ns / in : 0.0,
+           decompress_count, decompress_ns / 1000.0);
+    if (stream_count > 0) {
+        printf("compression: %lld responses compressed on the fly, %lld -> %lld bytes, %.1f us total\n",
+               stream_count, stream_in_bytes, stream_out_bytes, stream_ns / 1000.0);
+    }
+}
+
+// 압축 설정과 통계를 JSON 객체로 쓰는 함수
+// ratio 는 원래 크기 / 압축된 크기, ns_per_byte 는 원래 크기 1 바이트를 압축하는 데 쓴 CPU 시간
+ssize_t compress_render(char *buf, ssize_t size) {
+    long long in = LOAD_STAT(compress_in_bytes), out = LOAD_STAT(compress_out_bytes), ns = LOAD_STAT(compress_ns);
+    long long s_in = LOAD_STAT(stream_in_bytes), s_out = LOAD_STAT(stream_out_bytes), s_ns = LOAD_STAT(stream_ns);
+    int n;
+
+    n = snprintf(buf, size, "{\"level\": %d, \"min_size\": %lld, "
+                            "\"cached\": {\"objects\": %lld, \"in_bytes\": %lld, \"out_bytes\": %lld, "
+                            "\"ratio\": %.2f, \"cpu_us\": %lld, \"ns_per_byte\": %.2f}, "
+                            "\"streamed\": {\"responses\": %lld, \"in_bytes\": %lld, \"out_bytes\": %lld, "
+                            "\"ratio\": %.2f, \"cpu_us\": %lld, \"ns_per_byte\": %.2f}, "
+                            "\"inflated\": {\"count\": %lld, \"cpu_us\": %lld}}",
+                 __atomic_load_n(&compress_level, __ATOMIC_RELAXED),
+                 __atomic_load_n(&compress_min_size, __ATOMIC_RELAXED),
+                 LOAD_STAT(compress_count), in, out, out ? (double) in / out : 0.0, ns / 1000,
+                 in ? (double) ns / in : 0.0,
+                 LOAD_STAT(stream_count), s_in, s_out, s_out ? (double) s_in / s_out : 0.0, s_ns / 1000,
+                 s_in ? (double) s_ns / s_in : 0.0,
+                 LOAD_STAT(decompress_count), LOAD_STAT(decompress_ns) / 1000);
+    return n < size ? n : size - 1;
+}
@@ -0,0 +1,47 @@
+/*
+ * compress.h - 텍스트 응답의 gzip 압축/해제 (캐시에 저장할 객체와 client 로 흘려보내는 응답)
+ */
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include "csapp.h"
+#include "config.h"
+
+#define COMPRESS_LEVEL 1        /* 기본 zlib 압축 레벨 (gzip_level), 요청 경로에서 압축하므로 속도 우선 */
+#define COMPRESS_MIN_SIZE 256   /* 기본 최소 크기 (gzip_min_size), 이보다 작은 body 는 압축해도 이득이 없음 */
+#define GZIP_STREAM_MEMORY (256 * 1024 + 16384)  /* 흘려보내며 압축하는 응답 하나의 deflate 상태 (window 와 hash) 와 출력 버퍼 */
+
+/* CacheItem->encoding 값 */
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP 1
+
+typedef struct GzipStream GzipStream;
+
+void compress_configure(ProxyConfig *config);
+
+ssize_t response_header_length(char *response, ssize_t size);
+
+int is_compressible(char *header, ssize_t header_size);
+
+int should_compress(char *header, ssize_t header_size, long long body_size);
+
+int accepts_gzip(char *request_header);
+
+ssize_t gzip_body(char *src, ssize_t src_size, char *dst, ssize_t dst_size);
+
+ssize_t render_response(char *stored, ssize_t stored_size, ssize_t header_size, int encoding,
+                        int accept_gzip, char *out, ssize_t out_size);
+
+size_t gzip_etag(char *line, size_t len, char *out);
+
+GzipStream *gzip_stream_new(void);
+
+ssize_t gzip_stream(GzipStream *gz, char **in, size_t *len, char *out, size_t size, int finish);
+
+void gzip_stream_free(GzipStream *gz);
+
+void compress_report(void);
+
+ssize_t compress_render(char *buf, ssize_t size);
+
+#endif /* __COMPRESS_H__ */
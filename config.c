@@ -0,0 +1,509 @@
+/*
+ * config.c - 실행 중에 다시 읽을 수 있는 proxy 설정
+ *
+ * 설정 파일 형식은 한 줄에 하나씩 "key = value", '#' 뒤는 주석이다.
+ * 크기 값에는 K/M/G 접미사를 쓸 수 있다.
+ *
+ *     cache_size = 4M
+ *     object_size = 100K
+ *     listen_queue = 1024
+ *     relay_buffer_size = 64K
+ *     relay_spill_size = 0
+ *     request_body_size = 1M
+ *     gzip = 1
+ *     gzip_level = 1
+ *     gzip_min_size = 256
+ *     cache = 1
+ *     sort_query = 0
+ *     negative_ttl_4xx = 10
+ *     negative_ttl_5xx = 2
+ *     connect_fail_ttl = 5
+ *     trace_sample = 0
+ *     slow_request_ms = 1000
+ *     header_timeout_ms = 10000
+ *     connect_timeout_ms = 5000
+ *     connect_attempt_delay_ms = 250
+ *     connect_attempt_timeout_ms = 2000
+ *     first_byte_timeout_ms = 30000
+ *     idle_timeout_ms = 30000
+ *     request_timeout_ms = 0
+ *     memory_budget = 0
+ *     thread_stack_size = 512K
+ *     access_log_segment_size = 64M
+ *     access_log_segments = 16
+ *     health_check_interval_ms = 2000
+ *     health_check_timeout_ms = 1000
+ *     upstream_max_fails = 3
+ *     upstream_fail_timeout = 10
+ *     max_connections = 0
+ *     shed_queue_ms = 0
+ *     concurrency_target_ms = 0
+ *     concurrency_limit_min = 8
+ *     concurrency_limit_max = 256
+ *     tcp_nodelay = 1
+ *     tcp_defer_accept = 0
+ *     tcp_fastopen = 0
+ *     tcp_quickack = 0
+ *     tcp_notsent_lowat = 0
+ *     client_rcvbuf = 0
+ *     client_sndbuf = 0
+ *     upstream_rcvbuf = 0
+ *     upstream_sndbuf = 0
+ *     h2c = 1
+ *     h2_max_streams = 100
+ *     prefetch = 0
+ *     prefetch_concurrency = 4
+ *     prefetch_budget = 1M
+ *     predict = 0
+ *     predict_threshold = 50
+ *     predict_half_life = 600
+ *     user_agent = Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3
+ *     disk_cache_dir = ./.disk_cache
+ *     trace_file = ./proxy-trace.json
+ *     access_log_dir =
+ *     health_check_path = /
+ *     upstream = backend p2c 127.0.0.1:8001 127.0.0.1:8002
+ *
+ * upstream 은 여러 번 적을 수 있고, 한 줄이 group 하나다.
+ * 명령행의 -o key=value 는 파일보다 나중에 적용되며, reload 할 때도 매번 다시 적용된다.
+ * 새 설정은 파일 전체를 읽고 검증까지 끝난 뒤에만 교체되므로, 잘못된 파일로 reload 하면
+ * 이전 설정이 그대로 유지된다.
+ */
+#include "config.h"
+#include "cache.h"
+#include "disk_cache.h"
+#include "trace.h"
+#include "memory.h"
+#include "accesslog.h"
+#include "upstream.h"
+#include "h2.h"
+#include "prefetch.h"
+
+static ProxyConfig *current_config = NULL;
+static sem_t config_mutex;
+static int config_initialized = 0;
+
+static char config_path[MAXLINE];
+static char *overrides[CONFIG_MAX_OVERRIDES];
+static int override_count = 0;
+
+
+static void config_defaults(ProxyConfig *config) {
+    config->cache_size = MAX_CACHE_SIZE;
+    config->object_size = MAX_OBJECT_SIZE;
+    config->listen_queue = LISTENQ;
+    config->relay_buffer_size = DEFAULT_RELAY_BUFFER_SIZE;
+    config->relay_spill_size = 0;
+    config->request_body_size = 1024 * 1024;
+    config->cache = 1;
+    config->sort_query = 0;
+    config->negative_ttl_4xx = 10;
+    config->negative_ttl_5xx = 2;
+    config->connect_fail_ttl = 5;
+    config->gzip = 1;
+    config->gzip_level = COMPRESS_LEVEL;
+    config->gzip_min_size = COMPRESS_MIN_SIZE;
+    config->trace_sample = 0;
+    config->slow_request_ms = 1000;
+    config->header_timeout_ms = 10000;
+    config->connect_timeout_ms = 5000;
+    config->connect_attempt_delay_ms = 250;
+    config->connect_attempt_timeout_ms = 2000;
+    config->first_byte_timeout_ms = 30000;
+    config->idle_timeout_ms = 30000;
+    config->request_timeout_ms = 0;
+    config->memory_budget = 0;
+    config->thread_stack_size = DEFAULT_THREAD_STACK_SIZE;
+    config->access_log_segment_size = DEFAULT_ACCESSLOG_SEGMENT_SIZE;
+    config->access_log_segments = DEFAULT_ACCESSLOG_SEGMENTS;
+    strcpy(config->user_agent, DEFAULT_USER_AGENT);
+    strcpy(config->disk_cache_dir, DISK_CACHE_DIR);
+    strcpy(config->trace_file, DEFAULT_TRACE_FILE);
+    config->access_log_dir[0] = '\0';
+    config->health_check_interval_ms = 2000;
+    config->health_check_timeout_ms = 1000;
+    config->upstream_max_fails = 3;
+    config->upstream_fail_timeout = 10;
+    config->max_connections = 0;
+    config->shed_queue_ms = 0;
+    config->concurrency_target_ms = 0;
+    config->concurrency_limit_min = 8;
+    config->concurrency_limit_max = 256;
+    config->tcp_nodelay = 1;
+    config->tcp_defer_accept = 0;
+    config->tcp_fastopen = 0;
+    config->tcp_quickack = 0;
+    config->tcp_notsent_lowat = 0;
+    config->client_rcvbuf = config->client_sndbuf = 0;
+    config->upstream_rcvbuf = config->upstream_sndbuf = 0;
+    config->h2c = 1;
+    config->h2_max_streams = 100;
+    config->prefetch = 0;
+    config->prefetch_concurrency = 4;
+    config->prefetch_budget = 1024 * 1024;
+    config->predict = 0;
+    config->predict_threshold = 50;
+    config->predict_half_life = 600;
+    strcpy(config->health_check_path, "/");
+    config->upstream_count = 0;
+    config->refs = 0;
+}
+
+// 앞뒤 공백을 잘라주는 함수
+static char *trim(char *s) {
+    char *end;
+
+    while (isspace((unsigned char) *s)) {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+// "100K", "4M" 같은 크기 값을 읽어주는 함수, 잘못된 값이면 -1
+static long long parse_size(char *value) {
+    char *end;
+    long long n = strtoll(value, &end, 10);
+
+    if (end == value || n < 0) {
+        return -1;
+    }
+    switch (toupper((unsigned char) *end)) {
+        case 'K': n *= 1024; end++; break;
+        case 'M': n *= 1024 * 1024; end++; break;
+        case 'G': n *= 1024LL * 1024 * 1024; end++; break;
+    }
+    return *trim(end) == '\0' ? n : -1;
+}
+
+// key 하나를 설정에 반영하는 함수, 모르는 key 이거나 값이 잘못되었으면 -1
+static int config_set(ProxyConfig *config, char *key, char *value) {
+    long long n;
+
+    if (!strcmp(key, "user_agent")) {
+        if (strlen(value) >= MAXLINE) return -1;
+        strcpy(config->user_agent, value);
+        return 0;
+    }
+    if (!strcmp(key, "disk_cache_dir")) {
+        if (strlen(value) >= MAXLINE) return -1;
+        strcpy(config->disk_cache_dir, value);
+        return 0;
+    }
+    if (!strcmp(key, "trace_file")) {
+        if (strlen(value) >= MAXLINE) return -1;
+        strcpy(config->trace_file, value);
+        return 0;
+    }
+    if (!strcmp(key, "access_log_dir")) {
+        if (strlen(value) >= MAXLINE) return -1;
+        strcpy(config->access_log_dir, value);
+        return 0;
+    }
+    if (!strcmp(key, "health_check_path")) {
+        if (strlen(value) >= MAXLINE) return -1;
+        strcpy(config->health_check_path, value);
+        return 0;
+    }
+    if (!strcmp(key, "upstream")) {
+        if (strlen(value) >= MAXLINE || config->upstream_count == CONFIG_MAX_UPSTREAMS) return -1;
+        strcpy(config->upstreams[config->upstream_count++], value);
+        return 0;
+    }
+
+    if ((n = parse_size(value)) < 0) {
+        return -1;
+    }
+    if (!strcmp(key, "cache_size")) {
+        config->cache_size = n;
+    } else if (!strcmp(key, "object_size")) {
+        config->object_size = n;
+    } else if (!strcmp(key, "listen_queue")) {
+        config->listen_queue = n;
+    } else if (!strcmp(key, "relay_buffer_size")) {
+        config->relay_buffer_size = n;
+    } else if (!strcmp(key, "relay_spill_size")) {
+        config->relay_spill_size = n;
+    } else if (!strcmp(key, "request_body_size")) {
+        config->request_body_size = n;
+    } else if (!strcmp(key, "cache")) {
+        config->cache = n != 0;
+    } else if (!strcmp(key, "sort_query")) {
+        config->sort_query = n != 0;
+    } else if (!strcmp(key, "negative_ttl_4xx")) {
+        config->negative_ttl_4xx = n;
+    } else if (!strcmp(key, "negative_ttl_5xx")) {
+        config->negative_ttl_5xx = n;
+    } else if (!strcmp(key, "connect_fail_ttl")) {
+        config->connect_fail_ttl = n;
+    } else if (!strcmp(key, "trace_sample")) {
+        config->trace_sample = n;
+    } else if (!strcmp(key, "slow_request_ms")) {
+        config->slow_request_ms = n;
+    } else if (!strcmp(key, "header_timeout_ms")) {
+        config->header_timeout_ms = n;
+    } else if (!strcmp(key, "connect_timeout_ms")) {
+        config->connect_timeout_ms = n;
+    } else if (!strcmp(key, "connect_attempt_delay_ms")) {
+        config->connect_attempt_delay_ms = n;
+    } else if (!strcmp(key, "connect_attempt_timeout_ms")) {
+        config->connect_attempt_timeout_ms = n;
+    } else if (!strcmp(key, "first_byte_timeout_ms")) {
+        config->first_byte_timeout_ms = n;
+    } else if (!strcmp(key, "idle_timeout_ms")) {
+        config->idle_timeout_ms = n;
+    } else if (!strcmp(key, "request_timeout_ms")) {
+        config->request_timeout_ms = n;
+    } else if (!strcmp(key, "memory_budget")) {
+        config->memory_budget = n;
+    } else if (!strcmp(key, "thread_stack_size")) {
+        config->thread_stack_size = n;
+    } else if (!strcmp(key, "access_log_segment_size")) {
+        config->access_log_segment_size = n;
+    } else if (!strcmp(key, "access_log_segments")) {
+        config->access_log_segments = n;
+    } else if (!strcmp(key, "health_check_interval_ms")) {
+        config->health_check_interval_ms = n;
+    } else if (!strcmp(key, "health_check_timeout_ms")) {
+        config->health_check_timeout_ms = n;
+    } else if (!strcmp(key, "upstream_max_fails")) {
+        config->upstream_max_fails = n;
+    } else if (!strcmp(key, "upstream_fail_timeout")) {
+        config->upstream_fail_timeout = n;
+    } else if (!strcmp(key, "max_connections")) {
+        config->max_connections = n;
+    } else if (!strcmp(key, "shed_queue_ms")) {
+        config->shed_queue_ms = n;
+    } else if (!strcmp(key, "concurrency_target_ms")) {
+        config->concurrency_target_ms = n;
+    } else if (!strcmp(key, "concurrency_limit_min")) {
+        config->concurrency_limit_min = n;
+    } else if (!strcmp(key, "concurrency_limit_max")) {
+        config->concurrency_limit_max = n;
+    } else if (!strcmp(key, "tcp_nodelay")) {
+        config->tcp_nodelay = n != 0;
+    } else if (!strcmp(key, "tcp_defer_accept")) {
+        config->tcp_defer_accept = n;
+    } else if (!strcmp(key, "tcp_fastopen")) {
+        config->tcp_fastopen = n;
+    } else if (!strcmp(key, "tcp_quickack")) {
+        config->tcp_quickack = n != 0;
+    } else if (!strcmp(key, "tcp_notsent_lowat")) {
+        config->tcp_notsent_lowat = n;
+    } else if (!strcmp(key, "client_rcvbuf")) {
+        config->client_rcvbuf = n;
+    } else if (!strcmp(key, "client_sndbuf")) {
+        config->client_sndbuf = n;
+    } else if (!strcmp(key, "upstream_rcvbuf")) {
+        config->upstream_rcvbuf = n;
+    } else if (!strcmp(key, "upstream_sndbuf")) {
+        config->upstream_sndbuf = n;
+    } else if (!strcmp(key, "gzip")) {
+        config->gzip = n != 0;
+    } else if (!strcmp(key, "gzip_level")) {
+        config->gzip_level = n;
+    } else if (!strcmp(key, "gzip_min_size")) {
+        config->gzip_min_size = n;
+    } else if (!strcmp(key, "h2c")) {
+        config->h2c = n != 0;
+    } else if (!strcmp(key, "h2_max_streams")) {
+        config->h2_max_streams = n;
+    } else if (!strcmp(key, "prefetch")) {
+        config->prefetch = n != 0;
+    } else if (!strcmp(key, "prefetch_concurrency")) {
+        config->prefetch_concurrency = n;
+    } else if (!strcmp(key, "prefetch_budget")) {
+        config->prefetch_budget = n;
+    } else if (!strcmp(key, "predict")) {
+        config->predict = n != 0;
+    } else if (!strcmp(key, "predict_threshold")) {
+        config->predict_threshold = n;
+    } else if (!strcmp(key, "predict_half_life")) {
+        config->predict_half_life = n;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// "key = value" 한 줄을 반영하는 함수
+static int config_apply_line(ProxyConfig *config, char *line, char *origin, int lineno) {
+    char tmp[MAXLINE], *eq, *comment;
+
+    snprintf(tmp, sizeof(tmp), "%s", line);
+    if ((comment = strchr(tmp, '#')) != NULL) {
+        *comment = '\0';
+    }
+    if (*trim(tmp) == '\0') {
+        return 0;
+    }
+    if ((eq = strchr(tmp, '=')) == NULL) {
+        fprintf(stderr, "%s:%d: expected key = value\n", origin, lineno);
+        return -1;
+    }
+    *eq = '\0';
+    if (config_set(config, trim(tmp), trim(eq + 1)) < 0) {
+        fprintf(stderr, "%s:%d: invalid setting '%s'\n", origin, lineno, trim(tmp));
+        return -1;
+    }
+    return 0;
+}
+
+static int config_validate(ProxyConfig *config) {
+    UpstreamSpec spec, other;
+    int i, j;
+
+    if (config->object_size <= 0 || config->cache_size < config->object_size) {
+        fprintf(stderr, "config: object_size must be positive and not larger than cache_size\n");
+        return -1;
+    }
+    if (config->listen_queue <= 0) {
+        fprintf(stderr, "config: listen_queue must be positive\n");
+        return -1;
+    }
+    if (config->request_body_size <= 0) {
+        fprintf(stderr, "config: request_body_size must be positive\n");
+        return -1;
+    }
+    if (config->relay_buffer_size < 512 || config->relay_buffer_size > (1 << 24)) {
+        fprintf(stderr, "config: relay_buffer_size must be between 512 and 16M\n");
+        return -1;
+    }
+    if (config->thread_stack_size < MIN_THREAD_STACK_SIZE) {
+        fprintf(stderr, "config: thread_stack_size must be at least %dK\n", MIN_THREAD_STACK_SIZE / 1024);
+        return -1;
+    }
+    if (config->access_log_segment_size < 64 * 1024) {
+        fprintf(stderr, "config: access_log_segment_size must be at least 64K\n");
+        return -1;
+    }
+    if (config->concurrency_limit_min < 1 || config->concurrency_limit_max < config->concurrency_limit_min) {
+        fprintf(stderr, "config: concurrency_limit_min must be positive and not larger than concurrency_limit_max\n");
+        return -1;
+    }
+    if (config->client_rcvbuf > (1 << 30) || config->client_sndbuf > (1 << 30)
+        || config->upstream_rcvbuf > (1 << 30) || config->upstream_sndbuf > (1 << 30)
+        || config->tcp_notsent_lowat > (1 << 30)) {
+        fprintf(stderr, "config: socket buffer sizes must be at most 1G\n");
+        return -1;
+    }
+    if (config->gzip_level < 1 || config->gzip_level > 9) {
+        fprintf(stderr, "config: gzip_level must be between 1 and 9\n");
+        return -1;
+    }
+    if (config->h2_max_streams < 1 || config->h2_max_streams > H2_MAX_STREAMS) {
+        fprintf(stderr, "config: h2_max_streams must be between 1 and %d\n", H2_MAX_STREAMS);
+        return -1;
+    }
+    if (config->prefetch_concurrency < 1 || config->prefetch_concurrency > PREFETCH_MAX_WORKERS) {
+        fprintf(stderr, "config: prefetch_concurrency must be between 1 and %d\n", PREFETCH_MAX_WORKERS);
+        return -1;
+    }
+    if (config->prefetch_budget <= 0) {
+        fprintf(stderr, "config: prefetch_budget must be positive\n");
+        return -1;
+    }
+    if (config->predict_threshold < 1 || config->predict_threshold > 100) {
+        fprintf(stderr, "config: predict_threshold must be between 1 and 100\n");
+        return -1;
+    }
+    if (config->predict_half_life <= 0) {
+        fprintf(stderr, "config: predict_half_life must be positive\n");
+        return -1;
+    }
+    for (i = 0; i < config->upstream_count; i++) {
+        if (upstream_parse(config->upstreams[i], &spec) < 0) {
+            fprintf(stderr, "config: upstream must be '<name> [round_robin|least_conn|p2c] <host:port>...' "
+                            "with at most %d servers: %s\n", UPSTREAM_MAX_SERVERS, config->upstreams[i]);
+            return -1;
+        }
+        for (j = 0; j < i; j++) {
+            upstream_parse(config->upstreams[j], &other);
+            if (!strcasecmp(spec.name, other.name)) {
+                fprintf(stderr, "config: upstream %s is defined twice\n", spec.name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// 설정 파일 경로 지정, 지정하지 않으면 기본값과 명령행 값만 사용한다
+void config_set_path(char *path) {
+    snprintf(config_path, sizeof(config_path), "%s", path);
+}
+
+// 명령행의 -o key=value 를 등록하는 함수
+int config_add_override(char *assignment) {
+    if (override_count == CONFIG_MAX_OVERRIDES || strchr(assignment, '=') == NULL) {
+        return -1;
+    }
+    overrides[override_count++] = assignment;
+    return 0;
+}
+
+// 기본값 -> 설정 파일 -> 명령행 순서로 새 설정을 만들고, 문제가 없으면 현재 설정과 교체하는 함수
+int config_load(void) {
+    ProxyConfig *config = (ProxyConfig *) malloc(sizeof(ProxyConfig)), *old;
+    char line[MAXLINE];
+    FILE *fp;
+    int i, lineno = 0, rc = 0;
+
+    if (!config_initialized) {
+        Sem_init(&config_mutex, 0, 1);
+        config_initialized = 1;
+    }
+
+    config_defaults(config);
+    if (config_path[0] != '\0') {
+        if ((fp = fopen(config_path, "r")) == NULL) {
+            fprintf(stderr, "config: cannot open %s: %s\n", config_path, strerror(errno));
+            free(config);
+            return -1;
+        }
+        while (rc == 0 && fgets(line, MAXLINE, fp) != NULL) {
+            rc = config_apply_line(config, line, config_path, ++lineno);
+        }
+        fclose(fp);
+    }
+    for (i = 0; rc == 0 && i < override_count; i++) {
+        rc = config_apply_line(config, overrides[i], "-o", i + 1);
+    }
+    if (rc < 0 || config_validate(config) < 0) {
+        free(config);
+        return -1;
+    }
+
+    // 교체는 포인터 하나만 바꾸므로, 요청들은 이전 설정이나 새 설정 중 하나만 온전히 보게 된다
+    config->refs = 1;   // current_config 자신이 가진 참조
+    P(&config_mutex);
+    old = current_config;
+    current_config = config;
+    if (old != NULL && --old->refs == 0) {
+        free(old);
+    }
+    V(&config_mutex);
+    return 0;
+}
+
+// 현재 설정을 가져오는 함수, 다 쓰고 나면 config_release 로 돌려줘야 한다
+ProxyConfig *config_acquire(void) {
+    ProxyConfig *config;
+
+    P(&config_mutex);
+    config = current_config;
+    config->refs++;
+    V(&config_mutex);
+    return config;
+}
+
+void config_release(ProxyConfig *config) {
+    P(&config_mutex);
+    if (--config->refs == 0) {
+        free(config);
+    }
+    V(&config_mutex);
+}
@@ -0,0 +1,87 @@
+/*
+ * config.h - 실행 중에 다시 읽을 수 있는 proxy 설정
+ */
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include "csapp.h"
+
+#define CONFIG_MAX_OVERRIDES 64
+#define CONFIG_MAX_UPSTREAMS 16     /* upstream 줄 (group) 의 최대 개수 */
+#define DEFAULT_RELAY_BUFFER_SIZE 65536
+#define DEFAULT_USER_AGENT "Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3"
+
+// 설정 한 벌, 한 번 만들어진 뒤에는 바뀌지 않는다
+// reload 시에는 새 ProxyConfig 를 만들어 통째로 교체하고, 이전 것은 마지막 사용자가 놓을 때 free 된다.
+typedef struct ProxyConfig {
+    ssize_t cache_size;         // RAM 캐시 용량 (reload 시 즉시 반영, 초과분은 점진적으로 밀어냄)
+    ssize_t object_size;        // 캐시할 수 있는 객체 하나의 최대 크기
+    int listen_queue;           // listen() backlog
+    int relay_buffer_size;      // origin 응답을 client 로 중계할 때 연결마다 두는 버퍼 크기 (relay.c 참고)
+    long long relay_spill_size; // relay 버퍼가 가득 찼을 때 임시 파일에 더 받아둘 수 있는 크기, 0 이면 사용 안 함
+    ssize_t request_body_size;  // client 가 보내는 요청 body 의 최대 크기 (chunked 는 푼 크기), 넘으면 413
+    int gzip;                   // gzip 을 받는 client 에게 텍스트 응답을 보내면서 압축 (compress.c)
+    int gzip_level;             // zlib 압축 레벨 (1~9), 캐시에 넣을 때와 보내면서 압축할 때 모두
+    ssize_t gzip_min_size;      // body 가 이보다 작은 응답은 압축하지 않음 (길이를 모르는 응답은 압축)
+    int cache;                  // 0 이면 RAM, disk, negative cache 를 찾지도 저장하지도 않음 (cache miss 측정용)
+    int sort_query;             // 캐시 key 를 만들 때 query parameter 를 정렬할지 여부
+    int negative_ttl_4xx;       // 404/405/410/414 응답을 기억하는 시간(초), 0 이면 사용 안 함
+    int negative_ttl_5xx;       // 5xx 응답을 기억하는 시간(초)
+    int connect_fail_ttl;       // connect 에 실패한 origin 으로 다시 연결하지 않는 시간(초)
+    int trace_sample;           // N 개 요청 중 하나를 trace_file 에 기록, 0 이면 기록하지 않음
+    int slow_request_ms;        // 이보다 오래 걸린 요청은 단계별 시간을 stderr 로 출력, 0 이면 사용 안 함
+    int header_timeout_ms;      // client 가 요청 header 를 다 보내야 하는 시간, 넘으면 408 (0 이면 사용 안 함)
+    int connect_timeout_ms;     // origin 에 connect 하는 시간, 넘으면 504
+    int connect_attempt_delay_ms;   // origin 의 다음 주소로 connect 를 하나 더 걸기까지 기다리는 시간 (happy_eyeballs.c)
+    int connect_attempt_timeout_ms; // 주소 하나에 대한 connect 를 포기하는 시간, 0 이면 connect_timeout_ms 까지 기다림
+    int first_byte_timeout_ms;  // origin 에 요청을 보내고 첫 바이트를 받을 때까지의 시간, 넘으면 504
+    int idle_timeout_ms;        // origin 응답을 받는 중 read 사이의 최대 간격
+    int request_timeout_ms;     // accept 부터 응답을 다 보낼 때까지의 전체 시간 (0 이면 사용 안 함)
+    long long memory_budget;    // 프로세스 전체 메모리 예산, 0 이면 제한 없음 (memory.c 참고)
+    ssize_t thread_stack_size;  // deliver thread 하나의 stack 크기, 새 연결부터 적용
+    long long access_log_segment_size; // access log segment 하나의 최대 크기 (시작 시에만 적용)
+    int access_log_segments;    // 남겨둘 access log segment 수, 0 이면 지우지 않음 (시작 시에만 적용)
+    int health_check_interval_ms; // upstream server 에 health check 를 보내는 간격
+    int health_check_timeout_ms;  // health check 응답을 기다리는 시간, 넘으면 unhealthy
+    int upstream_max_fails;     // 연속으로 이만큼 실패한 upstream server 는 잠시 뺀다, 0 이면 빼지 않음
+    int upstream_fail_timeout;  // 실패로 뺀 server 를 다시 쓰기까지의 시간(초)
+    int max_connections;        // 동시에 열어둘 수 있는 최대 연결 수, 넘으면 accept 하자마자 503 (0 이면 제한 없음)
+    int shed_queue_ms;          // accept 부터 thread 시작까지 이보다 오래 기다린 cache miss 는 503 (0 이면 사용 안 함)
+    int concurrency_target_ms;  // origin 첫 바이트까지의 목표 지연, 동시 실행 limit 을 이에 맞춰 조절 (0 이면 사용 안 함)
+    int concurrency_limit_min, concurrency_limit_max;   // origin 으로 가는 요청의 동시 실행 limit 범위 (admission.c)
+    int tcp_nodelay;            // listener (accept 한 socket 이 물려받음) 와 upstream socket 의 TCP_NODELAY
+    int tcp_defer_accept;       // 요청이 도착할 때까지 accept 를 미루는 최대 시간(초), 0 이면 사용 안 함
+    int tcp_fastopen;           // listener 의 TCP Fast Open 대기열 길이, 0 이면 사용 안 함
+    int tcp_quickack;           // client/upstream socket 에서 ACK 을 미루지 않음
+    int tcp_notsent_lowat;      // client socket 의 TCP_NOTSENT_LOWAT (바이트), 0 이면 커널 기본값
+    int client_rcvbuf, client_sndbuf;       // client socket 의 SO_RCVBUF/SO_SNDBUF, 0 이면 커널 자동 조절
+    int upstream_rcvbuf, upstream_sndbuf;   // upstream socket 의 SO_RCVBUF/SO_SNDBUF, 0 이면 커널 자동 조절
+    int h2c;                    // prior knowledge 나 "Upgrade: h2c" 로 오는 HTTP/2 연결을 받음 (h2.c)
+    int h2_max_streams;         // h2 연결 하나에서 동시에 열 수 있는 stream 수, 넘으면 REFUSED_STREAM
+    int prefetch;               // 캐시할 수 있는 HTML 응답의 src/href 를 미리 캐시에 넣음 (prefetch.c)
+    int prefetch_concurrency;   // 동시에 prefetch 하는 수 (worker thread 수)
+    long long prefetch_budget;  // HTML 페이지 하나 때문에 prefetch 로 받을 수 있는 바이트
+    int predict;                // client 별 요청 순서에서 다음 URL 을 배워 미리 캐시에 넣음 (predict.c)
+    int predict_threshold;      // 다음에 올 확률이 이 % 이상인 URL 만 prefetch
+    int predict_half_life;      // 배운 전이 수가 절반이 되는 시간 (초)
+    char user_agent[MAXLINE];   // server 로 보내는 User-Agent 값
+    char disk_cache_dir[MAXLINE]; // disk cache 위치, 빈 문자열이면 사용 안 함 (시작 시에만 적용)
+    char trace_file[MAXLINE];   // trace log 위치 (시작 시에만 적용)
+    char access_log_dir[MAXLINE]; // binary access log 위치, 빈 문자열이면 사용 안 함 (시작 시에만 적용)
+    char health_check_path[MAXLINE]; // upstream server 에 HEAD 로 확인할 path, 빈 문자열이면 health check 안 함
+    char upstreams[CONFIG_MAX_UPSTREAMS][MAXLINE]; // "upstream = ..." 줄의 값 (upstream.c 참고)
+    int upstream_count;
+    int refs;
+} ProxyConfig;
+
+void config_set_path(char *path);
+
+int config_add_override(char *assignment);
+
+int config_load(void);
+
+ProxyConfig *config_acquire(void);
+
+void config_release(ProxyConfig *config);
+
+#endif /* __CONFIG_H__ */
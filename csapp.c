@@ -834,16 +834,27 @@ ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
+/*
+ * proxy: 상대가 먼저 끊었거나 deadline 이 지나서 proxy 가 shutdown 한 연결에서 생기는 에러는
+ * 프로세스를 끝내지 않고, 읽기는 EOF 로, 쓰기는 무시하는 것으로 처리한다
+ */
+static int connection_error(void) {
+    return errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN || errno == ETIMEDOUT;
+}
+
 ssize_t Rio_readn(int fd, void *ptr, size_t nbytes) {
     ssize_t n;
 
-    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
-        unix_error("Rio_readn error");
+    if ((n = rio_readn(fd, ptr, nbytes)) < 0) {
+        if (!connection_error())
+            unix_error("Rio_readn error");
+        n = 0;
+    }
     return n;
 }
 
 void Rio_writen(int fd, void *usrbuf, size_t n) {
-    if (rio_writen(fd, usrbuf, n) != n)
+    if (rio_writen(fd, usrbuf, n) != n && !connection_error())
         unix_error("Rio_writen error");
 }
 
@@ -854,16 +865,22 @@ void Rio_readinitb(rio_t *rp, int fd) {
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
     ssize_t rc;
 
-    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
-        unix_error("Rio_readnb error");
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0) {
+        if (!connection_error())
+            unix_error("Rio_readnb error");
+        rc = 0;
+    }
     return rc;
 }
 
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
     ssize_t rc;
 
-    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
-        unix_error("Rio_readlineb error");
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0) {
+        if (!connection_error())
+            unix_error("Rio_readlineb error");
+        rc = 0;
+    }
     return rc;
 }
 
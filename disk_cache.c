@@ -0,0 +1,500 @@
+/*
+ * disk_cache.c - RAM 캐시에서 밀려난 객체를 보관하는 2차(disk) 캐시
+ *
+ * 구조
+ * - 저장소: dir 아래의 append-only segment 파일들 (00000001.log, 00000002.log, ...)
+ *   각 레코드는 [DiskRecord 헤더][key][value] 순서로 이어 붙여진다.
+ * - 색인: key -> (segment, offset, size) 를 가리키는 메모리 hash table
+ * - 쓰기: put_cache 에서 밀려난 아이템을 대기열에 넣기만 하고, 실제 write 는 writer thread 가 한다.
+ *   대기열이 가득 차 있으면 요청 경로를 막지 않도록 그냥 버린다.
+ * - 용량: DISK_CACHE_SIZE 를 넘으면 가장 오래된 segment 를 통째로 지운다 (FIFO).
+ * - 읽기: 압축되지 않은 객체의 hit 은 sendfile 로 바로 client 에 보내고, 압축된 객체이거나
+ *   DISK_PROMOTE_HITS 번째 hit 이라면 pread 로 읽어서 보내준다. 승격할 때는 RAM 에 있던 형태
+ *   (압축된 상태 그대로) 의 CacheItem 을 만들어 호출한 쪽에 넘겨준다.
+ * - 삭제: purge 는 색인에서 바로 지우고, 재시작 시 되살아나지 않도록 value 가 없는 tombstone 레코드를
+ *   대기열 뒤에 넣는다. writer thread 는 tombstone 을 쓰면서 그 사이에 색인에 들어간 대상도 다시 지운다.
+ */
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include "disk_cache.h"
+#include "stats.h"
+#include "cache_key.h"
+#include "probes.h"
+#include "util.h"
+
+#define DISK_RECORD_MAGIC 0x50525832  /* "PRX2" */
+#define DISK_PURGE_KEY (-1)             /* tombstone 레코드의 encoding: key 와 그 variant 들을 지움 */
+#define DISK_PURGE_PREFIX (-2)          /* tombstone 레코드의 encoding: key 로 시작하는 항목을 모두 지움 */
+
+// segment 파일 안의 레코드 헤더
+typedef struct DiskRecord {
+    uint32_t magic;
+    uint32_t key_len;
+    uint32_t value_len;
+    uint32_t raw_len;
+    uint32_t header_len;
+    uint32_t encoding;
+} DiskRecord;
+
+// 메모리 색인의 한 항목
+typedef struct DiskEntry {
+    char *key;
+    int seg;            // segment id
+    off_t offset;       // segment 안에서 value 가 시작하는 위치
+    ssize_t size;
+    ssize_t raw_size;
+    ssize_t header_size;
+    int encoding;
+    int hits;
+    struct DiskEntry *next;
+} DiskEntry;
+
+// 열려 있는 segment 파일
+typedef struct DiskSegment {
+    int id;
+    int fd;
+    off_t size;
+} DiskSegment;
+
+static int disk_enabled = 0;
+static char disk_dir[MAXLINE];
+
+// 색인과 segment 목록은 index_mutex 로 보호
+static DiskEntry *disk_index[DISK_INDEX_BUCKETS];
+static DiskSegment disk_segments[DISK_MAX_SEGMENTS];
+static int oldest_seg, active_seg;  // 살아있는 segment id 범위 [oldest_seg, active_seg]
+static long long disk_bytes;
+static sem_t index_mutex;
+
+// write-behind 대기열 (CS:APP 의 sbuf 와 같은 구조)
+static CacheItem *demote_queue[DISK_QUEUE_SIZE];
+static int queue_front, queue_rear;
+static sem_t queue_mutex, queue_slots, queue_items;
+
+static void *disk_writer(void *vargp);
+
+
+// FNV-1a 해시
+static unsigned int disk_hash(char *key) {
+    return fnv1a32_str(key) % DISK_INDEX_BUCKETS;
+}
+
+static DiskSegment *segment_of(int id) {
+    return &disk_segments[id % DISK_MAX_SEGMENTS];
+}
+
+static void segment_path(char *path, int id) {
+    sprintf(path, "%s/%08d.log", disk_dir, id);
+}
+
+static DiskEntry **index_find(char *key) {
+    DiskEntry **pp = &disk_index[disk_hash(key)];
+    while (*pp != NULL && strcmp((*pp)->key, key) != 0) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static void index_unlink(DiskEntry **pp) {
+    DiskEntry *e = *pp;
+    *pp = e->next;
+    free(e->key);
+    free(e);
+}
+
+// 색인에 key 를 등록하는 함수, 같은 key 가 있으면 새 위치로 덮어쓴다 (index_mutex 를 잡은 상태에서 호출)
+static void index_put(char *key, int seg, off_t offset, DiskRecord *rec) {
+    DiskEntry **pp = index_find(key);
+    DiskEntry *e = *pp;
+
+    if (e == NULL) {
+        e = (DiskEntry *) malloc(sizeof(DiskEntry));
+        e->key = strdup(key);
+        e->next = NULL;
+        *pp = e;
+    }
+    e->seg = seg;
+    e->offset = offset;
+    e->size = rec->value_len;
+    e->raw_size = rec->raw_len;
+    e->header_size = rec->header_len;
+    e->encoding = rec->encoding;
+    e->hits = 0;
+}
+
+// pattern 에 맞는 색인 항목을 지우고 지운 개수를 반환하는 함수 (index_mutex 를 잡은 상태에서 호출)
+static int index_purge(char *pattern, int prefix) {
+    DiskEntry **pp;
+    int i, n = 0;
+
+    for (i = 0; i < DISK_INDEX_BUCKETS; i++) {
+        pp = &disk_index[i];
+        while (*pp != NULL) {
+            if (cache_key_matches((*pp)->key, pattern, prefix)) {
+                index_unlink(pp);
+                n++;
+            } else {
+                pp = &(*pp)->next;
+            }
+        }
+    }
+    return n;
+}
+
+// 가장 오래된 segment 를 지우고, 그 segment 를 가리키던 색인 항목도 모두 지워주는 함수 (index_mutex 를 잡은 상태에서 호출)
+static void drop_oldest_segment(void) {
+    DiskSegment *seg = segment_of(oldest_seg);
+    DiskEntry **pp;
+    char path[MAXLINE];
+    int i;
+
+    for (i = 0; i < DISK_INDEX_BUCKETS; i++) {
+        pp = &disk_index[i];
+        while (*pp != NULL) {
+            if ((*pp)->seg == oldest_seg) {
+                index_unlink(pp);
+            } else {
+                pp = &(*pp)->next;
+            }
+        }
+    }
+
+    // 이미 dup 해서 sendfile 중인 thread 는 자기 fd 로 계속 읽을 수 있으므로 바로 unlink 해도 된다
+    segment_path(path, seg->id);
+    unlink(path);
+    close(seg->fd);
+    disk_bytes -= seg->size;
+    seg->fd = -1;
+    seg->size = 0;
+    oldest_seg++;
+}
+
+// 새 segment 파일을 열어서 active segment 로 만들어주는 함수 (index_mutex 를 잡은 상태에서 호출)
+static int open_segment(int id) {
+    DiskSegment *seg = segment_of(id);
+    char path[MAXLINE];
+    struct stat st;
+
+    segment_path(path, id);
+    if ((seg->fd = open(path, O_RDWR | O_CREAT | O_APPEND, DEF_MODE)) < 0) {
+        return -1;
+    }
+    fstat(seg->fd, &st);
+    seg->id = id;
+    seg->size = st.st_size;
+    return 0;
+}
+
+// 재시작 시 segment 하나를 처음부터 읽어서 색인을 다시 만들어주는 함수
+// 중간에 깨진 레코드(쓰다가 죽은 경우)를 만나면 그 뒤는 잘라낸다.
+static void rebuild_segment(int id) {
+    DiskSegment *seg = segment_of(id);
+    DiskRecord rec;
+    char key[MAXLINE];
+    off_t offset = 0;
+
+    while (offset + (off_t) sizeof(rec) <= seg->size) {
+        if (pread(seg->fd, &rec, sizeof(rec), offset) != sizeof(rec) ||
+            rec.magic != DISK_RECORD_MAGIC || rec.key_len >= MAXLINE ||
+            offset + (off_t) sizeof(rec) + rec.key_len + rec.value_len > seg->size) {
+            break;
+        }
+        if (pread(seg->fd, key, rec.key_len, offset + sizeof(rec)) != rec.key_len) {
+            break;
+        }
+        key[rec.key_len] = '\0';
+        if ((int) rec.encoding == DISK_PURGE_KEY || (int) rec.encoding == DISK_PURGE_PREFIX) {
+            index_purge(key, (int) rec.encoding == DISK_PURGE_PREFIX);
+        } else {
+            index_put(key, id, offset + sizeof(rec) + rec.key_len, &rec);
+        }
+        offset += sizeof(rec) + rec.key_len + rec.value_len;
+    }
+
+    if (offset < seg->size) {
+        ftruncate(seg->fd, offset);
+        seg->size = offset;
+    }
+}
+
+// disk cache 초기화 함수, dir 에 남아있는 segment 가 있다면 색인을 복구한다
+int disk_cache_init(char *dir) {
+    DIR *dp;
+    struct dirent *ent;
+    int id, first = 0, last = 0;
+    char path[MAXLINE];
+    pthread_t tid;
+
+    strcpy(disk_dir, dir);
+    if (mkdir(disk_dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "disk cache disabled: cannot create %s: %s\n", disk_dir, strerror(errno));
+        return -1;
+    }
+
+    // 남아있는 segment id 범위 확인
+    if ((dp = opendir(disk_dir)) == NULL) {
+        return -1;
+    }
+    while ((ent = readdir(dp)) != NULL) {
+        if (sscanf(ent->d_name, "%d.log", &id) == 1 && id > 0) {
+            if (first == 0 || id < first) first = id;
+            if (id > last) last = id;
+        }
+    }
+    closedir(dp);
+
+    Sem_init(&index_mutex, 0, 1);
+    disk_bytes = 0;
+
+    // 이전 실행 때보다 용량이 줄었을 수 있으므로, ring 에 들어가지 않는 오래된 segment 는 지운다
+    if (first == 0) {
+        first = last = 1;
+    }
+    for (id = first; id <= last - DISK_MAX_SEGMENTS; id++) {
+        segment_path(path, id);
+        unlink(path);
+    }
+    if (first <= last - DISK_MAX_SEGMENTS) {
+        first = last - DISK_MAX_SEGMENTS + 1;
+    }
+
+    oldest_seg = first;
+    for (id = first; id <= last; id++) {
+        if (open_segment(id) < 0) {
+            return -1;
+        }
+        rebuild_segment(id);
+        disk_bytes += segment_of(id)->size;
+    }
+    active_seg = last;
+
+    queue_front = queue_rear = 0;
+    Sem_init(&queue_mutex, 0, 1);
+    Sem_init(&queue_slots, 0, DISK_QUEUE_SIZE);
+    Sem_init(&queue_items, 0, 0);
+
+    disk_enabled = 1;
+    Pthread_create(&tid, NULL, disk_writer, NULL);
+    return 0;
+}
+
+// RAM 캐시에서 밀려난 아이템을 write-behind 대기열에 넣는 함수
+// 아이템의 소유권은 disk cache 로 넘어오며, 요청 경로를 막지 않도록 대기열이 가득 차면 그냥 버린다.
+void disk_cache_demote(CacheItem *item) {
+    if (!disk_enabled || sem_trywait(&queue_slots) < 0) {
+        freeCacheItem(item);
+        return;
+    }
+
+    P(&queue_mutex);
+    demote_queue[(++queue_rear) % DISK_QUEUE_SIZE] = item;
+    V(&queue_mutex);
+    V(&queue_items);
+}
+
+// pattern 에 맞는 항목을 지우고 지운 개수를 반환하는 함수 (cache_key_matches 참고)
+// tombstone 은 버려지면 안 되므로 대기열에 자리가 날 때까지 기다린다
+int disk_cache_purge(char *pattern, int prefix) {
+    CacheItem *tombstone;
+    int n;
+
+    if (!disk_enabled) {
+        return 0;
+    }
+
+    P(&index_mutex);
+    n = index_purge(pattern, prefix);
+    V(&index_mutex);
+
+    tombstone = createCacheItem(pattern, "", 0);
+    tombstone->encoding = prefix ? DISK_PURGE_PREFIX : DISK_PURGE_KEY;
+    P(&queue_slots);
+    P(&queue_mutex);
+    demote_queue[(++queue_rear) % DISK_QUEUE_SIZE] = tombstone;
+    V(&queue_mutex);
+    V(&queue_items);
+    return n;
+}
+
+// 색인의 모든 항목에 대해 fn 을 불러주는 함수, index_mutex 를 잡은 채로 부르므로 fn 은 값만 복사해야 한다
+void disk_cache_foreach(void (*fn)(char *key, ssize_t size, ssize_t raw_size, int hits, void *arg), void *arg) {
+    DiskEntry *e;
+    int i;
+
+    if (!disk_enabled) {
+        return;
+    }
+
+    P(&index_mutex);
+    for (i = 0; i < DISK_INDEX_BUCKETS; i++) {
+        for (e = disk_index[i]; e != NULL; e = e->next) {
+            fn(e->key, e->size, e->raw_size, e->hits, arg);
+        }
+    }
+    V(&index_mutex);
+}
+
+// 아이템 하나를 active segment 끝에 이어 붙이고 색인에 등록하는 함수 (writer thread 전용)
+static void disk_append(CacheItem *item) {
+    DiskRecord rec;
+    DiskSegment *seg;
+    struct iovec iov[3];
+    off_t offset;
+    ssize_t need, n;
+
+    rec.magic = DISK_RECORD_MAGIC;
+    rec.key_len = strlen(item->key);
+    rec.value_len = item->size;
+    rec.raw_len = item->raw_size;
+    rec.header_len = item->header_size;
+    rec.encoding = item->encoding;
+    need = sizeof(rec) + rec.key_len + rec.value_len;
+
+    P(&index_mutex);
+    seg = segment_of(active_seg);
+    // active segment 가 가득 찼으면 다음 segment 로 넘어감
+    if (seg->size + need > DISK_SEGMENT_SIZE) {
+        if (active_seg - oldest_seg + 1 >= DISK_MAX_SEGMENTS) {
+            drop_oldest_segment();
+        }
+        if (open_segment(active_seg + 1) < 0) {
+            V(&index_mutex);
+            return;
+        }
+        active_seg++;
+        seg = segment_of(active_seg);
+    }
+    // 전체 용량을 넘으면 오래된 segment 부터 지움
+    while (disk_bytes + need > DISK_CACHE_SIZE && oldest_seg < active_seg) {
+        drop_oldest_segment();
+    }
+    V(&index_mutex);
+
+    // 실제 disk write 는 lock 없이 진행, 색인에 등록되기 전까지는 아무도 이 영역을 읽지 않는다
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = item->key;
+    iov[1].iov_len = rec.key_len;
+    iov[2].iov_base = item->value;
+    iov[2].iov_len = rec.value_len;
+    offset = seg->size;
+    n = writev(seg->fd, iov, 3);
+
+    P(&index_mutex);
+    if (n == need) {
+        seg->size += need;
+        disk_bytes += need;
+        if (item->encoding == DISK_PURGE_KEY || item->encoding == DISK_PURGE_PREFIX) {
+            index_purge(item->key, item->encoding == DISK_PURGE_PREFIX);
+        } else {
+            index_put(item->key, seg->id, offset + sizeof(rec) + rec.key_len, &rec);
+        }
+    } else if (n > 0) {
+        // 일부만 써졌다면 잘라내서 log 를 깨끗하게 유지
+        ftruncate(seg->fd, offset);
+    }
+    V(&index_mutex);
+}
+
+// write-behind 대기열을 비우는 thread
+static void *disk_writer(void *vargp) {
+    CacheItem *item;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        P(&queue_items);
+        P(&queue_mutex);
+        item = demote_queue[(++queue_front) % DISK_QUEUE_SIZE];
+        V(&queue_mutex);
+        V(&queue_slots);
+
+        disk_append(item);
+        freeCacheItem(item);
+    }
+    return NULL;
+}
+
+// disk cache 에서 key 를 찾아 connfd 로 보내주는 함수, 보냈으면 보낸 바이트 수를, 없으면 -1 을 반환
+// DISK_PROMOTE_HITS 번째 hit 이라면 RAM 으로 올릴 CacheItem 을 만들어 promoted 에 넣어준다 (아니면 NULL)
+// buf 는 client 에게 보낼 response 를 만드는 데 쓰는 buf_size 크기의 버퍼
+ssize_t disk_cache_serve(int connfd, char *key, char *buf, ssize_t buf_size, int accept_gzip, CacheItem **promoted) {
+    DiskEntry **pp, e;
+    char *stored;
+    off_t offset;
+    ssize_t size, n;
+    int fd, promote;
+
+    *promoted = NULL;
+    if (!disk_enabled) {
+        return -1;
+    }
+
+    P(&index_mutex);
+    pp = index_find(key);
+    if (*pp == NULL) {
+        V(&index_mutex);
+        return -1;
+    }
+    // segment 가 지워지더라도 읽을 수 있도록 fd 를 복제해서 lock 밖에서 사용
+    fd = dup(segment_of((*pp)->seg)->fd);
+    e = **pp;
+    promote = ++(*pp)->hits >= DISK_PROMOTE_HITS;
+    V(&index_mutex);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    // 압축되지 않은 객체는 저장된 그대로가 response 이므로 sendfile 로 바로 보냄
+    if (!promote && e.encoding == ENCODING_IDENTITY) {
+        offset = e.offset;
+        size = e.size;
+        while (size > 0) {
+            if ((n = sendfile(connfd, fd, &offset, size)) <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            size -= n;
+        }
+        close(fd);
+        stats_count(STAT_BYTES_CACHE, e.size - size);
+        PROXY_PROBE3(cache_hit, key, e.size - size, "disk");
+        return e.size - size;
+    }
+
+    stored = (char *) malloc(e.size);
+    if (stored == NULL || pread(fd, stored, e.size, e.offset) != e.size ||
+        (size = render_response(stored, e.size, e.header_size, e.encoding, accept_gzip, buf, buf_size)) < 0) {
+        free(stored);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    Rio_writen(connfd, buf, size);
+    stats_count(STAT_BYTES_CACHE, size);
+    PROXY_PROBE3(cache_hit, key, size, "disk");
+
+    if (promote) {
+        *promoted = createCacheItem(key, stored, e.size);
+        (*promoted)->raw_size = e.raw_size;
+        (*promoted)->header_size = e.header_size;
+        (*promoted)->encoding = e.encoding;
+
+        // RAM 에 올릴 복사본이 생긴 뒤에야 색인에서 빼준다, 다시 밀려나면 새 레코드로 기록됨
+        // 읽는 동안 같은 key 가 새 레코드로 바뀌었다면 옛 값은 올리지 않는다
+        P(&index_mutex);
+        pp = index_find(key);
+        if (*pp != NULL && (*pp)->seg == e.seg && (*pp)->offset == e.offset) {
+            index_unlink(pp);
+        } else if (*pp != NULL) {
+            freeCacheItem(*promoted);
+            *promoted = NULL;
+        }
+        V(&index_mutex);
+    }
+    free(stored);
+    return size;
+}
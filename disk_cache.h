@@ -0,0 +1,27 @@
+/*
+ * disk_cache.h - RAM 캐시에서 밀려난 객체를 보관하는 2차(disk) 캐시
+ */
+#ifndef __DISK_CACHE_H__
+#define __DISK_CACHE_H__
+
+#include "cache.h"
+
+#define DISK_CACHE_DIR "./.disk_cache"
+#define DISK_CACHE_SIZE (4LL * 1024 * 1024 * 1024)  /* disk tier 전체 용량 */
+#define DISK_SEGMENT_SIZE (64LL * 1024 * 1024)      /* segment 파일 하나의 최대 크기 */
+#define DISK_MAX_SEGMENTS ((int) (DISK_CACHE_SIZE / DISK_SEGMENT_SIZE) + 1)
+#define DISK_QUEUE_SIZE 256     /* write-behind 대기열 길이 */
+#define DISK_INDEX_BUCKETS 65536
+#define DISK_PROMOTE_HITS 2     /* disk 에서 이만큼 hit 나면 RAM 으로 승격 */
+
+int disk_cache_init(char *dir);
+
+void disk_cache_demote(CacheItem *item);
+
+ssize_t disk_cache_serve(int connfd, char *key, char *buf, ssize_t buf_size, int accept_gzip, CacheItem **promoted);
+
+int disk_cache_purge(char *pattern, int prefix);
+
+void disk_cache_foreach(void (*fn)(char *key, ssize_t size, ssize_t raw_size, int hits, void *arg), void *arg);
+
+#endif /* __DISK_CACHE_H__ */
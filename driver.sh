@@ -8,6 +8,11 @@
 #     updated: 2/8/2016
 # 
 #     usage: ./driver.sh
+#            ./driver.sh --perf [--save-baseline]
+#
+#     --perf runs the performance regression mode instead of the
+#     grading tests (see run_perf below). It needs ./loadgen and is
+#     tuned with the PERF_* variables.
 # 
 
 # Point values
@@ -40,6 +45,26 @@ CACHE_LIST="tiny.c
 # The file we will fetch for various tests
 FETCH_FILE="home.html"
 
+# Performance mode settings (override from the environment)
+PERF_DIR="./.perf"
+PERF_BASELINE=${PERF_BASELINE:-${PERF_DIR}/baseline.json}
+PERF_REQUESTS=${PERF_REQUESTS:-300}         # requests per file measurement
+PERF_DURATION=${PERF_DURATION:-2}           # seconds per scaling step
+PERF_CLIENTS=${PERF_CLIENTS:-"1 2 4 8 16 32 64 128 256"}
+PERF_TOLERANCE=${PERF_TOLERANCE:-0.20}      # allowed relative regression
+PERF_LATENCY_SLACK_MS=${PERF_LATENCY_SLACK_MS:-0.5}  # ignore latency changes below this
+
+perf_mode=0
+save_baseline=0
+for arg in "$@"
+do
+    case ${arg} in
+        --perf) perf_mode=1 ;;
+        --save-baseline) perf_mode=1; save_baseline=1 ;;
+        *) echo "usage: $0 [--perf [--save-baseline]]"; exit 1 ;;
+    esac
+done
+
 #####
 # Helper functions
 #
@@ -132,6 +157,194 @@ function free_port {
 }
 
 
+#####
+# Performance mode helpers
+#
+
+#
+# json_value - print a numeric field of a loadgen JSON report
+# usage: json_value <file> <key>
+#
+function json_value {
+    grep -o "\"$2\": [0-9.]*" $1 | head -1 | awk '{print $2}'
+}
+
+#
+# perf_run - run loadgen and record its rps, p50 and p99 under a metric prefix
+# usage: perf_run <metric_prefix> <loadgen args...>
+#
+function perf_run {
+    prefix=$1
+    shift
+    ./loadgen -T ${TIMEOUT}000 -j ${PERF_DIR}/run.json "$@" > /dev/null
+    if [ $? -ne 0 ]; then
+        echo "   Error: loadgen reported errors for ${prefix}"
+        perf_errors=`expr ${perf_errors} + 1`
+    fi
+    rps=$(json_value ${PERF_DIR}/run.json rps)
+    p50=$(json_value ${PERF_DIR}/run.json p50)
+    p99=$(json_value ${PERF_DIR}/run.json p99)
+    metrics+=("\"${prefix}.rps\": ${rps}" "\"${prefix}.p50_ms\": ${p50}" "\"${prefix}.p99_ms\": ${p99}")
+    printf "   %-36s %10s req/s  p50 %8s ms  p99 %8s ms\n" ${prefix} ${rps} ${p50} ${p99}
+}
+
+#
+# compare_baseline - compare two metric files and print a table. Metrics
+#     ending in .rps or .speedup must not drop by more than the tolerance,
+#     the *_ms latencies must not grow by more than the tolerance plus
+#     PERF_LATENCY_SLACK_MS. Prints the number of regressions last.
+# usage: compare_baseline <baseline> <current>
+#
+function compare_baseline {
+    awk -v tol=${PERF_TOLERANCE} -v slack=${PERF_LATENCY_SLACK_MS} '
+        function parse(line) {
+            if (split(line, f, "\"") < 3) return 0
+            name = f[2]
+            value = f[3]
+            gsub(/[^0-9.]/, "", value)
+            return 1
+        }
+        NR == FNR { if (parse($0)) base[name] = value; next }
+        parse($0) {
+            if (!(name in base)) { printf "   %-40s %12s %12s %8s  new\n", name, "-", value, "-"; next }
+            b = base[name] + 0; c = value + 0
+            change = b > 0 ? (c - b) / b * 100 : 0
+            status = "ok"
+            if (name ~ /\.(rps|speedup)$/) {
+                if (c < b * (1 - tol)) status = "REGRESSED"
+            } else if (c > b * (1 + tol) + slack) {
+                status = "REGRESSED"
+            }
+            if (status != "ok") regressions++
+            printf "   %-40s %12.3f %12.3f %+7.1f%%  %s\n", name, b, c, change, status
+        }
+        END { print regressions + 0 }
+    ' $1 $2
+}
+
+#
+# run_perf - measure direct vs proxied throughput and latency for each
+#     BASIC_LIST file, the cache-hit speedup for each CACHE_LIST file and
+#     how throughput scales with PERF_CLIENTS concurrent clients. Results
+#     go to ${PERF_DIR}/current.json and are compared with the baseline.
+#
+function run_perf {
+    metrics=()
+    perf_errors=0
+    mkdir -p ${PERF_DIR}
+
+    if [ ! -x ./loadgen ]
+    then
+        echo "Building loadgen."
+        make loadgen > /dev/null || exit 1
+    fi
+
+    echo "*** Performance ***"
+
+    tiny_port=$(free_port)
+    echo "Starting tiny on port ${tiny_port}"
+    cd ./tiny
+    ./tiny ${tiny_port} &> /dev/null &
+    tiny_pid=$!
+    cd ${HOME_DIR}
+    wait_for_port_use "${tiny_port}"
+
+    # disk cache and tracing would add noise, so both proxies run without them
+    proxy_port=$(free_port)
+    echo "Starting proxy on port ${proxy_port}"
+    ./proxy -o disk_cache_dir= -o trace_sample=0 ${proxy_port} &> /dev/null &
+    proxy_pid=$!
+    wait_for_port_use "${proxy_port}"
+
+    # a proxy with caching turned off (cache = 0), for the cache-miss path
+    # (object_size stays at its default so misses go through the normal relay)
+    nocache_port=$(free_port)
+    echo "Starting non-caching proxy on port ${nocache_port}"
+    ./proxy -o disk_cache_dir= -o trace_sample=0 -o cache=0 ${nocache_port} &> /dev/null &
+    nocache_pid=$!
+    wait_for_port_use "${nocache_port}"
+
+    echo "Direct vs proxied (cache warm), ${PERF_REQUESTS} sequential requests per file"
+    for file in ${BASIC_LIST}
+    do
+        url="http://localhost:${tiny_port}/${file}"
+        perf_run "basic.${file}.direct" -c 1 -n ${PERF_REQUESTS} ${url}
+        ./loadgen -c 1 -n 2 -x localhost:${proxy_port} ${url} > /dev/null
+        perf_run "basic.${file}.proxy" -c 1 -n ${PERF_REQUESTS} -x localhost:${proxy_port} ${url}
+    done
+
+    echo "Cache hit vs miss"
+    for file in ${CACHE_LIST}
+    do
+        url="http://localhost:${tiny_port}/${file}"
+        perf_run "cache.${file}.miss" -c 1 -n ${PERF_REQUESTS} -x localhost:${nocache_port} ${url}
+        miss=${p50}
+        perf_run "cache.${file}.hit" -c 1 -n ${PERF_REQUESTS} -x localhost:${proxy_port} ${url}
+        speedup=`awk -v m=${miss} -v h=${p50} 'BEGIN { printf "%.2f", (h > 0 ? m / h : 0) }'`
+        metrics+=("\"cache.${file}.speedup\": ${speedup}")
+        echo "   cache.${file}.speedup: ${speedup}x"
+    done
+
+    echo "Concurrent clients, ${PERF_DURATION}s per step"
+    urls=""
+    for file in ${CACHE_LIST}
+    do
+        urls="${urls} http://localhost:${tiny_port}/${file}"
+    done
+    for clients in ${PERF_CLIENTS}
+    do
+        threads=$(( clients < 4 ? clients : 4 ))
+        perf_run "scale.c${clients}" -c ${clients} -t ${threads} -d ${PERF_DURATION} -z 1.0 -x localhost:${proxy_port} ${urls}
+    done
+
+    echo "Killing tiny and proxies"
+    kill $tiny_pid $proxy_pid $nocache_pid 2> /dev/null
+    wait $tiny_pid $proxy_pid $nocache_pid 2> /dev/null
+
+    # one metric per line, so the baseline can be diffed and compared with awk
+    (
+        echo "{"
+        last=$(( ${#metrics[@]} - 1 ))
+        for i in ${!metrics[@]}
+        do
+            [ $i -lt $last ] && echo "  ${metrics[$i]}," || echo "  ${metrics[$i]}"
+        done
+        echo "}"
+    ) > ${PERF_DIR}/current.json
+    echo "Results written to ${PERF_DIR}/current.json"
+
+    if [ ${perf_errors} -ne 0 ]; then
+        echo "perfResult: FAIL (${perf_errors} runs had request errors)"
+        exit 1
+    fi
+
+    if [ ${save_baseline} -eq 1 ]; then
+        cp ${PERF_DIR}/current.json ${PERF_BASELINE}
+        echo "Baseline saved to ${PERF_BASELINE}"
+        echo "perfResult: PASS"
+        exit 0
+    fi
+    if [ ! -f ${PERF_BASELINE} ]; then
+        echo "No baseline at ${PERF_BASELINE}; run ./driver.sh --save-baseline to create one"
+        echo "perfResult: PASS"
+        exit 0
+    fi
+
+    echo ""
+    echo "Comparing with ${PERF_BASELINE} (tolerance ${PERF_TOLERANCE}, latency slack ${PERF_LATENCY_SLACK_MS} ms)"
+    printf "   %-40s %12s %12s %8s\n" "metric" "baseline" "current" "change"
+    compare_baseline ${PERF_BASELINE} ${PERF_DIR}/current.json > ${PERF_DIR}/compare.txt
+    head -n -1 ${PERF_DIR}/compare.txt
+    regressions=`tail -n 1 ${PERF_DIR}/compare.txt`
+    if [ ${regressions} -ne 0 ]; then
+        echo "perfResult: FAIL (${regressions} metrics regressed)"
+        exit 1
+    fi
+    echo "perfResult: PASS"
+    exit 0
+}
+
+
 #######
 # Main 
 #######
@@ -142,7 +355,7 @@ function free_port {
 #
 
 # Kill any stray proxies or tiny servers owned by this user
-killall -q proxy tiny nop-server.py 2> /dev/null
+killall -q proxy tiny nop-server.py chunked-server.py 2> /dev/null
 
 # Make sure we have a Tiny directory
 if [ ! -d ./tiny ]
@@ -188,6 +401,13 @@ then
     exit
 fi
 
+# Make sure we have an existing executable chunked-server.py file
+if [ ! -x ./chunked-server.py ]
+then 
+    echo "Error: ./chunked-server.py not found or not an executable file."
+    exit
+fi
+
 # Create the test directories if needed
 if [ ! -d ${PROXY_DIR} ]
 then
@@ -202,6 +422,11 @@ fi
 # Add a handler to generate a meaningful timeout message
 trap 'echo "Timeout waiting for the server to grab the port reserved for it"; kill $$' ALRM
 
+if [ ${perf_mode} -eq 1 ]
+then
+    run_perf
+fi
+
 #####
 # Basic
 #
@@ -400,6 +625,121 @@ wait $proxy_pid 2> /dev/null
 
 echo "cacheScore: $cacheScore/${MAX_CACHE}"
 
+#####
+# Protocol
+#
+# Framing and encoding checks that are not part of the score: a chunked
+# origin response is cached and re-served with a Content-Length, a
+# response cut off before its last chunk is not cached, gzip clients
+# get the compressed copy on a miss and on a hit, and h2c prior-knowledge
+# clients can fetch a page and its image.
+#
+echo ""
+echo "*** Protocol ***"
+
+# Run the Tiny Web server and the chunked server, both serving ./tiny
+tiny_port=$(free_port)
+echo "Starting tiny on port ${tiny_port}"
+cd ./tiny
+./tiny ${tiny_port} &> /dev/null &
+tiny_pid=$!
+cd ${HOME_DIR}
+wait_for_port_use "${tiny_port}"
+
+chunked_port=$(free_port)
+echo "Starting the chunked server on port ${chunked_port}"
+cd ./tiny
+../chunked-server.py ${chunked_port} &> /dev/null &
+chunked_pid=$!
+cd ${HOME_DIR}
+wait_for_port_use "${chunked_port}"
+
+# Run the proxy without the disk cache so nothing survives from earlier runs
+proxy_port=$(free_port)
+echo "Starting proxy on port ${proxy_port}"
+./proxy -o disk_cache_dir= ${proxy_port} &> /dev/null &
+proxy_pid=$!
+wait_for_port_use "${proxy_port}"
+
+protocolRun=0
+protocolSucceeded=0
+
+#
+# protocol_check - count one protocol check and report it
+# usage: protocol_check <status> <description>
+#
+function protocol_check {
+    protocolRun=`expr ${protocolRun} + 1`
+    if [ $1 -eq 0 ]; then
+        protocolSucceeded=`expr ${protocolSucceeded} + 1`
+        echo "   Success: $2"
+    else
+        echo "   Failure: $2"
+    fi
+}
+
+clear_dirs
+echo "Fetching ./tiny/csapp.c from the chunked server using the proxy"
+curl --max-time ${TIMEOUT} --silent --proxy http://localhost:${proxy_port} \
+    --output ${PROXY_DIR}/chunked.c http://localhost:${chunked_port}/csapp.c
+diff -q ./tiny/csapp.c ${PROXY_DIR}/chunked.c &> /dev/null
+protocol_check $? "chunked response relayed intact"
+
+echo "Fetching a truncated chunked response using the proxy"
+curl --max-time ${TIMEOUT} --silent --proxy http://localhost:${proxy_port} \
+    --output /dev/null http://localhost:${chunked_port}/trunc/csapp.c
+
+echo "Fetching ./tiny/csapp.c as a gzip client using the proxy"
+curl --max-time ${TIMEOUT} --silent --compressed --proxy http://localhost:${proxy_port} \
+    --dump-header ${PROXY_DIR}/gzip.head --output ${PROXY_DIR}/gzip.c http://localhost:${tiny_port}/csapp.c
+diff -q ./tiny/csapp.c ${PROXY_DIR}/gzip.c &> /dev/null && grep -qi "^Content-Encoding: gzip" ${PROXY_DIR}/gzip.head
+protocol_check $? "gzip response on a miss"
+
+# curl 7.88 cannot reuse a prior-knowledge connection, so one connection per file
+for file in home.html godzilla.gif
+do
+    echo "Fetching ./tiny/${file} over h2c (prior knowledge) from the proxy"
+    curl --max-time ${TIMEOUT} --silent --http2-prior-knowledge \
+        --connect-to localhost:${tiny_port}:localhost:${proxy_port} \
+        --output ${PROXY_DIR}/h2.${file} http://localhost:${tiny_port}/${file}
+    diff -q ./tiny/${file} ${PROXY_DIR}/h2.${file} &> /dev/null
+    protocol_check $? "h2c fetch of ${file}"
+done
+
+# Kill both origins, so everything from here on must come from the cache
+echo "Killing tiny and the chunked server"
+kill $tiny_pid $chunked_pid 2> /dev/null
+wait $tiny_pid $chunked_pid 2> /dev/null
+
+echo "Fetching a cached copy of the chunked response"
+curl --max-time ${TIMEOUT} --silent --proxy http://localhost:${proxy_port} \
+    --dump-header ${NOPROXY_DIR}/chunked.head --output ${NOPROXY_DIR}/chunked.c \
+    http://localhost:${chunked_port}/csapp.c
+diff -q ./tiny/csapp.c ${NOPROXY_DIR}/chunked.c &> /dev/null && grep -qi "^Content-Length:" ${NOPROXY_DIR}/chunked.head
+protocol_check $? "chunked response cached and re-served with a Content-Length"
+
+echo "Fetching the truncated response again"
+status=`curl --max-time ${TIMEOUT} --silent --proxy http://localhost:${proxy_port} \
+    --output /dev/null --write-out "%{http_code}" http://localhost:${chunked_port}/trunc/csapp.c`
+[ "${status}" != "200" ]
+protocol_check $? "truncated response was not cached"
+
+echo "Fetching a cached copy of ./tiny/csapp.c as a gzip client"
+curl --max-time ${TIMEOUT} --silent --compressed --proxy http://localhost:${proxy_port} \
+    --dump-header ${NOPROXY_DIR}/gzip.head --output ${NOPROXY_DIR}/gzip.c http://localhost:${tiny_port}/csapp.c
+diff -q ./tiny/csapp.c ${NOPROXY_DIR}/gzip.c &> /dev/null && grep -qi "^Content-Encoding: gzip" ${NOPROXY_DIR}/gzip.head
+protocol_check $? "gzip response on a hit"
+
+echo "Killing proxy"
+kill $proxy_pid 2> /dev/null
+wait $proxy_pid 2> /dev/null
+
+if [ ${protocolSucceeded} -eq ${protocolRun} ]; then
+    echo "protocolResult: PASS (${protocolSucceeded}/${protocolRun} checks)"
+else
+    echo "protocolResult: FAIL (${protocolSucceeded}/${protocolRun} checks)"
+fi
+
 # Emit the total score
 totalScore=`expr ${basicScore} + ${cacheScore} + ${concurrencyScore}`
 maxScore=`expr ${MAX_BASIC} + ${MAX_CACHE} + ${MAX_CONCURRENCY}`
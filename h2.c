@@ -0,0 +1,1060 @@
+/*
+ * h2.c - HTTP/2 cleartext (h2c) frontend (RFC 9113)
+ *
+ * client 가 prior knowledge 로 연결 preface 를 보내거나 HTTP/1.1 요청에 "Upgrade: h2c" 를 붙이면
+ * 그 연결은 h2_serve 가 맡는다. session 은 thread 하나가 poll 로 client socket 과 열린 stream 들을 함께 본다.
+ * - stream 마다 socketpair 를 만들어 요청을 HTTP/1.0 요청으로 바꿔 써넣고, 반대쪽 끝을 spawn 으로 넘긴다.
+ *   proxy.c 는 그것을 요청 하나짜리 연결처럼 deliver thread 에서 처리하므로 캐시, upstream, relay, admission 은
+ *   HTTP/1 요청과 똑같이 거친다. 느린 stream 하나가 다른 stream 을 막지 않는다 (head-of-line blocking 없음).
+ * - stream 에서 돌아오는 HTTP/1 응답의 header 는 HEADERS frame 으로, body 는 DATA frame 으로 바꿔 보낸다.
+ *   DATA 는 client 가 준 연결 / stream flow control window 안에서만 보내고, window 가 없으면 그 stream 을
+ *   읽지 않는다. 그러면 relay 의 backpressure 가 그대로 origin 까지 이어진다.
+ * - HEADERS 에 END_STREAM 이 없으면 request body 가 DATA 로 이어진다. DATA 는 받는 대로 socketpair 에 써넣고
+ *   (content-length 가 없으면 chunked 로 감싸서), END_STREAM 에서 쓰는 쪽을 닫는다. deliver 가 HTTP/1 요청처럼
+ *   request_body_size 까지 읽어 origin 으로 보낸다. 받은 만큼 window 를 돌려준다.
+ * - 동시에 열린 stream 이 h2_max_streams 에 닿았거나 spawn 이 거절하면 (admission, memory) REFUSED_STREAM 으로 돌려보낸다.
+ * 열린 stream 이 없는 채로 header_timeout_ms 가 지나면 GOAWAY 를 보내고 연결을 닫는다.
+ */
+#include <poll.h>
+#include "h2.h"
+#include "sockopt.h"
+#include "util.h"
+
+#define MIN_SIZE(a, b) ((a) < (b) ? (a) : (b))
+#define H2_WINDOW_MAX 0x7fffffffLL
+#define H2_DEFAULT_WINDOW 65535
+#define H2_SWITCHING "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"
+
+// frame type
+enum {
+    H2_DATA = 0x0,
+    H2_HEADERS = 0x1,
+    H2_PRIORITY = 0x2,
+    H2_RST_STREAM = 0x3,
+    H2_SETTINGS = 0x4,
+    H2_PUSH_PROMISE = 0x5,
+    H2_PING = 0x6,
+    H2_GOAWAY = 0x7,
+    H2_WINDOW_UPDATE = 0x8,
+    H2_CONTINUATION = 0x9
+};
+
+// frame flag
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIORITY_FLAG 0x20
+
+// SETTINGS 항목
+enum {
+    H2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    H2_SETTINGS_ENABLE_PUSH = 0x2,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    H2_SETTINGS_MAX_FRAME_SIZE = 0x5
+};
+
+// error code
+enum {
+    H2_NO_ERROR = 0x0,
+    H2_PROTOCOL_ERROR = 0x1,
+    H2_INTERNAL_ERROR = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_FRAME_SIZE_ERROR = 0x6,
+    H2_REFUSED_STREAM = 0x7,
+    H2_COMPRESSION_ERROR = 0x9
+};
+
+typedef struct H2Stream {
+    int id;
+    int fd;                     // 이 stream 을 처리하는 deliver thread 와 이어진 socketpair 의 이쪽 끝, 닫았으면 -1
+    long long window;           // 이 stream 으로 더 보낼 수 있는 바이트 (client 의 stream flow control window)
+    long long remaining;        // Content-Length 중 아직 보내지 않은 body, 모르면 -1
+    int head_done;              // 응답 header 를 HEADERS frame 으로 보냈는지
+    int head_only;              // HEAD 요청이라 응답에 body 가 없음
+    int body_open;              // request body 를 아직 다 받지 않음 (socketpair 의 쓰는 쪽이 열려 있음)
+    int body_chunked;           // content-length 없는 body 라서 chunked 로 감싸서 넘김
+    char *buf;                  // 응답 header 를 모으는 버퍼 (H2_HEAD_SIZE), header 와 같이 읽힌 body 도 보낼 때까지 여기 둔다
+    size_t len, off;            // buf 에 있는 바이트와 그중 이미 보낸 위치
+} H2Stream;
+
+typedef struct H2Session {
+    int fd;
+    ProxyConfig *config;
+    int (*spawn)(void *arg, int fd);
+    void *arg;
+    H2Stream streams[H2_MAX_STREAMS];
+    int nstreams;
+    int last_id;                // client 가 연 가장 큰 stream id
+    int served;                 // 연 stream 수
+    long long window;           // 연결 전체의 send window
+    long long initial_window;   // client 의 SETTINGS_INITIAL_WINDOW_SIZE
+    size_t max_frame;           // 보내는 frame payload 의 최대 크기 (client 의 SETTINGS_MAX_FRAME_SIZE 와 H2_FRAME_SIZE 중 작은 것)
+    int goaway;                 // client 가 GOAWAY 를 보냄 (새 stream 은 받지 않고 열린 것만 끝낸다)
+    int error;                  // 연결 에러 code, 0 이 아니면 GOAWAY 를 보내고 끝낸다
+    HpackTable hpack;
+    unsigned char *block;       // HEADERS + CONTINUATION 으로 이어지는 header block (H2_BLOCK_SIZE)
+    size_t block_len;
+    int block_stream;           // CONTINUATION 을 기다리는 stream, 0 이면 기다리지 않음
+    int block_end_stream;
+    unsigned char in[9 + H2_FRAME_SIZE];
+    size_t in_len;
+    unsigned char out[9 + H2_FRAME_SIZE];
+    unsigned char chunk[H2_FRAME_SIZE];
+} H2Session;
+
+// header block 을 HTTP/1.0 요청으로 바꾸는 중간 결과
+typedef struct H2Request {
+    char method[32];
+    char scheme[16];
+    char authority[MAXLINE];
+    char path[MAXLINE];
+    char host[MAXLINE];         // :authority 가 없을 때 대신 쓰는 host header 값
+    char headers[MAXBUF];
+    size_t headers_len;
+    int has_host;
+    int has_length;             // content-length header 가 있음
+    int bad;                    // 잘못되었거나 너무 긴 header, 이 stream 만 PROTOCOL_ERROR 로 닫는다
+} H2Request;
+
+static void put32(unsigned char *p, unsigned int v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static unsigned int get32(unsigned char *p) {
+    return (unsigned int) p[0] << 24 | (unsigned int) p[1] << 16 | (unsigned int) p[2] << 8 | p[3];
+}
+
+// client 로 len 바이트를 다 보내는 함수, client 가 끊겼으면 -1
+static int send_all(int fd, unsigned char *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = send(fd, buf, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// frame 하나를 보내는 함수 (len 은 H2_FRAME_SIZE 이하), 보내지 못하면 -1
+static int send_frame(H2Session *s, int type, int flags, int stream, void *payload, size_t len) {
+    s->out[0] = len >> 16;
+    s->out[1] = len >> 8;
+    s->out[2] = len;
+    s->out[3] = type;
+    s->out[4] = flags;
+    put32(s->out + 5, stream & 0x7fffffff);
+    if (len > 0) {
+        memcpy(s->out + 9, payload, len);
+    }
+    return send_all(s->fd, s->out, 9 + len);
+}
+
+static int send_rst(H2Session *s, int stream, int code) {
+    unsigned char payload[4];
+
+    put32(payload, code);
+    return send_frame(s, H2_RST_STREAM, 0, stream, payload, 4);
+}
+
+static int send_window_update(H2Session *s, int stream, size_t increment) {
+    unsigned char payload[4];
+
+    put32(payload, increment);
+    return send_frame(s, H2_WINDOW_UPDATE, 0, stream, payload, 4);
+}
+
+static void send_goaway(H2Session *s, int code) {
+    unsigned char payload[8];
+
+    put32(payload, s->last_id);
+    put32(payload + 4, code);
+    send_frame(s, H2_GOAWAY, 0, 0, payload, 8);
+}
+
+static H2Stream *stream_find(H2Session *s, int id) {
+    int i;
+
+    for (i = 0; i < s->nstreams; i++) {
+        if (s->streams[i].id == id && s->streams[i].fd >= 0) {
+            return &s->streams[i];
+        }
+    }
+    return NULL;
+}
+
+// stream 을 닫는 함수, socketpair 를 닫으면 아직 응답 중인 deliver thread 는 쓰기에 실패하고 끝난다
+// 배열에서 빼는 것은 poll loop 가 한 바퀴 돈 뒤 stream_compact 에서 한다
+static void stream_close(H2Stream *st) {
+    if (st->fd >= 0) {
+        close(st->fd);
+        st->fd = -1;
+    }
+    free(st->buf);
+    st->buf = NULL;
+}
+
+static void stream_compact(H2Session *s) {
+    int i;
+
+    for (i = 0; i < s->nstreams; i++) {
+        if (s->streams[i].fd < 0) {
+            s->streams[i--] = s->streams[--s->nstreams];
+        }
+    }
+}
+
+// stream 하나를 에러로 닫는 함수
+static int stream_reset(H2Session *s, H2Stream *st, int code) {
+    stream_close(st);
+    return send_rst(s, st->id, code);
+}
+
+// header 값에 CR, LF, NUL 이 있는지 확인하는 함수 (NUL 은 hpack.c 가 LF 로 바꿔서 넘긴다)
+static int field_value_bad(char *value) {
+    return strpbrk(value, "\r\n") != NULL;
+}
+
+// header 이름이 비었거나 대문자, 공백, 제어 문자, ':' 가 있는지 확인하는 함수 (pseudo-header 의 첫 ':' 는 빼고)
+static int field_name_bad(char *name) {
+    char *p = name[0] == ':' ? name + 1 : name;
+
+    if (*p == '\0') {
+        return 1;
+    }
+    for (; *p; p++) {
+        if (isupper((unsigned char) *p) || (unsigned char) *p <= ' ' || *p == 0x7f || *p == ':') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 요청줄에 들어가는 pseudo-header 값 (:method, :path, :authority) 에 공백이나 제어 문자가 있는지 확인하는 함수
+static int request_token_bad(char *value) {
+    for (; *value; value++) {
+        if ((unsigned char) *value <= ' ' || *value == 0x7f) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// hpack_decode 가 넘겨주는 header 를 H2Request 에 모으는 함수
+// HTTP/1.0 요청으로 옮겨 쓰므로 다른 줄을 만들 수 있는 header 는 malformed 로 본다 (RFC 9113 8.2.1, 8.3.1)
+static int request_emit(void *arg, char *name, char *value) {
+    H2Request *req = (H2Request *) arg;
+    size_t n;
+
+    if (field_name_bad(name) || field_value_bad(value)) {
+        req->bad = 1;
+        return 0;
+    }
+    if (name[0] == ':') {
+        if (request_token_bad(value)) {
+            req->bad = 1;
+            return 0;
+        }
+        if (!strcmp(name, ":method")) {
+            snprintf(req->method, sizeof(req->method), "%s", value);
+        } else if (!strcmp(name, ":scheme")) {
+            snprintf(req->scheme, sizeof(req->scheme), "%s", value);
+        } else if (!strcmp(name, ":authority")) {
+            snprintf(req->authority, sizeof(req->authority), "%s", value);
+        } else if (!strcmp(name, ":path")) {
+            if (value[0] != '/' && strcmp(value, "*")) {
+                req->bad = 1;
+            }
+            snprintf(req->path, sizeof(req->path), "%s", value);
+        } else {
+            req->bad = 1;
+        }
+        return 0;
+    }
+    // HTTP/2 에는 없는 연결 단위 header 는 잘못된 요청 (RFC 9113 8.2.2)
+    if (!strcmp(name, "connection") || !strcmp(name, "keep-alive") || !strcmp(name, "proxy-connection") ||
+        !strcmp(name, "transfer-encoding") || !strcmp(name, "upgrade")) {
+        req->bad = 1;
+        return 0;
+    }
+    if (!strcmp(name, "host")) {
+        req->has_host = 1;
+        snprintf(req->host, sizeof(req->host), "%s", value);
+    } else if (!strcmp(name, "content-length")) {
+        req->has_length = 1;
+    }
+    n = strlen(name) + strlen(value) + 4;
+    if (req->headers_len + n >= sizeof(req->headers)) {
+        req->bad = 1;
+        return 0;
+    }
+    req->headers_len += sprintf(req->headers + req->headers_len, "%s: %s\r\n", name, value);
+    return 0;
+}
+
+// 새 stream 을 열어 요청을 deliver thread 로 넘기는 함수, 연결을 끊어야 하면 -1
+// body 는 DATA 가 이어지는 요청 (0 이면 쓰는 쪽을 바로 닫음), chunked 면 body 를 chunked 로 감싸서 넘긴다
+static int stream_open(H2Session *s, int id, char *request, size_t len, char *method, int body, int chunked) {
+    H2Stream *st;
+    int sp[2];
+
+    s->served++;
+    if (s->nstreams >= s->config->h2_max_streams || s->nstreams >= H2_MAX_STREAMS) {
+        return send_rst(s, id, H2_REFUSED_STREAM);
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sp) < 0) {
+        return send_rst(s, id, H2_REFUSED_STREAM);
+    }
+    // 요청은 socket 버퍼 하나에 다 들어가므로 여기서 막히지 않는다
+    if (send_all(sp[0], (unsigned char *) request, len) < 0 || s->spawn(s->arg, sp[1]) < 0) {
+        close(sp[0]);
+        close(sp[1]);
+        return send_rst(s, id, H2_REFUSED_STREAM);
+    }
+    if (!body) {
+        shutdown(sp[0], SHUT_WR);
+    }
+
+    st = &s->streams[s->nstreams++];
+    memset(st, 0, sizeof(H2Stream));
+    st->id = id;
+    st->fd = sp[0];
+    st->window = s->initial_window;
+    st->remaining = -1;
+    st->head_only = !strcasecmp(method, "HEAD");
+    st->body_open = body;
+    st->body_chunked = chunked;
+    return 0;
+}
+
+// DATA 로 받은 request body 를 deliver thread 로 넘기는 함수, end 면 body 를 끝내고 쓰는 쪽을 닫는다
+// deliver 는 header 를 읽자마자 body 를 읽으므로 socket 버퍼가 차더라도 잠깐만 막힌다.
+// deliver 가 먼저 답하고 (413 등) 닫았다면 쓰기가 실패하므로 남은 body 는 버린다
+static void stream_body(H2Stream *st, unsigned char *data, size_t len, int end) {
+    char line[32];
+    int n;
+
+    if (len > 0 && st->body_chunked) {
+        n = sprintf(line, "%zx\r\n", len);
+        if (send_all(st->fd, (unsigned char *) line, n) < 0 || send_all(st->fd, data, len) < 0
+            || send_all(st->fd, (unsigned char *) "\r\n", 2) < 0) {
+            end = 1;
+        }
+    } else if (len > 0 && send_all(st->fd, data, len) < 0) {
+        end = 1;
+    }
+    if (end) {
+        if (st->body_chunked) {
+            send_all(st->fd, (unsigned char *) "0\r\n\r\n", 5);
+        }
+        shutdown(st->fd, SHUT_WR);
+        st->body_open = 0;
+    }
+}
+
+// 다 모인 header block 을 읽어 stream 을 여는 함수, 연결 에러면 -1
+static int headers_complete(H2Session *s, int id) {
+    H2Request *req;
+    H2Stream *st;
+    char *request;
+    size_t len;
+    int rc = 0, body = !s->block_end_stream;
+
+    req = (H2Request *) Calloc(1, sizeof(H2Request));
+    if (hpack_decode(&s->hpack, s->block, s->block_len, request_emit, req) < 0) {
+        free(req);
+        s->error = H2_COMPRESSION_ERROR;
+        return -1;
+    }
+    s->block_stream = 0;
+
+    // 이미 연 stream 의 trailer 이거나 닫힌 stream 이면 decode 만 하고 버린다 (HPACK 상태는 맞춰야 하므로)
+    // trailer 가 END_STREAM 이면 request body 는 거기서 끝난다
+    if (id <= s->last_id) {
+        if (!body && (st = stream_find(s, id)) != NULL && st->body_open) {
+            stream_body(st, NULL, 0, 1);
+        }
+        free(req);
+        return 0;
+    }
+    s->last_id = id;
+    if (s->goaway) {
+        free(req);
+        return 0;
+    }
+    if (req->bad || !req->method[0] || !req->path[0] || (!req->authority[0] && !req->has_host)) {
+        free(req);
+        return send_rst(s, id, H2_PROTOCOL_ERROR);
+    }
+
+    // /__proxy 로 시작하는 관리 요청은 origin-form 그대로, 나머지는 proxy 요청처럼 absolute-form 으로
+    // :authority 가 없으면 host header 값으로 만든다 (origin-form 이면 parse_uri 가 경로 첫 부분을 host 로 읽으므로)
+    request = (char *) Malloc(MAXLINE * 3 + MAXBUF);
+    if (!strncmp(req->path, "/__proxy", 8)) {
+        len = sprintf(request, "%s %s HTTP/1.0\r\n", req->method, req->path);
+    } else {
+        len = sprintf(request, "%s http://%s%s HTTP/1.0\r\n", req->method,
+                      req->authority[0] ? req->authority : req->host, req->path);
+    }
+    if (!req->has_host) {
+        len += sprintf(request + len, "Host: %s\r\n", req->authority);
+    }
+    memcpy(request + len, req->headers, req->headers_len);
+    len += req->headers_len;
+    // 길이를 모르는 body 는 chunked 로 넘긴다 (h2 에는 Transfer-Encoding 이 없으므로 여기서 붙임)
+    if (body && !req->has_length) {
+        len += sprintf(request + len, "Transfer-Encoding: chunked\r\n");
+    }
+    len += sprintf(request + len, "\r\n");
+
+    rc = stream_open(s, id, request, len, req->method, body, body && !req->has_length);
+    free(request);
+    free(req);
+    return rc;
+}
+
+// SETTINGS payload 를 적용하는 함수 (HTTP2-Settings header 로 온 것도 같음), 잘못된 값이면 -1
+static int settings_apply(H2Session *s, unsigned char *p, size_t len) {
+    unsigned int id, value;
+    long long delta;
+    int i;
+
+    if (len % 6 != 0) {
+        s->error = H2_FRAME_SIZE_ERROR;
+        return -1;
+    }
+    for (; len > 0; p += 6, len -= 6) {
+        id = (unsigned int) p[0] << 8 | p[1];
+        value = get32(p + 2);
+        if (id == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (value > H2_WINDOW_MAX) {
+                s->error = H2_FLOW_CONTROL_ERROR;
+                return -1;
+            }
+            // 이미 열린 stream 의 window 도 차이만큼 바뀐다 (음수가 될 수도 있음)
+            delta = (long long) value - s->initial_window;
+            for (i = 0; i < s->nstreams; i++) {
+                s->streams[i].window += delta;
+            }
+            s->initial_window = value;
+        } else if (id == H2_SETTINGS_MAX_FRAME_SIZE) {
+            if (value < H2_FRAME_SIZE || value > 0xffffff) {
+                s->error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            s->max_frame = MIN_SIZE(value, H2_FRAME_SIZE);
+        } else if (id == H2_SETTINGS_ENABLE_PUSH && value > 1) {
+            s->error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// frame 하나를 처리하는 함수, 연결 에러면 -1 (s->error 에 code)
+static int frame_handle(H2Session *s, int type, int flags, int id, unsigned char *p, size_t len) {
+    H2Stream *st;
+    unsigned int increment;
+    size_t pad = 0;
+
+    // header block 은 다른 frame 이 끼어들지 않고 CONTINUATION 으로만 이어진다
+    if (s->block_stream != 0 && (type != H2_CONTINUATION || id != s->block_stream)) {
+        s->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    switch (type) {
+        case H2_DATA:
+            if (id == 0) {
+                s->error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            // padding 까지 window 에 들어가므로 돌려줄 때는 frame 전체 길이로
+            increment = len;
+            if (flags & H2_PADDED) {
+                if (len < 1 || (pad = p[0]) + 1 > len) {
+                    s->error = H2_PROTOCOL_ERROR;
+                    return -1;
+                }
+                p++;
+                len -= pad + 1;
+            }
+            // body 는 열린 stream 이면 deliver thread 로 넘기고, 받은 만큼 window 를 돌려준다
+            if ((st = stream_find(s, id)) != NULL && st->body_open) {
+                stream_body(st, p, len, flags & H2_END_STREAM);
+            }
+            if (increment == 0) {
+                return 0;
+            }
+            if (send_window_update(s, 0, increment) < 0) {
+                return -1;
+            }
+            if (st != NULL && !(flags & H2_END_STREAM)) {
+                return send_window_update(s, id, increment);
+            }
+            return 0;
+
+        case H2_HEADERS:
+            if (id == 0 || id % 2 == 0) {
+                s->error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            if (flags & H2_PADDED) {
+                if (len < 1 || (pad = p[0]) + 1 > len) {
+                    s->error = H2_PROTOCOL_ERROR;
+                    return -1;
+                }
+                p++;
+                len -= pad + 1;
+            }
+            if (flags & H2_PRIORITY_FLAG) {
+                if (len < 5) {
+                    s->error = H2_FRAME_SIZE_ERROR;
+                    return -1;
+                }
+                p += 5;
+                len -= 5;
+            }
+            if (s->block == NULL) {
+                s->block = (unsigned char *) Malloc(H2_BLOCK_SIZE);
+            }
+            memcpy(s->block, p, len);
+            s->block_len = len;
+            s->block_end_stream = flags & H2_END_STREAM;
+            if (flags & H2_END_HEADERS) {
+                return headers_complete(s, id);
+            }
+            s->block_stream = id;
+            return 0;
+
+        case H2_CONTINUATION:
+            if (s->block_stream == 0 || s->block_len + len > H2_BLOCK_SIZE) {
+                s->error = s->block_stream == 0 ? H2_PROTOCOL_ERROR : H2_INTERNAL_ERROR;
+                return -1;
+            }
+            memcpy(s->block + s->block_len, p, len);
+            s->block_len += len;
+            if (flags & H2_END_HEADERS) {
+                return headers_complete(s, id);
+            }
+            return 0;
+
+        case H2_PRIORITY:
+            if (len != 5) {
+                s->error = H2_FRAME_SIZE_ERROR;
+                return -1;
+            }
+            return 0;
+
+        case H2_RST_STREAM:
+            if (id == 0 || len != 4) {
+                s->error = id == 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR;
+                return -1;
+            }
+            if ((st = stream_find(s, id)) != NULL) {
+                stream_close(st);
+            }
+            return 0;
+
+        case H2_SETTINGS:
+            if (id != 0) {
+                s->error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            if (flags & H2_ACK) {
+                return 0;
+            }
+            if (settings_apply(s, p, len) < 0) {
+                return -1;
+            }
+            return send_frame(s, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+
+        case H2_PING:
+            if (id != 0 || len != 8) {
+                s->error = id != 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR;
+                return -1;
+            }
+            return flags & H2_ACK ? 0 : send_frame(s, H2_PING, H2_ACK, 0, p, 8);
+
+        case H2_GOAWAY:
+            s->goaway = 1;
+            return 0;
+
+        case H2_WINDOW_UPDATE:
+            if (len != 4) {
+                s->error = H2_FRAME_SIZE_ERROR;
+                return -1;
+            }
+            increment = get32(p) & 0x7fffffff;
+            if (id == 0) {
+                if (increment == 0 || s->window + increment > H2_WINDOW_MAX) {
+                    s->error = increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR;
+                    return -1;
+                }
+                s->window += increment;
+            } else if ((st = stream_find(s, id)) != NULL) {
+                if (increment == 0 || st->window + increment > H2_WINDOW_MAX) {
+                    return stream_reset(s, st, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+                }
+                st->window += increment;
+            }
+            return 0;
+
+        case H2_PUSH_PROMISE:
+            // client 는 push 할 수 없다
+            s->error = H2_PROTOCOL_ERROR;
+            return -1;
+
+        default:
+            // 모르는 frame type 은 무시한다
+            return 0;
+    }
+}
+
+// 받은 바이트에서 완성된 frame 을 모두 처리하는 함수, 연결을 끝내야 하면 -1
+static int frames_process(H2Session *s) {
+    unsigned char *p = s->in;
+    size_t left = s->in_len, len;
+    int rc = 0;
+
+    while (left >= 9) {
+        len = (size_t) p[0] << 16 | (size_t) p[1] << 8 | p[2];
+        if (len > H2_FRAME_SIZE) {
+            s->error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        if (left < 9 + len) {
+            break;
+        }
+        if ((rc = frame_handle(s, p[3], p[4], get32(p + 5) & 0x7fffffff, p + 9, len)) < 0) {
+            return -1;
+        }
+        p += 9 + len;
+        left -= 9 + len;
+    }
+    memmove(s->in, p, left);
+    s->in_len = left;
+    return 0;
+}
+
+// 응답 header 의 한 줄을 HPACK 으로 block 에 덧붙이는 함수, 자리가 없으면 -1
+static int response_header(H2Stream *st, unsigned char *block, size_t *len, size_t room, char *line) {
+    char *value, *p;
+    size_t n;
+
+    if ((value = strchr(line, ':')) == NULL) {
+        return 0;
+    }
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    // HTTP/2 는 값 앞뒤의 공백을 잘못된 header 로 본다
+    for (p = value + strlen(value); p > value && (p[-1] == ' ' || p[-1] == '\t'); p--) {
+        p[-1] = '\0';
+    }
+    for (p = line; *p; p++) {
+        *p = tolower(*p);
+    }
+    // 연결 단위 header 는 HTTP/2 에서 쓰지 않는다
+    if (!strcmp(line, "connection") || !strcmp(line, "keep-alive") || !strcmp(line, "proxy-connection") ||
+        !strcmp(line, "transfer-encoding") || !strcmp(line, "upgrade")) {
+        return 0;
+    }
+    if (!strcmp(line, "content-length") && st->remaining < 0) {
+        st->remaining = atoll(value);
+    }
+    if ((n = hpack_encode_header(block + *len, room - *len, line, value)) == 0) {
+        return -1;
+    }
+    *len += n;
+    return 0;
+}
+
+// 모인 HTTP/1 응답 header 를 HEADERS (+ CONTINUATION) frame 으로 보내는 함수, 연결 에러면 -1
+// 1xx (request body 의 100 Continue 등) 는 END_STREAM 없는 HEADERS 로 보내고 buf 에서 떼어내, 최종 응답 header 를 다시 모은다
+static int response_head(H2Session *s, H2Stream *st, size_t end) {
+    unsigned char *block;
+    char *line, *next;
+    size_t len, sent = 0, n;
+    int status, interim, rc = 0;
+
+    st->buf[end - 2] = '\0';
+    if (strncmp(st->buf, "HTTP/", 5) != 0 || (line = strchr(st->buf, ' ')) == NULL ||
+        (status = atoi(line + 1)) < 100 || status > 999 || status == 101) {
+        return stream_reset(s, st, H2_INTERNAL_ERROR);
+    }
+    interim = status < 200;
+
+    block = (unsigned char *) Malloc(H2_HEAD_SIZE * 2);
+    len = hpack_encode_status(block, status);
+    for (line = strstr(st->buf, "\r\n"); line != NULL; line = next) {
+        line += 2;
+        if ((next = strstr(line, "\r\n")) != NULL) {
+            *next = '\0';
+        }
+        if (response_header(st, block, &len, H2_HEAD_SIZE * 2, line) < 0) {
+            free(block);
+            return stream_reset(s, st, H2_INTERNAL_ERROR);
+        }
+    }
+    if (interim) {
+        st->remaining = -1;
+    } else if (st->head_only || status == 204 || status == 304) {
+        st->remaining = 0;
+    }
+
+    // header block 이 frame 하나보다 크면 CONTINUATION 으로 나눠 보낸다
+    do {
+        n = MIN_SIZE(len - sent, s->max_frame);
+        rc = send_frame(s, sent == 0 ? H2_HEADERS : H2_CONTINUATION,
+                        (sent + n == len ? H2_END_HEADERS : 0) | (sent + n == len && st->remaining == 0 ? H2_END_STREAM : 0),
+                        st->id, block + sent, n);
+        sent += n;
+    } while (rc == 0 && sent < len);
+    free(block);
+
+    if (interim) {
+        memmove(st->buf, st->buf + end, st->len - end);
+        st->len -= end;
+        st->buf[st->len] = '\0';
+        return rc;
+    }
+    st->head_done = 1;
+    st->off = end;
+    if (st->remaining == 0) {
+        stream_close(st);
+    }
+    return rc;
+}
+
+// body 바이트를 window 안에서 DATA frame 하나로 보내는 함수, 보낸 바이트 수 (연결 에러면 -1)
+static ssize_t response_data(H2Session *s, H2Stream *st, unsigned char *data, size_t len) {
+    int flags = 0;
+
+    len = MIN_SIZE(len, s->max_frame);
+    len = MIN_SIZE((long long) len, MIN_SIZE(st->window, s->window));
+    if (st->remaining >= 0 && (long long) len >= st->remaining) {
+        // Content-Length 를 다 채우면 그 frame 으로 stream 을 끝낸다 (넘치는 바이트는 버린다)
+        len = st->remaining;
+        flags = H2_END_STREAM;
+    }
+    if (send_frame(s, H2_DATA, flags, st->id, data, len) < 0) {
+        return -1;
+    }
+    st->window -= len;
+    s->window -= len;
+    if (st->remaining >= 0) {
+        st->remaining -= len;
+    }
+    if (flags & H2_END_STREAM) {
+        stream_close(st);
+    }
+    return len;
+}
+
+// header 뒤에 같이 읽어둔 body 를 window 가 허락하는 만큼 보내는 함수, 연결 에러면 -1
+static int stream_flush(H2Session *s, H2Stream *st) {
+    ssize_t n;
+
+    while (st->fd >= 0 && st->head_done && st->off < st->len && st->window > 0 && s->window > 0) {
+        if ((n = response_data(s, st, (unsigned char *) st->buf + st->off, st->len - st->off)) < 0) {
+            return -1;
+        }
+        st->off += n;
+    }
+    return 0;
+}
+
+// stream 의 응답을 한 번 읽어서 보내는 함수, 연결 에러면 -1
+static int stream_read(H2Session *s, H2Stream *st) {
+    char *end;
+    ssize_t n;
+
+    if (!st->head_done) {
+        if (st->buf == NULL) {
+            st->buf = (char *) Malloc(H2_HEAD_SIZE + 1);
+        }
+        if ((n = recv(st->fd, st->buf + st->len, H2_HEAD_SIZE - st->len, MSG_DONTWAIT)) < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : stream_reset(s, st, H2_INTERNAL_ERROR);
+        }
+        if (n == 0) {
+            return stream_reset(s, st, H2_INTERNAL_ERROR);
+        }
+        st->len += n;
+        st->buf[st->len] = '\0';
+        // 1xx 뒤에 최종 응답 header 가 같이 읽혔을 수 있다
+        while (st->fd >= 0 && !st->head_done && (end = strstr(st->buf, "\r\n\r\n")) != NULL) {
+            if (response_head(s, st, end - st->buf + 4) < 0) {
+                return -1;
+            }
+        }
+        if (st->head_done) {
+            return stream_flush(s, st);
+        }
+        return st->fd >= 0 && st->len == H2_HEAD_SIZE ? stream_reset(s, st, H2_INTERNAL_ERROR) : 0;
+    }
+
+    // 같은 poll 결과를 처리하는 동안 다른 stream 이 연결 window 를 다 썼을 수 있다
+    if ((n = MIN_SIZE((long long) s->max_frame, MIN_SIZE(st->window, s->window))) <= 0) {
+        return 0;
+    }
+    if ((n = recv(st->fd, s->chunk, n, MSG_DONTWAIT)) < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : stream_reset(s, st, H2_INTERNAL_ERROR);
+    }
+    if (n == 0) {
+        // 응답이 Content-Length 보다 짧게 끝났으면 client 가 잘린 응답을 쓰지 않도록 reset 으로 끝낸다
+        if (st->remaining > 0) {
+            return stream_reset(s, st, H2_INTERNAL_ERROR);
+        }
+        stream_close(st);
+        return send_frame(s, H2_DATA, H2_END_STREAM, st->id, NULL, 0);
+    }
+    return response_data(s, st, s->chunk, n) < 0 ? -1 : 0;
+}
+
+// base64url (padding 없음) 을 decode 하는 함수, decode 한 바이트 수 (잘못된 입력이면 -1)
+static ssize_t base64url_decode(char *in, unsigned char *out, size_t room) {
+    static const char *digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    unsigned int acc = 0;
+    size_t n = 0;
+    int bits = 0;
+    char *p;
+
+    for (; *in && *in != '=' && *in != '\r' && *in != ' '; in++) {
+        if ((p = strchr(digits, *in)) == NULL) {
+            return -1;
+        }
+        acc = acc << 6 | (unsigned int) (p - digits);
+        if ((bits += 6) >= 8) {
+            bits -= 8;
+            if (n == room) {
+                return -1;
+            }
+            out[n++] = acc >> bits;
+        }
+    }
+    return n;
+}
+
+// header 들 가운데 name 의 값을 찾는 함수 (대소문자 무시), 없으면 NULL
+static char *header_find(char *headers, char *name, char *value, size_t size) {
+    char *line, *end;
+    size_t n = strlen(name);
+
+    for (line = headers; line != NULL && *line; line = end ? end + 2 : NULL) {
+        end = strstr(line, "\r\n");
+        if (!strncasecmp(line, name, n) && line[n] == ':') {
+            line += n + 1;
+            while (*line == ' ' || *line == '\t') {
+                line++;
+            }
+            snprintf(value, size, "%.*s", end ? (int) (end - line) : (int) strlen(line), line);
+            return value;
+        }
+    }
+    return NULL;
+}
+
+// "Upgrade: h2c" 와 HTTP2-Settings 가 있는 GET / HEAD 요청인지 확인하는 함수
+int h2_upgrade_requested(char *method, char *headers) {
+    char value[MAXLINE];
+
+    if (strcasecmp(method, "GET") != 0 && strcasecmp(method, "HEAD") != 0) {
+        return 0;
+    }
+    if (header_find(headers, "HTTP2-Settings", value, sizeof(value)) == NULL ||
+        header_find(headers, "Upgrade", value, sizeof(value)) == NULL) {
+        return 0;
+    }
+    return strcasestr(value, "h2c") != NULL;
+}
+
+// Upgrade 요청의 HTTP2-Settings 를 적용하고 그 요청을 stream 1 로 여는 함수, 연결을 끝내야 하면 -1
+// (101 과 server 의 SETTINGS 는 이미 보냄)
+static int upgrade_stream(H2Session *s, char *method, char *uri, char *headers) {
+    unsigned char settings[H2_FRAME_SIZE];
+    char value[MAXLINE], *request, *line, *end;
+    ssize_t n;
+    size_t len;
+    int rc;
+
+    header_find(headers, "HTTP2-Settings", value, sizeof(value));
+    if ((n = base64url_decode(value, settings, sizeof(settings))) < 0) {
+        s->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+    if (settings_apply(s, settings, n) < 0) {
+        return -1;
+    }
+
+    // 원래 요청을 absolute-form 으로 바꾸고 upgrade 에 쓴 header 는 뺀다
+    request = (char *) Malloc(MAXLINE * 3 + MAXBUF);
+    if (uri[0] == '/' && strncmp(uri, "/__proxy", 8) != 0 && header_find(headers, "Host", value, sizeof(value)) != NULL) {
+        len = sprintf(request, "%s http://%s%s HTTP/1.0\r\n", method, value, uri);
+    } else {
+        len = sprintf(request, "%s %s HTTP/1.0\r\n", method, uri);
+    }
+    for (line = strstr(headers, "\r\n"); line != NULL; line = end) {
+        line += 2;
+        if ((end = strstr(line, "\r\n")) == NULL || line == end) {
+            break;
+        }
+        if (strncasecmp(line, "Upgrade:", 8) != 0 && strncasecmp(line, "HTTP2-Settings:", 15) != 0 &&
+            strncasecmp(line, "Connection:", 11) != 0 && len + (end - line) + 4 < MAXLINE * 3 + MAXBUF) {
+            memcpy(request + len, line, end - line + 2);
+            len += end - line + 2;
+        }
+    }
+    len += sprintf(request + len, "\r\n");
+
+    s->last_id = 1;
+    rc = stream_open(s, 1, request, len, method, 0, 0);
+    free(request);
+    return rc;
+}
+
+// 아직 받지 못한 preface 부분과 in 의 앞부분을 맞춰보고 떼어내는 함수, 다르면 -1
+static int preface_check(H2Session *s, size_t *preface) {
+    size_t m = MIN_SIZE(*preface, s->in_len);
+
+    if (memcmp(s->in, H2_PREFACE + sizeof(H2_PREFACE) - 1 - *preface, m) != 0) {
+        s->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+    memmove(s->in, s->in + m, s->in_len - m);
+    s->in_len -= m;
+    *preface -= m;
+    return 0;
+}
+
+// client socket 에서 읽을 수 있는 만큼 읽어 frame 을 처리하는 함수, 연결을 끝내야 하면 -1
+static int client_read(H2Session *s, size_t *preface) {
+    ssize_t n;
+
+    if ((n = recv(s->fd, s->in + s->in_len, sizeof(s->in) - s->in_len, MSG_DONTWAIT)) < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    if (n == 0) {
+        return -1;
+    }
+    s->in_len += n;
+    sockopt_quickack(s->fd, s->config);
+
+    // 아직 받지 못한 preface 부분부터 확인한다
+    if (*preface > 0 && preface_check(s, preface) < 0) {
+        return -1;
+    }
+    return *preface > 0 ? 0 : frames_process(s);
+}
+
+// 연결 하나를 h2 session 으로 처리하는 함수, 연 stream 수를 반환
+// method 가 NULL 이면 prior knowledge (preface 의 첫 줄은 이미 읽음), 아니면 method / uri / headers 의 요청을 upgrade 한다.
+// rio 에 남아 있는 바이트는 client 가 이어서 보낸 것이므로 먼저 쓴다.
+int h2_serve(int fd, rio_t *rio, ProxyConfig *config, char *method, char *uri, char *headers,
+             int (*spawn)(void *arg, int fd), void *arg) {
+    H2Session *s = (H2Session *) Calloc(1, sizeof(H2Session));
+    struct pollfd fds[1 + H2_MAX_STREAMS];
+    H2Stream *owner[1 + H2_MAX_STREAMS];
+    size_t preface = method == NULL ? sizeof(H2_PREFACE) - sizeof(H2_PREFACE_LINE) : sizeof(H2_PREFACE) - 1;
+    unsigned char settings[12];
+    int served, nfds, rc, i;
+
+    s->fd = fd;
+    s->config = config;
+    s->spawn = spawn;
+    s->arg = arg;
+    s->window = s->initial_window = H2_DEFAULT_WINDOW;
+    s->max_frame = H2_FRAME_SIZE;
+    hpack_init(&s->hpack);
+
+    // upgrade 라면 101 을 먼저 보낸다. 그 다음은 양쪽 모두 SETTINGS 로 시작한다:
+    // 동시에 열 수 있는 stream 수를 알리고 push 는 쓰지 않는다
+    rc = method == NULL ? 0 : send_all(fd, (unsigned char *) H2_SWITCHING, sizeof(H2_SWITCHING) - 1);
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(settings + 2, MIN_SIZE(config->h2_max_streams, H2_MAX_STREAMS));
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_ENABLE_PUSH;
+    put32(settings + 8, 0);
+    if (rc == 0) {
+        rc = send_frame(s, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    }
+    if (rc == 0 && method != NULL) {
+        rc = upgrade_stream(s, method, uri, headers);
+    }
+
+    // Rio 가 미리 읽어둔 바이트는 client_read 가 받은 것처럼 처리한다
+    if (rc == 0 && rio->rio_cnt > 0) {
+        s->in_len = MIN_SIZE((size_t) rio->rio_cnt, sizeof(s->in));
+        memcpy(s->in, rio->rio_bufptr, s->in_len);
+        if ((rc = preface_check(s, &preface)) == 0 && preface == 0) {
+            rc = frames_process(s);
+        }
+    }
+
+    while (rc == 0 && !s->error) {
+        for (i = 0; i < s->nstreams; i++) {
+            if (stream_flush(s, &s->streams[i]) < 0) {
+                rc = -1;
+            }
+        }
+        stream_compact(s);
+        if (rc < 0 || (s->goaway && s->nstreams == 0)) {
+            break;
+        }
+
+        // header 를 모으는 중이거나 보낼 window 가 있는 stream 만 읽는다
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        nfds = 1;
+        for (i = 0; i < s->nstreams; i++) {
+            if (!s->streams[i].head_done ||
+                (s->streams[i].off >= s->streams[i].len && s->streams[i].window > 0 && s->window > 0)) {
+                owner[nfds] = &s->streams[i];
+                fds[nfds].fd = s->streams[i].fd;
+                fds[nfds++].events = POLLIN;
+            }
+        }
+        if ((rc = poll(fds, nfds, s->nstreams == 0 && config->header_timeout_ms > 0 ? config->header_timeout_ms : -1)) < 0) {
+            rc = errno == EINTR ? 0 : -1;
+            continue;
+        }
+        if (rc == 0) {
+            // 한동안 새 요청이 없었으므로 정상 종료
+            send_goaway(s, H2_NO_ERROR);
+            break;
+        }
+        rc = 0;
+        for (i = 1; i < nfds && rc == 0; i++) {
+            if (fds[i].revents != 0 && owner[i]->fd >= 0) {
+                rc = stream_read(s, owner[i]);
+            }
+        }
+        if (rc == 0 && fds[0].revents != 0) {
+            rc = client_read(s, &preface);
+        }
+    }
+    if (s->error) {
+        send_goaway(s, s->error);
+    }
+
+    for (i = 0; i < s->nstreams; i++) {
+        stream_close(&s->streams[i]);
+    }
+    served = s->served;
+    hpack_free(&s->hpack);
+    free(s->block);
+    free(s);
+    return served;
+}
@@ -0,0 +1,23 @@
+/*
+ * h2.h - HTTP/2 cleartext (h2c) frontend, stream 마다 요청 하나짜리 연결처럼 deliver 에 넘긴다
+ */
+#ifndef __H2_H__
+#define __H2_H__
+
+#include "csapp.h"
+#include "config.h"
+#include "hpack.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LINE "PRI * HTTP/2.0\r\n"    /* prior knowledge 연결의 첫 줄 */
+#define H2_FRAME_SIZE 16384                     /* 주고받는 frame payload 의 최대 크기 (SETTINGS_MAX_FRAME_SIZE 기본값) */
+#define H2_MAX_STREAMS 256                      /* h2_max_streams 의 상한 */
+#define H2_HEAD_SIZE MAXBUF                     /* stream 응답의 HTTP/1 header 를 모으는 버퍼 */
+#define H2_BLOCK_SIZE (64 * 1024)               /* HEADERS + CONTINUATION 으로 받는 header block 의 최대 크기 */
+
+int h2_upgrade_requested(char *method, char *headers);
+
+int h2_serve(int fd, rio_t *rio, ProxyConfig *config, char *method, char *uri, char *headers,
+             int (*spawn)(void *arg, int fd), void *arg);
+
+#endif /* __H2_H__ */
@@ -0,0 +1,205 @@
+/*
+ * happy_eyeballs.c - origin 의 모든 주소로 non-blocking connect 를 번갈아 거는 연결 (RFC 8305)
+ *
+ * 예전에는 host 를 inet_addr 로 IPv4 주소 하나로만 읽고 blocking connect 를 했기 때문에,
+ * IPv6 origin 에는 연결할 수 없었고 응답하지 않는 주소에서는 커널의 SYN 재전송이 끝날 때까지 멈춰 있었다.
+ * origin_connect 는 getaddrinfo 가 준 모든 주소를 IPv6 / IPv4 가 번갈아 오도록 늘어놓고
+ * - connect_attempt_delay_ms 마다 (앞의 시도가 실패하면 바로) 다음 주소로 non-blocking connect 를 하나씩 더 걸고,
+ * - connect_attempt_timeout_ms 가 지나도록 붙지 않은 시도는 포기하고,
+ * - 가장 먼저 붙은 socket 하나만 남기고 나머지는 닫는다.
+ * 전체 시간은 connect_timeout_ms 를 넘지 않고, 넘으면 errno 를 ETIMEDOUT 으로 두고 -1 을 반환한다.
+ * 붙은 주소는 addr 로 돌려주므로 같은 요청의 다음 연결은 origin_connect_addr 로 그 주소에 바로 건다.
+ */
+#include <poll.h>
+#include <time.h>
+#include "happy_eyeballs.h"
+#include "sockopt.h"
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// non-blocking connect 를 시작하는 함수, 진행 중이거나 바로 붙었으면 fd (*done 에 바로 붙었는지), 실패하면 -1
+static int attempt_start(struct sockaddr *addr, socklen_t addrlen, ProxyConfig *config, int *done) {
+    int fd;
+
+    if ((fd = socket(addr->sa_family, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if (config != NULL) {
+        sockopt_upstream(fd, config);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    *done = connect(fd, addr, addrlen) == 0;
+    if (!*done && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 붙은 socket 을 다시 blocking 으로 돌려서 반환하는 함수 (이후에는 Rio 로 읽고 쓰므로)
+static int attempt_finish(int fd, ProxyConfig *config) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    if (config != NULL) {
+        sockopt_upstream_connected(fd, config);
+    }
+    return fd;
+}
+
+// getaddrinfo 결과를 첫 주소의 family 부터 두 family 가 번갈아 오도록 addrs 에 담는 함수, 담은 개수를 반환
+static int interleave(struct addrinfo *list, struct addrinfo **addrs) {
+    struct addrinfo *first[HE_MAX_ADDRS], *second[HE_MAX_ADDRS], *p;
+    int n1 = 0, n2 = 0, i = 0, j = 0, n = 0;
+
+    for (p = list; p != NULL; p = p->ai_next) {
+        if (p->ai_family == list->ai_family && n1 < HE_MAX_ADDRS) {
+            first[n1++] = p;
+        } else if (p->ai_family != list->ai_family && n2 < HE_MAX_ADDRS) {
+            second[n2++] = p;
+        }
+    }
+    while (n < HE_MAX_ADDRS && (i < n1 || j < n2)) {
+        if (i < n1) {
+            addrs[n++] = first[i++];
+        }
+        if (j < n2 && n < HE_MAX_ADDRS) {
+            addrs[n++] = second[j++];
+        }
+    }
+    return n;
+}
+
+// host:port 의 주소들로 연결을 경주시켜 먼저 붙은 socket 을 반환하는 함수, 모두 실패하면 -1 (시간이 지났으면 errno 는 ETIMEDOUT)
+int origin_connect(char *host, char *port, ProxyConfig *config, struct sockaddr_storage *addr, socklen_t *addrlen) {
+    struct addrinfo hints, *list, *addrs[HE_MAX_ADDRS];
+    struct pollfd fds[HE_MAX_ADDRS];
+    long long started[HE_MAX_ADDRS], now, deadline, next_start, wait;
+    int owner[HE_MAX_ADDRS];    // fds[i] 가 addrs 의 몇 번째 주소인지
+    int count, next = 0, active = 0, winner = -1, fd, done, err, timed_out = 0, i;
+    socklen_t len = sizeof(err);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &list) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    count = interleave(list, addrs);
+
+    now = monotonic_ms();
+    deadline = now + (config->connect_timeout_ms > 0 ? config->connect_timeout_ms : 75000);
+    next_start = now;
+    while (winner < 0) {
+        now = monotonic_ms();
+        // 시간이 됐거나 진행 중인 시도가 없으면 다음 주소로 하나 더 건다
+        if (next < count && (active == 0 || now >= next_start)) {
+            if ((fd = attempt_start(addrs[next]->ai_addr, addrs[next]->ai_addrlen, config, &done)) >= 0) {
+                fds[active].fd = fd;
+                fds[active].events = POLLOUT;
+                owner[active] = next;
+                started[active++] = now;
+                if (done) {
+                    winner = active - 1;
+                    break;
+                }
+                next_start = now + config->connect_attempt_delay_ms;
+            } else {
+                next_start = now;
+            }
+            next++;
+            continue;
+        }
+        // 너무 오래 걸리는 시도는 포기하고 바로 다음 주소로
+        for (i = 0; i < active; i++) {
+            if (config->connect_attempt_timeout_ms > 0 && now - started[i] >= config->connect_attempt_timeout_ms) {
+                close(fds[i].fd);
+                fds[i] = fds[--active];
+                owner[i] = owner[active];
+                started[i--] = started[active];
+                next_start = now;
+                timed_out = 1;
+            }
+        }
+        if (active == 0 && next == count) {
+            break;
+        }
+        if (now >= deadline) {
+            timed_out = 1;
+            break;
+        }
+
+        wait = deadline - now;
+        if (next < count && next_start - now < wait) {
+            wait = next_start - now;
+        }
+        for (i = 0; i < active; i++) {
+            if (config->connect_attempt_timeout_ms > 0 && started[i] + config->connect_attempt_timeout_ms - now < wait) {
+                wait = started[i] + config->connect_attempt_timeout_ms - now;
+            }
+        }
+        if (active == 0 || poll(fds, active, wait > 0 ? wait : 0) <= 0) {
+            continue;
+        }
+
+        for (i = 0; i < active; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+                winner = i;
+                break;
+            }
+            // 실패한 시도가 있으면 기다리지 않고 다음 주소로
+            close(fds[i].fd);
+            fds[i] = fds[--active];
+            owner[i] = owner[active];
+            started[i--] = started[active];
+            next_start = monotonic_ms();
+        }
+    }
+
+    for (i = 0; i < active; i++) {
+        if (i != winner) {
+            close(fds[i].fd);
+        }
+    }
+    if (winner < 0) {
+        freeaddrinfo(list);
+        errno = timed_out ? ETIMEDOUT : ECONNREFUSED;
+        return -1;
+    }
+    memcpy(addr, addrs[owner[winner]]->ai_addr, addrs[owner[winner]]->ai_addrlen);
+    *addrlen = addrs[owner[winner]]->ai_addrlen;
+    freeaddrinfo(list);
+    return attempt_finish(fds[winner].fd, config);
+}
+
+// 이미 붙어본 주소 하나로 timeout_ms 안에 연결하는 함수, 실패하면 -1 (시간이 지났으면 errno 는 ETIMEDOUT)
+// config 가 NULL 이면 socket 옵션을 걸지 않는다 (health check)
+int origin_connect_addr(struct sockaddr *addr, socklen_t addrlen, ProxyConfig *config, int timeout_ms) {
+    struct pollfd pfd;
+    socklen_t len = sizeof(int);
+    int fd, done, err = 0, rc;
+
+    if ((fd = attempt_start(addr, addrlen, config, &done)) < 0) {
+        return -1;
+    }
+    if (done) {
+        return attempt_finish(fd, config);
+    }
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    while ((rc = poll(&pfd, 1, timeout_ms > 0 ? timeout_ms : -1)) < 0 && errno == EINTR);
+    if (rc > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+        return attempt_finish(fd, config);
+    }
+    close(fd);
+    errno = rc == 0 ? ETIMEDOUT : (err ? err : ECONNREFUSED);
+    return -1;
+}
@@ -0,0 +1,16 @@
+/*
+ * happy_eyeballs.h - origin 의 모든 주소로 non-blocking connect 를 번갈아 거는 연결 (RFC 8305)
+ */
+#ifndef __HAPPY_EYEBALLS_H__
+#define __HAPPY_EYEBALLS_H__
+
+#include "csapp.h"
+#include "config.h"
+
+#define HE_MAX_ADDRS 16     /* 이름 하나에서 시도해보는 최대 주소 수 */
+
+int origin_connect(char *host, char *port, ProxyConfig *config, struct sockaddr_storage *addr, socklen_t *addrlen);
+
+int origin_connect_addr(struct sockaddr *addr, socklen_t addrlen, ProxyConfig *config, int timeout_ms);
+
+#endif /* __HAPPY_EYEBALLS_H__ */
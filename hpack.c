@@ -0,0 +1,386 @@
+/*
+ * hpack.c - HTTP/2 header 압축 (RFC 7541)
+ *
+ * decoder 는 client 가 보내는 모든 표현을 읽는다: static/dynamic table 참조, 색인하거나 하지 않는 literal,
+ * dynamic table 크기 변경, Huffman 으로 인코딩된 문자열.
+ * encoder 는 응답 header 에만 쓰므로 단순하게 만든다: 자주 쓰는 :status 는 static table 로, 나머지는 모두
+ * 색인하지 않는 literal 로 Huffman 없이 보낸다. dynamic table 을 쓰지 않으므로 client 의 table 크기 설정과 상관없다.
+ *
+ * Huffman code 는 canonical 이라서 (같은 길이의 code 는 symbol 순서대로 이어진다) 길이별 첫 code 와 개수만 있으면
+ * 한 bit 씩 읽으며 decode 할 수 있다. 표는 처음 쓸 때 RFC 7541 Appendix B 의 code 길이로부터 만든다.
+ */
+#include "hpack.h"
+
+#define HUFFMAN_MAX_BITS 30
+#define HPACK_MAX_INTEGER (1 << 24)     /* 이보다 큰 정수 (문자열 길이, index) 는 잘못된 header 로 본다 */
+
+static const char *static_table[HPACK_STATIC_ENTRIES + 1][2] = {
+        {NULL, NULL},
+        {":authority", ""},
+        {":method", "GET"},
+        {":method", "POST"},
+        {":path", "/"},
+        {":path", "/index.html"},
+        {":scheme", "http"},
+        {":scheme", "https"},
+        {":status", "200"},
+        {":status", "204"},
+        {":status", "206"},
+        {":status", "304"},
+        {":status", "400"},
+        {":status", "404"},
+        {":status", "500"},
+        {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""},
+        {"accept-ranges", ""},
+        {"accept", ""},
+        {"access-control-allow-origin", ""},
+        {"age", ""},
+        {"allow", ""},
+        {"authorization", ""},
+        {"cache-control", ""},
+        {"content-disposition", ""},
+        {"content-encoding", ""},
+        {"content-language", ""},
+        {"content-length", ""},
+        {"content-location", ""},
+        {"content-range", ""},
+        {"content-type", ""},
+        {"cookie", ""},
+        {"date", ""},
+        {"etag", ""},
+        {"expect", ""},
+        {"expires", ""},
+        {"from", ""},
+        {"host", ""},
+        {"if-match", ""},
+        {"if-modified-since", ""},
+        {"if-none-match", ""},
+        {"if-range", ""},
+        {"if-unmodified-since", ""},
+        {"last-modified", ""},
+        {"link", ""},
+        {"location", ""},
+        {"max-forwards", ""},
+        {"proxy-authenticate", ""},
+        {"proxy-authorization", ""},
+        {"range", ""},
+        {"referer", ""},
+        {"refresh", ""},
+        {"retry-after", ""},
+        {"server", ""},
+        {"set-cookie", ""},
+        {"strict-transport-security", ""},
+        {"transfer-encoding", ""},
+        {"user-agent", ""},
+        {"vary", ""},
+        {"via", ""},
+        {"www-authenticate", ""}};
+
+/* RFC 7541 Appendix B 의 symbol 0..255 의 code 길이 (EOS 는 30 bit) */
+static const uint8_t huffman_lengths[256] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+        5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+        13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+        15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+        6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26};
+
+static uint32_t huffman_first[HUFFMAN_MAX_BITS + 2];   // 길이별 첫 code
+static int huffman_count[HUFFMAN_MAX_BITS + 2];        // 길이별 symbol 수 (EOS 제외)
+static int huffman_offset[HUFFMAN_MAX_BITS + 2];       // 길이별 첫 symbol 의 huffman_sorted 위치
+static unsigned char huffman_sorted[256];               // (길이, code) 순으로 정렬한 symbol
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+
+static void huffman_init(void) {
+    uint32_t code = 0;
+    int len, sym, n = 0;
+
+    for (sym = 0; sym < 256; sym++) {
+        huffman_count[huffman_lengths[sym]]++;
+    }
+    for (len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+        code = (code + huffman_count[len - 1]) << 1;
+        huffman_first[len] = code;
+        huffman_offset[len] = n;
+        for (sym = 0; sym < 256; sym++) {
+            if (huffman_lengths[sym] == len) {
+                huffman_sorted[n++] = sym;
+            }
+        }
+    }
+}
+
+// Huffman 문자열을 decode 하는 함수, 잘못된 code 거나 out 이 모자라면 -1
+static ssize_t huffman_decode(unsigned char *in, size_t len, char *out, size_t room) {
+    uint32_t code = 0;
+    size_t i, n = 0;
+    int bit, bits = 0;
+
+    pthread_once(&huffman_once, huffman_init);
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            if (++bits > HUFFMAN_MAX_BITS) {
+                return -1;  // EOS 이거나 없는 code
+            }
+            if (code - huffman_first[bits] < (uint32_t) huffman_count[bits]) {
+                if (n + 1 >= room) {
+                    return -1;
+                }
+                out[n++] = huffman_sorted[huffman_offset[bits] + code - huffman_first[bits]];
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+    // 남은 bit 는 7 개 이하의 EOS 앞부분 (모두 1) 이어야 한다
+    if (bits > 7 || code != (1u << bits) - 1) {
+        return -1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+void hpack_init(HpackTable *table) {
+    memset(table, 0, sizeof(HpackTable));
+    table->max_size = HPACK_TABLE_SIZE;
+}
+
+// 가장 오래된 entry 를 버리는 함수
+static void table_evict(HpackTable *table) {
+    HpackEntry *e = &table->entries[(table->head + table->count - 1) % HPACK_MAX_ENTRIES];
+
+    table->size -= e->size;
+    free(e->name);
+    free(e->value);
+    table->count--;
+}
+
+void hpack_free(HpackTable *table) {
+    while (table->count > 0) {
+        table_evict(table);
+    }
+}
+
+// entry 를 dynamic table 맨 앞에 넣는 함수, 자리가 모자라면 오래된 것부터 버린다
+static void table_add(HpackTable *table, char *name, char *value) {
+    size_t size = strlen(name) + strlen(value) + 32;
+    HpackEntry *e;
+
+    while (table->count > 0 && table->size + size > table->max_size) {
+        table_evict(table);
+    }
+    // table 보다 큰 entry 는 table 을 비우기만 하고 넣지 않는다 (RFC 7541 4.4)
+    if (size > table->max_size) {
+        return;
+    }
+    table->head = (table->head + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    e = &table->entries[table->head];
+    e->name = strdup(name);
+    e->value = strdup(value);
+    e->size = size;
+    table->size += size;
+    table->count++;
+}
+
+// index 가 가리키는 entry 의 name/value, 없는 index 면 -1
+static int table_get(HpackTable *table, size_t index, char **name, char **value) {
+    HpackEntry *e;
+
+    if (index == 0) {
+        return -1;
+    }
+    if (index <= HPACK_STATIC_ENTRIES) {
+        *name = (char *) static_table[index][0];
+        *value = (char *) static_table[index][1];
+        return 0;
+    }
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= (size_t) table->count) {
+        return -1;
+    }
+    e = &table->entries[(table->head + index) % HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *value = e->value;
+    return 0;
+}
+
+// prefix bit 정수를 읽는 함수 (RFC 7541 5.1), 읽은 바이트 수, 잘못되었으면 -1
+static ssize_t decode_integer(unsigned char *in, size_t len, int prefix, size_t *value) {
+    size_t max = (1 << prefix) - 1, i = 1;
+    int shift = 0;
+
+    if (len == 0) {
+        return -1;
+    }
+    if ((*value = in[0] & max) < max) {
+        return 1;
+    }
+    do {
+        if (i >= len || shift > 21) {
+            return -1;
+        }
+        *value += (size_t) (in[i] & 0x7f) << shift;
+        shift += 7;
+    } while (in[i++] & 0x80);
+    return *value > HPACK_MAX_INTEGER ? -1 : (ssize_t) i;
+}
+
+// 문자열을 읽어서 out 에 NUL 로 끝나게 담는 함수 (RFC 7541 5.2), 읽은 바이트 수, 잘못되었으면 -1
+// 문자열 안의 NUL 은 끝과 구분되지 않으므로 LF 로 바꿔 둔다. 길이가 그대로라 table 크기 계산은 맞고,
+// header 에 올 수 없는 바이트이므로 받는 쪽 (h2.c) 이 malformed 로 거른다
+static ssize_t decode_string(unsigned char *in, size_t len, char *out, size_t room) {
+    size_t n, i;
+    ssize_t used, decoded;
+
+    if ((used = decode_integer(in, len, 7, &n)) < 0 || n > len - used) {
+        return -1;
+    }
+    if (in[0] & 0x80) {
+        if ((decoded = huffman_decode(in + used, n, out, room)) < 0) {
+            return -1;
+        }
+    } else {
+        if (n >= room) {
+            return -1;
+        }
+        memcpy(out, in + used, n);
+        out[n] = '\0';
+        decoded = n;
+    }
+    for (i = 0; i < (size_t) decoded; i++) {
+        if (out[i] == '\0') {
+            out[i] = '\n';
+        }
+    }
+    return used + n;
+}
+
+// header block 하나를 decode 해서 header 마다 emit 을 부르는 함수, 잘못된 block 이거나 emit 이 -1 을 주면 -1
+// (decode 에 실패하면 dynamic table 이 어긋나므로 호출한 쪽은 연결을 끊어야 한다)
+int hpack_decode(HpackTable *table, unsigned char *in, size_t len,
+                 int (*emit)(void *arg, char *name, char *value), void *arg) {
+    char name[MAXLINE], value[MAXLINE], *ref_name, *ref_value;
+    size_t pos = 0, index;
+    ssize_t n;
+    int prefix, indexing;
+
+    while (pos < len) {
+        // 1xxxxxxx: table 의 name/value 를 그대로
+        if (in[pos] & 0x80) {
+            if ((n = decode_integer(in + pos, len - pos, 7, &index)) < 0
+                || table_get(table, index, &ref_name, &ref_value) < 0) {
+                return -1;
+            }
+            pos += n;
+            if (emit(arg, ref_name, ref_value) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        // 001xxxxx: dynamic table 크기 변경
+        if ((in[pos] & 0xe0) == 0x20) {
+            if ((n = decode_integer(in + pos, len - pos, 5, &index)) < 0 || index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            pos += n;
+            table->max_size = index;
+            while (table->count > 0 && table->size > table->max_size) {
+                table_evict(table);
+            }
+            continue;
+        }
+        // 01xxxxxx: literal 을 table 에 넣음, 0000xxxx / 0001xxxx: 넣지 않음
+        indexing = (in[pos] & 0xc0) == 0x40;
+        prefix = indexing ? 6 : 4;
+        if ((n = decode_integer(in + pos, len - pos, prefix, &index)) < 0) {
+            return -1;
+        }
+        pos += n;
+        if (index > 0) {
+            if (table_get(table, index, &ref_name, &ref_value) < 0 || strlen(ref_name) >= sizeof(name)) {
+                return -1;
+            }
+            strcpy(name, ref_name);
+        } else if ((n = decode_string(in + pos, len - pos, name, sizeof(name))) < 0) {
+            return -1;
+        } else {
+            pos += n;
+        }
+        if ((n = decode_string(in + pos, len - pos, value, sizeof(value))) < 0) {
+            return -1;
+        }
+        pos += n;
+        if (indexing) {
+            table_add(table, name, value);
+        }
+        if (emit(arg, name, value) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// prefix bit 정수를 쓰는 함수, 쓴 바이트 수 (out 은 최소 6 바이트)
+static size_t encode_integer(unsigned char *out, unsigned char flags, int prefix, size_t value) {
+    size_t max = (1 << prefix) - 1, n = 1;
+
+    if (value < max) {
+        out[0] = flags | value;
+        return 1;
+    }
+    out[0] = flags | max;
+    value -= max;
+    while (value >= 0x80) {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+// :status 를 쓰는 함수, static table 에 있는 값이면 1 바이트 (out 은 최소 8 바이트)
+size_t hpack_encode_status(unsigned char *out, int status) {
+    char value[8];
+    int i;
+
+    for (i = 8; i <= 14; i++) {
+        if (atoi(static_table[i][1]) == status) {
+            return encode_integer(out, 0x80, 7, i);
+        }
+    }
+    // 이름은 static table 의 :status, 값은 literal (색인하지 않음)
+    snprintf(value, sizeof(value), "%03d", status % 1000);
+    out[0] = 0x08;
+    out[1] = 3;
+    memcpy(out + 2, value, 3);
+    return 5;
+}
+
+// name/value 를 색인하지 않는 literal 로 쓰는 함수, 쓴 바이트 수, room 이 모자라면 0
+size_t hpack_encode_header(unsigned char *out, size_t room, char *name, char *value) {
+    size_t name_len = strlen(name), value_len = strlen(value), n;
+
+    if (room < 1 + 6 + name_len + 6 + value_len) {
+        return 0;
+    }
+    out[0] = 0x00;
+    n = 1 + encode_integer(out + 1, 0x00, 7, name_len);
+    memcpy(out + n, name, name_len);
+    n += name_len;
+    n += encode_integer(out + n, 0x00, 7, value_len);
+    memcpy(out + n, value, value_len);
+    return n + value_len;
+}
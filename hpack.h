@@ -0,0 +1,37 @@
+/*
+ * hpack.h - HTTP/2 header 압축 (RFC 7541)
+ */
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_TABLE_SIZE 4096                       /* SETTINGS_HEADER_TABLE_SIZE 기본값, decoder 가 허용하는 최대 크기 */
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32)    /* entry 하나는 최소 32 바이트로 센다 */
+
+typedef struct HpackEntry {
+    char *name, *value;
+    size_t size;                // strlen(name) + strlen(value) + 32
+} HpackEntry;
+
+// 연결 하나의 decoder dynamic table, 가장 최근에 넣은 entry 가 62 번
+typedef struct HpackTable {
+    HpackEntry entries[HPACK_MAX_ENTRIES];  // 원형, head 가 가장 최근 entry
+    int head, count;
+    size_t size, max_size;
+} HpackTable;
+
+void hpack_init(HpackTable *table);
+
+void hpack_free(HpackTable *table);
+
+int hpack_decode(HpackTable *table, unsigned char *in, size_t len,
+                 int (*emit)(void *arg, char *name, char *value), void *arg);
+
+size_t hpack_encode_status(unsigned char *out, int status);
+
+size_t hpack_encode_header(unsigned char *out, size_t room, char *name, char *value);
+
+#endif /* __HPACK_H__ */
@@ -0,0 +1,640 @@
+/*
+ * loadgen.c - proxy 성능 측정용 HTTP 부하 생성기
+ *
+ * thread 마다 epoll 하나로 여러 연결을 non-blocking 으로 돌리면서 요청을 보내고,
+ * 처리량, 지연 시간 분포, 에러 수를 출력한다.
+ *
+ * - closed-loop (기본): 연결마다 응답을 받자마자 다음 요청을 보낸다.
+ * - open-loop (-r rate): 초당 rate 개의 요청을 일정한 간격으로 예약하고, 지연 시간은 예약된 시각부터 잰다.
+ *   연결이 모두 바쁘면 요청이 밀리는데, 밀린 시간까지 지연 시간에 들어가므로 coordinated omission 이 생기지 않는다.
+ * - URL 목록은 명령행이나 파일(-f)로 받고, -z s 를 주면 i 번째 URL 을 1/i^s 에 비례하는 확률(Zipf)로 고른다.
+ * - -x host:port 를 주면 모든 요청을 proxy 로 보내고 (request target 은 absolute URL),
+ *   주지 않으면 첫 번째 URL 의 origin 으로 바로 보낸다.
+ *
+ * usage: loadgen [-c conns] [-t threads] [-d sec | -n requests] [-r rate] [-k] [-z s]
+ *                [-x proxy_host:port] [-T timeout_ms] [-j json_file] [-f url_file] [url...]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_URLS 4096
+#define URL_SIZE 1024
+#define REQ_SIZE 2048
+#define HDR_SIZE 8192
+#define READ_SIZE 65536
+#define MAX_EVENTS 256
+
+enum { CONN_IDLE, CONN_CONNECTING, CONN_WRITING, CONN_READING };
+
+typedef struct Options {
+    int conns;              // 전체 연결 수
+    int threads;
+    double duration;        // 초, -n 을 주면 0
+    long long requests;     // 보낼 요청 수, 0 이면 duration 동안
+    double rate;            // open-loop 초당 요청 수, 0 이면 closed-loop
+    int keepalive;
+    double zipf;            // 0 이면 균등 분포
+    int timeout_ms;
+    char *json_path;
+    char *proxy;            // "host:port", NULL 이면 origin 으로 직접
+} Options;
+
+// 연결 하나의 상태
+typedef struct Conn {
+    int fd;                 // 닫혀 있으면 -1
+    int state;
+    int reused;             // keep-alive 로 재사용 중인 연결인지 (끊겨 있으면 한 번 다시 시도)
+    char req[REQ_SIZE];
+    size_t req_len, req_sent;
+    char hdr[HDR_SIZE];     // 응답 header 를 모으는 버퍼
+    size_t hdr_len;
+    int hdr_done;
+    long long body_left;    // 남은 body 바이트, -1 이면 연결이 닫힐 때까지
+    int close_after;        // 응답을 다 받으면 닫아야 하는지
+    int status;
+    long long start_us;     // 지연 시간의 기준 시각 (open-loop 에서는 예약된 시각)
+    long long bytes;
+} Conn;
+
+typedef struct Worker {
+    pthread_t tid;
+    int id, epfd, nconns;
+    Conn *conns;
+    unsigned int rng;
+    long long quota;        // 보낼 요청 수, -1 이면 제한 없음
+    double interval_us;     // open-loop 요청 간격
+    long long next_send;    // 다음 요청이 예약된 시각
+    long long *lat;         // 완료된 요청들의 지연 시간 (us)
+    size_t nlat, cap;
+    long long sent, ok, status[6], conn_errors, read_errors, timeouts, bytes, connects;
+} Worker;
+
+static Options opt = {16, 2, 10.0, 0, 0.0, 0, 0.0, 10000, NULL, NULL};
+static char *urls[MAX_URLS];
+static char *targets[MAX_URLS];     // 요청 line 에 들어가는 target (proxy 면 URL 전체, 아니면 path)
+static char *hosts[MAX_URLS];       // Host header 값
+static double *zipf_cdf;
+static int nurls;
+static struct sockaddr_storage server_addr;
+static socklen_t server_addrlen;
+static long long started_us, deadline_us;
+static volatile int stopping;
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-c conns] [-t threads] [-d sec | -n requests] [-r rate] [-k] [-z s]\n"
+                    "          [-x proxy_host:port] [-T timeout_ms] [-j json_file] [-f url_file] [url...]\n", prog);
+    exit(1);
+}
+
+// "host:port" 를 주소로 바꿔주는 함수
+static int resolve(char *hostport) {
+    char host[URL_SIZE], *port;
+    struct addrinfo hints, *res;
+
+    snprintf(host, sizeof(host), "%s", hostport);
+    if ((port = strrchr(host, ':')) == NULL) {
+        port = "80";
+    } else {
+        *port++ = '\0';
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = AF_UNSPEC;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+// URL 하나를 등록하는 함수, http://host[:port]/path 형식만 받는다
+static void add_url(char *url) {
+    char *host, *path;
+    size_t len;
+
+    if (nurls == MAX_URLS || strncmp(url, "http://", 7) != 0 || strlen(url) >= URL_SIZE) {
+        fprintf(stderr, "loadgen: skipping url %s\n", url);
+        return;
+    }
+    host = url + 7;
+    path = strchr(host, '/');
+    len = path ? (size_t) (path - host) : strlen(host);
+
+    urls[nurls] = strdup(url);
+    hosts[nurls] = strndup(host, len);
+    targets[nurls] = opt.proxy ? urls[nurls] : strdup(path ? path : "/");
+    nurls++;
+}
+
+static void load_url_file(char *path) {
+    char line[URL_SIZE], *p;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((p = strpbrk(line, "\r\n")) != NULL) {
+            *p = '\0';
+        }
+        if (line[0] != '\0' && line[0] != '#') {
+            add_url(line);
+        }
+    }
+    fclose(fp);
+}
+
+// Zipf 분포의 누적 확률표를 만드는 함수
+static void build_zipf(void) {
+    double sum = 0;
+    int i;
+
+    zipf_cdf = (double *) malloc(sizeof(double) * nurls);
+    for (i = 0; i < nurls; i++) {
+        sum += 1.0 / pow(i + 1, opt.zipf);
+        zipf_cdf[i] = sum;
+    }
+    for (i = 0; i < nurls; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+static int pick_url(Worker *w) {
+    double u = rand_r(&w->rng) / ((double) RAND_MAX + 1);
+    int lo = 0, hi = nurls - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void conn_close(Worker *w, Conn *c) {
+    if (c->fd >= 0) {
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->state = CONN_IDLE;
+    c->reused = 0;
+}
+
+static void conn_watch(Worker *w, Conn *c, unsigned int events) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// 새 연결을 non-blocking 으로 여는 함수
+static int conn_open(Worker *w, Conn *c) {
+    struct epoll_event ev;
+    int one = 1;
+
+    if ((c->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+        return -1;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *) &server_addr, server_addrlen) < 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->state = CONN_CONNECTING;
+    w->connects++;
+    return 0;
+}
+
+static void record(Worker *w, long long usec) {
+    if (w->nlat == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 4096;
+        w->lat = (long long *) realloc(w->lat, sizeof(long long) * w->cap);
+    }
+    w->lat[w->nlat++] = usec;
+}
+
+// 요청을 보내기 시작하는 함수, 연결이 없으면 새로 연다
+static void conn_send(Worker *w, Conn *c, int url) {
+    c->req_len = snprintf(c->req, REQ_SIZE, "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: loadgen\r\n"
+                                            "Connection: %s\r\n\r\n",
+                          targets[url], hosts[url], opt.keepalive ? "keep-alive" : "close");
+    c->req_sent = 0;
+    c->hdr_len = 0;
+    c->hdr_done = 0;
+    c->bytes = 0;
+    c->status = 0;
+
+    if (c->fd >= 0) {
+        c->state = CONN_WRITING;
+        conn_watch(w, c, EPOLLOUT);
+    } else if (conn_open(w, c) < 0) {
+        w->conn_errors++;
+        c->state = CONN_IDLE;
+    }
+}
+
+// 앞으로 보낼 요청이 남아 있는지 확인하는 함수
+static int more_requests(Worker *w, long long now) {
+    return !stopping && (w->quota < 0 || w->sent < w->quota) && (opt.duration <= 0 || now < deadline_us);
+}
+
+// 다음 요청을 보내도 되는지, 보낸다면 기준 시각은 언제인지 알려주는 함수
+static int next_request(Worker *w, long long now, long long *start) {
+    if (!more_requests(w, now)) {
+        return 0;
+    }
+    if (opt.rate > 0) {
+        if (w->next_send > now) {
+            return 0;
+        }
+        *start = w->next_send;
+        w->next_send += (long long) w->interval_us;
+    } else {
+        *start = now;
+    }
+    w->sent++;
+    return 1;
+}
+
+// 응답 하나를 다 받았을 때 호출
+static void conn_done(Worker *w, Conn *c) {
+    record(w, now_us() - c->start_us);
+    w->status[c->status >= 100 && c->status < 600 ? c->status / 100 : 0]++;
+    w->bytes += c->bytes;
+    if (c->status >= 200 && c->status < 400) {
+        w->ok++;
+    }
+    if (!opt.keepalive || c->close_after) {
+        conn_close(w, c);
+    } else {
+        c->state = CONN_IDLE;
+        c->reused = 1;
+        conn_watch(w, c, 0);
+    }
+}
+
+// 응답 header 를 해석하는 함수 (status, Content-Length, Connection)
+static void parse_header(Conn *c, char *end) {
+    char *line, *next;
+
+    *end = '\0';
+    c->status = 0;
+    sscanf(c->hdr, "HTTP/%*d.%*d %d", &c->status);
+    c->body_left = -1;
+    c->close_after = strncmp(c->hdr, "HTTP/1.0", 8) == 0;
+
+    for (line = strstr(c->hdr, "\r\n"); line != NULL; line = next) {
+        line += 2;
+        next = strstr(line, "\r\n");
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            c->body_left = atoll(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            c->close_after = strcasestr(line, "close") != NULL;
+        }
+    }
+    if (c->body_left < 0) {
+        c->close_after = 1;
+    }
+}
+
+// 읽을 수 있는 만큼 읽고 응답이 끝났는지 확인하는 함수
+static void conn_read(Worker *w, Conn *c, char *scratch) {
+    ssize_t n;
+    char *end;
+    size_t room, used;
+
+    while (1) {
+        if (!c->hdr_done) {
+            room = HDR_SIZE - 1 - c->hdr_len;
+            n = read(c->fd, c->hdr + c->hdr_len, room);
+        } else {
+            n = read(c->fd, scratch, READ_SIZE);
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return;
+            }
+            break;
+        }
+        if (n == 0) {
+            // 길이를 모르는 body 는 연결이 닫히면 끝
+            if (c->hdr_done && c->body_left < 0) {
+                conn_done(w, c);
+                return;
+            }
+            break;
+        }
+        c->bytes += n;
+
+        if (!c->hdr_done) {
+            c->hdr_len += n;
+            c->hdr[c->hdr_len] = '\0';
+            if ((end = strstr(c->hdr, "\r\n\r\n")) == NULL) {
+                if (c->hdr_len == HDR_SIZE - 1) {
+                    break;
+                }
+                continue;
+            }
+            c->hdr_done = 1;
+            used = end + 4 - c->hdr;
+            parse_header(c, end);
+            n = c->hdr_len - used;      // header 와 같이 읽힌 body
+        }
+        if (c->body_left >= 0) {
+            c->body_left -= n;
+            if (c->body_left <= 0) {
+                conn_done(w, c);
+                return;
+            }
+        }
+    }
+
+    // 재사용하던 연결을 server 가 먼저 닫았고 아무것도 못 받았다면, 새 연결로 한 번 다시 보낸다
+    if (c->reused && c->bytes == 0) {
+        conn_close(w, c);
+        if (conn_open(w, c) == 0) {
+            c->req_sent = 0;
+            return;
+        }
+        w->conn_errors++;
+        return;
+    }
+    w->read_errors++;
+    conn_close(w, c);
+}
+
+static void conn_event(Worker *w, Conn *c, unsigned int events, char *scratch) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    ssize_t n;
+
+    if (c->state == CONN_CONNECTING) {
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            w->conn_errors++;
+            conn_close(w, c);
+            return;
+        }
+        c->state = CONN_WRITING;
+    }
+    if (c->state == CONN_WRITING) {
+        while (c->req_sent < c->req_len) {
+            n = write(c->fd, c->req + c->req_sent, c->req_len - c->req_sent);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    return;
+                }
+                if (c->reused) {
+                    // keep-alive 연결이 이미 끊겨 있었음
+                    conn_close(w, c);
+                    if (conn_open(w, c) < 0) w->conn_errors++;
+                    return;
+                }
+                w->conn_errors++;
+                conn_close(w, c);
+                return;
+            }
+            c->req_sent += n;
+        }
+        c->state = CONN_READING;
+        conn_watch(w, c, EPOLLIN);
+        return;
+    }
+    if (c->state == CONN_READING && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        conn_read(w, c, scratch);
+    }
+}
+
+// 너무 오래 걸리는 요청은 timeout 으로 세고 연결을 끊는다
+static void check_timeouts(Worker *w, long long now) {
+    int i;
+
+    for (i = 0; i < w->nconns; i++) {
+        Conn *c = &w->conns[i];
+        if (c->state != CONN_IDLE && now - c->start_us > opt.timeout_ms * 1000LL) {
+            w->timeouts++;
+            conn_close(w, c);
+        }
+    }
+}
+
+static void *worker_main(void *vargp) {
+    Worker *w = (Worker *) vargp;
+    struct epoll_event events[MAX_EVENTS];
+    char *scratch = (char *) malloc(READ_SIZE);
+    long long now, start, last_check = 0;
+    int i, n, busy, timeout;
+
+    w->epfd = epoll_create1(0);
+    w->next_send = started_us;
+    for (i = 0; i < w->nconns; i++) {
+        w->conns[i].fd = -1;
+        w->conns[i].state = CONN_IDLE;
+    }
+
+    while (1) {
+        now = now_us();
+
+        // 쉬고 있는 연결에 다음 요청을 배정
+        busy = 0;
+        for (i = 0; i < w->nconns; i++) {
+            Conn *c = &w->conns[i];
+            if (c->state == CONN_IDLE && next_request(w, now, &start)) {
+                c->start_us = start;
+                conn_send(w, c, pick_url(w));
+            }
+            busy += c->state != CONN_IDLE;
+        }
+        if (busy == 0 && !more_requests(w, now)) {
+            break;
+        }
+
+        if (now - last_check > 100000) {
+            check_timeouts(w, now);
+            last_check = now;
+        }
+
+        timeout = 100;
+        if (opt.rate > 0 && w->next_send > now) {
+            timeout = (int) ((w->next_send - now) / 1000);
+        }
+        n = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        for (i = 0; i < n; i++) {
+            conn_event(w, (Conn *) events[i].data.ptr, events[i].events, scratch);
+        }
+    }
+
+    free(scratch);
+    close(w->epfd);
+    return NULL;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(long long *sorted, size_t n, double q) {
+    size_t i;
+
+    if (n == 0) {
+        return 0;
+    }
+    i = (size_t) (q * n);
+    return sorted[i < n ? i : n - 1] / 1000.0;
+}
+
+static void on_signal(int sig) {
+    stopping = 1;
+}
+
+int main(int argc, char **argv) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p99", "p999"};
+    Worker *workers, total;
+    long long *all, sum = 0;
+    size_t nall = 0;
+    double elapsed;
+    FILE *fp;
+    int c, i, j, k;
+
+    while ((c = getopt(argc, argv, "c:t:d:n:r:kz:x:T:j:f:")) != -1) {
+        switch (c) {
+            case 'c': opt.conns = atoi(optarg); break;
+            case 't': opt.threads = atoi(optarg); break;
+            case 'd': opt.duration = atof(optarg); break;
+            case 'n': opt.requests = atoll(optarg); opt.duration = 0; break;
+            case 'r': opt.rate = atof(optarg); break;
+            case 'k': opt.keepalive = 1; break;
+            case 'z': opt.zipf = atof(optarg); break;
+            case 'x': opt.proxy = optarg; break;
+            case 'T': opt.timeout_ms = atoi(optarg); break;
+            case 'j': opt.json_path = optarg; break;
+            case 'f': load_url_file(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    for (i = optind; i < argc; i++) {
+        add_url(argv[i]);
+    }
+    if (nurls == 0 || opt.conns <= 0 || opt.threads <= 0 || (opt.duration <= 0 && opt.requests <= 0)) {
+        usage(argv[0]);
+    }
+    if (opt.threads > opt.conns) {
+        opt.threads = opt.conns;
+    }
+    if (resolve(opt.proxy ? opt.proxy : hosts[0]) < 0) {
+        fprintf(stderr, "loadgen: cannot resolve %s\n", opt.proxy ? opt.proxy : hosts[0]);
+        exit(1);
+    }
+    build_zipf();
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+
+    workers = (Worker *) calloc(opt.threads, sizeof(Worker));
+    started_us = now_us();
+    deadline_us = started_us + (long long) (opt.duration * 1000000);
+    for (i = 0; i < opt.threads; i++) {
+        Worker *w = &workers[i];
+        w->id = i;
+        w->rng = 12345 + i * 7919;
+        w->nconns = opt.conns / opt.threads + (i < opt.conns % opt.threads);
+        w->conns = (Conn *) calloc(w->nconns, sizeof(Conn));
+        w->quota = opt.requests > 0 ? opt.requests / opt.threads + (i < opt.requests % opt.threads) : -1;
+        w->interval_us = opt.rate > 0 ? 1e6 * opt.threads / opt.rate : 0;
+        pthread_create(&w->tid, NULL, worker_main, w);
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < opt.threads; i++) {
+        Worker *w = &workers[i];
+        pthread_join(w->tid, NULL);
+        total.sent += w->sent;
+        total.ok += w->ok;
+        total.conn_errors += w->conn_errors;
+        total.read_errors += w->read_errors;
+        total.timeouts += w->timeouts;
+        total.bytes += w->bytes;
+        total.connects += w->connects;
+        for (j = 0; j < 6; j++) {
+            total.status[j] += w->status[j];
+        }
+        nall += w->nlat;
+    }
+    elapsed = (now_us() - started_us) / 1e6;
+
+    all = (long long *) malloc(sizeof(long long) * (nall ? nall : 1));
+    for (i = 0, k = 0; i < opt.threads; i++) {
+        memcpy(all + k, workers[i].lat, sizeof(long long) * workers[i].nlat);
+        k += workers[i].nlat;
+    }
+    qsort(all, nall, sizeof(long long), compare_ll);
+    for (i = 0; i < (int) nall; i++) {
+        sum += all[i];
+    }
+
+    printf("%zu requests in %.2fs, %.1f MB read, %lld connections opened\n",
+           nall, elapsed, total.bytes / 1e6, total.connects);
+    printf("  throughput: %.1f req/s, %.2f MB/s\n", nall / elapsed, total.bytes / 1e6 / elapsed);
+    printf("  latency (ms): mean %.3f", nall ? sum / 1000.0 / nall : 0.0);
+    for (i = 0; i < 4; i++) {
+        printf(" %s %.3f", labels[i], percentile(all, nall, quantiles[i]));
+    }
+    printf(" max %.3f\n", nall ? all[nall - 1] / 1000.0 : 0.0);
+    printf("  status: 2xx %lld, 3xx %lld, 4xx %lld, 5xx %lld, other %lld\n",
+           total.status[2], total.status[3], total.status[4], total.status[5], total.status[0] + total.status[1]);
+    printf("  errors: connect %lld, read %lld, timeout %lld\n", total.conn_errors, total.read_errors, total.timeouts);
+
+    if (opt.json_path != NULL) {
+        if ((fp = fopen(opt.json_path, "w")) == NULL) {
+            perror(opt.json_path);
+            exit(1);
+        }
+        fprintf(fp, "{\"requests\": %zu, \"duration_sec\": %.3f, \"rps\": %.1f, \"mb_per_sec\": %.3f, "
+                    "\"connections\": %d, \"rate\": %.1f, \"keepalive\": %d, \"zipf\": %.2f,\n",
+                nall, elapsed, nall / elapsed, total.bytes / 1e6 / elapsed, opt.conns, opt.rate, opt.keepalive, opt.zipf);
+        fprintf(fp, " \"latency_ms\": {\"mean\": %.3f", nall ? sum / 1000.0 / nall : 0.0);
+        for (i = 0; i < 4; i++) {
+            fprintf(fp, ", \"%s\": %.3f", labels[i], percentile(all, nall, quantiles[i]));
+        }
+        fprintf(fp, ", \"max\": %.3f},\n", nall ? all[nall - 1] / 1000.0 : 0.0);
+        fprintf(fp, " \"status\": {\"2xx\": %lld, \"3xx\": %lld, \"4xx\": %lld, \"5xx\": %lld},\n",
+                total.status[2], total.status[3], total.status[4], total.status[5]);
+        fprintf(fp, " \"errors\": {\"connect\": %lld, \"read\": %lld, \"timeout\": %lld}}\n",
+                total.conn_errors, total.read_errors, total.timeouts);
+        fclose(fp);
+    }
+
+    // 에러가 있었으면 0 이 아닌 값으로 끝내서 script 에서 확인할 수 있게 한다
+    return total.conn_errors + total.read_errors + total.timeouts > 0 ? 2 : 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * memory.c - component 별 메모리 사용량 추적과 전체 메모리 예산(memory_budget)
+ *
+ * Cache 의 capacity 는 저장된 payload 만 세므로, 실제로는 key 와 CacheItem, malloc 의 chunk header,
+ * 연결마다의 버퍼와 thread stack 까지 합쳐야 프로세스가 쓰는 메모리가 된다.
+ * - 캐시와 연결은 할당/해제하는 곳에서 memory_add 로 바로 더하고 뺀다 (malloc_usable_size 기준).
+ * - 연결은 accept 할 때 그 연결이 쓸 수 있는 최대치(버퍼, stack)를 미리 잡아두고 닫을 때 돌려준다.
+ * - monitor thread 가 MEMORY_CHECK_MS 마다 RSS 와 mallinfo2 를 읽어 allocator 가 쥐고 있는 여유분과
+ *   나머지(코드, 전역 테이블 등)를 채운다.
+ * memory_budget 이 있으면
+ * 1. 사용량이 예산의 MEMORY_HIGH_PCT 를 넘으면 RAM 캐시를 MEMORY_LOW_PCT 까지 줄이고,
+ * 2. accept 한 연결을 잡아둘 자리가 없으면 먼저 캐시를 그만큼 줄여보고, 그래도 없으면 거절(503)한다.
+ * 3. RAM 캐시에 넣을 때도 같은 방법으로 자리를 확인하고, 없으면 RAM 대신 disk 로 보낸다 (insert_cache_item).
+ *    monitor 는 MEMORY_CHECK_MS 마다만 보므로 한꺼번에 많이 넣으면 그 사이에 예산을 넘을 수 있기 때문이다.
+ * 연결을 잡는 것은 main thread 와 h2 session thread 들이라 확인과 예약 사이에 다른 연결이 끼어들 수 있지만,
+ * 그래도 예산을 연결 몇 개 몫만큼 넘을 뿐이다.
+ */
+#include <malloc.h>
+#include "memory.h"
+#include "config.h"
+
+static long long usage[MEM_COMPONENTS];
+static long long rss_bytes;
+static long long current_budget;
+
+void memory_add(int component, long long bytes) {
+    __atomic_add_fetch(&usage[component], bytes, __ATOMIC_RELAXED);
+}
+
+// malloc 으로 받은 블록이 실제로 차지하는 크기 (chunk header 포함)
+long long memory_block(void *ptr) {
+    return ptr == NULL ? 0 : (long long) (malloc_usable_size(ptr) + sizeof(size_t));
+}
+
+long long memory_total(void) {
+    long long total = 0;
+    int i;
+
+    for (i = 0; i < MEM_COMPONENTS; i++) {
+        total += __atomic_load_n(&usage[i], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// monitor 가 마지막으로 읽은 memory_budget, 0 이면 예산 없음
+long long memory_current_budget(void) {
+    return __atomic_load_n(&current_budget, __ATOMIC_RELAXED);
+}
+
+// cost 만큼의 새 연결을 받을 수 있는지 확인하는 함수, 예산이 없으면(0) 항상 받는다
+// 모자라면 RAM 캐시를 모자란 만큼 줄여보고, 그래도 모자라면 0 을 반환
+// 캐시를 다 비워도 모자란 경우에는 캐시를 건드리지 않는다 (연결이 몰릴 때 캐시까지 잃지 않도록)
+int memory_admit(Cache *cache, long long budget, long long cost) {
+    long long over;
+
+    if (budget <= 0) {
+        return 1;
+    }
+    if ((over = memory_total() + cost - budget) <= 0) {
+        return 1;
+    }
+    if (__atomic_load_n(&usage[MEM_CACHE], __ATOMIC_RELAXED) < over) {
+        return 0;
+    }
+    cache_shrink(cache, over);
+    return memory_total() + cost <= budget;
+}
+
+// /proc/self/statm 의 두 번째 값(resident pages)으로 RSS 를 읽는 함수
+static long long read_rss(void) {
+    long long pages = 0;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/statm", "r")) == NULL) {
+        return 0;
+    }
+    if (fscanf(fp, "%*s %lld", &pages) != 1) {
+        pages = 0;
+    }
+    fclose(fp);
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+// RSS 와 allocator 상태를 읽어서 MEM_ALLOCATOR, MEM_OTHER 를 갱신하는 함수
+static void memory_measure(void) {
+    struct mallinfo2 mi = mallinfo2();
+    long long rss = read_rss(), other;
+
+    __atomic_store_n(&rss_bytes, rss, __ATOMIC_RELAXED);
+    __atomic_store_n(&usage[MEM_ALLOCATOR], (long long) mi.fordblks, __ATOMIC_RELAXED);
+
+    // 연결과 stack 은 최대치로 잡아두므로 실제 RSS 보다 클 수 있다, 그때는 나머지를 0 으로 둔다
+    other = rss - __atomic_load_n(&usage[MEM_CACHE], __ATOMIC_RELAXED)
+            - __atomic_load_n(&usage[MEM_CONNECTIONS], __ATOMIC_RELAXED)
+            - __atomic_load_n(&usage[MEM_STACKS], __ATOMIC_RELAXED)
+            - (long long) mi.fordblks;
+    __atomic_store_n(&usage[MEM_OTHER], other > 0 ? other : 0, __ATOMIC_RELAXED);
+}
+
+// 사용량을 주기적으로 재고, 예산에 가까워지면 RAM 캐시를 줄이고 여유가 생기면 다시 키워주는 thread
+static void *memory_monitor(void *vargp) {
+    Cache *cache = (Cache *) vargp;
+    ProxyConfig *config;
+    long long budget, cache_size, total, high, low;
+    ssize_t limit;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        usleep(MEMORY_CHECK_MS * 1000);
+
+        config = config_acquire();
+        budget = config->memory_budget;
+        cache_size = config->cache_size;
+        config_release(config);
+        __atomic_store_n(&current_budget, budget, __ATOMIC_RELAXED);
+
+        memory_measure();
+        if (budget <= 0) {
+            continue;
+        }
+
+        total = memory_total();
+        high = budget / 100 * MEMORY_HIGH_PCT;
+        low = budget / 100 * MEMORY_LOW_PCT;
+        limit = cache_limit(cache);
+        if (total > high) {
+            if (cache_shrink(cache, total - low) > 0) {
+                // 해제한 메모리를 OS 에 돌려줘야 RSS 가 줄어든다
+                malloc_trim(0);
+                memory_measure();
+            }
+        } else if (total < low && limit < cache_size) {
+            cache_resize(cache, limit + (low - total) < cache_size ? limit + (low - total) : cache_size);
+        }
+    }
+    return NULL;
+}
+
+void memory_start(Cache *cache) {
+    ProxyConfig *config = config_acquire();
+    pthread_t tid;
+
+    __atomic_store_n(&current_budget, config->memory_budget, __ATOMIC_RELAXED);
+    config_release(config);
+    memory_measure();
+    Pthread_create(&tid, NULL, memory_monitor, cache);
+}
+
+// 통계용으로 현재 값들을 복사해주는 함수
+void memory_snapshot(long long *values, long long *rss, long long *budget) {
+    int i;
+
+    for (i = 0; i < MEM_COMPONENTS; i++) {
+        values[i] = __atomic_load_n(&usage[i], __ATOMIC_RELAXED);
+    }
+    *rss = __atomic_load_n(&rss_bytes, __ATOMIC_RELAXED);
+    *budget = __atomic_load_n(&current_budget, __ATOMIC_RELAXED);
+}
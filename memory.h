@@ -0,0 +1,40 @@
+/*
+ * memory.h - component 별 메모리 사용량 추적과 전체 메모리 예산(memory_budget)
+ */
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define DEFAULT_THREAD_STACK_SIZE (512 * 1024)  /* deliver thread 하나의 stack 크기 */
+#define MIN_THREAD_STACK_SIZE (256 * 1024)      /* deliver 의 stack frame 이 100KB 가까이 되므로 이보다 작게는 못 줄임 */
+#define MEMORY_CHECK_MS 100     /* monitor thread 가 RSS 와 allocator 상태를 읽는 주기 */
+#define MEMORY_HIGH_PCT 95      /* 사용량이 예산의 이만큼을 넘으면 RAM 캐시를 줄임 */
+#define MEMORY_LOW_PCT 85       /* 줄일 때는 이만큼까지 줄이고, 이보다 적게 쓰면 캐시를 다시 키움 */
+
+// 메모리를 쓰는 곳
+enum {
+    MEM_CACHE,          // RAM 캐시 아이템 (disk 로 내려가려고 대기 중인 아이템 포함)
+    MEM_CONNECTIONS,    // 연결마다 미리 잡아두는 Connection, 요청/응답 버퍼, 압축 버퍼
+    MEM_STACKS,         // 살아있는 deliver thread 들의 stack
+    MEM_ALLOCATOR,      // malloc 이 OS 에서 받아두고 아직 내주지 않은 메모리 (monitor 가 갱신)
+    MEM_OTHER,          // 위에 포함되지 않은 나머지 RSS: 코드, 전역 테이블 등 (monitor 가 갱신)
+    MEM_COMPONENTS
+};
+
+void memory_add(int component, long long bytes);
+
+long long memory_block(void *ptr);
+
+long long memory_total(void);
+
+long long memory_current_budget(void);
+
+int memory_admit(Cache *cache, long long budget, long long cost);
+
+void memory_start(Cache *cache);
+
+void memory_snapshot(long long *values, long long *rss, long long *budget);
+
+#endif /* __MEMORY_H__ */
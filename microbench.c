@@ -0,0 +1,420 @@
+/*
+ * microbench.c - 캐시, 요청 파싱, rio 함수들을 따로 떼어서 재보는 microbenchmark
+ *
+ * 각 benchmark 는 실제와 비슷한 입력을 미리 만들어 둔 뒤 같은 연산을 반복하고
+ * ns/op, cycles/op (rdtsc), allocs/op, 할당 bytes/op 를 출력한다.
+ * - 캐시: 수천 개의 URL key, 크기가 섞인 text/이미지 객체, Zipf 분포의 접근 순서
+ * - 파싱: 실제 browser (Chrome, Firefox, Safari) 와 curl 의 요청 header
+ * - rio: 위 header 를 파일에 써두고 lseek 으로 되감아 가며 Rio_readlineb 로 읽기
+ *
+ * 할당 횟수는 malloc/calloc/realloc/free 를 이 파일에서 다시 정의해서 센다 (glibc 의 __libc_malloc 으로 넘김).
+ *
+ * usage: microbench [-n iters] [-k keys] [-m cache_bytes] [-z zipf] [benchmark...]
+ */
+#include <math.h>
+#include <time.h>
+#include "csapp.h"
+#include "cache.h"
+#include "cache_key.h"
+#include "request.h"
+#include "config.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#define ZIPF_SEQUENCE (1 << 16)     /* 미리 뽑아둔 Zipf 접근 순서의 길이 */
+
+/* ================= 할당 횟수 세기 ================= */
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static __thread long long alloc_count, alloc_bytes;
+
+void *malloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    alloc_count++;
+    alloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+/* ================= 입력 데이터 ================= */
+
+static const char *browser_headers[] = {
+        // Chrome
+        "GET http://www.example.com/assets/app.js?v=3 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Accept: */*\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Dest: script\r\n"
+        "Referer: http://www.example.com/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: ko-KR,ko;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+        "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; _ga=GA1.1.1234567890.1700000000\r\n"
+        "\r\n",
+        // Firefox
+        "GET http://news.example.org:8080/2024/05/article.html HTTP/1.1\r\n"
+        "Host: news.example.org:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Connection: keep-alive\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "Priority: u=1\r\n"
+        "Proxy-Connection: keep-alive\r\n"
+        "\r\n",
+        // Safari
+        "GET http://img.example.net/photos/2024/cat_large.jpg HTTP/1.1\r\n"
+        "Host: img.example.net\r\n"
+        "Accept: image/webp,image/avif,image/jxl,image/heic,image/heic-sequence,video/*;q=0.8,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+        "Accept-Language: ko-KR,ko;q=0.9\r\n"
+        "Connection: keep-alive\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Safari/605.1.15\r\n"
+        "Referer: http://www.example.net/gallery\r\n"
+        "\r\n",
+        // curl
+        "GET http://localhost:15213/home.html HTTP/1.1\r\n"
+        "Host: localhost:15213\r\n"
+        "User-Agent: curl/8.5.0\r\n"
+        "Accept: */*\r\n"
+        "Proxy-Connection: Keep-Alive\r\n"
+        "\r\n",
+};
+#define BROWSER_HEADERS (sizeof(browser_headers) / sizeof(browser_headers[0]))
+
+static const char *uri_samples[] = {
+        "http://www.example.com/assets/app.js?v=3",
+        "http://news.example.org:8080/2024/05/article.html",
+        "http://img.example.net/photos/2024/cat_large.jpg",
+        "http://localhost:15213/home.html",
+        "http://cdn.example.com:80/static/css/main.8f14e45f.css",
+        "http://api.example.com/v1/search?q=proxy&page=2&sort=desc",
+        "http://example.com",
+        "http://example.com:8000/",
+};
+#define URI_SAMPLES (sizeof(uri_samples) / sizeof(uri_samples[0]))
+
+static long iters = 200000;
+static int nkeys = 4096;
+static ssize_t cache_bytes = 16 * 1024 * 1024;
+static double zipf = 1.0;
+
+static char **keys;                 // 캐시 key (정규화된 URL)
+static char **responses;            // key 별 응답 (header + body)
+static ssize_t *response_sizes;
+static int *zipf_sequence;          // Zipf 분포로 뽑은 key 번호들
+static Cache *cache;
+static char *out_buf;
+static int header_fd, line_fd;
+static rio_t rio;
+
+// 객체 크기 분포: 작은 text 가 대부분이고 가끔 큰 이미지가 섞인다
+static ssize_t object_size(unsigned int *rng, int *is_text) {
+    int r = rand_r(rng) % 100;
+
+    *is_text = r < 70;
+    if (r < 60) return 512 + rand_r(rng) % 4096;                // html, css, js
+    if (r < 70) return 8192 + rand_r(rng) % 24576;              // 큰 js 번들
+    if (r < 95) return 4096 + rand_r(rng) % 45056;              // 이미지
+    return 65536 + rand_r(rng) % (MAX_OBJECT_SIZE - 65536);     // 큰 이미지
+}
+
+// text 응답의 body, 적당히 압축되도록 단어를 섞어서 만든다
+static void fill_text(char *p, ssize_t n, unsigned int *rng) {
+    static const char *words[] = {"<div class=\"item\">", "proxy", "cache", "</div>\n", "function", "return",
+                                  "var", "=", "{", "}", ";\n", "color: #333;", "margin: 0 auto;", "lorem", "ipsum"};
+    ssize_t i = 0, len;
+    const char *w;
+
+    while (i < n) {
+        w = words[rand_r(rng) % (sizeof(words) / sizeof(words[0]))];
+        len = strlen(w);
+        if (len > n - i) len = n - i;
+        memcpy(p + i, w, len);
+        i += len;
+        if (i < n) p[i++] = ' ';
+    }
+}
+
+static void make_objects(void) {
+    unsigned int rng = 42;
+    double *cdf, sum = 0, u;
+    char host[64], path[256];
+    int i, lo, hi, mid, is_text;
+    ssize_t body, header;
+
+    keys = (char **) __libc_malloc(sizeof(char *) * nkeys);
+    responses = (char **) __libc_malloc(sizeof(char *) * nkeys);
+    response_sizes = (ssize_t *) __libc_malloc(sizeof(ssize_t) * nkeys);
+    for (i = 0; i < nkeys; i++) {
+        snprintf(host, sizeof(host), "www%d.example.com", i % 37);
+        snprintf(path, sizeof(path), "/static/%d/asset-%08x.%s", i % 113, rand_r(&rng), i % 3 ? "js" : "png");
+        keys[i] = (char *) __libc_malloc(MAXLINE);
+        build_cache_key(keys[i], host, "80", path, 0);
+
+        body = object_size(&rng, &is_text);
+        responses[i] = (char *) __libc_malloc(body + 256);
+        header = sprintf(responses[i], "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\nContent-length: %zd\r\n"
+                                       "Content-type: %s\r\n\r\n", body, is_text ? "text/html" : "image/png");
+        if (is_text) {
+            fill_text(responses[i] + header, body, &rng);
+        } else {
+            for (mid = 0; mid < body; mid++) responses[i][header + mid] = (char) rand_r(&rng);
+        }
+        response_sizes[i] = header + body;
+    }
+
+    // i 번째 key 가 1/(i+1)^zipf 에 비례하는 확률로 뽑히도록 순서를 미리 만들어 둔다
+    cdf = (double *) __libc_malloc(sizeof(double) * nkeys);
+    for (i = 0; i < nkeys; i++) {
+        sum += 1.0 / pow(i + 1, zipf);
+        cdf[i] = sum;
+    }
+    zipf_sequence = (int *) __libc_malloc(sizeof(int) * ZIPF_SEQUENCE);
+    for (i = 0; i < ZIPF_SEQUENCE; i++) {
+        u = rand_r(&rng) / ((double) RAND_MAX + 1) * sum;
+        for (lo = 0, hi = nkeys - 1; lo < hi;) {
+            mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1;
+            else hi = mid;
+        }
+        zipf_sequence[i] = lo;
+    }
+    __libc_free(cdf);
+
+    out_buf = (char *) __libc_malloc(MAX_OBJECT_SIZE + MAXLINE);
+}
+
+// 읽기용 임시 파일을 만들어 주는 함수, 만들자마자 unlink 해서 fd 만 남긴다
+static int temp_file(const char **blocks, int n, int repeat) {
+    char path[] = "/tmp/microbench.XXXXXX";
+    int fd = mkstemp(path), i, j;
+
+    unlink(path);
+    for (j = 0; j < repeat; j++) {
+        for (i = 0; i < n; i++) {
+            Rio_writen(fd, (void *) blocks[i], strlen(blocks[i]));
+        }
+    }
+    return fd;
+}
+
+/* ================= benchmark 들 ================= */
+
+// 모든 key 를 넣어서 캐시를 채워두는 함수 (get 벤치마크 준비)
+static void setup_cache(void) {
+    int i;
+
+    cache = initCache(cache_bytes);
+    for (i = nkeys - 1; i >= 0; i--) {
+        put_cache(cache, keys[i], responses[i], response_sizes[i]);
+    }
+}
+
+static void setup_empty_cache(void) {
+    cache = initCache(cache_bytes);
+}
+
+static void bench_get_cache(long i) {
+    int k = zipf_sequence[i % ZIPF_SEQUENCE];
+    get_cache(cache, keys[k], out_buf, MAX_OBJECT_SIZE + MAXLINE, 1);
+}
+
+static void bench_get_cache_inflate(long i) {
+    int k = zipf_sequence[i % ZIPF_SEQUENCE];
+    get_cache(cache, keys[k], out_buf, MAX_OBJECT_SIZE + MAXLINE, 0);
+}
+
+static void bench_put_cache(long i) {
+    int k = zipf_sequence[i % ZIPF_SEQUENCE];
+    put_cache(cache, keys[k], responses[k], response_sizes[k]);
+}
+
+static void bench_parse_uri(long i) {
+    char uri[MAXLINE], host[MAXLINE], port[MAXLINE], path[MAXLINE];
+
+    strcpy(uri, uri_samples[i % URI_SAMPLES]);
+    parse_uri(uri, host, port, path);
+}
+
+static void bench_build_cache_key(long i) {
+    char key[MAXLINE];
+    static char *paths[] = {"/a/./b/../c/index.html", "/static/%7Euser/app.js?b=2&a=1", "/", "/img/cat.jpg"};
+
+    build_cache_key(key, "WWW.Example.COM", "80", paths[i % 4], 1);
+}
+
+static void setup_headers(void) {
+    header_fd = temp_file(browser_headers, BROWSER_HEADERS, 1);
+}
+
+// 요청 line 을 읽은 상태에서 generate_header 로 나머지 header 를 읽고 server 용 header 를 만든다
+static void bench_generate_header(long i) {
+    char line[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE], head[MAXLINE];
+    static off_t offsets[BROWSER_HEADERS];
+    int n = i % BROWSER_HEADERS, j;
+
+    if (offsets[BROWSER_HEADERS - 1] == 0) {
+        for (j = 1; j < BROWSER_HEADERS; j++) {
+            offsets[j] = offsets[j - 1] + strlen(browser_headers[j - 1]);
+        }
+    }
+    lseek(header_fd, offsets[n], SEEK_SET);
+    Rio_readinitb(&rio, header_fd);
+    Rio_readlineb(&rio, line, MAXLINE);
+    sscanf(line, "%s %s %s", method, uri, version);
+    generate_header(out_buf, method, "www.example.com", "/index.html", &rio, head, DEFAULT_USER_AGENT);
+}
+
+static void setup_lines(void) {
+    line_fd = temp_file(browser_headers, BROWSER_HEADERS, 64);
+    lseek(line_fd, 0, SEEK_SET);
+    Rio_readinitb(&rio, line_fd);
+}
+
+// header line 하나를 읽는 비용, 파일 끝에 닿으면 처음으로 되감는다
+static void bench_rio_readlineb(long i) {
+    char line[MAXLINE];
+
+    if (Rio_readlineb(&rio, line, MAXLINE) == 0) {
+        lseek(line_fd, 0, SEEK_SET);
+        Rio_readinitb(&rio, line_fd);
+        Rio_readlineb(&rio, line, MAXLINE);
+    }
+}
+
+static void teardown_cache(void) {
+    CacheItem *item;
+
+    while ((item = cache->head) != NULL) {
+        removeCacheItem(cache, item);
+    }
+    free(cache);
+    cache = NULL;
+}
+
+static void teardown_fds(void) {
+    if (header_fd > 0) close(header_fd);
+    if (line_fd > 0) close(line_fd);
+    header_fd = line_fd = 0;
+}
+
+typedef struct Benchmark {
+    const char *name;
+    void (*setup)(void);
+    void (*run)(long i);
+    void (*teardown)(void);
+    int divisor;        // 기본 반복 횟수를 이 값으로 나눠서 사용 (느린 benchmark)
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+        {"get_cache",          setup_cache,       bench_get_cache,         teardown_cache, 10},
+        {"get_cache_inflate",  setup_cache,       bench_get_cache_inflate, teardown_cache, 20},
+        {"put_cache",          setup_empty_cache, bench_put_cache,         teardown_cache, 20},
+        {"parse_uri",          NULL,              bench_parse_uri,         NULL,           1},
+        {"build_cache_key",    NULL,              bench_build_cache_key,   NULL,           1},
+        {"generate_header",    setup_headers,     bench_generate_header,   teardown_fds,   1},
+        {"rio_readlineb",      setup_lines,       bench_rio_readlineb,     teardown_fds,   1},
+};
+#define BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run_benchmark(Benchmark *b) {
+    long n = iters / b->divisor, i;
+    long long t0, t1, c0 = 0, c1 = 0, a0, a1, b0, b1;
+
+    if (n < 1) n = 1;
+    if (b->setup) b->setup();
+
+    // warm-up 후 측정
+    for (i = 0; i < n / 10; i++) {
+        b->run(i);
+    }
+    a0 = alloc_count;
+    b0 = alloc_bytes;
+    t0 = now_ns();
+#ifdef HAVE_RDTSC
+    c0 = __rdtsc();
+#endif
+    for (i = 0; i < n; i++) {
+        b->run(i);
+    }
+#ifdef HAVE_RDTSC
+    c1 = __rdtsc();
+#endif
+    t1 = now_ns();
+    a1 = alloc_count;
+    b1 = alloc_bytes;
+
+    printf("%-20s %10ld %12.1f", b->name, n, (double) (t1 - t0) / n);
+#ifdef HAVE_RDTSC
+    printf(" %12.1f", (double) (c1 - c0) / n);
+#else
+    printf(" %12s", "-");
+#endif
+    printf(" %10.2f %12.1f\n", (double) (a1 - a0) / n, (double) (b1 - b0) / n);
+
+    if (b->teardown) b->teardown();
+}
+
+int main(int argc, char **argv) {
+    int opt, i, j, selected;
+
+    while ((opt = getopt(argc, argv, "n:k:m:z:")) != -1) {
+        switch (opt) {
+            case 'n': iters = atol(optarg); break;
+            case 'k': nkeys = atoi(optarg); break;
+            case 'm': cache_bytes = atoll(optarg); break;
+            case 'z': zipf = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iters] [-k keys] [-m cache_bytes] [-z zipf] [benchmark...]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    make_objects();
+    printf("# %d keys, cache %zd bytes, zipf %.2f\n", nkeys, cache_bytes, zipf);
+    printf("%-20s %10s %12s %12s %10s %12s\n", "benchmark", "iters", "ns/op", "cycles/op", "allocs/op", "bytes/op");
+    for (i = 0; i < BENCHMARKS; i++) {
+        selected = optind == argc;
+        for (j = optind; j < argc; j++) {
+            selected |= strcmp(argv[j], benchmarks[i].name) == 0;
+        }
+        if (selected) {
+            run_benchmark(&benchmarks[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * negative_cache.c - 에러 응답과 연결 실패를 짧은 시간 동안 기억하는 negative cache
+ *
+ * origin 이 죽어 있거나 자주 요청되는 URL 이 404 라면, 매 요청마다 connect 를 다시 시도하는 대신
+ * TTL 동안은 기억해 둔 결과를 바로 돌려준다.
+ * - 응답 테이블: 캐시 key -> 에러 응답 전체 (status class 별 TTL)
+ * - origin 테이블: "host:port" -> 연결 실패 시각 (connect 실패 TTL)
+ * 두 테이블 모두 만료된 항목은 조회할 때나 테이블이 가득 찼을 때 지운다.
+ */
+#include <time.h>
+#include "negative_cache.h"
+#include "cache_key.h"
+#include "util.h"
+
+// 만료 시각이 있는 항목
+typedef struct NegativeEntry {
+    char *key;
+    char *value;        // 기억해 둔 응답, origin 테이블에서는 NULL
+    ssize_t size;
+    long long expires;  // CLOCK_MONOTONIC 기준 ms
+    struct NegativeEntry *next;
+} NegativeEntry;
+
+typedef struct NegativeTable {
+    NegativeEntry *buckets[NEGATIVE_CACHE_BUCKETS];
+    int count;
+    sem_t mutex;
+} NegativeTable;
+
+static NegativeTable responses, origins;
+static pthread_once_t negative_once = PTHREAD_ONCE_INIT;
+
+static void negative_init(void) {
+    Sem_init(&responses.mutex, 0, 1);
+    Sem_init(&origins.mutex, 0, 1);
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int negative_hash(char *key) {
+    return fnv1a32_str(key) % NEGATIVE_CACHE_BUCKETS;
+}
+
+static void entry_unlink(NegativeTable *table, NegativeEntry **pp) {
+    NegativeEntry *e = *pp;
+    *pp = e->next;
+    free(e->key);
+    free(e->value);
+    free(e);
+    table->count--;
+}
+
+// key 를 찾아주는 함수, 가는 길에 만난 만료 항목은 지운다 (mutex 를 잡은 상태에서 호출)
+static NegativeEntry **table_find(NegativeTable *table, char *key, long long now) {
+    NegativeEntry **pp = &table->buckets[negative_hash(key)];
+
+    while (*pp != NULL) {
+        if ((*pp)->expires <= now) {
+            entry_unlink(table, pp);
+        } else if (strcmp((*pp)->key, key) == 0) {
+            break;
+        } else {
+            pp = &(*pp)->next;
+        }
+    }
+    return pp;
+}
+
+// 테이블에 항목을 넣는 함수, 가득 차 있으면 만료된 항목을 정리하고 그래도 자리가 없으면 넣지 않는다
+static void table_put(NegativeTable *table, char *key, char *value, ssize_t size, int ttl) {
+    long long now = now_ms();
+    NegativeEntry **pp, *e;
+    int i;
+
+    P(&table->mutex);
+    pp = table_find(table, key, now);
+    if ((e = *pp) == NULL) {
+        if (table->count >= NEGATIVE_CACHE_MAX) {
+            for (i = 0; i < NEGATIVE_CACHE_BUCKETS; i++) {
+                pp = &table->buckets[i];
+                while (*pp != NULL) {
+                    if ((*pp)->expires <= now) entry_unlink(table, pp);
+                    else pp = &(*pp)->next;
+                }
+            }
+            if (table->count >= NEGATIVE_CACHE_MAX) {
+                V(&table->mutex);
+                return;
+            }
+            pp = table_find(table, key, now);
+        }
+        e = (NegativeEntry *) malloc(sizeof(NegativeEntry));
+        e->key = strdup(key);
+        e->value = NULL;
+        e->next = NULL;
+        *pp = e;
+        table->count++;
+    }
+    free(e->value);
+    e->value = NULL;
+    if (value != NULL) {
+        e->value = (char *) malloc(size);
+        memcpy(e->value, value, size);
+    }
+    e->size = size;
+    e->expires = now + ttl * 1000LL;
+    V(&table->mutex);
+}
+
+// response 의 status code 를 읽어주는 함수, status line 이 아니면 -1
+int response_status(char *response, ssize_t size) {
+    int status;
+
+    if (size < 12 || strncmp(response, "HTTP/1.", 7) != 0 || sscanf(response + 8, " %3d", &status) != 1) {
+        return -1;
+    }
+    return status;
+}
+
+static void origin_key(char *key, char *hostname, char *port) {
+    if (snprintf(key, MAXLINE, "%s:%s", hostname, port) >= MAXLINE) {
+        key[MAXLINE - 1] = '\0';
+    }
+}
+
+// 기억해 둔 에러 응답이 있으면 buf 에 복사하고 크기를 반환, 없으면 -1
+ssize_t negative_cache_get(char *key, char *buf, ssize_t buf_size) {
+    NegativeEntry *e;
+    ssize_t size = -1;
+
+    pthread_once(&negative_once, negative_init);
+
+    P(&responses.mutex);
+    e = *table_find(&responses, key, now_ms());
+    if (e != NULL && e->size <= buf_size) {
+        memcpy(buf, e->value, e->size);
+        size = e->size;
+    }
+    V(&responses.mutex);
+    return size;
+}
+
+// 에러 응답을 ttl 초 동안 기억하는 함수
+void negative_cache_put(char *key, char *response, ssize_t size, int ttl) {
+    pthread_once(&negative_once, negative_init);
+
+    if (ttl <= 0 || size > NEGATIVE_MAX_RESPONSE) {
+        return;
+    }
+    table_put(&responses, key, response, size, ttl);
+}
+
+// pattern 에 맞는 에러 응답을 지우고 지운 개수를 반환하는 함수 (cache_key_matches 참고)
+int negative_cache_purge(char *pattern, int prefix) {
+    NegativeEntry **pp;
+    int i, n = 0;
+
+    pthread_once(&negative_once, negative_init);
+
+    P(&responses.mutex);
+    for (i = 0; i < NEGATIVE_CACHE_BUCKETS; i++) {
+        pp = &responses.buckets[i];
+        while (*pp != NULL) {
+            if (cache_key_matches((*pp)->key, pattern, prefix)) {
+                entry_unlink(&responses, pp);
+                n++;
+            } else {
+                pp = &(*pp)->next;
+            }
+        }
+    }
+    V(&responses.mutex);
+    return n;
+}
+
+// origin 이 최근 연결에 실패해서 아직 TTL 안에 있는지 확인하는 함수
+int origin_is_down(char *hostname, char *port) {
+    char key[MAXLINE];
+    int down;
+
+    pthread_once(&negative_once, negative_init);
+
+    origin_key(key, hostname, port);
+    P(&origins.mutex);
+    down = *table_find(&origins, key, now_ms()) != NULL;
+    V(&origins.mutex);
+    return down;
+}
+
+void origin_mark_down(char *hostname, char *port, int ttl) {
+    char key[MAXLINE];
+
+    pthread_once(&negative_once, negative_init);
+
+    if (ttl <= 0) {
+        return;
+    }
+    origin_key(key, hostname, port);
+    table_put(&origins, key, NULL, 0, ttl);
+}
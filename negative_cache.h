@@ -0,0 +1,25 @@
+/*
+ * negative_cache.h - 에러 응답과 연결 실패를 짧은 시간 동안 기억하는 negative cache
+ */
+#ifndef __NEGATIVE_CACHE_H__
+#define __NEGATIVE_CACHE_H__
+
+#include "csapp.h"
+
+#define NEGATIVE_CACHE_BUCKETS 1024
+#define NEGATIVE_CACHE_MAX 4096         /* 테이블 하나에 들어가는 최대 항목 수 */
+#define NEGATIVE_MAX_RESPONSE 16384     /* 이보다 큰 에러 응답은 기억하지 않음 */
+
+int response_status(char *response, ssize_t size);
+
+ssize_t negative_cache_get(char *key, char *buf, ssize_t buf_size);
+
+void negative_cache_put(char *key, char *response, ssize_t size, int ttl);
+
+int negative_cache_purge(char *pattern, int prefix);
+
+int origin_is_down(char *hostname, char *port);
+
+void origin_mark_down(char *hostname, char *port, int ttl);
+
+#endif /* __NEGATIVE_CACHE_H__ */
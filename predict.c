@@ -0,0 +1,277 @@
+/*
+ * predict.c - client 별 요청 순서에서 배운 "다음 URL" 모델로 미리 캐시에 넣는 예측 prefetch
+ *
+ * prefetch.c 는 HTML 안의 링크만 보지만, 페이지를 넘기는 순서나 API 호출 순서처럼 응답 안에 드러나지 않는
+ * 연결도 있다. predict = 1 이면 GET 요청마다 같은 client (IP 주소) 의 바로 앞 요청에서 이번 요청으로의 전이를 센다.
+ *
+ * 모델
+ * - URL (base key) 마다 PredictNode 하나: 이 URL 다음에 요청된 횟수 total 과 가장 많이 온 다음 URL PREDICT_TOP_K 개.
+ *   top-k 는 space-saving 으로 유지한다. 처음 보는 다음 URL 은 가장 적은 칸을 (그 칸의 weight + 1) 로 물려받으므로
+ *   weight 의 합은 늘 total 과 같고, weight / total 이 "다음에 이 URL 이 올 확률" 의 추정이 된다.
+ * - 모든 weight 는 predict_half_life 초마다 절반이 되도록 감쇠한다. node 를 건드릴 때 지난 시간만큼 한꺼번에 줄인다.
+ * - 같은 client 의 두 요청 사이가 PREDICT_CLIENT_GAP 초를 넘으면 이어진 것으로 보지 않는다. 같은 URL 이 이어지면 세지 않는다.
+ * - 표는 모두 hash 로 바로 찾는 고정 크기 배열이다 (충돌하면 덮어씀). predict 를 처음 켤 때 할당한다.
+ *
+ * 예측
+ * 요청된 URL 의 total 이 PREDICT_MIN_SAMPLES 이상이고 weight / total 이 predict_threshold % 이상인 다음 URL 은
+ * prefetch_submit 으로 prefetch 대기열에 넣는다. origin 으로 가는 요청이 limit 의 절반 아래 (admission_idle) 이고
+ * 대기열이 비어 쉬는 prefetch worker 가 있을 때만 넣고, 아니면 skipped_busy 로 센다 (한가할 때만 쓰는 일).
+ *
+ * 정확도
+ * 넣은 URL 은 PREDICT_TRACK 칸의 표에 남겨 두고, PREDICT_USE_WINDOW 초 안에 어느 client 든 그 URL 을 요청하면 used,
+ * 아니면 unused 로 끝낸다. 받은 바이트는 used 면 useful_bytes, unused 면 wasted_bytes 에 더한다.
+ * accuracy = used / (used + unused) 와 wasted_bytes 를 보고 predict_threshold 를 조절한다.
+ */
+#include <math.h>
+#include "predict.h"
+#include "prefetch.h"
+#include "admission.h"
+#include "accesslog.h"
+#include "stats.h"
+#include "util.h"
+
+typedef struct PredictEdge {
+    unsigned long long hash;    // 다음 URL, 0 이면 빈 칸
+    double weight;
+} PredictEdge;
+
+typedef struct PredictNode {
+    unsigned long long hash;    // 0 이면 빈 칸
+    char *url;
+    double total;               // 이 URL 다음에 온 요청 수 (감쇠), next 의 weight 합과 같음
+    long long updated_us;       // 마지막으로 감쇠를 반영한 시각
+    PredictEdge next[PREDICT_TOP_K];
+} PredictNode;
+
+typedef struct PredictClient {
+    unsigned long long client;
+    unsigned long long last;    // 이 client 가 마지막으로 요청한 URL
+    long long at_us;
+} PredictClient;
+
+typedef struct PredictTrack {
+    unsigned long long hash;    // 예측으로 넣은 URL, 0 이면 빈 칸
+    long long issued_us;
+    long long bytes;            // prefetch 로 받은 바이트
+    int fetched;
+    int used;
+} PredictTrack;
+
+static sem_t predict_mutex;
+static int predict_ready;
+static PredictNode *nodes;
+static PredictClient *clients;
+static PredictTrack *tracks;
+static int threshold;
+static long long urls, transitions, issued, used, unused, failed, skipped_busy, useful_bytes, wasted_bytes;
+
+// 시작할 때와 reload 할 때 부르는 함수, predict 가 처음 켜질 때 표를 할당한다
+void predict_configure(ProxyConfig *config) {
+    if (!predict_ready) {
+        Sem_init(&predict_mutex, 0, 1);
+        predict_ready = 1;
+    }
+    P(&predict_mutex);
+    if (config->predict && nodes == NULL) {
+        nodes = (PredictNode *) Calloc(PREDICT_URLS, sizeof(PredictNode));
+        clients = (PredictClient *) Calloc(PREDICT_CLIENTS, sizeof(PredictClient));
+        tracks = (PredictTrack *) Calloc(PREDICT_TRACK, sizeof(PredictTrack));
+    }
+    threshold = config->predict_threshold;
+    V(&predict_mutex);
+}
+
+// 지난 시간만큼 node 의 weight 들을 줄이는 함수
+static void node_decay(PredictNode *node, long long now, long long half_life_us) {
+    double factor;
+    int i;
+
+    if (now > node->updated_us) {
+        factor = exp2(-(double) (now - node->updated_us) / half_life_us);
+        node->total *= factor;
+        for (i = 0; i < PREDICT_TOP_K; i++) {
+            node->next[i].weight *= factor;
+        }
+        node->updated_us = now;
+    }
+}
+
+// URL 의 node 를 찾는 함수, 없으면 그 칸에 있던 node 를 지우고 새로 만든다
+static PredictNode *node_get(unsigned long long hash, char *url, long long now, long long half_life_us) {
+    PredictNode *node = &nodes[hash % PREDICT_URLS];
+
+    if (node->hash != hash) {
+        if (node->hash == 0) {
+            urls++;
+        }
+        free(node->url);
+        memset(node, 0, sizeof(PredictNode));
+        node->hash = hash;
+        node->url = strdup(url);
+        node->updated_us = now;
+    }
+    node_decay(node, now, half_life_us);
+    return node;
+}
+
+// node 다음에 hash 가 요청됐음을 top-k 에 반영하는 함수 (space-saving)
+static void node_learn(PredictNode *node, unsigned long long hash) {
+    PredictEdge *edge = NULL, *least = &node->next[0];
+    int i;
+
+    for (i = 0; i < PREDICT_TOP_K; i++) {
+        if (node->next[i].hash == hash) {
+            edge = &node->next[i];
+            break;
+        }
+        if (node->next[i].weight < least->weight || node->next[i].hash == 0) {
+            least = &node->next[i];
+        }
+    }
+    if (edge == NULL) {
+        edge = least;
+        edge->hash = hash;
+    }
+    edge->weight += 1;
+    node->total += 1;
+}
+
+// 예측 하나를 끝내는 함수, 요청되지 않았으면 받은 바이트는 낭비
+static void track_close(PredictTrack *track) {
+    if (track->hash != 0 && !track->used) {
+        unused++;
+        wasted_bytes += track->bytes;
+    }
+    track->hash = 0;
+}
+
+// 아직 결과를 기다리는 예측인지 확인하는 함수
+static int track_pending(unsigned long long hash, long long now) {
+    PredictTrack *track = &tracks[hash % PREDICT_TRACK];
+
+    return track->hash == hash && now - track->issued_us <= PREDICT_USE_WINDOW * 1000000LL;
+}
+
+static void track_issue(unsigned long long hash, long long now) {
+    PredictTrack *track = &tracks[hash % PREDICT_TRACK];
+
+    track_close(track);
+    *track = (PredictTrack) {hash, now, 0, 0, 0};
+    issued++;
+}
+
+// 요청된 URL 이 예측으로 넣은 것이면 맞춘 것으로 세는 함수
+static void track_use(unsigned long long hash, long long now) {
+    PredictTrack *track = &tracks[hash % PREDICT_TRACK];
+
+    if (track->hash != hash || track->used) {
+        return;
+    }
+    if (now - track->issued_us > PREDICT_USE_WINDOW * 1000000LL) {
+        track_close(track);
+        return;
+    }
+    track->used = 1;
+    used++;
+    useful_bytes += track->bytes;
+}
+
+// GET 요청마다 부르는 함수: 이 client 의 앞 요청에서 url 로의 전이를 배우고, url 다음에 올 것 같은 URL 을 prefetch 한다
+void predict_request(ProxyConfig *config, uint8_t client[16], char *url) {
+    unsigned long long hash = accesslog_hash(url), who = fnv1a64(client, 16) | 1, targets[PREDICT_TOP_K];
+    long long now = stats_now_us(), half_life_us = config->predict_half_life * 1000000LL;
+    char *target_urls[PREDICT_TOP_K];
+    int i, count = 0, idle = admission_idle(config) && prefetch_idle();
+    PredictNode *node, *from, *to;
+    PredictClient *seen;
+    PredictEdge *edge;
+
+    P(&predict_mutex);
+    if (nodes == NULL) {
+        V(&predict_mutex);
+        return;
+    }
+    track_use(hash, now);
+    node = node_get(hash, url, now, half_life_us);
+
+    seen = &clients[who % PREDICT_CLIENTS];
+    if (seen->client == who && seen->last != hash && now - seen->at_us <= PREDICT_CLIENT_GAP * 1000000LL) {
+        from = &nodes[seen->last % PREDICT_URLS];
+        if (from->hash == seen->last) {
+            node_decay(from, now, half_life_us);
+            node_learn(from, hash);
+            transitions++;
+        }
+    }
+    *seen = (PredictClient) {who, hash, now};
+
+    if (node->total >= PREDICT_MIN_SAMPLES) {
+        for (i = 0; i < PREDICT_TOP_K; i++) {
+            edge = &node->next[i];
+            to = &nodes[edge->hash % PREDICT_URLS];
+            if (edge->hash == 0 || to->hash != edge->hash || edge->weight * 100 < node->total * config->predict_threshold
+                || track_pending(edge->hash, now)) {
+                continue;
+            }
+            if (!idle) {
+                skipped_busy++;
+                continue;
+            }
+            track_issue(edge->hash, now);
+            targets[count] = edge->hash;
+            target_urls[count++] = strdup(to->url);
+        }
+    }
+    V(&predict_mutex);
+
+    // prefetch_submit 은 실패하면 바로 predict_fetched 를 부르므로 lock 밖에서
+    for (i = 0; i < count; i++) {
+        prefetch_submit(target_urls[i], config->prefetch_budget, targets[i]);
+        free(target_urls[i]);
+    }
+}
+
+// 예측으로 넣은 URL 의 prefetch 가 끝났을 때 받은 바이트를 기록하는 함수 (prefetch worker)
+void predict_fetched(unsigned long long hash, long long bytes) {
+    PredictTrack *track;
+
+    P(&predict_mutex);
+    track = tracks ? &tracks[hash % PREDICT_TRACK] : NULL;
+    if (track != NULL && track->hash == hash && !track->fetched) {
+        if (bytes <= 0 && !track->used) {
+            failed++;
+            track->hash = 0;
+        } else {
+            track->fetched = 1;
+            track->bytes = bytes;
+            if (track->used) {
+                useful_bytes += bytes;
+            }
+        }
+    }
+    V(&predict_mutex);
+}
+
+// 예측 통계를 JSON 객체로 쓰는 함수, 기다리는 시간이 지난 예측은 여기서 unused 로 끝낸다
+ssize_t predict_render(char *buf, ssize_t size) {
+    long long now = stats_now_us();
+    int i, n;
+
+    if (!predict_ready) {
+        n = snprintf(buf, size, "null");
+        return n < size ? n : size - 1;
+    }
+    P(&predict_mutex);
+    for (i = 0; tracks != NULL && i < PREDICT_TRACK; i++) {
+        if (tracks[i].hash != 0 && now - tracks[i].issued_us > PREDICT_USE_WINDOW * 1000000LL) {
+            track_close(&tracks[i]);
+        }
+    }
+    n = snprintf(buf, size, "{\"threshold\": %d, \"urls\": %lld, \"transitions\": %lld, \"issued\": %lld, "
+                            "\"used\": %lld, \"unused\": %lld, \"failed\": %lld, \"skipped_busy\": %lld, "
+                            "\"accuracy\": %.3f, \"useful_bytes\": %lld, \"wasted_bytes\": %lld}",
+                 threshold, urls, transitions, issued, used, unused, failed, skipped_busy,
+                 used + unused ? (double) used / (used + unused) : 0.0, useful_bytes, wasted_bytes);
+    V(&predict_mutex);
+    return n < size ? n : size - 1;
+}
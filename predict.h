@@ -0,0 +1,27 @@
+/*
+ * predict.h - client 별 요청 순서에서 배운 "다음 URL" 모델로 미리 캐시에 넣는 예측 prefetch
+ */
+#ifndef __PREDICT_H__
+#define __PREDICT_H__
+
+#include <stdint.h>
+#include "csapp.h"
+#include "config.h"
+
+#define PREDICT_TOP_K 4             /* URL 하나마다 기억하는 다음 URL 수 */
+#define PREDICT_URLS 8192           /* 모델에 올라가는 URL 수 (direct-mapped, 충돌하면 덮어씀) */
+#define PREDICT_CLIENTS 1024        /* 마지막 요청을 기억하는 client 수 */
+#define PREDICT_TRACK 1024          /* 결과를 기다리는 예측 수 */
+#define PREDICT_MIN_SAMPLES 3       /* 감쇠된 전이 수가 이보다 적은 URL 에서는 예측하지 않음 */
+#define PREDICT_CLIENT_GAP 30       /* 같은 client 의 두 요청이 이 초 안에 있어야 전이로 본다 */
+#define PREDICT_USE_WINDOW 120      /* 예측으로 받은 URL 이 이 초 안에 요청되어야 맞춘 것으로 본다 */
+
+void predict_configure(ProxyConfig *config);
+
+void predict_request(ProxyConfig *config, uint8_t client[16], char *url);
+
+void predict_fetched(unsigned long long hash, long long bytes);
+
+ssize_t predict_render(char *buf, ssize_t size);
+
+#endif /* __PREDICT_H__ */
@@ -0,0 +1,581 @@
+/*
+ * prefetch.c - HTML 응답에 들어있는 같은 origin 의 리소스를 미리 캐시에 넣는 prefetch
+ *
+ * 캐시할 수 있는 text/html 응답은 client 로 보내는 동안 framing (chunked.c) 이 풀어낸 body 를 HtmlScanner 에도 넘긴다.
+ * scanner 는 body 가 몇 바이트씩 나뉘어 들어와도 이어서 읽는 state machine 으로, 태그의 src 속성과
+ * <link rel=stylesheet|icon|preload href> 를 찾는다. 찾은 값을 페이지 URL 기준으로 풀어서 같은 origin 이면
+ * 바로 대기열에 넣으므로, HTML 을 다 받기 전에도 prefetch 가 시작된다.
+ *
+ * worker thread 들은 admin.c 의 preload 처럼 proxy 자신에게 GET 을 보낸다. 일반 요청과 같은 경로를 지나므로
+ * 캐시 key, Vary, 크기 제한, admission 이 똑같이 적용되고, 이미 캐시에 있으면 hit 으로 끝난다.
+ * 요청에는 "Sec-Purpose: prefetch" 를 붙이고, 이런 요청의 응답은 다시 훑지 않는다 (prefetch 가 번지지 않도록).
+ *
+ * predict.c 가 접근 기록에서 예측한 URL 도 prefetch_submit 으로 같은 대기열에 넣는다.
+ *
+ * 한도
+ * - 동시에 받는 수는 prefetch_concurrency (worker thread 수), 대기열이 가득 차면 버린다.
+ * - 페이지 하나에서 PREFETCH_MAX_URLS 개, 합쳐서 prefetch_budget 바이트까지만 받는다.
+ *   Content-Length 가 남은 예산이나 object_size 를 넘는 응답은 header 만 보고 끊는다 (캐시되지 않으므로).
+ */
+#include "prefetch.h"
+#include "request.h"
+#include "stats.h"
+#include "predict.h"
+#include "util.h"
+
+// HTML 페이지 하나에서 나온 prefetch 들이 같이 쓰는 예산, scanner 와 대기열의 URL 들이 참조한다
+typedef struct PrefetchPage {
+    int refs;
+    long long bytes;            // 지금까지 이 페이지 때문에 받은 바이트
+    long long budget;
+} PrefetchPage;
+
+typedef struct PrefetchJob {
+    char *url;
+    PrefetchPage *page;
+    unsigned long long track;   // 예측으로 넣은 URL 이면 predict.c 에 결과를 알려줄 hash, 아니면 0
+} PrefetchJob;
+
+// HtmlScanner 의 state
+enum {
+    SCAN_TEXT,
+    SCAN_TAG_OPEN,          // '<' 다음
+    SCAN_BANG,              // "<!" 다음, "--" 면 주석
+    SCAN_COMMENT,
+    SCAN_SKIP_TAG,          // 닫는 태그, doctype 등 '>' 까지 버림
+    SCAN_TAG_NAME,
+    SCAN_ATTRS,             // 속성 사이
+    SCAN_ATTR_NAME,
+    SCAN_ATTR_EQ,           // 속성 이름 뒤, '=' 를 기다림
+    SCAN_VALUE_START,
+    SCAN_VALUE,
+};
+
+struct HtmlScanner {
+    int state;
+    int html;               // text/html 200 응답이라 body 를 훑음
+    char quote;             // 값을 감싼 따옴표, 없으면 0
+    int dashes;             // 주석 안에서 연달아 본 '-' 수
+    char tag[16];
+    int tag_len;
+    char attr[16];
+    int attr_len;
+    char value[PREFETCH_URL_SIZE];
+    int value_len;          // PREFETCH_URL_SIZE 를 넘으면 그 값은 버림
+    char href[PREFETCH_URL_SIZE];   // <link> 의 href, rel 을 본 뒤 태그가 끝날 때 결정
+    int rel_ok;
+    char host[MAXLINE];     // 페이지의 origin 과 경로
+    char port[MAXLINE];
+    char origin[MAXLINE];   // "http://host:port"
+    char dir[MAXLINE];      // 상대 경로의 기준, '/' 로 끝남
+    unsigned long long seen[PREFETCH_MAX_URLS];
+    int urls;
+    PrefetchPage *page;
+};
+
+static char proxy_port[MAXLINE];
+static PrefetchJob queue[PREFETCH_QUEUE_SIZE];
+static int queue_front, queue_rear;
+static sem_t queue_mutex, queue_slots, queue_items;
+static int workers;                 // 떠 있는 worker 수 (queue_mutex)
+static int concurrency;             // 원하는 worker 수, 줄어들면 남는 worker 가 스스로 끝난다 (queue_mutex)
+static int queued;                  // 대기열에 있는 URL 수
+static int busy;                    // 받고 있는 worker 수
+static int prefetch_ready;
+
+// proxy 자신에게 연결하기 위해 listen port 를 기억하고 대기열을 만드는 함수
+void prefetch_init(char *port) {
+    snprintf(proxy_port, sizeof(proxy_port), "%s", port);
+    queue_front = queue_rear = 0;
+    Sem_init(&queue_mutex, 0, 1);
+    Sem_init(&queue_slots, 0, PREFETCH_QUEUE_SIZE);
+    Sem_init(&queue_items, 0, 0);
+    prefetch_ready = 1;
+}
+
+static void page_release(PrefetchPage *page) {
+    if (__sync_sub_and_fetch(&page->refs, 1) == 0) {
+        free(page);
+    }
+}
+
+// header 목록에서 name 줄의 값에 word 가 들어있는지 확인하는 함수 (대소문자 무시)
+static int header_has(char *headers, char *name, char *word) {
+    char value[MAXLINE], *line, *end;
+    size_t n;
+
+    for (line = headers; (line = strcasestr(line, name)) != NULL; line += strlen(name)) {
+        if (line != headers && line[-1] != '\n') {
+            continue;
+        }
+        n = (end = strstr(line, "\r\n")) != NULL ? (size_t) (end - line) : strlen(line);
+        if (n >= MAXLINE) {
+            continue;
+        }
+        memcpy(value, line, n);
+        value[n] = '\0';
+        if (strcasestr(value + strlen(name), word) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// prefetch 로 보낸 요청인지 (브라우저의 prefetch 포함) 확인하는 함수, 이런 요청의 응답은 훑지 않는다
+int prefetch_requested(char *request_header) {
+    return header_has(request_header, "Sec-Purpose:", "prefetch") || header_has(request_header, "Purpose:", "prefetch");
+}
+
+// URL 하나를 proxy 자신에게 GET 해서 캐시를 채우는 함수, 받은 바이트 수를 반환 (받지 않았으면 0)
+// 응답이 limit 이나 object_size 보다 큰 것이 header 에서 보이면 body 를 받지 않고 끊는다
+static long long prefetch_fetch(char *url, long long limit, ssize_t object_size, int *status) {
+    char buf[MAXLINE], request[MAXLINE + PREFETCH_URL_SIZE], uri[PREFETCH_URL_SIZE];
+    char hostname[PREFETCH_URL_SIZE], port[PREFETCH_URL_SIZE], filename[PREFETCH_URL_SIZE];
+    long long bytes = 0, length = -1;
+    rio_t rio;
+    ssize_t n;
+    int fd;
+
+    *status = -1;
+    if ((fd = open_clientfd("127.0.0.1", proxy_port)) < 0) {
+        return 0;
+    }
+    snprintf(uri, sizeof(uri), "%s", url);
+    parse_uri(uri, hostname, port, filename);
+    snprintf(request, sizeof(request), "GET %s %s\r\nHost: %s:%s\r\nSec-Purpose: prefetch\r\nAccept-Encoding: gzip\r\n\r\n",
+             url, STATIC_HTTP_VER, hostname, port);
+    Rio_writen(fd, request, strlen(request));
+
+    Rio_readinitb(&rio, fd);
+    if (Rio_readlineb(&rio, buf, MAXLINE) > 0) {
+        sscanf(buf, "HTTP/1.%*d %d", status);
+    }
+    while ((n = Rio_readlineb(&rio, buf, MAXLINE)) > 0 && strcmp(buf, "\r\n") != 0) {
+        if (strncasecmp(buf, "Content-Length:", 15) == 0) {
+            length = atoll(buf + 15);
+        }
+    }
+    if (length > limit || length > object_size) {
+        Close(fd);
+        return 0;
+    }
+    while (bytes <= limit && (n = Rio_readnb(&rio, buf, MAXLINE)) > 0) {
+        bytes += n;
+    }
+    Close(fd);
+    return bytes;
+}
+
+// 대기열에서 URL 을 꺼내 받는 thread, worker 가 concurrency 보다 많아지면 스스로 끝난다
+static void *prefetch_worker(void *vargp) {
+    PrefetchJob job;
+    ProxyConfig *config;
+    long long left, bytes;
+    int status;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        P(&queue_items);
+        P(&queue_mutex);
+        if (workers > concurrency) {
+            workers--;
+            V(&queue_mutex);
+            V(&queue_items);
+            return NULL;
+        }
+        job = queue[(++queue_front) % PREFETCH_QUEUE_SIZE];
+        V(&queue_mutex);
+        V(&queue_slots);
+        __sync_fetch_and_sub(&queued, 1);
+        __sync_fetch_and_add(&busy, 1);
+
+        left = job.page->budget - __atomic_load_n(&job.page->bytes, __ATOMIC_RELAXED);
+        bytes = 0;
+        if (left <= 0) {
+            stats_count(STAT_PREFETCH_SKIPPED, 1);
+        } else {
+            config = config_acquire();
+            bytes = prefetch_fetch(job.url, left, config->object_size, &status);
+            config_release(config);
+            __sync_fetch_and_add(&job.page->bytes, bytes);
+            stats_count(status >= 200 && status < 300 && bytes > 0 ? STAT_PREFETCH_FETCHED : STAT_PREFETCH_SKIPPED, 1);
+        }
+        if (job.track != 0) {
+            predict_fetched(job.track, bytes);
+        }
+        __sync_fetch_and_sub(&busy, 1);
+        free(job.url);
+        page_release(job.page);
+    }
+    return NULL;
+}
+
+// 시작할 때와 reload 할 때 worker 수를 prefetch_concurrency 에 맞추는 함수 (줄이는 것은 worker 가 다음 일을 받을 때)
+void prefetch_configure(ProxyConfig *config) {
+    pthread_t tid;
+
+    if (!prefetch_ready) {
+        return;
+    }
+    P(&queue_mutex);
+    concurrency = config->prefetch || config->predict ? config->prefetch_concurrency : 0;
+    while (workers < concurrency) {
+        Pthread_create(&tid, NULL, prefetch_worker, NULL);
+        workers++;
+    }
+    V(&queue_mutex);
+}
+
+// 찾은 URL 을 대기열에 넣는 함수, 가득 찼으면 버리고 0 (요청 경로를 막지 않도록)
+static int prefetch_enqueue(char *url, PrefetchPage *page, unsigned long long track) {
+    if (sem_trywait(&queue_slots) < 0) {
+        stats_count(STAT_PREFETCH_SKIPPED, 1);
+        return 0;
+    }
+    __sync_fetch_and_add(&page->refs, 1);
+    __sync_fetch_and_add(&queued, 1);
+    P(&queue_mutex);
+    queue[(++queue_rear) % PREFETCH_QUEUE_SIZE] = (PrefetchJob) {strdup(url), page, track};
+    V(&queue_mutex);
+    V(&queue_items);
+    stats_count(STAT_PREFETCH_QUEUED, 1);
+    return 1;
+}
+
+// 대기열이 비어 있고 쉬고 있는 worker 가 있는지 확인하는 함수
+int prefetch_idle(void) {
+    return __atomic_load_n(&queued, __ATOMIC_RELAXED) == 0 &&
+           __atomic_load_n(&busy, __ATOMIC_RELAXED) < __atomic_load_n(&concurrency, __ATOMIC_RELAXED);
+}
+
+// HTML 이 아닌 곳에서 찾은 URL 하나를 budget 바이트 한도로 대기열에 넣는 함수 (predict.c)
+// 대기열에 넣지 못했으면 track 의 결과로 0 바이트를 바로 알려준다
+void prefetch_submit(char *url, long long budget, unsigned long long track) {
+    PrefetchPage *page = (PrefetchPage *) calloc(1, sizeof(PrefetchPage));
+
+    page->refs = 1;
+    page->budget = budget;
+    if (!prefetch_ready || !prefetch_enqueue(url, page, track)) {
+        if (track != 0) {
+            predict_fetched(track, 0);
+        }
+    }
+    page_release(page);
+}
+
+// 페이지 URL (캐시 key 형태 http://host:port/path) 의 응답을 훑을 scanner 를 만드는 함수
+HtmlScanner *prefetch_scanner_new(char *page_url, ProxyConfig *config) {
+    HtmlScanner *scanner = (HtmlScanner *) calloc(1, sizeof(HtmlScanner));
+    char uri[MAXLINE], *slash, *query;
+
+    snprintf(uri, MAXLINE, "%s", page_url);
+    parse_uri(uri, scanner->host, scanner->port, scanner->dir);
+    if ((query = strchr(scanner->dir, '?')) != NULL) {
+        *query = '\0';
+    }
+    if ((slash = strrchr(scanner->dir, '/')) != NULL) {
+        slash[1] = '\0';
+    }
+    // origin 은 page_url 에서 path 앞까지
+    snprintf(scanner->origin, MAXLINE, "%s", page_url);
+    if ((slash = strchr(scanner->origin + strlen("http://"), '/')) != NULL) {
+        *slash = '\0';
+    }
+    scanner->page = (PrefetchPage *) calloc(1, sizeof(PrefetchPage));
+    scanner->page->refs = 1;
+    scanner->page->budget = config->prefetch_budget;
+    return scanner;
+}
+
+void prefetch_scanner_free(HtmlScanner *scanner) {
+    if (scanner == NULL) {
+        return;
+    }
+    page_release(scanner->page);
+    free(scanner);
+}
+
+// 응답 header 를 보고 훑을 응답 (200 text/html) 인지 정하는 함수, 훑으면 1
+int prefetch_scan_head(void *arg, char *head, size_t len) {
+    HtmlScanner *scanner = (HtmlScanner *) arg;
+    char tmp[MAXLINE];
+
+    if (len >= MAXLINE) {
+        return 0;
+    }
+    memcpy(tmp, head, len);
+    tmp[len] = '\0';
+    scanner->html = strncmp(tmp, "HTTP/1.", 7) == 0 && strncmp(tmp + 8, " 200", 4) == 0 &&
+                    header_has(tmp, "Content-Type:", "text/html");
+    return scanner->html;
+}
+
+// path 의 "." 과 ".." segment 를 풀어주는 함수 (RFC 3986 5.2.4), query 는 건드리지 않는다
+static void remove_dot_segments(char *path) {
+    char *query = strchr(path, '?'), rest[PREFETCH_URL_SIZE], *in, *out = path, *next;
+
+    snprintf(rest, sizeof(rest), "%s", query != NULL ? query : "");
+    if (query != NULL) {
+        *query = '\0';
+    }
+    for (in = path; *in != '\0'; in = next) {
+        // in 은 항상 '/' 에서 시작
+        next = strchr(in + 1, '/');
+        if (next == NULL) {
+            next = in + strlen(in);
+        }
+        if (next - in == 2 && in[1] == '.') {
+            if (*next == '\0') *out++ = '/';
+            continue;
+        }
+        if (next - in == 3 && in[1] == '.' && in[2] == '.') {
+            while (out > path && *--out != '/');
+            if (*next == '\0') *out++ = '/';
+            continue;
+        }
+        memmove(out, in, next - in);
+        out += next - in;
+    }
+    if (out == path) {
+        *out++ = '/';
+    }
+    strcpy(out, rest);
+}
+
+// 요청줄에 그대로 넣을 수 없는 바이트를 고치는 함수, 넘치면 -1
+// 브라우저처럼 tab/CR/LF 는 지우고, 나머지 공백과 제어 문자, ASCII 가 아닌 바이트는 percent-encode 한다
+// (origin 의 HTML 에서 온 값이 proxy 로 가는 loopback 요청에 header 를 끼워 넣지 못하도록)
+static int url_escape(char *value, char *out, size_t size) {
+    static const char hex[] = "0123456789ABCDEF";
+    unsigned char c;
+    size_t n = 0;
+
+    for (; (c = (unsigned char) *value) != '\0'; value++) {
+        if (c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        if (c <= ' ' || c >= 0x7f) {
+            if (n + 3 >= size) {
+                return -1;
+            }
+            out[n++] = '%';
+            out[n++] = hex[c >> 4];
+            out[n++] = hex[c & 15];
+        } else {
+            if (n + 1 >= size) {
+                return -1;
+            }
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+    return 0;
+}
+
+// 태그에서 찾은 값을 페이지 기준으로 풀어서, 같은 origin 이면 대기열에 넣는 함수
+static void scanner_submit(HtmlScanner *scanner, char *raw) {
+    char url[PREFETCH_URL_SIZE], path[PREFETCH_URL_SIZE], uri[PREFETCH_URL_SIZE], value[PREFETCH_URL_SIZE];
+    char host[PREFETCH_URL_SIZE], port[PREFETCH_URL_SIZE], *p, *q;
+    unsigned long long hash;
+    int i;
+
+    // 앞뒤 공백, fragment 를 떼고 &amp; 를 푼다
+    while (isspace((unsigned char) *raw)) raw++;
+    for (p = raw, q = raw; *p != '\0' && *p != '#'; q++) {
+        *q = strncmp(p, "&amp;", 5) == 0 ? (p += 5, '&') : *p++;
+    }
+    while (q > raw && isspace((unsigned char) q[-1])) q--;
+    *q = '\0';
+    if (*raw == '\0' || url_escape(raw, value, sizeof(value)) < 0) {
+        return;
+    }
+
+    if (strncasecmp(value, "http://", 7) == 0 || strncmp(value, "//", 2) == 0) {
+        snprintf(uri, sizeof(uri), "%s%s", value[0] == '/' ? "http:" : "", value);
+        parse_uri(uri, host, port, path);
+        if (strcasecmp(host, scanner->host) != 0 || strcmp(port, scanner->port) != 0) {
+            return;
+        }
+    } else if (value[0] == '/') {
+        snprintf(path, sizeof(path), "%s", value);
+    } else {
+        // https:, data:, javascript:, mailto: 처럼 다른 scheme 은 건너뜀
+        for (p = value; *p != '\0' && *p != '/' && *p != '?' && *p != ':'; p++);
+        if (*p == ':') {
+            return;
+        }
+        if (snprintf(path, sizeof(path), "%s%s", scanner->dir, value) >= (int) sizeof(path)) {
+            return;
+        }
+    }
+    remove_dot_segments(path);
+    if (snprintf(url, sizeof(url), "%s%s", scanner->origin, path) >= (int) sizeof(url)) {
+        return;
+    }
+
+    // 같은 페이지에서 같은 URL 은 한 번만
+    hash = fnv1a64_str(url);
+    for (i = 0; i < scanner->urls; i++) {
+        if (scanner->seen[i] == hash) {
+            return;
+        }
+    }
+    if (scanner->urls == PREFETCH_MAX_URLS) {
+        stats_count(STAT_PREFETCH_SKIPPED, 1);
+        return;
+    }
+    scanner->seen[scanner->urls++] = hash;
+    prefetch_enqueue(url, scanner->page, 0);
+}
+
+// 속성 값 하나가 끝났을 때의 처리
+static void value_end(HtmlScanner *scanner) {
+    if (scanner->value_len >= PREFETCH_URL_SIZE) {
+        return;
+    }
+    scanner->value[scanner->value_len] = '\0';
+    if (!strcmp(scanner->attr, "src")) {
+        scanner_submit(scanner, scanner->value);
+    } else if (!strcmp(scanner->tag, "link") && !strcmp(scanner->attr, "href")) {
+        strcpy(scanner->href, scanner->value);
+    } else if (!strcmp(scanner->tag, "link") && !strcmp(scanner->attr, "rel")) {
+        scanner->rel_ok = strcasestr(scanner->value, "stylesheet") != NULL || strcasestr(scanner->value, "icon") != NULL
+                          || strcasestr(scanner->value, "preload") != NULL;
+    }
+}
+
+// 태그 하나가 끝났을 때의 처리, <link> 는 rel 과 href 를 다 본 뒤에 결정한다
+static void tag_end(HtmlScanner *scanner) {
+    if (!strcmp(scanner->tag, "link") && scanner->rel_ok && scanner->href[0] != '\0') {
+        scanner_submit(scanner, scanner->href);
+    }
+    scanner->state = SCAN_TEXT;
+}
+
+// 새 속성 이름을 시작하는 함수
+static void attr_start(HtmlScanner *scanner, char c) {
+    scanner->attr[0] = tolower((unsigned char) c);
+    scanner->attr_len = 1;
+    scanner->attr[1] = '\0';
+    scanner->state = SCAN_ATTR_NAME;
+}
+
+// 풀어낸 body 의 한 조각을 훑는 함수 (framing 의 body observer)
+void prefetch_scan_body(void *arg, char *data, size_t len) {
+    HtmlScanner *scanner = (HtmlScanner *) arg;
+    size_t i;
+    char c;
+
+    if (!scanner->html) {
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        c = data[i];
+        switch (scanner->state) {
+            case SCAN_TEXT:
+                if (c == '<') scanner->state = SCAN_TAG_OPEN;
+                break;
+            case SCAN_TAG_OPEN:
+                if (isalpha((unsigned char) c)) {
+                    scanner->tag[0] = tolower((unsigned char) c);
+                    scanner->tag_len = 1;
+                    scanner->tag[1] = '\0';
+                    scanner->href[0] = '\0';
+                    scanner->rel_ok = 0;
+                    scanner->state = SCAN_TAG_NAME;
+                } else if (c == '!') {
+                    scanner->dashes = 0;
+                    scanner->state = SCAN_BANG;
+                } else {
+                    scanner->state = c == '<' ? SCAN_TAG_OPEN : (c == '/' || c == '?' ? SCAN_SKIP_TAG : SCAN_TEXT);
+                }
+                break;
+            case SCAN_BANG:
+                if (c == '-' && ++scanner->dashes == 2) {
+                    scanner->dashes = 0;
+                    scanner->state = SCAN_COMMENT;
+                } else if (c != '-') {
+                    scanner->state = c == '>' ? SCAN_TEXT : SCAN_SKIP_TAG;
+                }
+                break;
+            case SCAN_COMMENT:
+                if (c == '>' && scanner->dashes >= 2) {
+                    scanner->state = SCAN_TEXT;
+                }
+                scanner->dashes = c == '-' ? scanner->dashes + 1 : 0;
+                break;
+            case SCAN_SKIP_TAG:
+                if (c == '>') scanner->state = SCAN_TEXT;
+                break;
+            case SCAN_TAG_NAME:
+                if (isalnum((unsigned char) c)) {
+                    if (scanner->tag_len < (int) sizeof(scanner->tag) - 1) {
+                        scanner->tag[scanner->tag_len++] = tolower((unsigned char) c);
+                        scanner->tag[scanner->tag_len] = '\0';
+                    }
+                } else if (c == '>') {
+                    tag_end(scanner);
+                } else {
+                    scanner->state = SCAN_ATTRS;
+                }
+                break;
+            case SCAN_ATTRS:
+                if (c == '>') {
+                    tag_end(scanner);
+                } else if (!isspace((unsigned char) c) && c != '/') {
+                    attr_start(scanner, c);
+                }
+                break;
+            case SCAN_ATTR_NAME:
+                if (c == '=') {
+                    scanner->state = SCAN_VALUE_START;
+                } else if (c == '>') {
+                    tag_end(scanner);
+                } else if (isspace((unsigned char) c)) {
+                    scanner->state = SCAN_ATTR_EQ;
+                } else if (c == '/') {
+                    scanner->state = SCAN_ATTRS;
+                } else if (scanner->attr_len < (int) sizeof(scanner->attr) - 1) {
+                    scanner->attr[scanner->attr_len++] = tolower((unsigned char) c);
+                    scanner->attr[scanner->attr_len] = '\0';
+                }
+                break;
+            case SCAN_ATTR_EQ:
+                if (c == '=') {
+                    scanner->state = SCAN_VALUE_START;
+                } else if (c == '>') {
+                    tag_end(scanner);
+                } else if (!isspace((unsigned char) c)) {
+                    attr_start(scanner, c);
+                }
+                break;
+            case SCAN_VALUE_START:
+                if (isspace((unsigned char) c)) {
+                    break;
+                }
+                if (c == '>') {
+                    tag_end(scanner);
+                    break;
+                }
+                scanner->value_len = 0;
+                scanner->quote = c == '"' || c == '\'' ? c : 0;
+                scanner->state = SCAN_VALUE;
+                if (scanner->quote) {
+                    break;
+                }
+                /* fall through - 따옴표 없는 값의 첫 글자 */
+            case SCAN_VALUE:
+                if (scanner->quote ? c == scanner->quote : (isspace((unsigned char) c) || c == '>')) {
+                    value_end(scanner);
+                    if (c == '>') {
+                        tag_end(scanner);
+                    } else {
+                        scanner->state = SCAN_ATTRS;
+                    }
+                } else if (scanner->value_len < PREFETCH_URL_SIZE) {
+                    scanner->value[scanner->value_len++] = c;
+                }
+                break;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * prefetch.h - HTML 응답에 들어있는 같은 origin 의 리소스를 미리 캐시에 넣는 prefetch
+ */
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "csapp.h"
+#include "config.h"
+
+#define PREFETCH_MAX_WORKERS 64     /* prefetch_concurrency 의 최대값 */
+#define PREFETCH_QUEUE_SIZE 256     /* 대기열이 가득 차면 새로 찾은 URL 은 버린다 */
+#define PREFETCH_MAX_URLS 64        /* 페이지 하나에서 prefetch 하는 최대 URL 수 */
+#define PREFETCH_URL_SIZE 2048      /* 이보다 긴 속성 값은 무시 */
+
+typedef struct HtmlScanner HtmlScanner;
+
+void prefetch_init(char *port);
+
+void prefetch_configure(ProxyConfig *config);
+
+int prefetch_idle(void);
+
+void prefetch_submit(char *url, long long budget, unsigned long long track);
+
+int prefetch_requested(char *request_header);
+
+HtmlScanner *prefetch_scanner_new(char *page_url, ProxyConfig *config);
+
+int prefetch_scan_head(void *arg, char *head, size_t len);
+
+void prefetch_scan_body(void *arg, char *data, size_t len);
+
+void prefetch_scanner_free(HtmlScanner *scanner);
+
+#endif /* __PREFETCH_H__ */
@@ -0,0 +1,98 @@
+/*
+ * probes.h - bpftrace, perf 로 붙을 수 있는 USDT(static tracepoint) probe
+ *
+ * probe 하나는 코드 안에서 nop 명령 하나가 되고, 위치와 인자 정보는 ELF 의 .note.stapsdt 에만 기록된다.
+ * 아무도 붙지 않았을 때는 nop 만 실행되므로, 인자로는 이미 계산된 값만 넘겨야 한다 (strlen 등 금지).
+ * sys/sdt.h (systemtap-sdt-dev) 가 있으면 그대로 사용하고, 없으면 x86-64 에서는 같은 형식의 note 를 직접 만든다.
+ * -DPROXY_NO_PROBES 로 빌드하면 모든 probe 가 사라진다.
+ *
+ * provider 는 "proxy" 이고, probe 목록과 인자는 아래와 같다 (문자열은 char *, 시간은 us).
+ *   request_start(conn, method, uri)           요청 line 을 읽은 직후
+ *   request_done(conn, total_us)               연결을 닫을 때
+ *   cache_hit(key, size, tier)                 tier 는 "ram", "disk", "negative"
+ *   cache_miss(key)                            모든 캐시에서 찾지 못해 origin 으로 갈 때
+ *   cache_insert(key, size, raw_size)          RAM 캐시에 넣을 때 (size 는 압축 후 크기)
+ *   cache_evict(key, size)                     RAM 캐시에서 disk 로 밀려날 때
+ *   upstream_connect_start(host, port)         origin 에 connect 하기 직전
+ *   upstream_connect_done(host, port, ok, us)  connect 가 끝났을 때, 실패하면 ok 는 0
+ *   bytes_relayed(conn, bytes)                 origin 응답을 client 로 다 보냈을 때 (보낸 바이트)
+ *
+ * 예: sudo bpftrace probes/request_latency.bt (probes 디렉터리의 script 참고)
+ */
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#if defined(PROXY_NO_PROBES)
+
+/* 인자는 계산하지 않지만, 인자로만 쓰이는 변수가 unused 경고를 내지 않도록 sizeof 안에 넣어둔다 */
+#define PROXY_PROBE0(name) do { } while (0)
+#define PROXY_PROBE1(name, a1) do { (void) sizeof(a1); } while (0)
+#define PROXY_PROBE2(name, a1, a2) do { (void) sizeof(a1); (void) sizeof(a2); } while (0)
+#define PROXY_PROBE3(name, a1, a2, a3) do { (void) sizeof(a1); (void) sizeof(a2); (void) sizeof(a3); } while (0)
+#define PROXY_PROBE4(name, a1, a2, a3, a4) \
+    do { (void) sizeof(a1); (void) sizeof(a2); (void) sizeof(a3); (void) sizeof(a4); } while (0)
+
+#elif defined(__has_include) && __has_include(<sys/sdt.h>)
+
+#include <sys/sdt.h>
+
+#define PROXY_PROBE0(name) DTRACE_PROBE(proxy, name)
+#define PROXY_PROBE1(name, a1) DTRACE_PROBE1(proxy, name, a1)
+#define PROXY_PROBE2(name, a1, a2) DTRACE_PROBE2(proxy, name, a1, a2)
+#define PROXY_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(proxy, name, a1, a2, a3)
+#define PROXY_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(proxy, name, a1, a2, a3, a4)
+
+#elif defined(__x86_64__)
+
+/*
+ * sys/sdt.h 가 만드는 것과 같은 stapsdt note (version 3).
+ * 인자는 모두 long 으로 바꿔서 "8@<operand>" 로 기록하므로 tracer 에서는 arg0, arg1 ... 로 읽고,
+ * 문자열은 str(argN) 으로 읽는다. semaphore 는 사용하지 않는다.
+ */
+#define PROBE_NOTE(name, args, ...)                                                     \
+    __asm__ __volatile__("990: nop\n"                                                   \
+                         ".pushsection .note.stapsdt,\"?\",\"note\"\n"                  \
+                         ".balign 4\n"                                                  \
+                         ".4byte 992f-991f, 994f-993f, 3\n"                             \
+                         "991: .asciz \"stapsdt\"\n"                                    \
+                         "992: .balign 4\n"                                             \
+                         "993: .8byte 990b\n"                                           \
+                         ".8byte _.stapsdt.base\n"                                      \
+                         ".8byte 0\n"                                                   \
+                         ".asciz \"proxy\"\n"                                           \
+                         ".asciz \"" #name "\"\n"                                       \
+                         ".asciz \"" args "\"\n"                                        \
+                         "994: .balign 4\n"                                             \
+                         ".popsection\n"                                                \
+                         ".ifndef _.stapsdt.base\n"                                     \
+                         ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+                         ".weak _.stapsdt.base\n"                                       \
+                         ".hidden _.stapsdt.base\n"                                     \
+                         "_.stapsdt.base: .space 1\n"                                   \
+                         ".size _.stapsdt.base, 1\n"                                    \
+                         ".popsection\n"                                                \
+                         ".endif\n"                                                     \
+                         :: __VA_ARGS__)
+
+#define PROBE_ARG(a) "nor"((long) (a))
+
+#define PROXY_PROBE0(name) PROBE_NOTE(name, "")
+#define PROXY_PROBE1(name, a1) PROBE_NOTE(name, "8@%0", PROBE_ARG(a1))
+#define PROXY_PROBE2(name, a1, a2) PROBE_NOTE(name, "8@%0 8@%1", PROBE_ARG(a1), PROBE_ARG(a2))
+#define PROXY_PROBE3(name, a1, a2, a3) \
+    PROBE_NOTE(name, "8@%0 8@%1 8@%2", PROBE_ARG(a1), PROBE_ARG(a2), PROBE_ARG(a3))
+#define PROXY_PROBE4(name, a1, a2, a3, a4) \
+    PROBE_NOTE(name, "8@%0 8@%1 8@%2 8@%3", PROBE_ARG(a1), PROBE_ARG(a2), PROBE_ARG(a3), PROBE_ARG(a4))
+
+#else
+
+#define PROXY_PROBE0(name) do { } while (0)
+#define PROXY_PROBE1(name, a1) do { (void) sizeof(a1); } while (0)
+#define PROXY_PROBE2(name, a1, a2) do { (void) sizeof(a1); (void) sizeof(a2); } while (0)
+#define PROXY_PROBE3(name, a1, a2, a3) do { (void) sizeof(a1); (void) sizeof(a2); (void) sizeof(a3); } while (0)
+#define PROXY_PROBE4(name, a1, a2, a3, a4) \
+    do { (void) sizeof(a1); (void) sizeof(a2); (void) sizeof(a3); (void) sizeof(a4); } while (0)
+
+#endif
+
+#endif /* __PROBES_H__ */
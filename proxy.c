@@ -2,143 +2,488 @@
 
 #include <stdio.h>
 #include "./csapp.h"
+#include "./cache.h"
+#include "./disk_cache.h"
+#include "./config.h"
+#include "./cache_key.h"
+#include "./negative_cache.h"
+#include "./stats.h"
+#include "./trace.h"
+#include "./request.h"
+#include "./admin.h"
+#include "./memory.h"
+#include "./accesslog.h"
+#include "./timer_wheel.h"
+#include "./relay.h"
+#include "./upstream.h"
+#include "./happy_eyeballs.h"
+#include "./sockopt.h"
+#include "./h2.h"
+#include "./admission.h"
+#include "./prefetch.h"
+#include "./predict.h"
+#include "./probes.h"
+#include "./util.h"
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
 #define SERVER_HOST "127.0.0.1"
 #define SERVER_PORT 8080
-#define STATIC_HTTP_VER "HTTP/1.0"
-/* Misc constants */
-#define    MAXLINE     8192  /* Max text line length */
-#define MAXBUF   8192  /* Max I/O buffer size */
-#define LISTENQ  1024  /* Second argument to listen() */
-
-// 각 캐시 아이템
-typedef struct CacheItem {
-    char *key;
-    char *value;
-    ssize_t size;
-    struct CacheItem *prev;
-    struct CacheItem *next;
-} CacheItem;
-
-// 전체 캐시 풀
-typedef struct Cache {
-    ssize_t capacity;
-    CacheItem *head;
-    CacheItem *tail;
-} Cache;
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// 요청이 기다리는 단계별 deadline, 어느 단계에서 시간이 지났는지에 따라 408 또는 504 로 답한다
+enum {
+    DEADLINE_NONE,
+    DEADLINE_HEADER,        // client 의 요청 header 읽기 (408)
+    DEADLINE_CONNECT,       // origin 으로의 connect (504)
+    DEADLINE_FIRST_BYTE,    // origin 의 첫 바이트 (504)
+    DEADLINE_IDLE,          // origin 응답을 받는 중 read 사이의 간격 (504)
+    DEADLINE_REQUEST        // 위 단계가 아닐 때 걸려 있는 요청 전체의 deadline (504)
+};
+
+static const char *deadline_names[] = {"none", "header", "connect", "first_byte", "idle", "request"};
+
+// 연결 하나를 처리하는 deliver thread 의 실행 컨텍스트
+typedef struct Connection {
+    int connfd;
+    ProxyConfig *config;    // 요청을 처리하는 동안에는 reload 와 상관없이 같은 설정을 사용
+    char *data_buf;         // 요청 header 와 응답을 담는 버퍼
+    ssize_t buf_size;       // config->object_size + MAXLINE, 압축 해제나 header 재작성 시 여유분
+    RequestTrace trace;     // accept 부터 연결을 닫을 때까지 단계별 시각
+    int local;              // loopback 에서 온 연결인지, 캐시 관리 API 는 local 연결만 받음
+    long long reserved;     // accept 할 때 메모리 예산에서 잡아둔 버퍼 몫 (stack 은 config->thread_stack_size)
+    AccessRecord access;    // 연결을 닫을 때 access log 에 남길 레코드
+    Timer deadline;         // 지금 기다리는 단계의 deadline (요청 전체 deadline 이 더 가까우면 그 시각)
+    int deadline_phase;     // deadline 이 걸려 있는 단계
+    int expired;            // deadline 이 지나서 끊긴 단계, 아니면 DEADLINE_NONE (timer 가 울릴 때 ticker thread 가 씀)
+    int upstream;           // origin 과의 socket, deadline 이 지나면 ticker thread 가 shutdown 한다 (없으면 -1)
+    int responding;         // client 에게 응답을 보내기 시작했는지, 그 뒤에는 에러 응답 대신 연결을 끊는다
+    UpstreamServer *backend; // upstream group 으로 보낸 요청이면 고른 server, 연결을 닫을 때 결과를 돌려준다
+    int admitted;           // origin 으로 가는 요청으로 admission 을 받았는지, 연결을 닫을 때 admission_leave
+    char *body;             // client 가 보낸 요청 body (chunked 는 푼 것), origin 으로 요청 header 뒤에 이어서 보낸다
+    ssize_t body_len;
+    ssize_t body_size;      // body 로 잡은 크기, 메모리 예산에 들어가 있다
+} Connection;
 
 // cache_pool 생성
 static Cache *cache_pool;
+static int listenfd;
 
+int is_available_cache(char *data, ssize_t max_object_size);
 
-/* You won't lose style points for including this long line in your code */
-static const char *user_agent_hdr =
-        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
-        "Firefox/10.0.3";
+void *context_free(void *vargp, int clientfd, int connfd);
 
-CacheItem *createCacheItem(char *key, char *value, ssize_t size);
+void *deliver(void *vargv);
 
-Cache *initCache(void);
+int relay_response(Connection *conn, int clientfd, char *request, char *capture, ssize_t capture_size, ssize_t *captured,
+                   Framing *framing);
 
-void removeCacheItem(Cache *cache, CacheItem *item);
+void relay_event(void *vargp, int event);
 
-void put_cache(Cache *cache, char *key, char *value, ssize_t size);
+void *reload_config(void *vargp);
 
-char *get_cache(Cache *cache, char *key);
+void clienterror(int fd, char *errnum, char *shortmsg, char *longmsg);
 
-int is_available_cache(char *data);
+int negative_ttl(ProxyConfig *config, int status);
 
-void *context_free(void *vargp, int clientfd, int connfd);
+ssize_t response_head_size(char *response, ssize_t size);
 
-void *deliver(void *vargv);
+void serve_stats(int connfd, rio_t *rp, char *buf, ssize_t buf_size);
+
+long long connection_cost(ProxyConfig *config);
+
+void record_phase(Connection *conn, int phase, long long usec);
+
+void record_result(Connection *conn, int result, int status, long long bytes);
+
+void request_log(char *format, ...);
+
+void deadline_arm(Connection *conn, int phase);
+
+void deadline_expired(void *vargp);
 
-void request_to_server(int, char *, ssize_t *);
+int deadline_respond(Connection *conn);
 
-void generate_header(char *, char *, char *, char *, rio_t *, char *);
+void reject_connection(Connection *conn, int counter, char *reason);
 
-void parse_uri(char *uri, char *request_ip, char *port, char *filename);
+void overloaded_response(int fd, char *reason);
+
+Connection *connection_new(int connfd, SA *addr);
+
+int connection_start(Connection *conn, int *counter);
+
+int h2_stream_start(void *vargp, int fd);
+
+void *serve_h2(Connection *conn, rio_t *rp, char *method, char *uri, char *headers);
 
 int main(int argc, char **argv) {
-    int listenfd, *connfd;
+    Connection *conn;
     char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
     pthread_t tid;
-    cache_pool = initCache();
-
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port\n", argv[0]);
+    ProxyConfig *config;
+    sigset_t mask;
+    int opt, counter;
+
+    // -c <설정 파일>, -o key=value (여러 번 가능)
+    while ((opt = getopt(argc, argv, "c:o:")) != -1) {
+        if (opt == 'c') {
+            config_set_path(optarg);
+        } else if (opt != 'o' || config_add_override(optarg) < 0) {
+            fprintf(stderr, "usage: %s [-c config] [-o key=value]... <port>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "usage: %s [-c config] [-o key=value]... <port>\n", argv[0]);
         exit(1);
     }
+    if (config_load() < 0) {
+        exit(1);
+    }
+
+    // SIGHUP 은 reload_config thread 에서 sigwait 로만 받는다, 이후 생성되는 thread 들은 mask 를 물려받음
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    config = config_acquire();
+    cache_pool = initCache(config->cache_size);
+    if (config->disk_cache_dir[0] != '\0') {
+        disk_cache_init(config->disk_cache_dir);
+    }
+    trace_init(config->trace_file);
+    if (config->access_log_dir[0] != '\0') {
+        accesslog_init(config->access_log_dir, config->access_log_segment_size, config->access_log_segments);
+    }
+    admin_init(argv[optind]);
+    prefetch_init(argv[optind]);
+    upstream_configure(config);
+    upstream_start();
+    admission_configure(config);
+    compress_configure(config);
+    predict_configure(config);
+    prefetch_configure(config);
+    memory_start(cache_pool);
+    timer_wheel_init();
+    // client 나 origin 이 먼저 끊은 연결에 쓰더라도 프로세스가 끝나지 않도록 (csapp.c 의 Rio_writen 참고)
+    Signal(SIGPIPE, SIG_IGN);
+
+    listenfd = Open_listenfd(argv[optind]);
+    // open_listenfd 는 LISTENQ 로 listen 하므로, 설정된 backlog 로 다시 listen
+    listen(listenfd, config->listen_queue);
+    sockopt_listener(listenfd, config);
+    config_release(config);
+
+    Pthread_create(&tid, NULL, reload_config, NULL);
 
-    listenfd = Open_listenfd(argv[1]);
     while (1) {
         clientlen = sizeof(clientaddr);
-        connfd = malloc(sizeof(int));
+        conn = connection_new(sockopt_accept(listenfd, (SA *) &clientaddr, &clientlen), (SA *) &clientaddr);
+
+        // access log 를 쓰는 동안에는 연결마다 주소를 문자열로 바꾸지 않음
+        if (!accesslog_enabled()) {
+            Getnameinfo((SA *) &clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
+            printf("Accepted connection from (%s, %s)\n", hostname, port);
+        }
+
+        config = conn->config = config_acquire();
+        sockopt_client(conn->connfd, config);
+        if (connection_start(conn, &counter) < 0) {
+            reject_connection(conn, counter, counter == STAT_SHED ? "Proxy is overloaded, retry." : "Proxy is out of memory, retry.");
+        }
+    }
+}
+
+// accept 한 socket (h2 stream 이면 socketpair 의 한쪽 끝) 으로 연결 컨텍스트를 만드는 함수
+Connection *connection_new(int connfd, SA *addr) {
+    Connection *conn = malloc(sizeof(Connection));
+
+    conn->connfd = connfd;
+    trace_begin(&conn->trace);
+    accesslog_begin(&conn->access, addr);
+    timer_init(&conn->deadline, deadline_expired, conn);
+    conn->expired = DEADLINE_NONE;
+    conn->upstream = -1;
+    conn->responding = 0;
+    conn->backend = NULL;
+    conn->admitted = 0;
+    conn->body = NULL;
+    conn->body_len = 0;
+    conn->body_size = 0;
+    conn->local = admin_is_local(addr);
+    return conn;
+}
+
+// 연결의 deliver thread 를 시작하는 함수, 거절하면 -1 (counter 에 거절한 이유의 stats counter)
+// 열려 있는 연결이 이미 너무 많거나, 이 연결이 쓸 수 있는 최대 메모리를 예산 안에 미리 잡아둘 수 없으면
+// thread 를 만들지 않는다. conn->config 는 호출한 쪽이 잡아둔다
+int connection_start(Connection *conn, int *counter) {
+    ProxyConfig *config = conn->config;
+    pthread_attr_t attr;
+    pthread_t tid;
+    int rc;
+
+    if (!admission_accept(config)) {
+        *counter = STAT_SHED;
+        return -1;
+    }
+    conn->reserved = connection_cost(config);
+    if (!memory_admit(cache_pool, config->memory_budget, conn->reserved + config->thread_stack_size)) {
+        admission_close();
+        *counter = STAT_REJECTED_MEMORY;
+        return -1;
+    }
+    memory_add(MEM_CONNECTIONS, conn->reserved);
+    memory_add(MEM_STACKS, config->thread_stack_size);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, config->thread_stack_size);
+    rc = pthread_create(&tid, &attr, deliver, conn);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        memory_add(MEM_CONNECTIONS, -conn->reserved);
+        memory_add(MEM_STACKS, -config->thread_stack_size);
+        admission_close();
+        *counter = STAT_REJECTED_MEMORY;
+        return -1;
+    }
+    return 0;
+}
 
-        *connfd = Accept(listenfd, (SA *) &clientaddr, &clientlen);
+// SIGHUP 을 받으면 설정을 다시 읽어서 적용해주는 thread
+// 진행 중인 요청은 자기가 잡고 있는 이전 설정으로 끝까지 처리되고, 캐시 내용은 그대로 유지된다.
+void *reload_config(void *vargp) {
+    ProxyConfig *config;
+    ssize_t limit;
+    sigset_t mask;
+    int sig;
 
-        Getnameinfo((SA *) &clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-        printf("Accepted connection from (%s, %s)\n", hostname, port);
+    Pthread_detach(pthread_self());
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGHUP);
+
+    while (1) {
+        sigwait(&mask, &sig);
+        if (config_load() < 0) {
+            fprintf(stderr, "reload failed, keeping the current configuration\n");
+            continue;
+        }
 
-        pthread_create(&tid, NULL, deliver, connfd);
+        config = config_acquire();
+        listen(listenfd, config->listen_queue);
+        sockopt_listener(listenfd, config);
+        // memory_budget 때문에 monitor 가 줄여둔 캐시는 그대로 두고, 다시 키우는 것은 monitor 에 맡긴다
+        limit = cache_limit(cache_pool);
+        cache_resize(cache_pool, config->memory_budget > 0 && limit < config->cache_size ? limit : config->cache_size);
+        upstream_configure(config);
+        admission_configure(config);
+        compress_configure(config);
+        predict_configure(config);
+        prefetch_configure(config);
+        printf("configuration reloaded: cache_size=%zd object_size=%zd listen_queue=%d relay_buffer_size=%d\n",
+               config->cache_size, config->object_size, config->listen_queue, config->relay_buffer_size);
+        config_release(config);
     }
+    return NULL;
 }
 
 void *deliver(void *vargp) {
-    int connfd = *((int *) vargp);
+    Connection *conn = (Connection *) vargp;
+    int connfd = conn->connfd;
     pthread_detach(pthread_self());
+    trace_mark(&conn->trace, TRACE_START);
+    stats_connection_open();
 
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], data_buf[MAX_OBJECT_SIZE], version[MAX_OBJECT_SIZE];
+    ProxyConfig *config = conn->config;
+    ssize_t buf_size = conn->buf_size = config->object_size + MAXLINE;
+    char *data_buf = conn->data_buf = malloc(buf_size);
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     char filename[MAXLINE], hostname[MAXLINE], port[MAXLINE], key[MAXLINE], head_header[MAXLINE], server_header[MAXLINE];
-    char *cache_data;
-    ssize_t cache_size;
-
-    struct sockaddr_in servaddr;
-    int clientfd;
+    char base_key[MAXLINE], *request_header;
+    ssize_t cache_size, n, size;
+    long long length;
+    CacheItem *promoted;
+    Framing framing;
+    HtmlScanner *scanner = NULL;
+    int accept_gzip, status, use_cache, head;
+    long long phase_start, origin_start, connect_start;
+
+    struct sockaddr_storage servaddr;
+    socklen_t servaddr_len;
+    int clientfd = -1;
     rio_t rio;
 
     Rio_readinitb(&rio, connfd);
-    Rio_readlineb(&rio, buf, MAXLINE);
+    deadline_arm(conn, DEADLINE_HEADER);
+    if (Rio_readlineb(&rio, buf, MAXLINE) <= 0) {
+        deadline_respond(conn);
+        return context_free(vargp, -1, connfd);
+    }
+    trace_mark(&conn->trace, TRACE_REQUEST_LINE);
 
-    printf("Request headers:\n");
-    printf("%s", buf);
+    // HTTP/2 연결 preface 로 시작하면 (prior knowledge) 이 연결은 h2 session 으로 처리
+    if (config->h2c && strcmp(buf, H2_PREFACE_LINE) == 0) {
+        return serve_h2(conn, &rio, NULL, NULL, NULL);
+    }
+
+    request_log("Request headers:\n%s", buf);
 
 
     // browser 에서 요청을 보낼 때, 실제로는 host 와 uri 를 따로 보낸다: http://localhost/index.html X -> /index.html
     // 따라서 path 만 포함하기 위해 따로 구현해 줄 사항이 없다.
     sscanf(buf, "%s %s %s", method, uri, version);
+    trace_label(&conn->trace, method, uri);
+    conn->access.method = accesslog_method(method);
+    PROXY_PROBE3(request_start, conn, method, uri);
+
+    // proxy 자신에게 온 통계 요청이면 origin 으로 보내지 않고 바로 응답
+    if (strcmp(uri, STATS_PATH) == 0) {
+        accesslog_key(&conn->access, uri);
+        serve_stats(connfd, &rio, data_buf, buf_size);
+        record_result(conn, ACCESS_LOCAL, 200, 0);
+        return context_free(vargp, -1, connfd);
+    }
+    // 캐시 관리 요청도 origin 으로 보내지 않음 (admin.c 참고)
+    if (strncmp(uri, ADMIN_PATH, strlen(ADMIN_PATH)) == 0) {
+        accesslog_key(&conn->access, uri);
+        admin_serve(connfd, &rio, method, uri, conn->local, cache_pool, config);
+        record_result(conn, ACCESS_LOCAL, 0, 0);
+        return context_free(vargp, -1, connfd);
+    }
+    stats_count(STAT_REQUESTS, 1);
 
+    // parse_uri 가 uri 를 자르므로 h2c upgrade 에 쓸 원래 uri 는 buf 에 남겨둔다
+    strcpy(buf, uri);
     parse_uri(uri, hostname, port, filename);
 
-    // proxy_client socket 생성 및 verification
-    clientfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientfd == -1) {
-        printf("socket creation failed...\n");
-        return NULL;
+    // generate_header 에서는 GET 요청을 위한 헤더와 HEAD 요청을 위한 헤더를 생성함
+    generate_header(data_buf, method, hostname, filename, &rio, head_header, config->user_agent);
+    // body 가 있는 요청이면 header 와 같은 deadline 안에 끝까지 읽어둔다 (chunked 는 풀어서, request.c 참고)
+    // 버퍼는 Content-Length 를 알면 그만큼, chunked 면 request_body_size 만큼 메모리 예산 안에서 잡는다
+    if (request_has_body(data_buf) && conn->expired == DEADLINE_NONE) {
+        length = request_body_length(data_buf);
+        size = length >= 0 ? length : config->request_body_size;
+        if (length > config->request_body_size) {
+            n = -2;
+        } else if (!memory_admit(cache_pool, config->memory_budget, size)
+                   || (conn->body = (char *) malloc(size)) == NULL) {
+            conn->responding = 1;
+            overloaded_response(connfd, "Proxy is out of memory for the request body, retry.");
+            stats_count(STAT_REJECTED_MEMORY, 1);
+            record_result(conn, ACCESS_ERROR, 503, 0);
+            return context_free(vargp, clientfd, connfd);
+        } else {
+            conn->body_size = size;
+            memory_add(MEM_CONNECTIONS, size);
+            n = read_request_body(&rio, data_buf, head_header, conn->body, size);
+        }
+        if (n < 0) {
+            if (!deadline_respond(conn)) {
+                conn->responding = 1;
+                if (n == -2) {
+                    clienterror(connfd, "413", "Payload Too Large", "Request body is larger than request_body_size");
+                } else {
+                    clienterror(connfd, "400", "Bad Request", "Proxy could not read the request body");
+                }
+                record_result(conn, ACCESS_ERROR, n == -2 ? 413 : 400, 0);
+            }
+            return context_free(vargp, clientfd, connfd);
+        }
+        conn->body_len = n;
+    }
+    if (deadline_respond(conn)) {
+        return context_free(vargp, clientfd, connfd);
+    }
+    deadline_arm(conn, DEADLINE_NONE);
+
+    // "Upgrade: h2c" 요청이면 101 로 답하고, 이 요청을 stream 1 로 해서 h2 session 으로 넘어감
+    if (config->h2c && h2_upgrade_requested(method, data_buf)) {
+        return serve_h2(conn, &rio, method, buf, data_buf);
     }
 
-    // generate_header 에서는 GET 요청을 위한 헤더와 HEAD 요청을 위한 헤더를 생성함
-    generate_header(data_buf, method, hostname, filename, &rio, head_header);
+    accept_gzip = accepts_gzip(data_buf);
+    // gzip 은 proxy 가 직접 하므로 origin 에는 Accept-Encoding 을 보내지 않는다
+    // (origin 이 압축한 body 가 identity 로 캐시되어 gzip 을 받지 않는 client 에게 나가지 않도록)
+    remove_header(data_buf, "Accept-Encoding:");
+    remove_header(head_header, "Accept-Encoding:");
+
+    // 캐시는 GET 만 찾고 저장한다. HEAD 는 GET 으로 저장된 항목의 header 만 보내고 (저장하지 않음),
+    // 그 밖의 method 는 body 가 있을 수 있으므로 캐시를 거치지 않고 origin 으로 보낸다
+    // cache = 0 이면 모든 요청이 miss 경로로 간다
+    use_cache = config->cache && strcasecmp(method, "GET") == 0;
+    head = config->cache && strcasecmp(method, "HEAD") == 0;
+
+    // 같은 객체를 가리키는 요청들이 같은 key 를 갖도록 정규화하고,
+    // origin 이 Vary 를 보낸 적이 있는 URL 이면 해당 header 값이 붙은 variant key 를 사용
+    build_cache_key(base_key, hostname, port, filename, config->sort_query);
+    cache_variant_key(key, base_key, data_buf);
+    accesslog_key(&conn->access, key);
+
+    // 이 client 의 앞 요청에서 이번 URL 로의 전이를 배우고, 다음에 올 것 같은 URL 을 미리 캐시에 넣음 (predict.c)
+    if (config->predict && strcasecmp(method, "GET") == 0 && !prefetch_requested(data_buf)) {
+        predict_request(config, conn->access.client, base_key);
+    }
 
-    strcat(key, hostname);
-    strcat(key, filename);
+    phase_start = trace_mark(&conn->trace, TRACE_HEADERS);
+    record_phase(conn, PHASE_PARSE, phase_start - conn->trace.marks[TRACE_START]);
 
 
-    cache_data = get_cache(cache_pool, key);
+    cache_size = use_cache || head ? get_cache(cache_pool, key, data_buf, buf_size, accept_gzip) : 0;
 
     // 캐시에 있으면 그대로 반환
-    if (cache_data != NULL) {
-        Rio_writen(connfd, cache_data, MAX_OBJECT_SIZE);
+    if (cache_size > 0) {
+        if (head) {
+            cache_size = response_head_size(data_buf, cache_size);
+        }
+        trace_mark(&conn->trace, TRACE_CACHE);
+        conn->responding = 1;
+        Rio_writen(connfd, data_buf, cache_size);
+        stats_count(STAT_HIT_RAM, 1);
+        stats_count(STAT_BYTES_CACHE, cache_size);
+        record_result(conn, ACCESS_HIT_RAM, response_status(data_buf, cache_size), cache_size);
+        record_phase(conn, PHASE_CACHE, trace_mark(&conn->trace, TRACE_SEND) - phase_start);
 
-        printf("\n%s %s%s cache Hit! Get From cache\n", method, hostname, filename);
+        request_log("\n%s %s%s cache Hit! Get From cache\n", method, hostname, filename);
 
         // 요청 및 데이터 전달 완료 후 clientfd/connfd close, 동적할당 된 vargp free
         return context_free(vargp, clientfd, connfd);
     }
+
+    // RAM 에 없으면 disk cache 확인, 자주 찾는 객체라면 다시 RAM 으로 올려줌 (sendfile 로 전부 보내므로 GET 만)
+    conn->responding = 1;
+    if (use_cache && (n = disk_cache_serve(connfd, key, data_buf, buf_size, accept_gzip, &promoted)) >= 0) {
+        if (promoted != NULL) {
+            insert_cache_item(cache_pool, promoted);
+        }
+        stats_count(STAT_HIT_DISK, 1);
+        // sendfile 로 보낸 응답은 읽어보지 않으므로 status 를 알 수 없다
+        record_result(conn, ACCESS_HIT_DISK, 0, n);
+        record_phase(conn, PHASE_CACHE, trace_mark(&conn->trace, TRACE_SEND) - phase_start);
+
+        request_log("\n%s %s%s cache Hit! Get From disk\n", method, hostname, filename);
+
+        return context_free(vargp, clientfd, connfd);
+    }
+    conn->responding = 0;
+
+    // 최근에 에러로 끝난 요청이라면 TTL 동안은 기억해 둔 에러 응답을 그대로 반환
+    if ((use_cache || head) && (cache_size = negative_cache_get(key, data_buf, buf_size)) > 0) {
+        if (head) {
+            cache_size = response_head_size(data_buf, cache_size);
+        }
+        trace_mark(&conn->trace, TRACE_CACHE);
+        conn->responding = 1;
+        Rio_writen(connfd, data_buf, cache_size);
+        stats_count(STAT_HIT_NEGATIVE, 1);
+        stats_count(STAT_BYTES_CACHE, cache_size);
+        record_result(conn, ACCESS_HIT_NEGATIVE, response_status(data_buf, cache_size), cache_size);
+        PROXY_PROBE3(cache_hit, key, cache_size, "negative");
+        record_phase(conn, PHASE_CACHE, trace_mark(&conn->trace, TRACE_SEND) - phase_start);
+
+        request_log("\n%s %s%s negative cache Hit!\n", method, hostname, filename);
+
+        return context_free(vargp, clientfd, connfd);
+    }
     // ================= 캐시에 값이 있다면, 위에서 로직 종료 =================
 
 
@@ -150,57 +495,137 @@ void *deliver(void *vargp) {
 
 
 
+    // 과부하라면 origin 에 연결하지 않고 바로 503 (캐시 hit 은 위에서 이미 나갔다, admission.c 참고)
+    if (!admission_enter(config, conn->trace.marks[TRACE_START] - conn->trace.marks[TRACE_ACCEPT])) {
+        request_log("\n%s %s%s shed, proxy is overloaded\n", method, hostname, filename);
+        conn->responding = 1;
+        overloaded_response(connfd, "Proxy is overloaded, retry.");
+        stats_count(STAT_SHED, 1);
+        record_result(conn, ACCESS_ERROR, 503, 0);
+        return context_free(vargp, clientfd, connfd);
+    }
+    conn->admitted = 1;
+
     // 캐시에 값이 없다면, 서버로부터 데이터를 불러옴
-    printf("\n%s %s%s cache Miss! Get From Server\n", method, hostname, filename);
+    request_log("\n%s %s%s cache Miss! Get From Server\n", method, hostname, filename);
+    stats_count(STAT_MISS, 1);
+    PROXY_PROBE1(cache_miss, key);
+    origin_start = trace_mark(&conn->trace, TRACE_CACHE);
+    record_phase(conn, PHASE_CACHE, origin_start - phase_start);
+
+    // host 가 upstream group 이름이면 group 에서 고른 server 로 연결 (캐시 key 와 Host header 는 group 이름 그대로)
+    if (upstream_pick(hostname, &conn->backend)) {
+        if (conn->backend == NULL) {
+            request_log("upstream %s has no available server\n", hostname);
+            clienterror(connfd, "502", "Bad Gateway", "No upstream server is available");
+            record_result(conn, ACCESS_ERROR, 502, 0);
+            stats_count(STAT_ORIGIN_ERRORS, 1);
+            return context_free(vargp, clientfd, connfd);
+        }
+        strcpy(hostname, conn->backend->host);
+        strcpy(port, conn->backend->port);
+    }
 
     // localhost 는 127.0.0.1 로 변경
     if (strcmp(hostname, "localhost") == 0) {
         strcpy(hostname, SERVER_HOST);
     }
 
-    // servaddr 구조체 초기화
-    memset(&servaddr, 0, sizeof(servaddr));
-
-    // assign IP, PORT
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = inet_addr(hostname);
-    servaddr.sin_port = htons(atoi(port)); // network byte 순서를 big endian 순서로 하기 위한 htons 함수
 
+    // 최근에 연결이 실패한 origin 이라면 TTL 동안은 connect 를 다시 시도하지 않음 (upstream server 는 upstream_pick 이 거름)
+    if (conn->backend == NULL && origin_is_down(hostname, port)) {
+        request_log("origin %s:%s is marked down, skipping connect\n", hostname, port);
+        clienterror(connfd, "502", "Bad Gateway", "Origin server was recently unreachable");
+        record_result(conn, ACCESS_ERROR, 502, 0);
+        stats_count(STAT_ORIGIN_ERRORS, 1);
+        return context_free(vargp, clientfd, connfd);
+    }
 
     // 1. server 와 connection 생성
-    if (connect(clientfd, (SA *) &servaddr, sizeof(servaddr)) != 0) {
-        printf("connection with the server failed...\n");
-        return NULL;
+    // hostname 의 모든 주소(IPv6/IPv4)로 non-blocking connect 를 경주시켜 먼저 붙은 것을 쓰고 (happy_eyeballs.c),
+    // 그 주소를 servaddr 에 받아둬서 3 의 재연결에 다시 씀
+    // 연결 중인 socket 들은 origin_connect 가 connect_timeout_ms 안에서 직접 정리하므로 upstream 에 넣지 않는다
+    connect_start = stats_now_us();
+    PROXY_PROBE2(upstream_connect_start, hostname, port);
+    deadline_arm(conn, DEADLINE_CONNECT);
+    if ((clientfd = origin_connect(hostname, port, config, &servaddr, &servaddr_len)) < 0) {
+        if (errno == ETIMEDOUT && conn->expired == DEADLINE_NONE) {
+            conn->expired = DEADLINE_CONNECT;
+        }
+        PROXY_PROBE4(upstream_connect_done, hostname, port, 0, stats_now_us() - connect_start);
+        request_log("connection with the server failed...\n");
+        origin_mark_down(hostname, port, config->connect_fail_ttl);
+        if (!deadline_respond(conn)) {
+            clienterror(connfd, "502", "Bad Gateway", "Proxy could not connect to the origin server");
+            record_result(conn, ACCESS_ERROR, 502, 0);
+        }
+        stats_count(STAT_ORIGIN_ERRORS, 1);
+        return context_free(vargp, clientfd, connfd);
     }
+    conn->upstream = clientfd;
+    phase_start = trace_mark(&conn->trace, TRACE_CONNECT);
+    PROXY_PROBE4(upstream_connect_done, hostname, port, 1, phase_start - connect_start);
+    record_phase(conn, PHASE_CONNECT, phase_start - origin_start);
 
 
     // 2. server 에 HEAD 요청 전송
     // 이 때 HEAD 요청을 전송하는 이유는, 지금 불러오고자 하는 데이터가 캐싱 가능한 크기인지 content-length 를 통해서 확인하고자 함이다.
-    Rio_writen(clientfd, head_header, MAXLINE);
-    Rio_readn(clientfd, server_header, MAX_OBJECT_SIZE);
+    deadline_arm(conn, DEADLINE_FIRST_BYTE);
+    Rio_writen(clientfd, head_header, strlen(head_header));
+    n = Rio_readn(clientfd, server_header, MAXLINE - 1);
+    server_header[n] = '\0';
+    // timer 가 이 socket 을 건드리지 않도록 upstream 을 지우고 (timer 의 lock 을 거치면서 ticker 에 보임) 닫음
+    conn->upstream = -1;
+    deadline_arm(conn, DEADLINE_NONE);
     Close(clientfd);
-
-
-    // 3. HTTP 특성상 방금 전 HEAD 요청으로 인해 서버와의 connection 이 종료되었으므로, 다시 연결 생성
-    clientfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (connect(clientfd, (SA *) &servaddr, sizeof(servaddr)) != 0) {
-        printf("connection with the server failed...\n");
-        return NULL;
+    trace_mark(&conn->trace, TRACE_HEAD_PROBE);
+    if (deadline_respond(conn)) {
+        return context_free(vargp, -1, connfd);
     }
 
 
-    // 4-1. 캐시 불가능한 파일이라면, 용량이 큰 파일이라는 의미이므로, while 문을 사용해서 server 로 부터 받은 데이터를 그대로 client 로 지속적 전달해줌
-    if (is_available_cache(server_header) == 0) {
-        printf("\n %s cache unavailable\n ", server_header);
-
-        Rio_writen(clientfd, data_buf, MAXLINE);
-
-        memset(data_buf, 0, MAXLINE);
-
-        while (Rio_readn(clientfd, data_buf, MAXLINE) > 0) {
-            Rio_writen(connfd, data_buf, MAXLINE);
-            memset(data_buf, 0, MAXLINE);
+    // 3. HTTP 특성상 방금 전 HEAD 요청으로 인해 서버와의 connection 이 종료되었으므로, 다시 연결 생성
+    connect_start = conn->trace.marks[TRACE_HEAD_PROBE];
+    PROXY_PROBE2(upstream_connect_start, hostname, port);
+    deadline_arm(conn, DEADLINE_CONNECT);
+    if ((clientfd = origin_connect_addr((SA *) &servaddr, servaddr_len, config, config->connect_timeout_ms)) < 0) {
+        if (errno == ETIMEDOUT && conn->expired == DEADLINE_NONE) {
+            conn->expired = DEADLINE_CONNECT;
+        }
+        PROXY_PROBE4(upstream_connect_done, hostname, port, 0, stats_now_us() - connect_start);
+        request_log("connection with the server failed...\n");
+        origin_mark_down(hostname, port, config->connect_fail_ttl);
+        if (!deadline_respond(conn)) {
+            clienterror(connfd, "502", "Bad Gateway", "Proxy could not connect to the origin server");
+            record_result(conn, ACCESS_ERROR, 502, 0);
         }
+        stats_count(STAT_ORIGIN_ERRORS, 1);
+        return context_free(vargp, clientfd, connfd);
+    }
+    conn->upstream = clientfd;
+    PROXY_PROBE4(upstream_connect_done, hostname, port, 1, trace_mark(&conn->trace, TRACE_RECONNECT) - connect_start);
+
+
+    // origin 응답이 chunked 면 풀어서 보내고, 길이를 모르는 응답은 HTTP/1.1 client 에게 chunked 로 감싸서 보냄 (chunked.c)
+    // gzip 을 받는 client 에게는 텍스트 응답을 보내면서 압축함 (compress.c)
+    framing_init(&framing, strcasecmp(version, "HTTP/1.1") == 0, strcasecmp(method, "HEAD") == 0,
+                 config->gzip && accept_gzip);
+
+    // 4-1. 캐시 불가능한 파일이라면, 용량이 큰 파일이라는 의미이므로, server 로 부터 받은 데이터를 relay 버퍼를 거쳐 그대로 client 로 전달해줌
+    if (is_available_cache(server_header, config->object_size) == 0) {
+        request_log("\n %s cache unavailable\n ", server_header);
+
+        // status 를 알기 위해 응답 앞부분만 server_header 에 받아둠
+        relay_response(conn, clientfd, data_buf, server_header, MAXLINE - 1, &n, &framing);
+        framing_free(&framing);
+        clientfd = conn->upstream;
+        conn->access.status = response_status(server_header, n);
+        stats_count(STAT_UNCACHEABLE, 1);
+        conn->access.result = ACCESS_UNCACHEABLE;
+        // 보내던 도중에 시간이 지났다면 응답이 잘린 채로 연결을 끊는다
+        deadline_respond(conn);
+        record_phase(conn, PHASE_ORIGIN, conn->trace.marks[TRACE_TRANSFER] - phase_start);
+        stats_record_origin(hostname, port, conn->trace.marks[TRACE_TRANSFER] - origin_start);
 
         // 요청 및 데이터 전달 완료 후 clientfd/connfd close, 동적할당 된 vargp free
         return context_free(vargp, clientfd, connfd);
@@ -209,17 +634,56 @@ void *deliver(void *vargp) {
 
     // 4-2 캐시 가능한 파일이라면, 아래에서 캐시를 위한 로직을 실행해 줌
     // 서버로 요청 전송 및 응답 데이터 저장
-    request_to_server(clientfd, data_buf, &cache_size);
+    // 응답이 data_buf 를 덮어쓰므로, Vary 처리를 위해 요청 header 는 따로 보관
+    // 받는 동안 client 로도 바로 보내므로, 끝까지 받지 못했거나 object_size 를 넘었다면 캐시하지 않음
+    // chunked 응답은 풀린 body 가 담기므로 hit 때 쓸 Content-Length 를 붙여둔다 (압축해서 보낸 응답은 압축 전 크기)
+    // prefetch 가 켜져 있으면 HTML 응답을 보내면서 훑어서 같은 origin 의 리소스를 미리 캐시에 넣음 (prefetch.c)
+    // prefetch 로 온 요청의 응답은 훑지 않는다
+    if (config->prefetch && strcasecmp(method, "GET") == 0 && !prefetch_requested(data_buf)) {
+        scanner = prefetch_scanner_new(base_key, config);
+        framing_observe(&framing, prefetch_scan_head, prefetch_scan_body, scanner);
+    }
+    request_header = strdup(data_buf);
+    if (relay_response(conn, clientfd, request_header, data_buf, config->object_size, &cache_size, &framing) < 0
+        || !framing.complete) {
+        cache_size = -1;
+    } else if (!framing.head_only) {
+        cache_size = framing_set_length(&framing, data_buf, cache_size, buf_size);
+    }
+    framing_free(&framing);
+    prefetch_scanner_free(scanner);
+    clientfd = conn->upstream;
+    record_phase(conn, PHASE_ORIGIN, conn->trace.marks[TRACE_TRANSFER] - phase_start);
+    stats_record_origin(hostname, port, conn->trace.marks[TRACE_TRANSFER] - origin_start);
+
+    // 받는 도중에 시간이 지났다면 잘린 응답이므로 캐시하지 않고, 아직 아무것도 보내지 않았다면 504
+    if (deadline_respond(conn)) {
+        free(request_header);
+        return context_free(vargp, clientfd, connfd);
+    }
 
     // 5. 제대로 된 데이터가 들어왔는지 확인
-    if (0 < cache_size) {
-        // 데이터가 제대로 들어왔다면, cache 삽입
-        put_cache(cache_pool, key, data_buf, cache_size);
+    // 에러 응답은 캐시 대신 negative cache 에 짧게 기억하고, Vary: * 처럼 캐시하면 안 되는 응답은 건너뜀
+    // GET 이 아닌 요청의 응답 (HEAD 의 header 만 있는 응답 포함) 은 GET key 로 저장하지 않음
+    status = response_status(data_buf, cache_size);
+    record_result(conn, ACCESS_MISS, status, conn->access.bytes);
+    if (use_cache && status >= 400) {
+        negative_cache_put(key, data_buf, cache_size, negative_ttl(config, status));
+    } else if (use_cache && 0 < cache_size && conn->body == NULL && (!framing.compressed || framing.body_len <= config->object_size)
+               && cache_learn_vary(key, base_key, data_buf, cache_size, request_header) == 0) {
+        // 데이터가 제대로 들어왔다면, cache 삽입 (보내면서 압축했다면 압축된 body 그대로, 풀었을 때 object_size 이하인 것만)
+        if (framing.compressed) {
+            put_cache_gzip(cache_pool, key, data_buf, cache_size, framing.body_len);
+        } else {
+            put_cache(cache_pool, key, data_buf, cache_size);
+        }
+        if (!accesslog_enabled()) {
+            cache_report(cache_pool);
+        }
     }
-
-
-    // 6. 캐시를 마치고, 서버로부터 받은 data 를 client 에 전송
-    Rio_writen(connfd, data_buf, MAX_OBJECT_SIZE);
+    free(request_header);
+    trace_mark(&conn->trace, TRACE_STORE);
+    trace_mark(&conn->trace, TRACE_SEND);
 
 
     // 요청 및 데이터 전달 완료 후 clientfd/connfd close, 동적할당 된 vargp free
@@ -228,191 +692,347 @@ void *deliver(void *vargp) {
 
 // 실행 컨텍스트를 마무리해주는 함수
 void *context_free(void *vargp, int clientfd, int connfd) {
-    free(vargp);
-    Close(clientfd);
+    Connection *conn = (Connection *) vargp;
+    long long total, ttfb = 0;
+
+    // 닫은 fd 번호가 다른 연결에 다시 쓰일 수 있으므로, 닫기 전에 timer 를 먼저 푼다
+    timer_cancel(&conn->deadline);
+    if (clientfd >= 0) {
+        Close(clientfd);
+    }
     Close(connfd);
+
+    // 연결 실패(502), deadline, 5xx 나 응답이 없었던 경우는 upstream server 의 실패로 센다
+    if (conn->backend != NULL) {
+        if (conn->trace.marks[TRACE_TTFB] > 0 && conn->trace.marks[TRACE_RECONNECT] > 0) {
+            ttfb = conn->trace.marks[TRACE_TTFB] - conn->trace.marks[TRACE_RECONNECT];
+        }
+        upstream_done(conn->backend, conn->expired == DEADLINE_NONE && conn->access.status > 0
+                                     && conn->access.status < 500, ttfb, conn->config);
+    }
+    // origin 으로 출발해서 첫 바이트를 받을 때까지 (받지 못했다면 지금까지) 걸린 시간으로 동시 실행 limit 을 조절
+    if (conn->admitted) {
+        ttfb = (conn->trace.marks[TRACE_TTFB] > 0 ? conn->trace.marks[TRACE_TTFB] : stats_now_us())
+               - conn->trace.marks[TRACE_CACHE];
+        admission_leave(conn->config, ttfb, conn->expired == DEADLINE_NONE);
+    }
+    admission_close();
+
+    total = trace_mark(&conn->trace, TRACE_DONE) - conn->trace.marks[TRACE_ACCEPT];
+    record_phase(conn, PHASE_TOTAL, total);
+    PROXY_PROBE2(request_done, conn, total);
+    accesslog_write(&conn->access);
+    stats_connection_close();
+    trace_finish(&conn->trace, conn->config->trace_sample, conn->config->slow_request_ms);
+    memory_add(MEM_CONNECTIONS, -conn->reserved - conn->body_size);
+    memory_add(MEM_STACKS, -conn->config->thread_stack_size);
+    config_release(conn->config);
+    free(conn->body);
+    free(conn->data_buf);
+    free(conn);
     return NULL;
 }
 
-// header 를 만들어주는 generate_header 함수
-void generate_header(char *buf, char *method, char *hostname, char *filename, rio_t *rp, char *head_header) {
-    char tmp_buf[MAXLINE];
+// 캐시된 응답에서 header 부분 (빈 줄까지) 의 길이를 구하는 함수, HEAD 요청에 body 없이 보낼 때 사용
+ssize_t response_head_size(char *response, ssize_t size) {
+    char *end;
 
-    memset(tmp_buf, 0, MAXLINE);
-
-    sprintf(buf, "%s %s %s\r\n", method, filename, STATIC_HTTP_VER);
-    sprintf(buf, "%s%s\r\n", buf, user_agent_hdr);
-    sprintf(buf, "%sConnection: close\r\n", buf);
-    sprintf(buf, "%sProxy-Connection: close\r\n", buf);
-
-    // head 요청을 위한 header 생성
+    for (end = response; end + 4 <= response + size; end++) {
+        if (memcmp(end, "\r\n\r\n", 4) == 0) {
+            return end + 4 - response;
+        }
+    }
+    return size;
+}
 
-    sprintf(head_header, "%s %s %s\r\n", "HEAD", filename, STATIC_HTTP_VER);
-    sprintf(head_header, "%s%s\r\n", head_header, user_agent_hdr);
-    sprintf(head_header, "%sConnection: close\r\n", head_header);
-    sprintf(head_header, "%sProxy-Connection: close\r\n", head_header);
+// client 에게 에러 응답을 보내주는 함수 (tiny 의 clienterror 와 같은 형식)
+void clienterror(int fd, char *errnum, char *shortmsg, char *longmsg) {
+    char buf[MAXLINE], body[MAXBUF];
+
+    snprintf(body, MAXBUF, "<html><title>Proxy Error</title><body bgcolor=\"ffffff\">\r\n"
+                           "%s: %s\r\n<p>%s\r\n<hr><em>The Proxy server</em>\r\n</body></html>\r\n",
+             errnum, shortmsg, longmsg);
+    snprintf(buf, MAXLINE, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\nConnection: close\r\n\r\n",
+             errnum, shortmsg, (int) strlen(body));
+    Rio_writen(fd, buf, strlen(buf));
+    Rio_writen(fd, body, strlen(body));
+}
 
-    int host_flag = 0;
+// 통계 요청에 응답해주는 함수, 요청 header 는 읽어서 버린다
+void serve_stats(int connfd, rio_t *rp, char *buf, ssize_t buf_size) {
+    char header[MAXLINE];
+    ssize_t n;
 
-    while (strcmp(tmp_buf, "\r\n")) {
-        Rio_readlineb(rp, tmp_buf, MAXLINE);
-        if (strcasestr(tmp_buf, "GET") || strcasestr(tmp_buf, "HEAD") || strcasestr(tmp_buf, "User-Agent") ||
-            strcasestr(tmp_buf, "Connection") || strcasestr(tmp_buf, "Proxy-Connection")) {
-            continue;
-        } else if (strcasestr(tmp_buf, "HOST: ")) {
-            host_flag++;
+    do {
+        if (Rio_readlineb(rp, header, MAXLINE) <= 0) {
+            break;
         }
-        strcat(buf, tmp_buf);
-        strcat(head_header, tmp_buf);
-    }
-
-    // 호스트가 없으면 hostname 을 추가해줌
-    if (!host_flag) {
-        sprintf(buf, "%sHost: %s", buf, hostname);
-        sprintf(buf, "%sHost: %s", head_header, hostname);
-    }
+    } while (strcmp(header, "\r\n"));
 
-    strcat(buf, "\r\n");
+    n = stats_render(buf, buf_size);
+    snprintf(header, MAXLINE, "HTTP/1.0 200 OK\r\nContent-type: application/json\r\nContent-length: %zd\r\n"
+                              "Cache-Control: no-store\r\nConnection: close\r\n\r\n", n);
+    Rio_writen(connfd, header, strlen(header));
+    Rio_writen(connfd, buf, n);
 }
 
-// server 로 request 를 보내는 request_to_server 함수
-void request_to_server(int clientfd, char *buf, ssize_t *data_size) {
-
-    Rio_writen(clientfd, buf, MAXLINE);
+// 연결 하나가 쓸 수 있는 최대 버퍼 크기: Connection, data_buf, relay 버퍼, 그리고 Vary 용 요청 header 복사본이나
+// 압축/압축 해제 버퍼처럼 data_buf 와 같은 크기로 잠깐 생기는 버퍼 하나, 보내면서 압축할 때의 deflate 상태
+long long connection_cost(ProxyConfig *config) {
+    return sizeof(Connection) + 2 * (config->object_size + MAXLINE) + config->relay_buffer_size + 3 * sizeof(size_t)
+           + (config->gzip ? GZIP_STREAM_MEMORY : 0);
+}
 
-    memset(buf, 0, MAXLINE);
+// 단계별 시간을 통계와 access log 레코드에 같이 남기는 함수
+void record_phase(Connection *conn, int phase, long long usec) {
+    stats_record(phase, usec);
+    conn->access.phase_us[phase] = usec < 0 ? 0 : (usec > UINT32_MAX ? UINT32_MAX : usec);
+}
 
-    *data_size = Rio_readn(clientfd, buf, MAX_OBJECT_SIZE);
+// 요청이 어떻게 끝났는지를 access log 레코드에 남기는 함수, status 를 모르면 0
+void record_result(Connection *conn, int result, int status, long long bytes) {
+    conn->access.result = result;
+    conn->access.status = status > 0 ? status : 0;
+    conn->access.bytes = bytes;
 }
 
-void parse_uri(char *uri, char *request_ip, char *port, char *filename) {
-    /*
-    uri 파싱 조건
-    요청ip,filename,port,http_version
-    filename과 port는 있을 수도있고 없을수도있음
-    URI_examle= http://request_ip:port/path
-    http://request_ip:port
-    http://request_ip/
-    */
-    char *ip_ptr, *port_ptr, *filename_ptr;
-    ip_ptr = strstr(uri, "//") ? strstr(uri, "//") + 2 : uri + 1;
-    port_ptr = strchr(ip_ptr, ':');
-    filename_ptr = strchr(ip_ptr, '/');
-    if (filename_ptr != NULL) {
-        strcpy(filename, filename_ptr);
-        *filename_ptr = '\0';
-    } else
-        strcpy(filename, "/");
-    if (port_ptr != NULL) {
-        strcpy(port, port_ptr + 1);
-        *port_ptr = '\0';
-    } else {
-        strcpy(port, "80");
+// 요청마다 stdout 에 찍는 텍스트 로그, binary access log 를 쓰는 동안에는 찍지 않는다
+void request_log(char *format, ...) {
+    va_list ap;
+
+    if (accesslog_enabled()) {
+        return;
     }
-    strcpy(request_ip, ip_ptr);
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
 }
 
+// 단계에 맞는 deadline 을 거는 함수, 요청 전체 deadline 이 더 가까우면 그 시각으로 건다
+// DEADLINE_NONE 이면 요청 전체 deadline 만 남기고, 그것도 없으면 timer 를 푼다
+void deadline_arm(Connection *conn, int phase) {
+    ProxyConfig *config = conn->config;
+    long long ms = 0, left;
+
+    switch (phase) {
+        case DEADLINE_HEADER: ms = config->header_timeout_ms; break;
+        case DEADLINE_CONNECT: ms = config->connect_timeout_ms; break;
+        case DEADLINE_FIRST_BYTE: ms = config->first_byte_timeout_ms; break;
+        case DEADLINE_IDLE: ms = config->idle_timeout_ms; break;
+    }
+    if (config->request_timeout_ms > 0) {
+        left = config->request_timeout_ms - (stats_now_us() - conn->trace.marks[TRACE_ACCEPT]) / 1000;
+        if (ms == 0 || left < ms) {
+            ms = left > 0 ? left : 1;
+            // header 를 읽는 중이었다면 그대로 408 로 답하도록 단계를 유지
+            if (phase != DEADLINE_HEADER) {
+                phase = DEADLINE_REQUEST;
+            }
+        }
+    }
 
-// 새로운 cache 를 생성하는 함수
-CacheItem *createCacheItem(char *key, char *value, ssize_t size) {
-    CacheItem *newItem = (CacheItem *) malloc(sizeof(CacheItem));
-    newItem->value = (char *) malloc(size);
-    newItem->key = strdup(key);
-
-    memcpy(newItem->value, value, size);
-    newItem->size = size;
-    newItem->prev = NULL;
-    newItem->next = NULL;
-    return newItem;
+    if (ms == 0) {
+        timer_cancel(&conn->deadline);
+        return;
+    }
+    conn->deadline_phase = phase;
+    timer_arm(&conn->deadline, ms);
 }
 
-// cache pool init 함수
-Cache *initCache() {
-    Cache *cache = (Cache *) malloc(sizeof(Cache));
-    cache->capacity = MAX_CACHE_SIZE;
-    cache->head = NULL;
-    cache->tail = NULL;
-    return cache;
+// deadline 이 지났을 때 ticker thread 에서 불리는 함수 (timer wheel 의 lock 을 잡은 상태)
+// 기다리고 있는 socket 을 shutdown 해서 deliver thread 의 read/connect/write 가 바로 돌아오게 한다.
+// 응답을 보내는 중이 아니라면 client 쪽은 읽기만 막아서 408/504 를 보낼 수 있게 남겨둔다.
+void deadline_expired(void *vargp) {
+    Connection *conn = (Connection *) vargp;
+
+    conn->expired = conn->deadline_phase;
+    if (conn->upstream >= 0) {
+        shutdown(conn->upstream, SHUT_RDWR);
+    }
+    shutdown(conn->connfd, conn->responding ? SHUT_RDWR : SHUT_RD);
 }
 
-// cache_pool 에서 특정 cache 를 삭제하는 함수
-void removeCacheItem(Cache *cache, CacheItem *item) {
-    if (item->prev != NULL) {
-        item->prev->next = item->next;
-    } else {
-        cache->head = item->next;
+// deadline 이 지나서 끊긴 요청이면 client 에게 408/504 를 보내고(이미 응답 중이면 보내지 않음) 1 을 반환하는 함수
+int deadline_respond(Connection *conn) {
+    if (conn->expired == DEADLINE_NONE) {
+        return 0;
     }
-    if (item->next != NULL) {
-        item->next->prev = item->prev;
+    request_log("%s deadline expired\n", deadline_names[conn->expired]);
+    stats_count(STAT_TIMEOUTS, 1);
+    if (conn->responding) {
+        return 1;
+    }
+    conn->responding = 1;
+    if (conn->expired == DEADLINE_HEADER) {
+        clienterror(conn->connfd, "408", "Request Timeout", "The request was not received in time");
+        record_result(conn, ACCESS_ERROR, 408, 0);
     } else {
-        cache->tail = item->prev;
+        clienterror(conn->connfd, "504", "Gateway Timeout", "The origin server did not respond in time");
+        record_result(conn, ACCESS_ERROR, 504, 0);
     }
+    return 1;
+}
 
-    cache->capacity += item->size;
-    free(item->key);
-    free(item->value);
-    free(item);
+// 메모리가 모자라거나 과부하라서 받을 수 없는 연결에 503 을 보내고 닫아주는 함수 (main thread 에서 호출)
+void reject_connection(Connection *conn, int counter, char *reason) {
+    stats_count(counter, 1);
+    overloaded_response(conn->connfd, reason);
+    Close(conn->connfd);
+    config_release(conn->config);
+    free(conn);
 }
 
+// 연결 하나를 h2 session 으로 처리하는 함수 (h2.c), stream 은 각자 연결 하나처럼 deliver thread 에서 처리한다
+// session 은 stream 이 없는 동안에도 오래 열려 있으므로 deadline 을 걸지 않는다
+void *serve_h2(Connection *conn, rio_t *rp, char *method, char *uri, char *headers) {
+    int streams;
+
+    deadline_arm(conn, DEADLINE_NONE);
+    stats_count(STAT_H2_SESSIONS, 1);
+    streams = h2_serve(conn->connfd, rp, conn->config, method, uri, headers, h2_stream_start, conn);
+    request_log("\nh2 session closed after %d streams\n", streams);
+    accesslog_key(&conn->access, "h2");
+    record_result(conn, ACCESS_LOCAL, method != NULL ? 101 : 0, 0);
+    return context_free(conn, -1, conn->connfd);
+}
 
-// cache_pool 에 cache 를 넣어주는 함수
-void put_cache(Cache *cache, char *key, char *value, ssize_t size) {
-    CacheItem *newItem = createCacheItem(key, value, size);
+// h2 stream 하나를 socketpair 의 한쪽 끝 fd 로 받아서 새 연결처럼 deliver thread 에 넘기는 함수, 거절하면 -1
+// client 주소는 h2 연결의 것을 그대로 쓴다 (access log, 관리 API 의 local 확인)
+int h2_stream_start(void *vargp, int fd) {
+    Connection *session = (Connection *) vargp, *conn;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int counter;
+
+    memset(&addr, 0, sizeof(addr));
+    getpeername(session->connfd, (SA *) &addr, &addrlen);
+    conn = connection_new(fd, (SA *) &addr);
+    conn->config = config_acquire();
+    if (connection_start(conn, &counter) < 0) {
+        stats_count(counter, 1);
+        config_release(conn->config);
+        free(conn);
+        return -1;
+    }
+    stats_count(STAT_H2_STREAMS, 1);
+    return 0;
+}
 
-    while (cache->capacity < size) {
-        removeCacheItem(cache, cache->tail);
+// 거절할 때 보내는 짧은 503, 요청을 끝까지 읽거나 origin 에 연결하지 않고 바로 보낸다
+// 요청을 읽지 않은 채로 닫으면 RST 때문에 응답이 사라질 수 있어서, 보낸 뒤 이미 도착한 요청은 읽어서 버린다
+void overloaded_response(int fd, char *reason) {
+    char response[MAXLINE], buf[MAXLINE];
+
+    snprintf(response, MAXLINE, "HTTP/1.0 503 Service Unavailable\r\nContent-type: text/plain\r\n"
+                                "Content-length: %d\r\nRetry-After: 1\r\nConnection: close\r\n\r\n%s\r\n",
+             (int) strlen(reason) + 2, reason);
+    if (send(fd, response, strlen(response), MSG_NOSIGNAL) > 0) {
+        shutdown(fd, SHUT_WR);
+        while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
     }
+}
 
-    newItem->next = cache->head;
-    if (cache->head != NULL) {
-        cache->head->prev = newItem;
+// 에러 status 를 negative cache 에 몇 초 동안 기억할지 알려주는 함수, 0 이면 기억하지 않음
+// 4xx 중에서는 요청한 사람과 상관없이 결과가 같은 status 만 기억한다 (RFC 9110 15.1 의 heuristically cacheable)
+int negative_ttl(ProxyConfig *config, int status) {
+    if (status == 404 || status == 405 || status == 410 || status == 414) {
+        return config->negative_ttl_4xx;
     }
-    cache->head = newItem;
-    if (cache->tail == NULL) {
-        cache->tail = newItem;
+    if (status >= 500 && status < 600) {
+        return config->negative_ttl_5xx;
     }
-
-    cache->capacity -= size;
+    return 0;
 }
 
-
-// cache_pool 에서 특정 cache 를 가져오는 함수
-char *get_cache(Cache *cache, char *key) {
-    CacheItem *curr = cache->head;
-
-    while (curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            // 해당 항목을 가장 최근에 사용했으므로, head 로 옮겨줌
-            if (curr != cache->head) {
-                curr->prev->next = curr->next;
-                if (curr->next != NULL) {
-                    curr->next->prev = curr->prev;
-                } else {
-                    cache->tail = curr->prev;
-                }
-                curr->next = cache->head;
-                curr->prev = NULL;
-                cache->head->prev = curr;
-                cache->head = curr;
-            }
-            return curr->value;
-        }
-        curr = curr->next;
+// origin 에 request 를 보내고 응답을 relay 버퍼를 거쳐 client 로 보내는 함수 (relay.c 참고)
+// 받은 응답은 capture 에도 capture_size 까지 복사해 두고 그 크기를 captured 에 담는다.
+// 요청 body 가 있으면 request 뒤에 이어서 보내고, 응답은 framing 을 거친다 (capture 에는 chunked 가 풀린 응답).
+// 응답을 끝까지 client 에게 보냈고 capture 에 다 담았으면 0, 아니면 -1
+// origin socket 은 응답을 다 받는 즉시 relay_event 에서 닫으므로, 끝난 뒤에도 열려 있다면 conn->upstream 에 남아 있다
+int relay_response(Connection *conn, int clientfd, char *request, char *capture, ssize_t capture_size, ssize_t *captured,
+                   Framing *framing) {
+    Relay relay;
+    long long sent_us;
+    int rc;
+
+    relay_init(&relay, conn->config->relay_buffer_size, conn->config->relay_spill_size, relay_event, conn);
+    relay_capture(&relay, capture, capture_size);
+    relay_framing(&relay, framing);
+    deadline_arm(conn, DEADLINE_FIRST_BYTE);
+    Rio_writen(clientfd, request, strlen(request));
+    if (conn->body_len > 0) {
+        Rio_writen(clientfd, conn->body, conn->body_len);
     }
 
-    return NULL;
+    rc = relay_run(&relay, clientfd, conn->connfd);
+    deadline_arm(conn, DEADLINE_NONE);
+    // client 가 먼저 끊겼다면 origin 응답도 여기서 끝난 것으로 본다
+    if (conn->trace.marks[TRACE_TRANSFER] == 0) {
+        trace_mark(&conn->trace, TRACE_TRANSFER);
+    }
+    sent_us = stats_now_us();
+    // origin 응답을 다 받은 뒤 client 가 나머지를 받아가는 데 걸린 시간
+    record_phase(conn, PHASE_SEND, sent_us - conn->trace.marks[TRACE_TRANSFER]);
+
+    conn->access.bytes = relay.sent;
+    stats_count(STAT_BYTES_ORIGIN, relay.sent);
+    PROXY_PROBE2(bytes_relayed, conn, relay.sent);
+    *captured = relay.captured;
+    relay_free(&relay);
+    return rc < 0 || relay.overflow ? -1 : 0;
 }
 
+// relay_run 의 진행 상황에 맞춰 deadline 과 trace 를 갱신하는 함수
+void relay_event(void *vargp, int event) {
+    Connection *conn = (Connection *) vargp;
+    int fd;
+
+    switch (event) {
+        case RELAY_FIRST_BYTE:
+            trace_mark(&conn->trace, TRACE_TTFB);
+            conn->responding = 1;
+            sockopt_quickack(conn->upstream, conn->config);
+            deadline_arm(conn, DEADLINE_IDLE);
+            break;
+        case RELAY_READ:
+            sockopt_quickack(conn->upstream, conn->config);
+            deadline_arm(conn, DEADLINE_IDLE);
+            break;
+        case RELAY_RESUME:
+            deadline_arm(conn, DEADLINE_IDLE);
+            break;
+        case RELAY_PAUSE:
+            // client 가 느려서 멈춘 동안은 origin 의 idle 로 보지 않음 (요청 전체 deadline 만 남음)
+            deadline_arm(conn, DEADLINE_NONE);
+            break;
+        case RELAY_ORIGIN_DONE:
+            // 응답을 다 받았으니 client 가 나머지를 받아가는 동안 origin 연결을 잡고 있지 않음
+            trace_mark(&conn->trace, TRACE_TRANSFER);
+            fd = conn->upstream;
+            conn->upstream = -1;
+            deadline_arm(conn, DEADLINE_NONE);
+            Close(fd);
+            break;
+    }
+}
 
 // header 에서 content-length: 를 읽어서, 캐싱 가능한 데이터인지 확인해주는 함수
-int is_available_cache(char *data) {
-    char *content_length_start = strcasestr(data, "Content-Length: "); // "Content-Length: " 문자열 찾기
-    // "Content-Length: " 다음의 문자열에서 숫자를 읽어옴
-    int content_length;
-    sscanf(content_length_start + strlen("Content-Length: "), "%d", &content_length);
-
-    // content_length와 MAX_OBJECT_SIZE를 비교하여 캐시의 크기 제한을 확인
-    if (content_length <= MAX_OBJECT_SIZE) {
+// Content-Length 가 없으면 (chunked 이거나 연결을 닫아서 끝을 알리는 응답) 일단 캐시하는 쪽으로 받는다,
+// 받는 동안 object_size 를 넘으면 relay 가 capture 를 멈추므로 캐시되지 않고 client 에게는 그대로 간다
+int is_available_cache(char *data, ssize_t max_object_size) {
+    char *content_length_start = strcasestr(data, "Content-Length:"); // "Content-Length:" 문자열 찾기
+    long long content_length;
+
+    if (content_length_start == NULL) {
+        return 1;
+    }
+    // "Content-Length:" 다음의 문자열에서 숫자를 읽어옴
+    if (sscanf(content_length_start + strlen("Content-Length:"), "%lld", &content_length) != 1) {
+        return 1;
+    }
+
+    // content_length와 max_object_size를 비교하여 캐시의 크기 제한을 확인
+    if (content_length <= max_object_size) {
         return 1;
     } else {
         return 0;
@@ -0,0 +1,449 @@
+/*
+ * proxylog.c - binary access log (accesslog.c) 분석 도구
+ *
+ * access_log_dir 의 segment 들과 urls.bin 을 읽어서 다음을 출력한다.
+ * - 구간(-i 초)마다 요청 수, hit ratio, byte hit ratio, 그 구간에 요청된 서로 다른 객체 수와 크기 (working set)
+ * - 보낸 바이트가 많은 URL 상위 -n 개
+ * - 단계별 지연 시간 percentile, 처리 결과별 전체 지연 시간 percentile
+ * - 전체 working set 크기와, 요청의 50/90/99% 를 덮는 데 필요한 캐시 크기
+ * 레코드는 thread 별 버퍼에서 나온 순서대로 기록되므로 전부 읽어서 시간 순으로 정렬한 뒤 계산한다.
+ * proxy 자신이 답한 요청(통계, 캐시 관리 API)은 요청 수에만 세고 나머지 계산에서는 뺀다.
+ *
+ * usage: proxylog [-i interval_sec] [-n top] <access_log_dir | segment | urls.bin>...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define ACCESSLOG_FORMAT_ONLY
+#include "accesslog.h"
+
+#define PATH_SIZE 4096
+#define MAX_SEGMENTS 65536
+
+typedef struct Records {
+    AccessRecord *items;
+    long long count, capacity;
+} Records;
+
+// key hash 하나에 대한 집계
+typedef struct Object {
+    uint64_t hash;          // 0 이면 빈 칸
+    char *url;              // urls.bin 에 없으면 NULL
+    long long requests;
+    long long hits;
+    long long bytes;        // 보낸 바이트 합
+    long long size;         // 한 번에 보낸 최대 바이트 (객체 크기 추정)
+    long long last_interval;
+} Object;
+
+typedef struct Objects {
+    Object *slots;
+    long long count, capacity;
+} Objects;
+
+static const char *result_names[ACCESS_RESULTS] = {
+        "local", "hit_ram", "hit_disk", "hit_negative", "miss", "uncacheable", "error"};
+static const char *phase_names[ACCESSLOG_PHASES] = {"total", "parse", "cache", "connect", "origin", "send"};
+
+static Records records;
+static Objects objects;
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-i interval_sec] [-n top] <access_log_dir | segment | urls.bin>...\n", prog);
+    exit(1);
+}
+
+static Object *object_find(uint64_t hash) {
+    long long i, old_capacity;
+    Object *old;
+
+    if (objects.count * 2 >= objects.capacity) {
+        old = objects.slots;
+        old_capacity = objects.capacity;
+        objects.capacity = old_capacity ? old_capacity * 2 : 4096;
+        objects.slots = calloc(objects.capacity, sizeof(Object));
+        objects.count = 0;
+        for (i = 0; i < old_capacity; i++) {
+            if (old[i].hash != 0) {
+                *object_find(old[i].hash) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    i = (long long) (hash & (uint64_t) (objects.capacity - 1));
+    while (objects.slots[i].hash != 0 && objects.slots[i].hash != hash) {
+        i = (i + 1) & (objects.capacity - 1);
+    }
+    if (objects.slots[i].hash == 0) {
+        objects.slots[i].hash = hash;
+        objects.slots[i].last_interval = -1;
+        objects.count++;
+    }
+    return &objects.slots[i];
+}
+
+// urls.bin 을 읽어서 hash 와 URL 을 짝지어두는 함수, 같은 hash 가 여러 번 나오면 처음 것만 사용
+static void load_urls(char *path) {
+    AccessUrlEntry entry;
+    Object *object;
+    FILE *fp;
+    char *url;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return;
+    }
+    while (fread(&entry, sizeof(entry), 1, fp) == 1 && entry.len < (1 << 20)) {
+        url = malloc(entry.len + 1);
+        if (fread(url, 1, entry.len, fp) != entry.len) {
+            free(url);
+            break;
+        }
+        url[entry.len] = '\0';
+        object = object_find(entry.key_hash);
+        if (object->url == NULL) {
+            object->url = url;
+        } else {
+            free(url);
+        }
+    }
+    fclose(fp);
+}
+
+// segment 하나의 레코드를 모두 읽는 함수, 마지막의 잘린 레코드는 무시
+static void load_segment(char *path) {
+    AccessLogHeader header;
+    FILE *fp;
+    size_t n;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != ACCESSLOG_MAGIC ||
+        header.version != ACCESSLOG_VERSION || header.record_size != sizeof(AccessRecord)) {
+        fprintf(stderr, "%s: not an access log segment (version %d)\n", path, ACCESSLOG_VERSION);
+        fclose(fp);
+        return;
+    }
+    while (1) {
+        if (records.count == records.capacity) {
+            records.capacity = records.capacity ? records.capacity * 2 : 65536;
+            records.items = realloc(records.items, records.capacity * sizeof(AccessRecord));
+        }
+        n = fread(records.items + records.count, sizeof(AccessRecord), records.capacity - records.count, fp);
+        if (n == 0) {
+            break;
+        }
+        records.count += n;
+    }
+    fclose(fp);
+}
+
+static int compare_int(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+// 디렉터리의 segment 를 번호 순서대로, 그리고 urls.bin 을 읽는 함수
+static void load_dir(char *dir) {
+    static int ids[MAX_SEGMENTS];
+    char path[PATH_SIZE], name[64];
+    struct dirent *ent;
+    DIR *dp;
+    int id, count = 0, i;
+
+    if ((dp = opendir(dir)) == NULL) {
+        perror(dir);
+        return;
+    }
+    while ((ent = readdir(dp)) != NULL && count < MAX_SEGMENTS) {
+        if (sscanf(ent->d_name, "access-%d.bin", &id) == 1) {
+            ids[count++] = id;
+        }
+    }
+    closedir(dp);
+
+    qsort(ids, count, sizeof(int), compare_int);
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), ACCESSLOG_SEGMENT_FORMAT, ids[i]);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        load_segment(path);
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, ACCESSLOG_URL_FILE);
+    load_urls(path);
+}
+
+static void load_path(char *path) {
+    struct stat st;
+    char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    if (stat(path, &st) < 0) {
+        perror(path);
+    } else if (S_ISDIR(st.st_mode)) {
+        load_dir(path);
+    } else if (!strcmp(base, ACCESSLOG_URL_FILE)) {
+        load_urls(path);
+    } else {
+        load_segment(path);
+    }
+}
+
+static int compare_time(const void *a, const void *b) {
+    const AccessRecord *x = a, *y = b;
+
+    return x->time_us < y->time_us ? -1 : x->time_us > y->time_us;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int is_hit(int result) {
+    return result == ACCESS_HIT_RAM || result == ACCESS_HIT_DISK || result == ACCESS_HIT_NEGATIVE;
+}
+
+static void format_bytes(char *buf, size_t size, double bytes) {
+    if (bytes >= 1024.0 * 1024 * 1024) {
+        snprintf(buf, size, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+    } else if (bytes >= 1024.0 * 1024) {
+        snprintf(buf, size, "%.1fM", bytes / (1024.0 * 1024));
+    } else if (bytes >= 1024) {
+        snprintf(buf, size, "%.1fK", bytes / 1024);
+    } else {
+        snprintf(buf, size, "%.0f", bytes);
+    }
+}
+
+static void format_time(char *buf, size_t size, int64_t time_us) {
+    time_t t = (time_t) (time_us / 1000000);
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+// 정렬된 값들의 percentile 을 ms 로 출력하는 함수
+static void print_percentiles(const char *name, uint32_t *values, long long n) {
+    static const double points[] = {0.5, 0.9, 0.99, 0.999};
+    int i;
+
+    printf("  %-14s %10lld", name, n);
+    if (n == 0) {
+        printf("\n");
+        return;
+    }
+    qsort(values, n, sizeof(uint32_t), compare_u32);
+    for (i = 0; i < 4; i++) {
+        printf(" %10.3f", values[(long long) (points[i] * (n - 1))] / 1000.0);
+    }
+    printf(" %10.3f\n", values[n - 1] / 1000.0);
+}
+
+// 구간별 요청 수, hit ratio, working set
+static void report_intervals(long long interval_us) {
+    long long i, interval, current = -1, requests = 0, hits = 0, bytes = 0, hit_bytes = 0, distinct = 0, ws_bytes = 0;
+    int64_t start = records.items[0].time_us;
+    AccessRecord *rec;
+    Object *object;
+    char when[64], sent[32], ws[32];
+
+    printf("\nhit ratio over time (%llds intervals, working set = distinct objects requested in the interval)\n",
+           interval_us / 1000000);
+    printf("  %-19s %10s %8s %8s %10s %10s %10s\n", "start", "requests", "hit%", "bytehit%", "sent", "objects", "ws_bytes");
+
+    for (i = 0; i <= records.count; i++) {
+        rec = i < records.count ? &records.items[i] : NULL;
+        if (rec != NULL && rec->result == ACCESS_LOCAL) {
+            continue;
+        }
+        interval = rec != NULL ? (rec->time_us - start) / interval_us : -2;
+        if (interval != current) {
+            if (current >= 0 && requests > 0) {
+                format_time(when, sizeof(when), start + current * interval_us);
+                format_bytes(sent, sizeof(sent), bytes);
+                format_bytes(ws, sizeof(ws), ws_bytes);
+                printf("  %-19s %10lld %7.1f%% %7.1f%% %10s %10lld %10s\n", when, requests,
+                       100.0 * hits / requests, bytes > 0 ? 100.0 * hit_bytes / bytes : 0.0, sent, distinct, ws);
+            }
+            current = interval;
+            requests = hits = bytes = hit_bytes = distinct = ws_bytes = 0;
+        }
+        if (rec == NULL) {
+            break;
+        }
+
+        requests++;
+        bytes += rec->bytes;
+        if (is_hit(rec->result)) {
+            hits++;
+            hit_bytes += rec->bytes;
+        }
+        object = object_find(rec->key_hash);
+        if (object->last_interval != interval) {
+            object->last_interval = interval;
+            distinct++;
+            ws_bytes += rec->bytes;
+        }
+    }
+}
+
+static int compare_object_bytes(const void *a, const void *b) {
+    const Object *x = *(Object * const *) a, *y = *(Object * const *) b;
+
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+static int compare_object_requests(const void *a, const void *b) {
+    const Object *x = *(Object * const *) a, *y = *(Object * const *) b;
+
+    return x->requests < y->requests ? 1 : x->requests > y->requests ? -1 : 0;
+}
+
+// URL 별 상위 목록과 전체 working set
+static void report_objects(int top, long long total_requests) {
+    static const double coverage[] = {0.5, 0.9, 0.99};
+    Object **list = malloc(sizeof(Object *) * (objects.count + 1));
+    long long i, n = 0, covered = 0, size = 0, total_size = 0;
+    char bytes[32], unique[32];
+    int c = 0;
+
+    for (i = 0; i < objects.capacity; i++) {
+        if (objects.slots[i].hash != 0 && objects.slots[i].requests > 0) {
+            list[n++] = &objects.slots[i];
+            total_size += objects.slots[i].size;
+        }
+    }
+
+    qsort(list, n, sizeof(Object *), compare_object_bytes);
+    printf("\ntop %d URLs by bytes sent\n", top);
+    printf("  %10s %10s %8s  %s\n", "bytes", "requests", "hit%", "url");
+    for (i = 0; i < n && i < top; i++) {
+        format_bytes(bytes, sizeof(bytes), list[i]->bytes);
+        if (list[i]->url != NULL) {
+            printf("  %10s %10lld %7.1f%%  %s\n", bytes, list[i]->requests,
+                   100.0 * list[i]->hits / list[i]->requests, list[i]->url);
+        } else {
+            printf("  %10s %10lld %7.1f%%  (hash %016llx)\n", bytes, list[i]->requests,
+                   100.0 * list[i]->hits / list[i]->requests, (unsigned long long) list[i]->hash);
+        }
+    }
+
+    // 많이 요청된 객체부터 캐시에 넣는다고 할 때, 요청의 일정 비율을 덮는 데 필요한 크기
+    qsort(list, n, sizeof(Object *), compare_object_requests);
+    format_bytes(unique, sizeof(unique), total_size);
+    printf("\nworking set: %lld objects, %s\n", n, unique);
+    for (i = 0; i < n && c < 3; i++) {
+        covered += list[i]->requests;
+        size += list[i]->size;
+        while (c < 3 && covered >= coverage[c] * total_requests) {
+            format_bytes(bytes, sizeof(bytes), size);
+            printf("  %4.0f%% of requests: %lld objects, %s\n", coverage[c] * 100, i + 1, bytes);
+            c++;
+        }
+    }
+    free(list);
+}
+
+// 단계별, 처리 결과별 지연 시간 percentile
+static void report_latency(void) {
+    uint32_t *values = malloc(sizeof(uint32_t) * records.count);
+    long long i, n;
+    int phase, result;
+
+    printf("\nlatency (ms, phases the request did not go through are left out)\n");
+    printf("  %-14s %10s %10s %10s %10s %10s %10s\n", "phase", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (phase = 0; phase < ACCESSLOG_PHASES; phase++) {
+        for (i = n = 0; i < records.count; i++) {
+            if (records.items[i].result != ACCESS_LOCAL && (phase == 0 || records.items[i].phase_us[phase] > 0)) {
+                values[n++] = records.items[i].phase_us[phase];
+            }
+        }
+        print_percentiles(phase_names[phase], values, n);
+    }
+
+    printf("\ntotal latency by result (ms)\n");
+    printf("  %-14s %10s %10s %10s %10s %10s %10s\n", "result", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (result = ACCESS_HIT_RAM; result < ACCESS_RESULTS; result++) {
+        for (i = n = 0; i < records.count; i++) {
+            if (records.items[i].result == result) {
+                values[n++] = records.items[i].phase_us[0];
+            }
+        }
+        if (n > 0) {
+            print_percentiles(result_names[result], values, n);
+        }
+    }
+    free(values);
+}
+
+int main(int argc, char **argv) {
+    long long interval_sec = 60, counts[ACCESS_RESULTS] = {0}, status_classes[6] = {0}, requests = 0, i;
+    int top = 10, opt, result;
+    char first[64], last[64];
+    AccessRecord *rec;
+    Object *object;
+
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        switch (opt) {
+            case 'i': interval_sec = atoll(optarg); break;
+            case 'n': top = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind == argc || interval_sec <= 0 || top < 0) {
+        usage(argv[0]);
+    }
+    for (i = optind; i < argc; i++) {
+        load_path(argv[i]);
+    }
+    if (records.count == 0) {
+        fprintf(stderr, "no access log records\n");
+        return 1;
+    }
+    qsort(records.items, records.count, sizeof(AccessRecord), compare_time);
+
+    for (i = 0; i < records.count; i++) {
+        rec = &records.items[i];
+        result = rec->result < ACCESS_RESULTS ? rec->result : ACCESS_ERROR;
+        counts[result]++;
+        status_classes[rec->status >= 100 && rec->status < 600 ? rec->status / 100 : 0]++;
+        if (result == ACCESS_LOCAL) {
+            continue;
+        }
+        requests++;
+        object = object_find(rec->key_hash);
+        object->requests++;
+        object->hits += is_hit(result);
+        object->bytes += rec->bytes;
+        if ((long long) rec->bytes > object->size) {
+            object->size = rec->bytes;
+        }
+    }
+
+    format_time(first, sizeof(first), records.items[0].time_us);
+    format_time(last, sizeof(last), records.items[records.count - 1].time_us);
+    printf("%lld records, %s - %s (%.1fs)\n", records.count, first, last,
+           (records.items[records.count - 1].time_us - records.items[0].time_us) / 1e6);
+    printf("  results:");
+    for (result = 0; result < ACCESS_RESULTS; result++) {
+        printf(" %s %lld", result_names[result], counts[result]);
+    }
+    printf("\n  status: 1xx %lld, 2xx %lld, 3xx %lld, 4xx %lld, 5xx %lld, unknown %lld\n",
+           status_classes[1], status_classes[2], status_classes[3], status_classes[4], status_classes[5],
+           status_classes[0]);
+    if (requests == 0) {
+        return 0;
+    }
+
+    report_intervals(interval_sec * 1000000);
+    report_objects(top, requests);
+    report_latency();
+    return 0;
+}
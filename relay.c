@@ -0,0 +1,317 @@
+/*
+ * relay.c - origin 응답을 client 로 보내는 중계 단계
+ *
+ * 예전에는 캐시하지 않는 응답은 origin 에서 읽은 만큼 바로 client 로 썼고(읽기와 쓰기가 한 몸),
+ * 캐시하는 응답은 객체 전체를 다 받은 뒤에야 보냈다. relay_run 은 두 socket 을 poll 하면서 그 사이에
+ * 크기가 정해진 ring 버퍼 하나를 둔다.
+ * - origin 에서 받는 대로 ring 에 쌓고, client 가 받아갈 수 있을 때마다 ring 에서 보낸다.
+ * - 쌓인 양이 한도(ring + spill_limit)에 닿으면 origin 에서 더 읽지 않는다. 그러면 TCP 흐름 제어로 origin 도
+ *   client 가 받아가는 속도에 맞춰지고, 연결 하나가 쥐는 메모리는 ring 크기를 넘지 않는다.
+ *   한도의 RELAY_LOW_WATERMARK_PCT 까지 줄면 다시 읽는다 (조금씩 자주 깨어나지 않도록).
+ * - spill_limit 이 있으면 ring 이 가득 찬 뒤에 받은 데이터는 이름 없는 임시 파일에 쌓아두고 ring 이 비는 대로 옮긴다.
+ *   빠른 origin 은 느린 client 를 기다리지 않고 응답을 다 보낸 뒤 연결을 놓을 수 있다.
+ * - capture 가 있으면 받은 바이트를 그대로 복사해 둔다 (캐시에 넣을 응답).
+ * - framing 이 있으면 받은 바이트를 chunked.c 를 거쳐 client 와 capture 로 나눠 보낸다 (chunked 응답을 풀거나
+ *   길이를 모르는 응답을 chunked 로 감쌀 때). 바꿀 것이 없는 응답이면 header 뒤로는 framing 없이 그대로 쌓는다.
+ * 모든 연결에 쌓여 있는 양의 합은 stats 의 "relay" 항목에서 볼 수 있다.
+ */
+#include <poll.h>
+#include "relay.h"
+#include "stats.h"
+
+#define MIN_SIZE(a, b) ((a) < (b) ? (a) : (b))
+
+// origin_read / client_write 의 결과
+enum {
+    IO_AGAIN,       // 지금은 읽거나 쓸 수 없음 (poll 로 기다림)
+    IO_MOVED,       // 조금이라도 옮김
+    IO_EOF,         // origin 응답이 끝남
+    IO_ERROR
+};
+
+void relay_init(Relay *relay, size_t capacity, long long spill_limit, void (*event)(void *arg, int event), void *arg) {
+    memset(relay, 0, sizeof(Relay));
+    relay->ring = (char *) malloc(capacity);
+    relay->capacity = capacity;
+    relay->spill_limit = spill_limit;
+    relay->event = event;
+    relay->arg = arg;
+}
+
+// origin 에서 받은 바이트를 buf 에도 size 까지 복사해 두도록 지정하는 함수
+void relay_capture(Relay *relay, char *buf, ssize_t size) {
+    relay->capture = buf;
+    relay->capture_size = size;
+}
+
+// origin 응답을 framing 을 거쳐 보내도록 지정하는 함수
+void relay_framing(Relay *relay, Framing *framing) {
+    relay->framing = framing;
+}
+
+static long long spill_pending(Relay *relay) {
+    return relay->spill_write - relay->spill_read;
+}
+
+static long long relay_buffered(Relay *relay) {
+    return relay->len + spill_pending(relay);
+}
+
+// ring 의 빈 공간 중 꼬리부터 이어진 부분을 알려주는 함수
+static char *ring_space(Relay *relay, size_t *room) {
+    size_t tail = (relay->head + relay->len) % relay->capacity;
+
+    if (relay->len == relay->capacity) {
+        *room = 0;
+    } else if (tail >= relay->head) {
+        *room = relay->capacity - tail;
+    } else {
+        *room = relay->head - tail;
+    }
+    return relay->ring + tail;
+}
+
+// spill 파일에 쌓인 데이터를 ring 의 빈 공간으로 옮기는 함수, 실패하면 -1
+static int spill_refill(Relay *relay) {
+    size_t room;
+    ssize_t n;
+    char *dst;
+
+    while (spill_pending(relay) > 0 && relay->len < relay->capacity) {
+        dst = ring_space(relay, &room);
+        if (room > (size_t) spill_pending(relay)) {
+            room = spill_pending(relay);
+        }
+        if ((n = pread(fileno(relay->spill), dst, room, relay->spill_read)) <= 0) {
+            return -1;
+        }
+        relay->len += n;
+        relay->spill_read += n;
+        stats_relay(n, -n);
+    }
+    // 다 비었으면 파일 처음부터 다시 쓴다
+    if (spill_pending(relay) == 0) {
+        relay->spill_read = relay->spill_write = 0;
+    }
+    return 0;
+}
+
+// capture 에 받은 바이트를 복사하는 함수, 다 담지 못하면 들어가는 만큼만 담는다 (응답 앞부분만 필요한 경우도 있으므로)
+static void capture_add(Relay *relay, char *data, size_t n) {
+    if (relay->capture == NULL) {
+        return;
+    }
+    if (relay->captured + (ssize_t) n > relay->capture_size) {
+        relay->overflow = 1;
+    }
+    memcpy(relay->capture + relay->captured, data, MIN_SIZE((ssize_t) n, relay->capture_size - relay->captured));
+    relay->captured += MIN_SIZE((ssize_t) n, relay->capture_size - relay->captured);
+}
+
+// spill 파일 뒤에 이어서 쌓는 함수, 실패하면 -1
+static int spill_append(Relay *relay, char *data, size_t n) {
+    if (relay->spill == NULL) {
+        if ((relay->spill = tmpfile()) == NULL) {
+            return -1;
+        }
+        relay->spilled = 1;
+        stats_count(STAT_RELAY_SPILLS, 1);
+    }
+    if (pwrite(fileno(relay->spill), data, n, relay->spill_write) != (ssize_t) n) {
+        return -1;
+    }
+    relay->spill_write += n;
+    stats_relay(0, n);
+    return 0;
+}
+
+// framing 이 client 에게 보낼 바이트를 ring 에 (자리가 없으면 spill 파일에) 쌓는 함수, 실패하면 -1
+// 읽은 것보다 조금 많이 나올 수 있으므로 spill_limit 이 0 이어도 넘치는 부분은 spill 파일에 둔다
+static int framed_append(Relay *relay, char *data, size_t len) {
+    size_t room, n;
+    char *dst;
+
+    while (len > 0 && spill_pending(relay) == 0 && relay->len < relay->capacity) {
+        dst = ring_space(relay, &room);
+        n = MIN_SIZE(room, len);
+        memcpy(dst, data, n);
+        relay->len += n;
+        stats_relay(n, 0);
+        data += n;
+        len -= n;
+    }
+    return len > 0 ? spill_append(relay, data, len) : 0;
+}
+
+// framing 이 내보내는 바이트를 client (ring) 와 capture 로 나눠주는 함수
+static int framed_emit(void *arg, char *data, size_t len, int target) {
+    Relay *relay = (Relay *) arg;
+
+    if (target & FRAMING_CACHE) {
+        capture_add(relay, data, len);
+    }
+    if ((target & FRAMING_CLIENT) && framed_append(relay, data, len) < 0) {
+        relay->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// origin 에서 읽은 바이트를 framing 에 넣는 함수, 응답이 framing 대로 끝났으면 IO_EOF
+static int framed_input(Relay *relay, char *data, size_t n) {
+    int rc = framing_input(relay->framing, data, n, framed_emit, relay);
+
+    if (rc < 0) {
+        // 잘못된 chunked body 는 거기서 끊긴 응답으로 본다 (client 에게는 마지막 chunk 를 보내지 않음)
+        return relay->error ? IO_ERROR : IO_EOF;
+    }
+    if (framing_passthrough(relay->framing)) {
+        relay->direct = 1;
+    }
+    return rc == 1 ? IO_EOF : IO_MOVED;
+}
+
+// ring 에 쌓일 양이 읽은 양보다 많아질 수 있으면 그만큼 자리를 남겨두고 읽는다
+static long long relay_reserve(Relay *relay) {
+    return relay->framing != NULL && !relay->direct ? FRAMING_SLACK : 0;
+}
+
+// origin 에서 한 번 읽어서 ring 이나 spill 파일에 쌓는 함수, origin 쪽 에러는 응답이 끝난 것으로 본다
+static int origin_read(Relay *relay, int origin) {
+    char chunk[RELAY_CHUNK], *dst;
+    size_t room;
+    ssize_t n;
+    int framed = relay->framing != NULL && !relay->direct;
+    int to_spill = spill_pending(relay) > 0 || relay->len == relay->capacity;
+
+    // framing 을 거치면 chunk 에 읽은 뒤 옮기고, spill 중이라면 순서를 지키기 위해 ring 에 자리가 있어도 파일 뒤에 이어서 쌓는다
+    if (framed) {
+        dst = chunk;
+        room = MIN_SIZE(RELAY_CHUNK, relay->capacity + relay->spill_limit - relay_buffered(relay) - FRAMING_SLACK);
+    } else if (to_spill) {
+        dst = chunk;
+        room = relay->spill_limit - spill_pending(relay) < RELAY_CHUNK ?
+               relay->spill_limit - spill_pending(relay) : RELAY_CHUNK;
+    } else {
+        dst = ring_space(relay, &room);
+    }
+
+    if ((n = recv(origin, dst, room, MSG_DONTWAIT)) < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? IO_AGAIN : IO_EOF;
+    }
+    if (n == 0) {
+        return IO_EOF;
+    }
+    relay->event(relay->arg, relay->received == 0 ? RELAY_FIRST_BYTE : RELAY_READ);
+    relay->received += n;
+
+    if (framed) {
+        return framed_input(relay, chunk, n);
+    }
+    capture_add(relay, dst, n);
+    if (to_spill) {
+        if (spill_append(relay, chunk, n) < 0) {
+            return IO_ERROR;
+        }
+    } else {
+        relay->len += n;
+        stats_relay(n, 0);
+    }
+    return IO_MOVED;
+}
+
+// ring 에서 client 로 보낼 수 있는 만큼 보내는 함수
+static int client_write(Relay *relay, int client) {
+    size_t n = relay->capacity - relay->head < relay->len ? relay->capacity - relay->head : relay->len;
+    ssize_t sent;
+
+    if ((sent = send(client, relay->ring + relay->head, n, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? IO_AGAIN : IO_ERROR;
+    }
+    relay->head = (relay->head + sent) % relay->capacity;
+    relay->len -= sent;
+    relay->sent += sent;
+    if (relay->len == 0) {
+        relay->head = 0;
+    }
+    stats_relay(-sent, 0);
+    return IO_MOVED;
+}
+
+// origin 응답을 끝까지 client 로 보내는 함수, 다 보냈으면 0, client 가 끊겼거나 spill 에 실패했으면 -1
+// 양쪽 다 바로 읽고 쓸 수 있는 동안은 poll 없이 번갈아 옮기고, 둘 다 막혔을 때만 poll 로 기다린다.
+// origin socket 은 응답을 다 받으면 RELAY_ORIGIN_DONE event 에서 호출한 쪽이 닫는다
+int relay_run(Relay *relay, int origin, int client) {
+    long long limit = relay->capacity + relay->spill_limit;
+    struct pollfd fds[2];
+    int nfds, moved, rc;
+
+    while (origin >= 0 || relay_buffered(relay) > 0) {
+        if (spill_pending(relay) > 0 && spill_refill(relay) < 0) {
+            return -1;
+        }
+        if (origin >= 0 && !relay->paused && relay_buffered(relay) + relay_reserve(relay) >= limit) {
+            relay->paused = 1;
+            stats_count(STAT_RELAY_PAUSES, 1);
+            relay->event(relay->arg, RELAY_PAUSE);
+        } else if (relay->paused && relay_buffered(relay) <= limit * RELAY_LOW_WATERMARK_PCT / 100) {
+            relay->paused = 0;
+            relay->event(relay->arg, RELAY_RESUME);
+        }
+
+        moved = 0;
+        if (relay->len > 0) {
+            if ((rc = client_write(relay, client)) == IO_ERROR) {
+                return -1;
+            }
+            moved |= rc == IO_MOVED;
+        }
+        if (origin >= 0 && !relay->paused) {
+            if ((rc = origin_read(relay, origin)) == IO_ERROR) {
+                return -1;
+            }
+            if (rc == IO_EOF) {
+                // framing 이 있으면 응답을 마무리하고 (chunked 로 보내던 응답의 마지막 chunk 등) 그것까지 보낸다
+                if (relay->framing != NULL && framing_finish(relay->framing, framed_emit, relay) < 0) {
+                    return -1;
+                }
+                // client 가 아직 받는 중인데 origin 은 끝났다면 origin 연결을 먼저 놓아준 것
+                if (relay_buffered(relay) > 0) {
+                    stats_count(STAT_ORIGIN_RELEASED_EARLY, 1);
+                }
+                origin = -1;
+                relay->event(relay->arg, RELAY_ORIGIN_DONE);
+            }
+            moved |= rc != IO_AGAIN;
+        }
+        if (moved) {
+            continue;
+        }
+
+        nfds = 0;
+        if (relay->len > 0) {
+            fds[nfds].fd = client;
+            fds[nfds++].events = POLLOUT;
+        }
+        if (origin >= 0 && !relay->paused) {
+            fds[nfds].fd = origin;
+            fds[nfds++].events = POLLIN;
+        }
+        if (nfds > 0 && poll(fds, nfds, -1) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void relay_free(Relay *relay) {
+    stats_relay(-(long long) relay->len, -spill_pending(relay));
+    relay->len = 0;
+    relay->spill_read = relay->spill_write = 0;
+    if (relay->spill != NULL) {
+        fclose(relay->spill);
+        relay->spill = NULL;
+    }
+    free(relay->ring);
+    relay->ring = NULL;
+}
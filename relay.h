@@ -0,0 +1,52 @@
+/*
+ * relay.h - origin 응답을 client 로 보내는 중계 단계 (크기가 정해진 버퍼와 watermark, 선택적인 spill 파일)
+ */
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include "csapp.h"
+#include "chunked.h"
+
+#define RELAY_LOW_WATERMARK_PCT 25  /* 쌓인 양이 한도의 이만큼까지 줄어들면 origin 에서 다시 읽기 시작 */
+#define RELAY_CHUNK 16384           /* spill 파일로 보낼 때 한 번에 읽는 크기 */
+
+// relay_run 이 진행 상황을 알려주는 event
+enum {
+    RELAY_FIRST_BYTE,       // origin 에서 첫 바이트를 받음
+    RELAY_READ,             // origin 에서 더 받음
+    RELAY_PAUSE,            // 버퍼가 가득 차서 client 가 받아갈 때까지 origin 에서 읽지 않음
+    RELAY_RESUME,           // low watermark 까지 줄어서 다시 읽기 시작
+    RELAY_ORIGIN_DONE       // origin 응답을 다 받음, 이 뒤로 origin socket 은 쓰지 않는다
+};
+
+typedef struct Relay {
+    char *ring;                 // origin -> client 방향의 버퍼 (원형)
+    size_t capacity;            // ring 크기
+    size_t head, len;           // ring 에서 보낼 데이터의 시작 위치와 길이
+    long long spill_limit;      // spill 파일에 쌓아둘 수 있는 최대 바이트, 0 이면 spill 하지 않음
+    FILE *spill;                // ring 이 가득 찼을 때 origin 에서 받은 데이터를 쌓아두는 임시 파일
+    long long spill_read, spill_write;  // spill 파일에서 아직 ring 으로 옮기지 않은 구간
+    int paused;
+    char *capture;              // NULL 이 아니면 origin 에서 받은 바이트를 여기에도 복사 (캐시용)
+    ssize_t capture_size, captured;
+    int overflow;               // capture 에 다 담지 못했음
+    long long received, sent;   // origin 에서 받은 바이트, client 로 보낸 바이트
+    int spilled;                // spill 파일을 쓴 적이 있는지
+    Framing *framing;           // NULL 이 아니면 origin 응답의 framing 을 client 에 맞게 바꿔서 보냄 (chunked.c)
+    int direct;                 // framing 이 더 바꿀 것이 없어서 받은 바이트를 그대로 ring 에 쌓음
+    int error;                  // ring 이나 spill 파일에 쌓지 못했음
+    void (*event)(void *arg, int event);
+    void *arg;
+} Relay;
+
+void relay_init(Relay *relay, size_t capacity, long long spill_limit, void (*event)(void *arg, int event), void *arg);
+
+void relay_capture(Relay *relay, char *buf, ssize_t size);
+
+void relay_framing(Relay *relay, Framing *framing);
+
+int relay_run(Relay *relay, int origin, int client);
+
+void relay_free(Relay *relay);
+
+#endif /* __RELAY_H__ */
@@ -0,0 +1,177 @@
+/*
+ * request.c - client 의 요청을 해석해서 server 로 보낼 요청을 만드는 함수들
+ */
+#include "request.h"
+#include "util.h"
+
+// header 를 만들어주는 generate_header 함수
+// client 가 보낸 header 중 proxy 가 새로 쓰는 User-Agent / Connection / Proxy-Connection 줄만 이름으로 골라 빼고,
+// Host 가 없으면 hostname 으로 붙인다. head_header 에는 같은 header 로 HEAD 요청을 만든다
+void generate_header(char *buf, char *method, char *hostname, char *filename, rio_t *rp, char *head_header,
+                     char *user_agent) {
+    char tmp_buf[MAXLINE];
+    size_t len, head_len;
+    int host_flag = 0;
+
+    len = sprintf(buf, "%s %s %s\r\n", method, filename, STATIC_HTTP_VER);
+    len += sprintf(buf + len, "User-Agent: %s\r\n", user_agent);
+    len += sprintf(buf + len, "Connection: close\r\n");
+    len += sprintf(buf + len, "Proxy-Connection: close\r\n");
+
+    // head 요청을 위한 header 생성
+    head_len = sprintf(head_header, "%s %s %s\r\n", "HEAD", filename, STATIC_HTTP_VER);
+    head_len += sprintf(head_header + head_len, "User-Agent: %s\r\n", user_agent);
+    head_len += sprintf(head_header + head_len, "Connection: close\r\n");
+    head_len += sprintf(head_header + head_len, "Proxy-Connection: close\r\n");
+
+    // 빈 줄 전에 연결이 끝나면 (client 가 끊었거나 header deadline 이 지나서) 거기까지만 사용
+    while (Rio_readlineb(rp, tmp_buf, MAXLINE) > 0 && strcmp(tmp_buf, "\r\n")) {
+        if (!strncasecmp(tmp_buf, "User-Agent:", 11) || !strncasecmp(tmp_buf, "Connection:", 11) ||
+            !strncasecmp(tmp_buf, "Proxy-Connection:", 17)) {
+            continue;
+        }
+        if (!strncasecmp(tmp_buf, "Host:", 5)) {
+            host_flag++;
+        }
+        // 둘 다 MAXLINE 크기이므로 넘치는 header 는 버린다
+        if (head_len + strlen(tmp_buf) + MAXLINE / 4 < MAXLINE) {
+            len += sprintf(buf + len, "%s", tmp_buf);
+            head_len += sprintf(head_header + head_len, "%s", tmp_buf);
+        }
+    }
+
+    // 호스트가 없으면 hostname 을 추가해줌
+    if (!host_flag) {
+        len += sprintf(buf + len, "Host: %s\r\n", hostname);
+        snprintf(head_header + head_len, MAXLINE - 2 - head_len, "Host: %s\r\n", hostname);
+        head_len = strlen(head_header);
+    }
+
+    strcpy(buf + len, "\r\n");
+    strcpy(head_header + head_len, "\r\n");
+}
+
+void parse_uri(char *uri, char *request_ip, char *port, char *filename) {
+    /*
+    uri 파싱 조건
+    요청ip,filename,port,http_version
+    filename과 port는 있을 수도있고 없을수도있음
+    URI_examle= http://request_ip:port/path
+    http://request_ip:port
+    http://request_ip/
+    */
+    char *ip_ptr, *port_ptr, *filename_ptr, *bracket;
+    ip_ptr = strstr(uri, "//") ? strstr(uri, "//") + 2 : uri + 1;
+    filename_ptr = strchr(ip_ptr, '/');
+    if (filename_ptr != NULL) {
+        strcpy(filename, filename_ptr);
+        *filename_ptr = '\0';
+    } else
+        strcpy(filename, "/");
+    // IPv6 주소는 http://[::1]:8080/ 처럼 [] 로 감싸므로 port 는 ] 뒤에서 찾고, request_ip 에서는 [] 를 뺀다
+    if (*ip_ptr == '[' && (bracket = strchr(ip_ptr, ']')) != NULL) {
+        *bracket = '\0';
+        ip_ptr++;
+        port_ptr = strchr(bracket + 1, ':');
+    } else {
+        port_ptr = strchr(ip_ptr, ':');
+    }
+    if (port_ptr != NULL) {
+        strcpy(port, port_ptr + 1);
+        *port_ptr = '\0';
+    } else {
+        strcpy(port, "80");
+    }
+    strcpy(request_ip, ip_ptr);
+}
+
+// headers 에서 name 으로 시작하는 줄을 모두 지우는 함수 (대소문자 무시)
+void remove_header(char *headers, char *name) {
+    char *line = strstr(headers, "\r\n"), *next;
+
+    while (line != NULL && line[2] != '\0') {
+        if (strncasecmp(line + 2, name, strlen(name)) == 0 && (next = strstr(line + 2, "\r\n")) != NULL) {
+            memmove(line, next, strlen(next) + 1);
+        } else {
+            line = strstr(line + 2, "\r\n");
+        }
+    }
+}
+
+// 요청에 body 가 있는지 확인하는 함수 (Content-Length 가 0 보다 크거나 Transfer-Encoding 이 있으면)
+int request_has_body(char *headers) {
+    char *p;
+
+    if ((p = strcasestr(headers, "\r\nTransfer-Encoding:")) != NULL) {
+        return 1;
+    }
+    return (p = strcasestr(headers, "\r\nContent-Length:")) != NULL && atoll(p + 17) > 0;
+}
+
+// 요청 body 의 Content-Length 를 알려주는 함수, Transfer-Encoding 이 있어서 읽어봐야 알 수 있으면 -1
+long long request_body_length(char *headers) {
+    char *p;
+
+    if (strcasestr(headers, "\r\nTransfer-Encoding:") != NULL ||
+        (p = strcasestr(headers, "\r\nContent-Length:")) == NULL) {
+        return -1;
+    }
+    return atoll(p + 17);
+}
+
+// 요청 body 를 읽어서 body 에 담는 함수, body 크기 (잘못된 body 거나 끝까지 읽지 못하면 -1, size 를 넘으면 -2)
+// origin 으로는 HTTP/1.0 으로 보내므로 chunked body 는 풀어서 담고, headers (와 HEAD 요청 head_header) 의
+// Transfer-Encoding / Content-Length / Expect 는 지운 뒤 headers 에 실제 크기로 Content-Length 를 다시 적는다.
+// client 가 100-continue 를 기다리면 먼저 100 Continue 를 보낸다
+ssize_t read_request_body(rio_t *rp, char *headers, char *head_header, char *body, ssize_t size) {
+    char line[MAXLINE], *p, *coding;
+    ChunkedDecoder decoder;
+    ssize_t len = 0, n, length;
+    size_t consumed;
+    int chunked = 0;
+
+    if ((p = strcasestr(headers, "\r\nTransfer-Encoding:")) != NULL) {
+        chunked = (coding = strcasestr(p, "chunked")) != NULL && coding < strstr(p + 2, "\r\n");
+    }
+
+    if (strcasestr(headers, "\r\nExpect: 100-continue") != NULL) {
+        rio_writen(rp->rio_fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    }
+
+    if (chunked) {
+        chunked_init(&decoder);
+        while (!decoder.done) {
+            if ((n = Rio_readlineb(rp, line, MAXLINE)) <= 0) {
+                return -1;
+            }
+            // 푼 body 는 읽은 줄보다 길지 않으므로 줄 길이로 자리를 확인한다
+            if (len + n > size) {
+                return -2;
+            }
+            if ((n = chunked_decode(&decoder, line, n, body + len, &consumed)) < 0) {
+                return -1;
+            }
+            len += n;
+        }
+    } else if ((p = strcasestr(headers, "\r\nContent-Length:")) != NULL) {
+        if ((length = atoll(p + 17)) > size) {
+            return -2;
+        }
+        if (length < 0 || (len = Rio_readnb(rp, body, length)) != length) {
+            return -1;
+        }
+    } else {
+        // 길이를 알 수 없는 body (chunked 가 아닌 Transfer-Encoding)
+        return -1;
+    }
+
+    remove_header(headers, "Transfer-Encoding:");
+    remove_header(headers, "Content-Length:");
+    remove_header(headers, "Expect:");
+    remove_header(head_header, "Transfer-Encoding:");
+    remove_header(head_header, "Content-Length:");
+    remove_header(head_header, "Expect:");
+    // 첫 빈 줄 앞에 넣고 header 를 거기서 끝낸다 (뒤에 남은 빈 줄이 body 로 읽히지 않도록)
+    sprintf(strstr(headers, "\r\n\r\n") + 2, "Content-Length: %zd\r\n\r\n", len);
+    return len;
+}
@@ -0,0 +1,25 @@
+/*
+ * request.h - client 의 요청을 해석해서 server 로 보낼 요청을 만드는 함수들
+ */
+#ifndef __REQUEST_H__
+#define __REQUEST_H__
+
+#include "csapp.h"
+#include "chunked.h"
+
+#define STATIC_HTTP_VER "HTTP/1.0"
+
+void parse_uri(char *uri, char *request_ip, char *port, char *filename);
+
+void generate_header(char *buf, char *method, char *hostname, char *filename, rio_t *rp, char *head_header,
+                     char *user_agent);
+
+void remove_header(char *headers, char *name);
+
+int request_has_body(char *headers);
+
+long long request_body_length(char *headers);
+
+ssize_t read_request_body(rio_t *rp, char *headers, char *head_header, char *body, ssize_t size);
+
+#endif /* __REQUEST_H__ */
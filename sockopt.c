@@ -0,0 +1,89 @@
+/*
+ * sockopt.c - listener, client, upstream socket 마다 역할에 맞게 거는 TCP 옵션
+ *
+ * 예전에는 open_listenfd 의 SO_REUSEADDR 말고는 모든 socket 을 커널 기본값으로 썼다.
+ * 옵션은 모두 설정으로 끄고 켤 수 있고, 0 이면 커널 기본값을 그대로 둔다.
+ * - listener: TCP_NODELAY, client 쪽 SO_RCVBUF/SO_SNDBUF (accept 한 socket 이 물려받음, window scale 은 SYN 을 받을 때
+ *   listener 의 SO_RCVBUF 로 정해지므로 accept 뒤에 걸면 늦다), TCP_DEFER_ACCEPT (요청이 도착한 연결만 accept 로 깨움),
+ *   TCP_FASTOPEN (다시 오는 client 는 SYN 에 요청을 실어 보낼 수 있음)
+ * - client: accept4 의 SOCK_CLOEXEC, TCP_QUICKACK, TCP_NOTSENT_LOWAT
+ *   (아직 보내지 못한 데이터가 이보다 적을 때만 쓸 수 있다고 알려서 커널 송신 버퍼에 쌓아두는 양을 줄인다)
+ * - upstream: TCP_NODELAY, SO_RCVBUF/SO_SNDBUF (window scale 이 정해지기 전인 connect 전에), 붙은 뒤에 TCP_QUICKACK
+ * Linux 의 TCP_QUICKACK 은 한 번 걸어도 커널이 곧 delayed ACK 으로 되돌리므로, 응답을 받는 upstream socket 과
+ * h2 client socket 은 읽을 때마다 sockopt_quickack 으로 다시 건다.
+ * deliver thread 는 client socket 을 blocking 으로 읽고 쓰므로 accept4 에 SOCK_NONBLOCK 은 주지 않는다
+ * (relay.c 는 필요한 곳에서만 MSG_DONTWAIT 을 쓴다).
+ */
+#include <netinet/tcp.h>
+#include "sockopt.h"
+
+/* csapp.h 의 gai_error 와 충돌하므로 _GNU_SOURCE 대신 직접 선언 */
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+
+// 값이 0 이 아닐 때만 옵션을 거는 함수, 실패하면 -1
+static int set_option(int fd, int level, int name, int value) {
+    if (value <= 0) {
+        return 0;
+    }
+    return setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+// listener 에 옵션을 거는 함수, 시작할 때와 reload 할 때 호출 (지원하지 않는 커널이면 경고만 출력)
+void sockopt_listener(int fd, ProxyConfig *config) {
+    int nodelay = config->tcp_nodelay;
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0) {
+        fprintf(stderr, "sockopt: TCP_NODELAY: %s\n", strerror(errno));
+    }
+    // 0 을 주면 이전에 걸었던 값이 풀린다
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &config->tcp_defer_accept, sizeof(int)) < 0) {
+        fprintf(stderr, "sockopt: TCP_DEFER_ACCEPT: %s\n", strerror(errno));
+    }
+    if (set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, config->tcp_fastopen) < 0) {
+        fprintf(stderr, "sockopt: TCP_FASTOPEN: %s\n", strerror(errno));
+    }
+    // 한 번 고정한 버퍼 크기는 0 으로 바꿔도 자동 조절로 돌아가지 않는다 (다시 시작해야 함)
+    if (set_option(fd, SOL_SOCKET, SO_RCVBUF, config->client_rcvbuf) < 0) {
+        fprintf(stderr, "sockopt: SO_RCVBUF: %s\n", strerror(errno));
+    }
+    if (set_option(fd, SOL_SOCKET, SO_SNDBUF, config->client_sndbuf) < 0) {
+        fprintf(stderr, "sockopt: SO_SNDBUF: %s\n", strerror(errno));
+    }
+}
+
+// 새 연결을 accept 하는 함수, 다음 연결로 넘어가면 되는 에러는 다시 기다린다
+int sockopt_accept(int listenfd, SA *addr, socklen_t *addrlen) {
+    socklen_t len = *addrlen;
+    int fd;
+
+    while ((fd = accept4(listenfd, addr, addrlen, SOCK_CLOEXEC)) < 0) {
+        if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO) {
+            unix_error("Accept error");
+        }
+        *addrlen = len;
+    }
+    return fd;
+}
+
+// accept 한 client socket 에 옵션을 거는 함수, 버퍼 크기는 listener 에서 물려받는다
+void sockopt_client(int fd, ProxyConfig *config) {
+    set_option(fd, IPPROTO_TCP, TCP_QUICKACK, config->tcp_quickack);
+    set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, config->tcp_notsent_lowat);
+}
+
+// connect 하기 전의 upstream socket 에 옵션을 거는 함수
+void sockopt_upstream(int fd, ProxyConfig *config) {
+    set_option(fd, IPPROTO_TCP, TCP_NODELAY, config->tcp_nodelay);
+    set_option(fd, SOL_SOCKET, SO_RCVBUF, config->upstream_rcvbuf);
+    set_option(fd, SOL_SOCKET, SO_SNDBUF, config->upstream_sndbuf);
+}
+
+// 연결된 upstream socket 에 옵션을 거는 함수, 응답의 첫 segment 들부터 ACK 을 미루지 않도록
+void sockopt_upstream_connected(int fd, ProxyConfig *config) {
+    sockopt_quickack(fd, config);
+}
+
+// 읽은 뒤에 TCP_QUICKACK 을 다시 거는 함수 (커널이 quickack 모드를 스스로 끄므로)
+void sockopt_quickack(int fd, ProxyConfig *config) {
+    set_option(fd, IPPROTO_TCP, TCP_QUICKACK, config->tcp_quickack);
+}
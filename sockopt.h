@@ -0,0 +1,22 @@
+/*
+ * sockopt.h - listener, client, upstream socket 마다 역할에 맞게 거는 TCP 옵션
+ */
+#ifndef __SOCKOPT_H__
+#define __SOCKOPT_H__
+
+#include "csapp.h"
+#include "config.h"
+
+void sockopt_listener(int fd, ProxyConfig *config);
+
+int sockopt_accept(int listenfd, SA *addr, socklen_t *addrlen);
+
+void sockopt_client(int fd, ProxyConfig *config);
+
+void sockopt_upstream(int fd, ProxyConfig *config);
+
+void sockopt_upstream_connected(int fd, ProxyConfig *config);
+
+void sockopt_quickack(int fd, ProxyConfig *config);
+
+#endif /* __SOCKOPT_H__ */
@@ -0,0 +1,342 @@
+/*
+ * stats.c - 요청 수, 캐시 hit/miss, 단계별 지연 시간 통계
+ *
+ * 요청을 처리하는 thread 마다 자기 전용 counter/histogram 묶음(ThreadStats)을 가지고,
+ * 쓸 때는 lock 이나 atomic 연산 없이 자기 묶음에만 더한다. 통계를 읽을 때 모든 묶음을 합친다.
+ * thread 가 끝나면 묶음은 값을 그대로 가진 채 free list 로 돌아가고 다음 thread 가 이어서 쓰므로,
+ * thread 가 매 연결마다 새로 만들어져도 묶음 수는 동시에 살아있는 thread 수를 넘지 않는다.
+ *
+ * origin 별 histogram 은 thread 마다 두기에는 너무 커서 전역 테이블 하나에 atomic 으로 더한다.
+ * origin 당 miss 한 번에 한 번만 기록되므로 hot path 비용은 무시할 만하다.
+ *
+ * histogram 은 HDR histogram 과 같은 log-linear 구간을 쓴다: 값이 2^k 와 2^(k+1) 사이면
+ * 그 구간을 16 칸으로 나눠서 세므로, 1us 부터 71 분까지 464 칸으로 약 3% 정밀도를 가진다.
+ */
+#include <stdarg.h>
+#include <time.h>
+#include "stats.h"
+#include "memory.h"
+#include "upstream.h"
+#include "admission.h"
+#include "compress.h"
+#include "predict.h"
+#include "util.h"
+
+/* 주인 thread 만 쓰고 다른 thread 는 읽기만 하므로, 찢어진 값만 보이지 않게 relaxed 로 접근 */
+#define LOCAL_ADD(p, n) __atomic_store_n((p), __atomic_load_n((p), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define MIN_SIZE(a, b) ((a) < (b) ? (a) : (b))
+
+typedef struct Histogram {
+    long long counts[HIST_BUCKETS];
+    long long sum;
+    long long max;
+} Histogram;
+
+// thread 하나가 쓰는 통계 묶음
+typedef struct ThreadStats {
+    long long counters[STAT_COUNT];
+    Histogram phases[PHASE_COUNT];
+    int in_use;
+    struct ThreadStats *next_all;   // 읽을 때 순회하는 전체 목록
+    struct ThreadStats *next_free;
+} ThreadStats;
+
+typedef struct OriginStats {
+    int state;                      // 0: 비어있음, 1: 이름 쓰는 중, 2: 사용 중
+    char name[64];
+    Histogram latency;
+} OriginStats;
+
+static ThreadStats *all_stats, *free_stats;
+static sem_t stats_mutex;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static __thread ThreadStats *my_stats;
+
+static OriginStats origins[STATS_MAX_ORIGINS + 1];  // 마지막 칸은 테이블이 가득 찼을 때 쓰는 "other"
+static int active_connections;
+static long long relay_buffered, relay_spilled;   // 모든 relay 의 ring / spill 파일에 쌓여 있는 바이트
+static long long started_us;
+
+static const char *phase_names[PHASE_COUNT] = {"total", "parse", "cache", "connect", "origin", "send"};
+static const char *counter_names[STAT_COUNT] = {
+        "requests", "hit_ram", "hit_disk", "hit_negative", "miss", "uncacheable",
+        "origin_errors", "evictions", "bytes_from_cache", "bytes_from_origin", "rejected_memory",
+        "timeouts", "relay_pauses", "relay_spills", "origin_released_early", "shed",
+        "h2_sessions", "h2_streams", "prefetch_queued", "prefetch_fetched", "prefetch_skipped"};
+static const char *memory_names[MEM_COMPONENTS] = {"cache", "connections", "thread_stacks", "allocator", "other"};
+
+// thread 가 끝날 때 묶음을 free list 로 돌려주는 함수
+static void stats_release(void *vargp) {
+    ThreadStats *ts = (ThreadStats *) vargp;
+
+    P(&stats_mutex);
+    ts->in_use = 0;
+    ts->next_free = free_stats;
+    free_stats = ts;
+    V(&stats_mutex);
+}
+
+static void stats_init(void) {
+    Sem_init(&stats_mutex, 0, 1);
+    pthread_key_create(&stats_key, stats_release);
+    strcpy(origins[STATS_MAX_ORIGINS].name, "other");
+    origins[STATS_MAX_ORIGINS].state = 2;
+    started_us = stats_now_us();
+}
+
+// 현재 thread 의 묶음을 가져오는 함수, 처음 부르는 thread 라면 free list 에서 하나 받아온다
+static ThreadStats *local_stats(void) {
+    ThreadStats *ts;
+
+    if (my_stats != NULL) {
+        return my_stats;
+    }
+    pthread_once(&stats_once, stats_init);
+
+    P(&stats_mutex);
+    if ((ts = free_stats) != NULL) {
+        free_stats = ts->next_free;
+    } else {
+        ts = (ThreadStats *) calloc(1, sizeof(ThreadStats));
+        ts->next_all = all_stats;
+        all_stats = ts;
+    }
+    ts->in_use = 1;
+    V(&stats_mutex);
+
+    pthread_setspecific(stats_key, ts);
+    return my_stats = ts;
+}
+
+static int hist_index(long long v) {
+    int exp;
+
+    if (v < 0) {
+        v = 0;
+    }
+    if (v >= 1LL << HIST_MAX_BITS) {
+        v = (1LL << HIST_MAX_BITS) - 1;
+    }
+    if (v < 2 * HIST_SUB_HALF) {
+        return (int) v;
+    }
+    exp = 63 - __builtin_clzll(v) - (HIST_SUB_BITS - 1);
+    return exp * HIST_SUB_HALF + (int) (v >> exp);
+}
+
+// 칸에 들어가는 가장 큰 값
+static long long hist_value(int index) {
+    int exp;
+
+    if (index < 2 * HIST_SUB_HALF) {
+        return index;
+    }
+    exp = index / HIST_SUB_HALF - 1;
+    return ((long long) (index % HIST_SUB_HALF + HIST_SUB_HALF + 1) << exp) - 1;
+}
+
+long long stats_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void stats_count(int counter, long long n) {
+    ThreadStats *ts = local_stats();
+    LOCAL_ADD(&ts->counters[counter], n);
+}
+
+void stats_record(int phase, long long usec) {
+    Histogram *h = &local_stats()->phases[phase];
+
+    LOCAL_ADD(&h->counts[hist_index(usec)], 1);
+    LOCAL_ADD(&h->sum, usec);
+    if (usec > LOAD(&h->max)) {
+        __atomic_store_n(&h->max, usec, __ATOMIC_RELAXED);
+    }
+}
+
+// origin 테이블에서 이름에 맞는 칸을 찾거나 새로 차지하는 함수
+static OriginStats *origin_slot(char *name) {
+    unsigned int h = fnv1a32_str(name), i, n;
+    OriginStats *o;
+
+    for (n = 0; n < STATS_MAX_ORIGINS; n++) {
+        o = &origins[(h + n) % STATS_MAX_ORIGINS];
+        i = __atomic_load_n(&o->state, __ATOMIC_ACQUIRE);
+        if (i == 0 && __sync_bool_compare_and_swap(&o->state, 0, 1)) {
+            snprintf(o->name, sizeof(o->name), "%s", name);
+            __atomic_store_n(&o->state, 2, __ATOMIC_RELEASE);
+            return o;
+        }
+        if (i == 2 && strncmp(o->name, name, sizeof(o->name) - 1) == 0) {
+            return o;
+        }
+    }
+    return &origins[STATS_MAX_ORIGINS];
+}
+
+void stats_record_origin(char *hostname, char *port, long long usec) {
+    char name[MAXLINE];
+    OriginStats *o;
+    long long max;
+
+    pthread_once(&stats_once, stats_init);
+
+    if (snprintf(name, MAXLINE, "%s:%s", hostname, port) >= MAXLINE) {
+        name[MAXLINE - 1] = '\0';
+    }
+    o = origin_slot(name);
+    __sync_fetch_and_add(&o->latency.counts[hist_index(usec)], 1);
+    __sync_fetch_and_add(&o->latency.sum, usec);
+    while (usec > (max = LOAD(&o->latency.max)) && !__sync_bool_compare_and_swap(&o->latency.max, max, usec));
+}
+
+void stats_connection_open(void) {
+    __sync_fetch_and_add(&active_connections, 1);
+}
+
+void stats_connection_close(void) {
+    __sync_fetch_and_sub(&active_connections, 1);
+}
+
+// relay 에 쌓여 있는 양의 변화를 더하는 함수
+void stats_relay(long long buffered, long long spilled) {
+    if (buffered != 0) {
+        __sync_fetch_and_add(&relay_buffered, buffered);
+    }
+    if (spilled != 0) {
+        __sync_fetch_and_add(&relay_spilled, spilled);
+    }
+}
+
+// buf 뒤에 이어서 쓰는 함수, 공간이 모자라면 잘라낸다
+static void append(char *buf, ssize_t size, ssize_t *len, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    if (*len >= size - 1) {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    *len += n < 0 ? 0 : MIN_SIZE(n, size - 1 - *len);
+}
+
+static void hist_merge(Histogram *dst, Histogram *src) {
+    int i;
+    long long max;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += LOAD(&src->counts[i]);
+    }
+    dst->sum += LOAD(&src->sum);
+    if ((max = LOAD(&src->max)) > dst->max) {
+        dst->max = max;
+    }
+}
+
+static long long hist_total(Histogram *h) {
+    long long total = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        total += h->counts[i];
+    }
+    return total;
+}
+
+static void append_histogram(char *buf, ssize_t size, ssize_t *len, const char *name, Histogram *h) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p99", "p999"};
+    long long total = hist_total(h), seen = 0;
+    int i, q = 0;
+
+    append(buf, size, len, "\"%s\": {\"count\": %lld, \"mean\": %lld", name, total, total ? h->sum / total : 0);
+    for (i = 0; i < HIST_BUCKETS && q < 4; i++) {
+        seen += h->counts[i];
+        while (q < 4 && total > 0 && seen >= (long long) (quantiles[q] * total + 0.5)) {
+            append(buf, size, len, ", \"%s\": %lld", labels[q++], MIN_SIZE(hist_value(i), h->max));
+        }
+    }
+    for (; q < 4; q++) {
+        append(buf, size, len, ", \"%s\": 0", labels[q]);
+    }
+    append(buf, size, len, ", \"max\": %lld}", h->max);
+}
+
+// 모든 thread 의 통계를 합쳐서 JSON 으로 buf 에 써주는 함수, 쓴 길이를 반환
+ssize_t stats_render(char *buf, ssize_t size) {
+    long long counters[STAT_COUNT] = {0}, memory[MEM_COMPONENTS], rss, budget;
+    Histogram *phases = (Histogram *) calloc(PHASE_COUNT, sizeof(Histogram)), latency;
+    ThreadStats *ts;
+    ssize_t len = 0;
+    int i, threads = 0, slots = 0, first = 1;
+
+    pthread_once(&stats_once, stats_init);
+
+    // 목록에는 추가만 되므로 head 만 lock 안에서 읽으면 된다
+    P(&stats_mutex);
+    ts = all_stats;
+    V(&stats_mutex);
+    for (; ts != NULL; ts = ts->next_all) {
+        for (i = 0; i < STAT_COUNT; i++) {
+            counters[i] += LOAD(&ts->counters[i]);
+        }
+        for (i = 0; i < PHASE_COUNT; i++) {
+            hist_merge(&phases[i], &ts->phases[i]);
+        }
+        threads += LOAD(&ts->in_use);
+        slots++;
+    }
+
+    append(buf, size, &len, "{\n\"uptime_sec\": %lld,\n\"active_connections\": %d,\n"
+                            "\"threads\": %d,\n\"thread_slots\": %d,\n\"counters\": {",
+           (stats_now_us() - started_us) / 1000000, LOAD(&active_connections), threads, slots);
+    for (i = 0; i < STAT_COUNT; i++) {
+        append(buf, size, &len, "%s\"%s\": %lld", i ? ", " : "", counter_names[i], counters[i]);
+    }
+    memory_snapshot(memory, &rss, &budget);
+    append(buf, size, &len, "},\n\"memory\": {\"budget\": %lld, \"rss\": %lld, \"total\": %lld",
+           budget, rss, memory_total());
+    for (i = 0; i < MEM_COMPONENTS; i++) {
+        append(buf, size, &len, ", \"%s\": %lld", memory_names[i], memory[i]);
+    }
+    append(buf, size, &len, "},\n\"relay\": {\"buffered\": %lld, \"spilled\": %lld",
+           LOAD(&relay_buffered), LOAD(&relay_spilled));
+    append(buf, size, &len, "},\n\"admission\": ");
+    len += admission_render(buf + len, size - len);
+    append(buf, size, &len, ",\n\"compression\": ");
+    len += compress_render(buf + len, size - len);
+    append(buf, size, &len, ",\n\"prediction\": ");
+    len += predict_render(buf + len, size - len);
+    append(buf, size, &len, ",\n\"upstreams\": ");
+    len += upstream_render(buf + len, size - len);
+    append(buf, size, &len, ",\n\"latency_us\": {\n");
+    for (i = 0; i < PHASE_COUNT; i++) {
+        append(buf, size, &len, "  ");
+        append_histogram(buf, size, &len, phase_names[i], &phases[i]);
+        append(buf, size, &len, i < PHASE_COUNT - 1 ? ",\n" : "\n");
+    }
+    append(buf, size, &len, "},\n\"origins_us\": {\n");
+    for (i = 0; i <= STATS_MAX_ORIGINS; i++) {
+        if (__atomic_load_n(&origins[i].state, __ATOMIC_ACQUIRE) != 2) {
+            continue;
+        }
+        memset(&latency, 0, sizeof(latency));
+        hist_merge(&latency, &origins[i].latency);
+        if (hist_total(&latency) == 0) {
+            continue;
+        }
+        append(buf, size, &len, first ? "  " : ",\n  ");
+        append_histogram(buf, size, &len, origins[i].name, &latency);
+        first = 0;
+    }
+    append(buf, size, &len, "\n}\n}\n");
+
+    free(phases);
+    return len;
+}
@@ -0,0 +1,72 @@
+/*
+ * stats.h - 요청 수, 캐시 hit/miss, 단계별 지연 시간 통계
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "csapp.h"
+
+#define STATS_PATH "/__proxy/stats"    /* proxy 에 직접 GET 하면 통계를 JSON 으로 돌려주는 경로 */
+
+/* HDR histogram: 2 의 거듭제곱 구간마다 16 칸, 값의 상대 오차 약 3% */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_MAX_BITS 32                /* 2^32 us (약 71 분) 보다 긴 값은 마지막 칸에 넣음 */
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_SUB_HALF)
+
+#define STATS_MAX_ORIGINS 64            /* origin 별 histogram 개수, 넘치면 "other" 로 모음 */
+
+// 요청 하나가 거치는 단계
+enum {
+    PHASE_TOTAL,        // 요청을 받고 연결을 닫을 때까지
+    PHASE_PARSE,        // 요청 line/header 읽기, 캐시 key 만들기
+    PHASE_CACHE,        // RAM / disk / negative cache 조회 (hit 이면 전송까지)
+    PHASE_CONNECT,      // origin 으로의 connect
+    PHASE_ORIGIN,       // HEAD 확인부터 origin 응답을 다 받을 때까지
+    PHASE_SEND,         // origin 응답을 client 로 보내기
+    PHASE_COUNT
+};
+
+// 누적 counter
+enum {
+    STAT_REQUESTS,
+    STAT_HIT_RAM,
+    STAT_HIT_DISK,
+    STAT_HIT_NEGATIVE,
+    STAT_MISS,
+    STAT_UNCACHEABLE,       // 크기 때문에 캐시하지 않고 중계만 한 요청
+    STAT_ORIGIN_ERRORS,     // origin 에 연결하지 못해 502 를 보낸 요청
+    STAT_EVICTIONS,         // RAM 캐시에서 밀려난 아이템 수
+    STAT_BYTES_CACHE,       // 캐시에서 client 로 보낸 바이트
+    STAT_BYTES_ORIGIN,      // origin 에서 받아 client 로 보낸 바이트
+    STAT_REJECTED_MEMORY,   // 메모리 예산이 모자라 503 으로 거절한 연결
+    STAT_TIMEOUTS,          // deadline 이 지나서 408/504 로 끝내거나 끊은 요청
+    STAT_RELAY_PAUSES,      // relay 버퍼가 가득 차서 origin 에서 읽기를 멈춘 횟수
+    STAT_RELAY_SPILLS,      // relay 버퍼가 넘쳐 spill 파일을 쓴 응답
+    STAT_ORIGIN_RELEASED_EARLY, // client 가 다 받기 전에 origin 연결을 놓아준 응답
+    STAT_SHED,              // 과부하로 503 을 보낸 연결이나 cache miss (admission.c)
+    STAT_H2_SESSIONS,       // HTTP/2 로 받은 연결 (h2.c)
+    STAT_H2_STREAMS,        // HTTP/2 연결에서 deliver 로 넘긴 stream
+    STAT_PREFETCH_QUEUED,   // HTML 응답에서 찾아 prefetch 대기열에 넣은 URL (prefetch.c)
+    STAT_PREFETCH_FETCHED,  // prefetch 로 받은 응답
+    STAT_PREFETCH_SKIPPED,  // 대기열이 가득 찼거나 예산을 넘어서 받지 않은 URL
+    STAT_COUNT
+};
+
+long long stats_now_us(void);
+
+void stats_count(int counter, long long n);
+
+void stats_record(int phase, long long usec);
+
+void stats_record_origin(char *hostname, char *port, long long usec);
+
+void stats_connection_open(void);
+
+void stats_connection_close(void);
+
+void stats_relay(long long buffered, long long spilled);
+
+ssize_t stats_render(char *buf, ssize_t size);
+
+#endif /* __STATS_H__ */
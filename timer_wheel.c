@@ -0,0 +1,158 @@
+/*
+ * timer_wheel.c - O(1) 로 걸고 취소할 수 있는 계층형 timer wheel
+ *
+ * TIMER_LEVELS 개의 바퀴가 있고, 바퀴마다 TIMER_SLOTS 칸의 이중 연결 리스트가 있다.
+ * level i 의 한 칸은 64^i tick 을 나타내므로, timer 는 울릴 때까지 남은 시간에 맞는 level 의 칸에 들어간다.
+ * - 걸기/취소는 칸을 계산해서 리스트에 넣고 빼기만 하므로 걸려 있는 timer 수와 상관없이 O(1) 이다.
+ * - ticker thread 가 TIMER_TICK_MS 마다 한 칸씩 돌면서 level 0 의 현재 칸에 있는 timer 를 울린다.
+ *   level 0 이 한 바퀴 돌 때마다 level 1 의 다음 칸을 풀어서 아래 level 로 다시 넣고, 위 level 도 같은 식이다.
+ * 연결마다 timer 하나씩이므로 연결이 10 만 개여도 tick 마다 하는 일은 그 tick 에 울릴 timer 수에 비례한다.
+ *
+ * 모든 조작은 wheel 의 lock 하나로 보호되고, 울린 timer 의 fn 도 그 lock 을 잡은 채로 호출된다.
+ * 따라서 timer_cancel 이 끝난 뒤에는 fn 이 실행 중이거나 앞으로 실행될 일이 없다.
+ * fn 안에서는 timer_arm / timer_cancel 을 부를 수 없다.
+ */
+#include <time.h>
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define MAX_DELAY ((1LL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+static Timer wheel[TIMER_LEVELS][TIMER_SLOTS];  // 각 칸의 리스트 머리 (빈 원형 리스트)
+static long long now_tick;                      // 여기까지 처리한 tick
+static long long start_ms;
+static sem_t wheel_mutex;
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_add(Timer *head, Timer *timer) {
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_del(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+// expires 에 맞는 칸에 timer 를 넣는 함수 (lock 을 잡은 상태에서 호출)
+// level i 에는 현재 tick 과 64^i 단위 구간 번호의 차이가 64 보다 작은 timer 가 들어간다
+static void wheel_insert(Timer *timer) {
+    int level;
+
+    if (timer->expires <= now_tick) {
+        list_add(&wheel[0][now_tick & SLOT_MASK], timer);
+        return;
+    }
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if ((timer->expires >> (TIMER_SLOT_BITS * level)) - (now_tick >> (TIMER_SLOT_BITS * level)) < TIMER_SLOTS) {
+            break;
+        }
+    }
+    list_add(&wheel[level][(timer->expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK], timer);
+}
+
+// level 의 칸 하나에 있는 timer 들을 꺼내서 아래 level 로 다시 넣는 함수
+static void wheel_cascade(int level, int slot) {
+    Timer *head = &wheel[level][slot], *timer;
+
+    while ((timer = head->next) != head) {
+        list_del(timer);
+        wheel_insert(timer);
+    }
+}
+
+// 한 tick 진행하고, 그 tick 에 울릴 timer 들을 울리는 함수
+static void wheel_advance(void) {
+    Timer *head, *timer;
+    int level;
+
+    now_tick++;
+    // 위 level 부터 풀어야 내려온 timer 가 같은 tick 에 다시 풀린다
+    for (level = TIMER_LEVELS - 1; level > 0; level--) {
+        if ((now_tick & ((1LL << (TIMER_SLOT_BITS * level)) - 1)) == 0) {
+            wheel_cascade(level, (int) ((now_tick >> (TIMER_SLOT_BITS * level)) & SLOT_MASK));
+        }
+    }
+
+    head = &wheel[0][now_tick & SLOT_MASK];
+    while ((timer = head->next) != head) {
+        list_del(timer);
+        timer->fn(timer->arg);
+    }
+}
+
+// TIMER_TICK_MS 마다 밀린 tick 만큼 wheel 을 돌리는 thread
+static void *timer_ticker(void *vargp) {
+    long long target;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        usleep(TIMER_TICK_MS * 1000);
+
+        target = (monotonic_ms() - start_ms) / TIMER_TICK_MS;
+        P(&wheel_mutex);
+        while (now_tick < target) {
+            wheel_advance();
+        }
+        V(&wheel_mutex);
+    }
+    return NULL;
+}
+
+void timer_wheel_init(void) {
+    pthread_t tid;
+    int level, slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            wheel[level][slot].prev = wheel[level][slot].next = &wheel[level][slot];
+        }
+    }
+    Sem_init(&wheel_mutex, 0, 1);
+    start_ms = monotonic_ms();
+    now_tick = 0;
+    Pthread_create(&tid, NULL, timer_ticker, NULL);
+}
+
+void timer_init(Timer *timer, void (*fn)(void *arg), void *arg) {
+    timer->prev = timer->next = NULL;
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+// ms 뒤에 울리도록 timer 를 거는 함수, 이미 걸려 있으면 새 시각으로 옮긴다
+void timer_arm(Timer *timer, long long ms) {
+    long long ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks > MAX_DELAY) {
+        ticks = MAX_DELAY;
+    }
+
+    P(&wheel_mutex);
+    if (timer->prev != NULL) {
+        list_del(timer);
+    }
+    timer->expires = now_tick + ticks;
+    wheel_insert(timer);
+    V(&wheel_mutex);
+}
+
+// 걸려 있는 timer 를 빼는 함수, 이미 울렸거나 걸려 있지 않으면 아무것도 하지 않는다
+void timer_cancel(Timer *timer) {
+    P(&wheel_mutex);
+    if (timer->prev != NULL) {
+        list_del(timer);
+    }
+    V(&wheel_mutex);
+}
@@ -0,0 +1,29 @@
+/*
+ * timer_wheel.h - O(1) 로 걸고 취소할 수 있는 계층형 timer wheel
+ */
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "csapp.h"
+
+#define TIMER_TICK_MS 10        /* wheel 이 한 칸 도는 시간, timer 는 이 단위로 늦게 울릴 수 있다 */
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4          /* 10ms * 64^4 (약 194 일) 보다 먼 timer 는 그 시각에 건 것으로 취급 */
+
+typedef struct Timer {
+    struct Timer *prev, *next;  // 걸려 있는 slot 의 목록, 걸려 있지 않으면 prev 가 NULL
+    long long expires;          // 울릴 tick
+    void (*fn)(void *arg);      // 울릴 때 ticker thread 에서 wheel 의 lock 을 잡은 채로 호출
+    void *arg;
+} Timer;
+
+void timer_wheel_init(void);
+
+void timer_init(Timer *timer, void (*fn)(void *arg), void *arg);
+
+void timer_arm(Timer *timer, long long ms);
+
+void timer_cancel(Timer *timer);
+
+#endif /* __TIMER_WHEEL_H__ */
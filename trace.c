@@ -0,0 +1,133 @@
+/*
+ * trace.c - 요청 하나의 단계별 시각 기록 (Chrome trace 형식 trace log 와 slow request log)
+ *
+ * deliver() 는 단계가 바뀔 때마다 trace_mark 로 monotonic 시각을 찍어두고, 연결을 닫을 때 trace_finish 를 부른다.
+ * - trace log: trace_sample 개 요청 중 하나를 Chrome trace 의 JSON Array 형식으로 trace_file 에 남긴다.
+ *   요청 하나가 한 줄(tid)이 되고, 단계마다 "ph":"X" event 하나가 된다. chrome://tracing 이나 Perfetto 에서
+ *   그대로 열 수 있다 (형식상 마지막 ']' 는 생략 가능하므로 실행 중에도 열어볼 수 있다).
+ * - slow request log: 전체 시간이 slow_request_ms 를 넘은 요청은 sampling 과 상관없이 단계별 시간을 stderr 로 출력한다.
+ */
+#include <time.h>
+#include "trace.h"
+
+static const char *mark_names[TRACE_MARKS] = {
+        "accept", "queue", "read_request", "parse", "cache_lookup", "connect",
+        "head_probe", "reconnect", "ttfb", "transfer", "cache_store", "send", "close"};
+
+static char trace_path[MAXLINE];
+static FILE *trace_fp;
+static sem_t trace_mutex;
+static unsigned long request_seq;
+
+// trace log 위치 지정, 파일은 처음 sampling 된 요청이 있을 때 연다 (시작 시에만 적용)
+void trace_init(char *path) {
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+    Sem_init(&trace_mutex, 0, 1);
+}
+
+void trace_begin(RequestTrace *trace) {
+    memset(trace, 0, sizeof(RequestTrace));
+    trace_mark(trace, TRACE_ACCEPT);
+}
+
+// 현재 시각을 mark 에 찍고 반환하는 함수
+long long trace_mark(RequestTrace *trace, int mark) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return trace->marks[mark] = (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_label(RequestTrace *trace, char *method, char *uri) {
+    if (snprintf(trace->label, TRACE_LABEL_SIZE, "%s %s", method, uri) >= TRACE_LABEL_SIZE) {
+        trace->label[TRACE_LABEL_SIZE - 1] = '\0';
+    }
+}
+
+// JSON 문자열 안에 넣을 수 있게 '"' 와 '\' 와 제어문자를 바꿔주는 함수
+static void json_escape(char *dst, char *src, size_t size) {
+    size_t n = 0;
+
+    for (; *src && n + 7 < size; src++) {
+        if (*src == '"' || *src == '\\') {
+            dst[n++] = '\\';
+            dst[n++] = *src;
+        } else if ((unsigned char) *src < 0x20) {
+            n += sprintf(dst + n, "\\u%04x", (unsigned char) *src);
+        } else {
+            dst[n++] = *src;
+        }
+    }
+    dst[n] = '\0';
+}
+
+// 찍힌 mark 들을 trace event 로 만들어 파일에 쓰는 함수
+static void trace_write(RequestTrace *trace, unsigned long tid) {
+    char label[TRACE_LABEL_SIZE * 2], events[MAXBUF];
+    long long prev = trace->marks[TRACE_ACCEPT];
+    int i, n;
+
+    json_escape(label, trace->label, sizeof(label));
+    n = snprintf(events, MAXBUF, "{\"name\": \"request\", \"cat\": \"proxy\", \"ph\": \"X\", \"pid\": %d, \"tid\": %lu, "
+                                 "\"ts\": %lld, \"dur\": %lld, \"args\": {\"url\": \"%s\"}},\n",
+                 getpid(), tid, prev, trace->marks[TRACE_DONE] - prev, label);
+    for (i = TRACE_START; i < TRACE_MARKS && n < MAXBUF; i++) {
+        if (trace->marks[i] == 0) {
+            continue;
+        }
+        n += snprintf(events + n, MAXBUF - n, "{\"name\": \"%s\", \"cat\": \"proxy\", \"ph\": \"X\", \"pid\": %d, "
+                                              "\"tid\": %lu, \"ts\": %lld, \"dur\": %lld},\n",
+                      mark_names[i], getpid(), tid, prev, trace->marks[i] - prev);
+        prev = trace->marks[i];
+    }
+
+    P(&trace_mutex);
+    if (trace_fp == NULL && trace_path[0] != '\0') {
+        if ((trace_fp = fopen(trace_path, "w")) == NULL) {
+            fprintf(stderr, "trace: cannot open %s: %s\n", trace_path, strerror(errno));
+            trace_path[0] = '\0';
+        } else {
+            fputs("[\n", trace_fp);
+        }
+    }
+    if (trace_fp != NULL) {
+        fputs(events, trace_fp);
+        fflush(trace_fp);
+    }
+    V(&trace_mutex);
+}
+
+// slow request 의 단계별 시간을 한 줄로 출력하는 함수
+static void trace_slow(RequestTrace *trace, long long total) {
+    char line[MAXBUF];
+    long long prev = trace->marks[TRACE_ACCEPT];
+    int i, n;
+
+    n = snprintf(line, MAXBUF, "slow request %lld ms: %s |", total / 1000, trace->label);
+    for (i = TRACE_START; i < TRACE_MARKS && n < MAXBUF; i++) {
+        if (trace->marks[i] == 0) {
+            continue;
+        }
+        n += snprintf(line + n, MAXBUF - n, " %s=%.3f", mark_names[i], (trace->marks[i] - prev) / 1000.0);
+        prev = trace->marks[i];
+    }
+    fprintf(stderr, "%s\n", line);
+}
+
+// 요청이 끝났을 때 sampling 된 요청은 trace log 에, 느린 요청은 slow request log 에 남겨주는 함수
+void trace_finish(RequestTrace *trace, int sample_rate, int slow_ms) {
+    unsigned long seq = __sync_fetch_and_add(&request_seq, 1);
+    long long total;
+
+    if (trace->marks[TRACE_DONE] == 0) {
+        trace_mark(trace, TRACE_DONE);
+    }
+    total = trace->marks[TRACE_DONE] - trace->marks[TRACE_ACCEPT];
+
+    if (sample_rate > 0 && seq % sample_rate == 0) {
+        trace_write(trace, seq);
+    }
+    if (slow_ms > 0 && total >= slow_ms * 1000LL) {
+        trace_slow(trace, total);
+    }
+}
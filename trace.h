@@ -0,0 +1,45 @@
+/*
+ * trace.h - 요청 하나의 단계별 시각 기록 (Chrome trace 형식 trace log 와 slow request log)
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "csapp.h"
+
+#define TRACE_LABEL_SIZE 256
+#define DEFAULT_TRACE_FILE "./proxy-trace.json"
+
+// 단계가 끝나는 시점들, 요청이 거치지 않은 시점은 0 으로 남는다
+enum {
+    TRACE_ACCEPT,           // accept 가 끝난 시각
+    TRACE_START,            // deliver thread 가 시작된 시각
+    TRACE_REQUEST_LINE,     // 요청 line 을 읽은 시각
+    TRACE_HEADERS,          // 요청 header 를 읽고 server 로 보낼 header 와 캐시 key 를 만든 시각
+    TRACE_CACHE,            // 캐시 조회가 끝난 시각
+    TRACE_CONNECT,          // origin 과 연결된 시각
+    TRACE_HEAD_PROBE,       // HEAD 응답을 받은 시각
+    TRACE_RECONNECT,        // GET 을 위해 다시 연결된 시각
+    TRACE_TTFB,             // origin 응답의 첫 바이트를 받은 시각
+    TRACE_TRANSFER,         // origin 응답을 다 받은 시각
+    TRACE_STORE,            // 받은 응답을 캐시(또는 negative cache)에 넣은 시각
+    TRACE_SEND,             // client 로 응답을 다 보낸 시각
+    TRACE_DONE,             // 연결을 닫은 시각
+    TRACE_MARKS
+};
+
+typedef struct RequestTrace {
+    long long marks[TRACE_MARKS];   // CLOCK_MONOTONIC 기준 us
+    char label[TRACE_LABEL_SIZE];   // "GET http://..."
+} RequestTrace;
+
+void trace_init(char *path);
+
+void trace_begin(RequestTrace *trace);
+
+long long trace_mark(RequestTrace *trace, int mark);
+
+void trace_label(RequestTrace *trace, char *method, char *uri);
+
+void trace_finish(RequestTrace *trace, int sample_rate, int slow_ms);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,411 @@
+/*
+ * upstream.c - 이름 하나 뒤에 여러 origin 을 두는 upstream group
+ *
+ * 설정에 "upstream = backend p2c 127.0.0.1:8001 127.0.0.1:8002" 처럼 적으면, 요청 URL 의 host 가 backend 인 요청은
+ * 그 host 로 연결하는 대신 group 의 server 중 하나로 보낸다. 캐시 key 와 Host header 는 group 이름 그대로이므로
+ * 어느 server 가 응답했든 같은 캐시 항목을 쓴다 (caching reverse proxy).
+ * - server 고르기: round_robin, least_conn, p2c (무작위 두 개 중 EWMA 지연 x (진행 중인 요청 + 1) 이 작은 쪽)
+ * - active health check: health_check_path 가 있으면 health thread 가 health_check_interval_ms 마다
+ *   모든 server 에 HEAD 요청을 보내고, 2xx/3xx 가 아니거나 health_check_timeout_ms 안에 답하지 않으면 뺀다.
+ * - passive ejection: 요청이 연결 실패, deadline, 5xx 로 upstream_max_fails 번 연속 실패하면
+ *   upstream_fail_timeout 초 동안 뺀다.
+ * 쓸 수 있는 server 가 하나도 없으면 upstream_pick 은 NULL 을 주고, deliver 는 502 로 답한다.
+ *
+ * server 는 pool 에 host:port 별로 하나씩 있고 reload 해도 같은 주소면 상태(EWMA, 실패 수 등)를 이어 쓴다.
+ * pool 의 항목은 free 하지 않으므로 진행 중인 요청이 들고 있는 포인터는 reload 뒤에도 유효하다.
+ */
+#include <poll.h>
+#include "upstream.h"
+#include "stats.h"
+#include "negative_cache.h"
+#include "happy_eyeballs.h"
+
+typedef struct UpstreamGroup {
+    char name[64];
+    int policy;
+    int count;
+    UpstreamServer *servers[UPSTREAM_MAX_SERVERS];
+    unsigned int next;          // round robin 과 least_conn 동점일 때 시작 위치
+} UpstreamGroup;
+
+static UpstreamServer pool[UPSTREAM_POOL_SIZE];
+static UpstreamGroup groups[UPSTREAM_MAX_GROUPS];
+static int group_count;
+static sem_t upstream_mutex;
+static pthread_once_t upstream_once = PTHREAD_ONCE_INIT;
+static __thread unsigned int pick_seed;
+
+static const char *policy_names[] = {"round_robin", "least_conn", "p2c"};
+
+static void upstream_init(void) {
+    Sem_init(&upstream_mutex, 0, 1);
+}
+
+// "upstream = <name> [policy] <host:port>..." 의 값을 읽는 함수, 잘못된 줄이면 -1
+int upstream_parse(char *line, UpstreamSpec *spec) {
+    char tmp[MAXLINE], *token, *save, *colon;
+    int i;
+
+    snprintf(tmp, sizeof(tmp), "%s", line);
+    memset(spec, 0, sizeof(UpstreamSpec));
+    if ((token = strtok_r(tmp, " \t", &save)) == NULL || strlen(token) >= sizeof(spec->name)) {
+        return -1;
+    }
+    strcpy(spec->name, token);
+    spec->policy = UPSTREAM_ROUND_ROBIN;
+
+    while ((token = strtok_r(NULL, " \t", &save)) != NULL) {
+        if ((colon = strrchr(token, ':')) == NULL) {
+            // server 보다 앞에 올 때만 policy 로 읽음
+            for (i = 0; i < 3 && strcmp(token, policy_names[i]); i++);
+            if (i == 3 || spec->count > 0) {
+                return -1;
+            }
+            spec->policy = i;
+            continue;
+        }
+        if (spec->count == UPSTREAM_MAX_SERVERS || colon == token || colon - token >= 64
+            || strlen(colon + 1) == 0 || strlen(colon + 1) >= 8 || atoi(colon + 1) <= 0) {
+            return -1;
+        }
+        *colon = '\0';
+        // IPv6 주소는 [::1]:8080 처럼 적는다
+        if (token[0] == '[' && colon[-1] == ']') {
+            colon[-1] = '\0';
+            token++;
+        }
+        strcpy(spec->host[spec->count], token);
+        strcpy(spec->port[spec->count], colon + 1);
+        spec->count++;
+    }
+    return spec->count > 0 ? 0 : -1;
+}
+
+// host:port 에 해당하는 pool 의 server 를 찾는 함수, 없으면 NULL (lock 을 잡은 상태에서 호출)
+static UpstreamServer *pool_find(char *host, char *port) {
+    int i;
+
+    for (i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+        if (pool[i].host[0] != '\0' && !strcmp(pool[i].host, host) && !strcmp(pool[i].port, port)) {
+            return &pool[i];
+        }
+    }
+    return NULL;
+}
+
+// 이번 설정에서 쓰지 않고 진행 중인 요청도 없는 칸에 host:port 의 server 를 새로 만드는 함수 (lock 을 잡은 상태에서 호출)
+static UpstreamServer *pool_new(char *host, char *port) {
+    int i;
+
+    for (i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+        if (pool[i].refs == 0 && pool[i].active == 0) {
+            memset(&pool[i], 0, sizeof(UpstreamServer));
+            strcpy(pool[i].host, host);
+            strcpy(pool[i].port, port);
+            pool[i].healthy = 1;
+            return &pool[i];
+        }
+    }
+    return NULL;
+}
+
+// 설정의 upstream 줄들로 group 목록을 다시 만드는 함수, 시작할 때와 reload 할 때 호출
+// server 의 host 는 여기서 주소 하나로 풀어두므로, 이름이 바뀐 주소를 다시 읽으려면 reload 한다
+// 이미 pool 에 있는 server 를 모두 먼저 찾아 표시한 뒤에 새 server 의 칸을 정하므로,
+// 같은 reload 에서 뒤에 다시 나오는 server 의 칸 (EWMA, 실패 수 등) 을 앞의 새 server 가 가져가지 않는다
+void upstream_configure(ProxyConfig *config) {
+    static struct {
+        int group, index;
+        char host[64], port[8];
+    } pending[UPSTREAM_POOL_SIZE];
+    UpstreamSpec spec;
+    UpstreamGroup *group;
+    UpstreamServer *server;
+    struct addrinfo hints, *res;
+    char host[64];
+    int i, j, k, n = 0;
+
+    pthread_once(&upstream_once, upstream_init);
+
+    P(&upstream_mutex);
+    for (i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+        pool[i].refs = 0;
+    }
+    group_count = 0;
+    for (i = 0; i < config->upstream_count; i++) {
+        if (upstream_parse(config->upstreams[i], &spec) < 0) {
+            continue;
+        }
+        group = &groups[group_count++];
+        memset(group, 0, sizeof(UpstreamGroup));
+        strcpy(group->name, spec.name);
+        group->policy = spec.policy;
+
+        for (j = 0; j < spec.count; j++) {
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(spec.host[j], spec.port[j], &hints, &res) != 0) {
+                fprintf(stderr, "upstream %s: cannot resolve %s, skipping\n", spec.name, spec.host[j]);
+                continue;
+            }
+            getnameinfo(res->ai_addr, res->ai_addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST);
+            freeaddrinfo(res);
+            // pool 에 없는 server 는 자리만 잡아두고 아래에서 칸을 만든다
+            if ((server = pool_find(host, spec.port[j])) != NULL) {
+                server->refs++;
+            } else {
+                pending[n].group = group_count - 1;
+                pending[n].index = group->count;
+                strcpy(pending[n].host, host);
+                strcpy(pending[n].port, spec.port[j]);
+                n++;
+            }
+            group->servers[group->count++] = server;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        group = &groups[pending[i].group];
+        // 같은 reload 안에서 이미 만든 server 면 그 칸을 같이 쓴다
+        if ((server = pool_find(pending[i].host, pending[i].port)) == NULL
+            && (server = pool_new(pending[i].host, pending[i].port)) == NULL) {
+            fprintf(stderr, "upstream %s: too many servers, skipping %s:%s\n",
+                    group->name, pending[i].host, pending[i].port);
+            continue;
+        }
+        server->refs++;
+        group->servers[pending[i].index] = server;
+    }
+    // 칸을 만들지 못한 server 를 group 에서 뺀다
+    for (i = 0; i < group_count; i++) {
+        group = &groups[i];
+        for (j = k = 0; j < group->count; j++) {
+            if (group->servers[j] != NULL) {
+                group->servers[k++] = group->servers[j];
+            }
+        }
+        group->count = k;
+    }
+    V(&upstream_mutex);
+}
+
+// 지금 요청을 보낼 수 있는 server 인지 (lock 을 잡은 상태에서 호출)
+static int server_available(UpstreamServer *server, long long now) {
+    return server->healthy && server->ejected_until <= now;
+}
+
+// p2c 에서 비교하는 값, 지연을 모르는 server 는 1us 로 보고 먼저 써본다
+static long long server_cost(UpstreamServer *server) {
+    return (server->ewma_us + 1) * (server->active + 1);
+}
+
+// name 이 upstream group 이면 server 하나를 골라 *server 에 담고 1 을 반환하는 함수, group 이 아니면 0
+// 쓸 수 있는 server 가 없으면 *server 는 NULL, 고른 server 는 요청이 끝난 뒤 upstream_done 으로 돌려준다
+int upstream_pick(char *name, UpstreamServer **server) {
+    UpstreamGroup *group = NULL;
+    UpstreamServer *candidates[UPSTREAM_MAX_SERVERS], *chosen = NULL;
+    long long now = stats_now_us();
+    int i, n = 0, a, b;
+
+    pthread_once(&upstream_once, upstream_init);
+    if (pick_seed == 0) {
+        pick_seed = (unsigned int) (now ^ (long long) pthread_self());
+    }
+
+    P(&upstream_mutex);
+    for (i = 0; i < group_count; i++) {
+        if (!strcasecmp(groups[i].name, name)) {
+            group = &groups[i];
+            break;
+        }
+    }
+    if (group == NULL) {
+        V(&upstream_mutex);
+        return 0;
+    }
+
+    // round robin 순서를 유지하도록 next 부터 돌면서 후보를 모음
+    for (i = 0; i < group->count; i++) {
+        if (server_available(group->servers[(group->next + i) % group->count], now)) {
+            candidates[n++] = group->servers[(group->next + i) % group->count];
+        }
+    }
+    if (n > 0) {
+        switch (group->policy) {
+            case UPSTREAM_ROUND_ROBIN:
+                chosen = candidates[0];
+                break;
+            case UPSTREAM_LEAST_CONN:
+                chosen = candidates[0];
+                for (i = 1; i < n; i++) {
+                    if (candidates[i]->active < chosen->active) {
+                        chosen = candidates[i];
+                    }
+                }
+                break;
+            case UPSTREAM_P2C:
+                a = rand_r(&pick_seed) % n;
+                chosen = candidates[a];
+                if (n > 1) {
+                    b = rand_r(&pick_seed) % (n - 1);
+                    b += b >= a;
+                    if (server_cost(candidates[b]) < server_cost(chosen)) {
+                        chosen = candidates[b];
+                    }
+                }
+                break;
+        }
+        chosen->active++;
+        chosen->requests++;
+        group->next++;
+    }
+    V(&upstream_mutex);
+
+    *server = chosen;
+    return 1;
+}
+
+// upstream_pick 으로 고른 server 에 요청 결과를 돌려주는 함수
+// 성공이면 첫 바이트까지의 지연(latency_us, 0 이면 모름)을 EWMA 에 더하고, 실패가 이어지면 server 를 잠시 뺀다
+void upstream_done(UpstreamServer *server, int ok, long long latency_us, ProxyConfig *config) {
+    P(&upstream_mutex);
+    server->active--;
+    if (ok) {
+        server->fails = 0;
+        if (latency_us > 0) {
+            server->ewma_us = server->ewma_us == 0 ? latency_us :
+                              server->ewma_us + ((latency_us - server->ewma_us) >> UPSTREAM_EWMA_SHIFT);
+        }
+    } else {
+        server->failures++;
+        if (config->upstream_max_fails > 0 && ++server->fails >= config->upstream_max_fails) {
+            server->fails = 0;
+            server->ejected_until = stats_now_us() + config->upstream_fail_timeout * 1000000LL;
+            fprintf(stderr, "upstream %s:%s failed %d times in a row, ejected for %ds\n",
+                    server->host, server->port, config->upstream_max_fails, config->upstream_fail_timeout);
+        }
+    }
+    V(&upstream_mutex);
+}
+
+// fd 가 events 를 기다리는 상태가 될 때까지 최대 timeout_ms 기다리는 함수, 시간 안에 되면 1
+static int wait_fd(int fd, short events, int timeout_ms) {
+    struct pollfd pfd = {fd, events, 0};
+    int rc;
+
+    while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR);
+    return rc > 0;
+}
+
+// server 에 HEAD path 를 보내서 2xx/3xx 로 답하는지 확인하는 함수
+static int health_probe(char *host, char *port, char *path, int timeout_ms) {
+    struct addrinfo hints, *res;
+    char buf[MAXLINE];
+    int fd, status = -1;
+    ssize_t n;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return 0;
+    }
+    fd = origin_connect_addr(res->ai_addr, res->ai_addrlen, NULL, timeout_ms);
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return 0;
+    }
+    snprintf(buf, sizeof(buf), "HEAD %s HTTP/1.0\r\nHost: %s%s%s:%s\r\nConnection: close\r\n\r\n", path,
+             strchr(host, ':') ? "[" : "", host, strchr(host, ':') ? "]" : "", port);
+    if (send(fd, buf, strlen(buf), MSG_NOSIGNAL) == (ssize_t) strlen(buf) && wait_fd(fd, POLLIN, timeout_ms)
+        && (n = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        status = response_status(buf, n);
+        // 응답을 다 읽기 전에 닫으면 RST 를 받은 server 가 쓰다가 실패하므로 (tiny 는 SIGPIPE 로 죽는다) 끝까지 읽음
+        while (wait_fd(fd, POLLIN, timeout_ms) && recv(fd, buf, sizeof(buf), 0) > 0);
+    }
+    close(fd);
+    return status >= 200 && status < 400;
+}
+
+// health_check_interval_ms 마다 모든 server 를 확인하는 thread
+// 확인하는 동안에는 lock 을 잡지 않으므로, 주소만 복사해 두고 결과는 같은 주소의 server 에 반영한다
+static void *health_checker(void *vargp) {
+    ProxyConfig *config;
+    char path[MAXLINE], hosts[UPSTREAM_POOL_SIZE][64], ports[UPSTREAM_POOL_SIZE][8];
+    UpstreamServer *servers[UPSTREAM_POOL_SIZE];
+    int interval, timeout, i, n, healthy;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        config = config_acquire();
+        snprintf(path, sizeof(path), "%s", config->health_check_path);
+        interval = config->health_check_interval_ms;
+        timeout = config->health_check_timeout_ms;
+        config_release(config);
+
+        P(&upstream_mutex);
+        for (i = n = 0; i < UPSTREAM_POOL_SIZE; i++) {
+            if (pool[i].refs > 0) {
+                servers[n] = &pool[i];
+                strcpy(hosts[n], pool[i].host);
+                strcpy(ports[n++], pool[i].port);
+            }
+        }
+        V(&upstream_mutex);
+
+        for (i = 0; i < n; i++) {
+            healthy = path[0] == '\0' || interval <= 0 || health_probe(hosts[i], ports[i], path, timeout);
+            P(&upstream_mutex);
+            if (!strcmp(servers[i]->host, hosts[i]) && !strcmp(servers[i]->port, ports[i])
+                && servers[i]->healthy != healthy) {
+                servers[i]->healthy = healthy;
+                fprintf(stderr, "upstream %s:%s is %s\n", hosts[i], ports[i], healthy ? "healthy" : "unhealthy");
+            }
+            V(&upstream_mutex);
+        }
+        usleep((interval > 0 ? interval : 1000) * 1000);
+    }
+    return NULL;
+}
+
+void upstream_start(void) {
+    pthread_t tid;
+
+    pthread_once(&upstream_once, upstream_init);
+    Pthread_create(&tid, NULL, health_checker, NULL);
+}
+
+// group 별 server 상태를 JSON 객체로 buf 에 써주는 함수, 쓴 길이를 반환
+ssize_t upstream_render(char *buf, ssize_t size) {
+    UpstreamServer *server;
+    long long now = stats_now_us();
+    ssize_t len = 0;
+    int i, j;
+
+    pthread_once(&upstream_once, upstream_init);
+
+    P(&upstream_mutex);
+    len += snprintf(buf + len, size - len, "{");
+    for (i = 0; i < group_count && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%s\"%s\": {\"policy\": \"%s\", \"servers\": [",
+                        i ? ", " : "", groups[i].name, policy_names[groups[i].policy]);
+        for (j = 0; j < groups[i].count && len < size; j++) {
+            server = groups[i].servers[j];
+            len += snprintf(buf + len, size - len,
+                            "%s{\"server\": \"%s%s%s:%s\", \"healthy\": %d, \"ejected\": %d, \"active\": %d, "
+                            "\"ewma_us\": %lld, \"requests\": %lld, \"failures\": %lld}",
+                            j ? ", " : "", strchr(server->host, ':') ? "[" : "", server->host,
+                            strchr(server->host, ':') ? "]" : "", server->port, server->healthy, server->ejected_until > now,
+                            server->active, server->ewma_us, server->requests, server->failures);
+        }
+        if (len < size) {
+            len += snprintf(buf + len, size - len, "]}");
+        }
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "}");
+    }
+    V(&upstream_mutex);
+    return len < size ? len : size - 1;
+}
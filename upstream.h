@@ -0,0 +1,55 @@
+/*
+ * upstream.h - 이름 하나 뒤에 여러 origin 을 두는 upstream group (부하 분산, health check, passive ejection)
+ */
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include "csapp.h"
+#include "config.h"
+
+#define UPSTREAM_MAX_GROUPS CONFIG_MAX_UPSTREAMS
+#define UPSTREAM_MAX_SERVERS 16             /* group 하나에 들어가는 최대 server 수 */
+#define UPSTREAM_POOL_SIZE (UPSTREAM_MAX_GROUPS * UPSTREAM_MAX_SERVERS)
+#define UPSTREAM_EWMA_SHIFT 3               /* 지연 시간 EWMA 의 가중치 1/8 (TCP 의 srtt 와 같음) */
+
+// server 를 고르는 방법
+enum {
+    UPSTREAM_ROUND_ROBIN,
+    UPSTREAM_LEAST_CONN,    // 진행 중인 요청이 가장 적은 server
+    UPSTREAM_P2C            // 무작위로 두 server 를 골라 (EWMA 지연) x (진행 중인 요청 + 1) 이 작은 쪽
+};
+
+// 설정 한 줄 "upstream = <name> [policy] <host:port>..." 을 읽은 결과
+typedef struct UpstreamSpec {
+    char name[64];
+    int policy;
+    int count;
+    char host[UPSTREAM_MAX_SERVERS][64];
+    char port[UPSTREAM_MAX_SERVERS][8];
+} UpstreamSpec;
+
+typedef struct UpstreamServer {
+    char host[64];              // 설정할 때 풀어둔 주소 문자열 (IPv4 또는 IPv6)
+    char port[8];
+    int refs;                   // 이 server 를 가진 group 수, 0 이면 pool 에서 다시 쓸 수 있음
+    int active;                 // 진행 중인 요청 수
+    long long ewma_us;          // 요청을 보내고 첫 바이트를 받을 때까지의 지연 EWMA, 0 이면 아직 모름
+    int fails;                  // 연속 실패 수
+    long long ejected_until;    // passive ejection 이 풀리는 시각 (stats_now_us 기준)
+    int healthy;                // 마지막 health check 결과, health check 를 하지 않으면 항상 1
+    long long requests, failures;
+} UpstreamServer;
+
+int upstream_parse(char *line, UpstreamSpec *spec);
+
+void upstream_configure(ProxyConfig *config);
+
+void upstream_start(void);
+
+int upstream_pick(char *name, UpstreamServer **server);
+
+void upstream_done(UpstreamServer *server, int ok, long long latency_us, ProxyConfig *config);
+
+ssize_t upstream_render(char *buf, ssize_t size);
+
+#endif /* __UPSTREAM_H__ */
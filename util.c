@@ -0,0 +1,38 @@
+/*
+ * util.c - 여러 모듈이 같이 쓰는 작은 함수들
+ *
+ * 해시 테이블의 bucket (cache_key, disk_cache, negative_cache, stats 의 origin 표) 은 32bit FNV-1a 를,
+ * 서로 다른 URL 을 구분해야 하는 곳 (access log 의 key hash, prefetch 의 중복 확인, predict 의 표) 은 64bit 를 쓴다.
+ */
+#include "util.h"
+
+// data 의 len 바이트에 대한 64bit FNV-1a hash
+uint64_t fnv1a64(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len-- > 0) {
+        h = (h ^ *p++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// 문자열의 64bit FNV-1a hash
+uint64_t fnv1a64_str(const char *str) {
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*str) {
+        h = (h ^ (unsigned char) *str++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// 문자열의 32bit FNV-1a hash
+uint32_t fnv1a32_str(const char *str) {
+    uint32_t h = 2166136261u;
+
+    while (*str) {
+        h = (h ^ (unsigned char) *str++) * 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,19 @@
+/*
+ * util.h - 여러 모듈이 같이 쓰는 작은 함수들 (FNV-1a hash, strcasestr 선언)
+ */
+#ifndef __UTIL_H__
+#define __UTIL_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+/* csapp.h 의 gai_error 와 충돌하므로 _GNU_SOURCE 대신 직접 선언 */
+char *strcasestr(const char *haystack, const char *needle);
+
+uint64_t fnv1a64(const void *data, size_t len);
+
+uint64_t fnv1a64_str(const char *str);
+
+uint32_t fnv1a32_str(const char *str);
+
+#endif /* __UTIL_H__ */